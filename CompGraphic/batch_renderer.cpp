@@ -0,0 +1,129 @@
+#include "batch_renderer.h"
+#include "thread_pool.h"
+#include "profiler.h"
+
+void RenderTarget::clear() {
+    framebuffer.clear();
+    if (gbuffer) {
+        gbuffer->clear();
+        // the target may go to a renderer of another model next
+        gbuffer->clear_materials();
+    }
+    raster.reset_stats();
+}
+
+RenderTarget* RenderTargetPool::acquire() {
+    RenderTarget* target;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (free_.empty()) {
+            targets_.emplace_back(new RenderTarget(width_, height_));
+            target = targets_.back().get();
+        }
+        else {
+            target = free_.back();
+            free_.pop_back();
+        }
+    }
+    target->clear();
+    return target;
+}
+
+void RenderTargetPool::release(RenderTarget* target) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    free_.push_back(target);
+}
+
+BatchRenderer::BatchRenderer(Model* model, int width, int height, Vec3f light_dir, ThreadPool* pool,
+    float material_specular, float shininess)
+    : model_(model), width_(width), height_(height), light_dir_(light_dir), pool_(pool),
+    mode_(RASTER_SCANLINE), draw_mode_(DRAW_IMMEDIATE), filter_(TEXTURE_NEAREST), cull_backfaces_(false), material_specular_(material_specular), shininess_(shininess),
+    transparency_(TRANSPARENCY_BLEND), deferred_(false), prep_(&own_prep_), own_targets_(width, height),
+    targets_(&own_targets_) {
+    prepare_model(model, light_dir, own_prep_);
+    lights_.push_back(Light::directional(light_dir));
+}
+
+BatchRenderer::BatchRenderer(Model* model, const ModelPrep& prep, RenderTargetPool& targets, Vec3f light_dir,
+    ThreadPool* pool, float material_specular, float shininess)
+    : model_(model), width_(targets.width()), height_(targets.height()), light_dir_(light_dir), pool_(pool),
+    mode_(RASTER_SCANLINE), draw_mode_(DRAW_IMMEDIATE), filter_(TEXTURE_NEAREST), cull_backfaces_(false), material_specular_(material_specular), shininess_(shininess),
+    transparency_(TRANSPARENCY_BLEND), deferred_(false), prep_(&prep), own_targets_(0, 0), targets_(&targets) {
+    lights_.push_back(Light::directional(light_dir));
+}
+
+void BatchRenderer::set_shading(ShadingMode mode) {
+    deferred_ = mode == SHADE_DEFERRED;
+    if (mode == SHADE_FLAT || mode == SHADE_DEFERRED) shader_.reset();
+    else shader_.reset(new MapShader(light_dir_, material_specular_, shininess_, mode));
+}
+
+void BatchRenderer::render_view(int view, const Camera& camera, ThreadPool* raster_pool, const ViewCallback& on_view) {
+    RenderTarget* target = targets_->acquire();
+    Rasterizer& raster = target->raster;
+    raster.set_pool(raster_pool);
+    raster.set_mode(mode_);
+    raster.set_draw_mode(draw_mode_);
+    raster.set_filter(filter_);
+    raster.set_shader(shader_.get());
+    GBuffer* gbuffer = nullptr;
+    if (deferred_) {
+        if (!target->gbuffer) target->gbuffer.reset(new GBuffer(width_, height_));
+        gbuffer = target->gbuffer.get();
+        Material material = { model_, material_specular_, shininess_ };
+        gbuffer->add_material(material);
+        gbuffer->set_filter(filter_);
+    }
+    raster.set_gbuffer(gbuffer);
+
+    raster.set_transparency(transparency_);
+
+    ViewResult result;
+    // sorted transparency takes the scene in any order, except that a
+    // G-buffer has to be lit before anything blends over it
+    bool single_pass = transparency_ == TRANSPARENCY_OIT && !gbuffer;
+    if (single_pass) render_ice_cube(camera, raster, light_dir_);
+    else render_cube_with_layers(camera, raster, light_dir_);
+    int rendered_faces = render_model(*prep_, model_, camera, raster, material_specular_, shininess_,
+        cull_backfaces_, &result.cull);
+    if (gbuffer) {
+        // the model has to be lit before the transparent faces blend over it
+        raster.flush();
+        light_gbuffer(*gbuffer, target->framebuffer, camera, lights_, raster_pool,
+            0.25f, 32, true, &result.lighting);
+    }
+    if (!single_pass) render_front_cube_faces(camera, raster, light_dir_);
+    raster.flush();
+
+    // covered() walks the depth plane, so it is only evaluated while profiling
+    PROFILE_COUNT(COUNTER_PIXELS_COVERED, target->framebuffer.covered());
+
+    result.view = view;
+    result.framebuffer = &target->framebuffer;
+    result.rendered_faces = rendered_faces;
+    result.stats = raster.stats();
+    {
+        std::lock_guard<std::mutex> lock(stats_mutex_);
+        stats_ += result.stats;
+        cull_stats_ += result.cull;
+        lighting_stats_ += result.lighting;
+    }
+    if (on_view) on_view(result);
+    targets_->release(target);
+}
+
+void BatchRenderer::render(const std::vector<Camera>& cameras, const ViewCallback& on_view) {
+    int count = (int)cameras.size();
+    if (pool_ && count >= pool_->size()) {
+        // enough views to keep every thread busy: one view per task, each
+        // rasterized on its own thread
+        pool_->parallel_for(count, [&](int view) {
+            render_view(view, cameras[view], nullptr, on_view);
+        });
+    }
+    else {
+        for (int view = 0; view < count; view++) {
+            render_view(view, cameras[view], pool_, on_view);
+        }
+    }
+}
@@ -0,0 +1,125 @@
+#ifndef BATCH_RENDERER_H
+#define BATCH_RENDERER_H
+
+#include <vector>
+#include <mutex>
+#include <memory>
+#include <functional>
+#include "geometry.h"
+#include "tgaimage.h"
+#include "model.h"
+#include "camera.h"
+#include "rasterizer.h"
+#include "renderer.h"
+#include "deferred.h"
+
+class ThreadPool;
+
+// Framebuffer and rasterizer of one frame in flight. The rasterizer is kept
+// with it so its triangle and bin storage is reused across frames.
+struct RenderTarget {
+    Framebuffer framebuffer;
+    Rasterizer raster;
+    std::unique_ptr<GBuffer> gbuffer;  // made on first deferred use
+
+    RenderTarget(int width, int height) : framebuffer(width, height), raster(framebuffer) {}
+    void clear();
+};
+
+// Hands out cleared render targets and keeps released ones for reuse, so a
+// batch allocates at most one target per view rendered at the same time.
+class RenderTargetPool {
+private:
+    int width_;
+    int height_;
+    std::mutex mutex_;
+    std::vector<std::unique_ptr<RenderTarget> > targets_;
+    std::vector<RenderTarget*> free_;
+public:
+    RenderTargetPool(int width, int height) : width_(width), height_(height) {}
+
+    int width() const { return width_; }
+    int height() const { return height_; }
+
+    RenderTarget* acquire();
+    void release(RenderTarget* target);
+    int allocated() const { return (int)targets_.size(); }
+};
+
+struct ViewResult {
+    int view;
+    const Framebuffer* framebuffer; // valid until the callback returns
+    int rendered_faces;   // model faces handed to the rasterizer
+    RasterStats stats;
+    CullStats cull;
+    LightingStats lighting; // deferred shading only
+};
+
+typedef std::function<void(const ViewResult&)> ViewCallback;
+
+// Renders one model from many cameras. Everything render_model computes that
+// does not depend on the camera is prepared once in the constructor; views
+// then run in parallel, or one after another with tile-parallel rasterization
+// when there are fewer views than threads.
+class BatchRenderer {
+private:
+    Model* model_;
+    int width_;
+    int height_;
+    Vec3f light_dir_;
+    ThreadPool* pool_;
+    RasterMode mode_;
+    DrawMode draw_mode_;
+    TextureFilter filter_;
+    bool cull_backfaces_;
+    float material_specular_;
+    float shininess_;
+    TransparencyMode transparency_;
+    std::unique_ptr<FragmentShader> shader_;  // nullptr for SHADE_FLAT and SHADE_DEFERRED
+    bool deferred_;
+    std::vector<Light> lights_;
+    ModelPrep own_prep_;
+    const ModelPrep* prep_;  // own_prep_ or the caller's
+    RenderTargetPool own_targets_;
+    RenderTargetPool* targets_;
+    std::mutex stats_mutex_;
+    RasterStats stats_;
+    CullStats cull_stats_;
+    LightingStats lighting_stats_;
+
+    void render_view(int view, const Camera& camera, ThreadPool* raster_pool, const ViewCallback& on_view);
+public:
+    // pool == nullptr renders everything on the calling thread
+    BatchRenderer(Model* model, int width, int height, Vec3f light_dir, ThreadPool* pool = nullptr,
+        float material_specular = 0.5f, float shininess = 32.0f);
+    // For callers that render the same model or size again and again: prep
+    // must have been made by prepare_model for light_dir, and targets sets
+    // the image size. Both must outlive the renderer.
+    BatchRenderer(Model* model, const ModelPrep& prep, RenderTargetPool& targets, Vec3f light_dir,
+        ThreadPool* pool = nullptr, float material_specular = 0.5f, float shininess = 32.0f);
+
+    void set_mode(RasterMode mode) { mode_ = mode; }
+    void set_draw_mode(DrawMode mode) { draw_mode_ = mode; }
+    void set_filter(TextureFilter filter) { filter_ = filter; }
+    // SHADE_FLAT by default. SHADE_PHONG and SHADE_BLINN light every pixel
+    // of the model from its normal and specular maps with a MapShader;
+    // SHADE_DEFERRED does the same for every light in set_lights() through a
+    // G-buffer.
+    void set_shading(ShadingMode mode);
+    // Lights of SHADE_DEFERRED; a single white directional light along
+    // light_dir by default. The other modes only use light_dir.
+    void set_lights(const std::vector<Light>& lights) { lights_ = lights; }
+    void set_cull_backfaces(bool enabled) { cull_backfaces_ = enabled; }
+    // TRANSPARENCY_OIT draws the cube and the model in a single flush.
+    void set_transparency(TransparencyMode mode) { transparency_ = mode; }
+
+    // on_view is called once per camera, from the thread that rendered it.
+    void render(const std::vector<Camera>& cameras, const ViewCallback& on_view);
+
+    const RasterStats& stats() const { return stats_; }
+    const CullStats& cull_stats() const { return cull_stats_; }
+    const LightingStats& lighting_stats() const { return lighting_stats_; }
+    int targets_allocated() const { return targets_->allocated(); }
+};
+
+#endif // BATCH_RENDERER_H
@@ -0,0 +1,1466 @@
+﻿#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+#include <new>
+#include <atomic>
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <chrono>
+#include <limits>
+#include <vector>
+#include <cmath>
+#include <algorithm>
+#include "bench.h"
+#include "model.h"
+#include "camera.h"
+#include "rasterizer.h"
+#include "renderer.h"
+#include "shading.h"
+#include "deferred.h"
+#include "batch_renderer.h"
+#include "thread_pool.h"
+#include "mapped_file.h"
+#include "tga_rle.h"
+#include "profiler.h"
+#include "render_server.h"
+#include "image_writer.h"
+#include "image_formats.h"
+
+#ifdef _WIN32
+#include <malloc.h>
+#endif
+
+typedef std::chrono::steady_clock bench_clock;
+
+// The replaced allocation functions below are plain malloc and free; while an
+// AllocationScope is alive they also count, so benchmarks can report
+// allocation counts next to timings without taxing every other run.
+static std::atomic<bool> counting_allocations(false);
+static std::atomic<long long> allocation_count(0);
+
+class AllocationScope {
+    long long start_;
+public:
+    AllocationScope() {
+        start_ = allocation_count.load(std::memory_order_relaxed);
+        counting_allocations.store(true, std::memory_order_relaxed);
+    }
+    ~AllocationScope() { counting_allocations.store(false, std::memory_order_relaxed); }
+    // allocations since the scope began
+    long long count() const { return allocation_count.load(std::memory_order_relaxed) - start_; }
+};
+
+// align 0 is plain malloc; anything else must be released with aligned_free
+static void* counted_malloc(std::size_t size, std::size_t align) {
+    if (counting_allocations.load(std::memory_order_relaxed)) {
+        allocation_count.fetch_add(1, std::memory_order_relaxed);
+    }
+    if (size == 0) size = 1;
+    void* p;
+    if (align == 0) {
+        p = std::malloc(size);
+    }
+    else {
+        if (align < sizeof(void*)) align = sizeof(void*);
+#ifdef _WIN32
+        p = _aligned_malloc(size, align);
+#else
+        if (posix_memalign(&p, align, size) != 0) p = NULL;
+#endif
+    }
+    if (!p) throw std::bad_alloc();
+    return p;
+}
+
+static void aligned_free(void* p) {
+#ifdef _WIN32
+    _aligned_free(p);
+#else
+    std::free(p);
+#endif
+}
+
+// kept out of line so GCC does not pair the inlined free() with operator new
+#if defined(__GNUC__)
+#define BENCH_NOINLINE __attribute__((noinline))
+#else
+#define BENCH_NOINLINE
+#endif
+
+// The nothrow forms call these by default, so they are counted too.
+void* operator new(std::size_t size) {
+    return counted_malloc(size, 0);
+}
+
+void* operator new[](std::size_t size) {
+    return counted_malloc(size, 0);
+}
+
+void* operator new(std::size_t size, std::align_val_t align) {
+    return counted_malloc(size, (std::size_t)align);
+}
+
+void* operator new[](std::size_t size, std::align_val_t align) {
+    return counted_malloc(size, (std::size_t)align);
+}
+
+BENCH_NOINLINE void operator delete(void* p) noexcept {
+    std::free(p);
+}
+
+BENCH_NOINLINE void operator delete(void* p, std::size_t) noexcept {
+    std::free(p);
+}
+
+BENCH_NOINLINE void operator delete[](void* p) noexcept {
+    std::free(p);
+}
+
+BENCH_NOINLINE void operator delete[](void* p, std::size_t) noexcept {
+    std::free(p);
+}
+
+BENCH_NOINLINE void operator delete(void* p, std::align_val_t) noexcept {
+    aligned_free(p);
+}
+
+BENCH_NOINLINE void operator delete(void* p, std::size_t, std::align_val_t) noexcept {
+    aligned_free(p);
+}
+
+BENCH_NOINLINE void operator delete[](void* p, std::align_val_t) noexcept {
+    aligned_free(p);
+}
+
+BENCH_NOINLINE void operator delete[](void* p, std::size_t, std::align_val_t) noexcept {
+    aligned_free(p);
+}
+
+static double seconds_since(bench_clock::time_point start) {
+    return std::chrono::duration<double>(bench_clock::now() - start).count();
+}
+
+// Renders the model pass of all views repeatedly and reports triangle and pixel
+// throughput for each rasterizer path, single-threaded and on the shared pool.
+static int bench_raster(const char* model_path) {
+    Model model(model_path);
+    if (model.nverts() == 0) {
+        std::cerr << "can't load " << model_path << "\n";
+        return 1;
+    }
+
+    const int width = 800;
+    const int height = 800;
+    const int frames = 20;
+    Vec3f light_dir(0.2f, 0.4f, -1.0f);
+    light_dir.normalize();
+
+    Framebuffer framebuffer(width, height);
+
+    const RasterMode modes[] = { RASTER_SCANLINE, RASTER_EDGE_SIMD, RASTER_SUBPIXEL };
+    const char* mode_names[] = { "scanline", "simd", "subpixel" };
+    ThreadPool* pools[] = { nullptr, &ThreadPool::shared() };
+
+    for (int m = 0; m < 3; m++) {
+        for (int p = 0; p < 2; p++) {
+            for (int hiz = 0; hiz < 2; hiz++) {
+                Rasterizer raster(framebuffer, pools[p]);
+                raster.set_mode(modes[m]);
+                raster.set_hiz(hiz != 0);
+
+                double elapsed = 0.0;
+                for (int frame = 0; frame < frames; frame++) {
+                    const ViewConfig& config = view_configs[frame % num_views];
+                    Camera camera(config.eye, config.target, config.up,
+                        config.fov, (float)width / height, 0.1f, 100.0f);
+
+                    framebuffer.clear();
+
+                    bench_clock::time_point start = bench_clock::now();
+                    render_model(&model, camera, raster, light_dir);
+                    raster.flush();
+                    elapsed += seconds_since(start);
+                }
+
+                const RasterStats& stats = raster.stats();
+                std::cout << "raster/" << mode_names[m] << "/threads=" << (pools[p] ? pools[p]->size() : 1)
+                    << (hiz ? "/hiz" : "")
+                    << std::fixed << std::setprecision(3)
+                    << "  ms/frame=" << elapsed * 1000.0 / frames
+                    << "  Mtri/s=" << stats.triangles / elapsed * 1e-6
+                    << "  Mpix/s=" << stats.fragments / elapsed * 1e-6
+                    << "  shaded=" << stats.fragments_passed / frames << "/frame"
+                    << std::defaultfloat;
+                if (hiz) {
+                    std::cout << "  culled=" << stats.hiz_culled << "/" << stats.tile_triangles << " tile-tris"
+                        << "  blocks culled=" << stats.hiz_blocks_culled;
+                }
+                std::cout << std::endl;
+            }
+        }
+    }
+    return 0;
+}
+
+// Shading work of the model pass per draw mode: shaded fragments against the
+// pixels left visible, i.e. how often each visible pixel was shaded.
+static int bench_overdraw(const char* model_path) {
+    Model model(model_path);
+    if (model.nverts() == 0) {
+        std::cerr << "can't load " << model_path << "\n";
+        return 1;
+    }
+
+    const int width = 800;
+    const int height = 800;
+    const int frames = 20;
+    Vec3f light_dir(0.2f, 0.4f, -1.0f);
+    light_dir.normalize();
+
+    Framebuffer framebuffer(width, height);
+
+    const RasterMode modes[] = { RASTER_SCANLINE, RASTER_EDGE_SIMD, RASTER_SUBPIXEL };
+    const char* mode_names[] = { "scanline", "simd", "subpixel" };
+    const DrawMode draw_modes[] = { DRAW_IMMEDIATE, DRAW_FRONT_TO_BACK, DRAW_DEPTH_PREPASS };
+    const char* draw_names[] = { "immediate", "sorted", "prepass" };
+
+    for (int m = 0; m < 3; m++) {
+        for (int d = 0; d < 3; d++) {
+            Rasterizer raster(framebuffer, &ThreadPool::shared());
+            raster.set_mode(modes[m]);
+            raster.set_draw_mode(draw_modes[d]);
+
+            double elapsed = 0.0;
+            long long visible = 0;
+            for (int frame = 0; frame < frames; frame++) {
+                const ViewConfig& config = view_configs[frame % num_views];
+                Camera camera(config.eye, config.target, config.up,
+                    config.fov, (float)width / height, 0.1f, 100.0f);
+
+                framebuffer.clear();
+
+                bench_clock::time_point start = bench_clock::now();
+                render_model(&model, camera, raster, light_dir);
+                raster.flush();
+                elapsed += seconds_since(start);
+
+                visible += framebuffer.covered();
+            }
+
+            const RasterStats& stats = raster.stats();
+            std::cout << "overdraw/" << mode_names[m] << "/" << draw_names[d]
+                << std::fixed << std::setprecision(3)
+                << "  ms/frame=" << elapsed * 1000.0 / frames
+                << "  shaded=" << stats.fragments_shaded / frames << "/frame"
+                << "  visible=" << visible / frames << "/frame"
+                << "  overdraw=" << (visible ? (double)stats.fragments_shaded / visible : 0.0)
+                << "  depth tests=" << stats.fragments / frames << "/frame"
+                << std::defaultfloat << std::endl;
+        }
+    }
+    return 0;
+}
+
+// Cluster culling over a turntable, from far enough to see the whole model
+// and from close up where most of it is off screen.
+static int bench_cull(const char* model_path) {
+    Model model(model_path);
+    if (model.nverts() == 0) {
+        std::cerr << "can't load " << model_path << "\n";
+        return 1;
+    }
+
+    const int width = 800;
+    const int height = 800;
+    const int views = 32;
+    Vec3f light_dir(0.2f, 0.4f, -1.0f);
+    light_dir.normalize();
+
+    ModelPrep prep;
+    prepare_model(&model, light_dir, prep);
+    Framebuffer framebuffer(width, height);
+
+    const float distances[] = { 5.0f, 1.2f };
+    for (int d = 0; d < 2; d++) {
+        std::vector<Camera> cameras = make_turntable(views, distances[d], 0.3f, 45.0f, (float)width / height);
+        for (int backface = 0; backface < 2; backface++) {
+            Rasterizer raster(framebuffer, &ThreadPool::shared());
+            CullStats cull;
+            double elapsed = 0.0;
+            for (int view = 0; view < views; view++) {
+                framebuffer.clear();
+                bench_clock::time_point start = bench_clock::now();
+                render_model(prep, &model, cameras[view], raster, 0.5f, 32.0f, backface != 0, &cull);
+                raster.flush();
+                elapsed += seconds_since(start);
+            }
+
+            const RasterStats& stats = raster.stats();
+            std::cout << "cull/distance=" << distances[d] << (backface ? "/backface" : "")
+                << std::fixed << std::setprecision(3)
+                << "  ms/frame=" << elapsed * 1000.0 / views
+                << std::defaultfloat
+                << "  clusters outside=" << cull.clusters_frustum_culled / views
+                << " away=" << cull.clusters_backface_culled / views
+                << " of " << cull.clusters / views
+                << "  faces away=" << cull.triangles_backface_culled / views
+                << "  triangles=" << stats.triangles / views
+                << "  shaded=" << stats.fragments_shaded / views << "/frame" << std::endl;
+        }
+    }
+    return 0;
+}
+
+// Camera circling through the model, so faces keep crossing the near plane
+// and reaching far past the screen: the frames that used to spike.
+static int bench_clip(const char* model_path) {
+    Model model(model_path);
+    if (model.nverts() == 0) {
+        std::cerr << "can't load " << model_path << "\n";
+        return 1;
+    }
+
+    const int width = 800;
+    const int height = 800;
+    const int frames = 60;
+    Vec3f light_dir(0.2f, 0.4f, -1.0f);
+    light_dir.normalize();
+
+    ModelPrep prep;
+    prepare_model(&model, light_dir, prep);
+    Framebuffer framebuffer(width, height);
+
+    const RasterMode modes[] = { RASTER_SCANLINE, RASTER_EDGE_SIMD, RASTER_SUBPIXEL };
+    const char* mode_names[] = { "scanline", "simd", "subpixel" };
+
+    for (int m = 0; m < 3; m++) {
+        Rasterizer raster(framebuffer, &ThreadPool::shared());
+        raster.set_mode(modes[m]);
+        CullStats cull;
+        double elapsed = 0.0;
+        double worst = 0.0;
+        for (int frame = 0; frame < frames; frame++) {
+            float angle = 2.0f * 3.14159265f * frame / frames;
+            Vec3f eye(0.6f * std::sin(angle), 0.1f, 0.6f * std::cos(angle));
+            Vec3f ahead(-std::cos(angle), -0.1f, std::sin(angle));
+            Camera camera(eye, eye + ahead, Vec3f(0, 1, 0), 60.0f, (float)width / height, 0.1f, 100.0f);
+
+            framebuffer.clear();
+            bench_clock::time_point start = bench_clock::now();
+            render_cube_with_layers(camera, raster, light_dir);
+            render_model(prep, &model, camera, raster, 0.5f, 32.0f, false, &cull);
+            render_front_cube_faces(camera, raster, light_dir);
+            raster.flush();
+            double t = seconds_since(start);
+            elapsed += t;
+            worst = std::max(worst, t);
+        }
+
+        std::cout << "clip/" << mode_names[m]
+            << std::fixed << std::setprecision(3)
+            << "  ms/frame=" << elapsed * 1000.0 / frames
+            << "  worst ms=" << worst * 1000.0
+            << std::defaultfloat
+            << "  faces outside=" << cull.triangles_outside / frames
+            << " clipped=" << cull.triangles_clipped / frames
+            << "  fragments=" << raster.stats().fragments / frames << "/frame" << std::endl;
+    }
+    return 0;
+}
+
+// Renders the model alone into the framebuffer.
+static void render_model_only(const ModelPrep& prep, Model* model, const Camera& camera, RasterMode mode,
+    TextureFilter filter, Framebuffer& framebuffer, const FragmentShader* shader = nullptr) {
+    framebuffer.clear();
+    Rasterizer raster(framebuffer, &ThreadPool::shared());
+    raster.set_mode(mode);
+    raster.set_filter(filter);
+    raster.set_shader(shader);
+    render_model(prep, model, camera, raster);
+    raster.flush();
+}
+
+// The model rendered at ss x ss the size of the image and box filtered down,
+// as RGB floats.
+static void render_reference(const ModelPrep& prep, Model* model, const Camera& camera, RasterMode mode,
+    int width, int height, int ss, std::vector<float>& reference) {
+    Framebuffer big(width * ss, height * ss);
+    render_model_only(prep, model, camera, mode, TEXTURE_NEAREST, big);
+
+    reference.assign(width * height * 3, 0.0f);
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            float* r = &reference[(x + y * width) * 3];
+            for (int sy = 0; sy < ss; sy++) {
+                for (int sx = 0; sx < ss; sx++) {
+                    TGAColor c = big.get(x * ss + sx, y * ss + sy);
+                    r[0] += c.r;
+                    r[1] += c.g;
+                    r[2] += c.b;
+                }
+            }
+            for (int k = 0; k < 3; k++) r[k] /= (float)(ss * ss);
+        }
+    }
+}
+
+// Sum of absolute channel differences between image and reference.
+static double image_error(const Framebuffer& image, const std::vector<float>& reference) {
+    int width = image.get_width();
+    double error = 0.0;
+    for (int y = 0; y < image.get_height(); y++) {
+        for (int x = 0; x < width; x++) {
+            TGAColor c = image.get(x, y);
+            const float* r = &reference[(x + y * width) * 3];
+            error += std::fabs(c.r - r[0]) + std::fabs(c.g - r[1]) + std::fabs(c.b - r[2]);
+        }
+    }
+    return error;
+}
+
+// Image diff of each raster mode against a reference: RASTER_SUBPIXEL at
+// 4x4 the resolution, box filtered down. Also counts cracks, pixels left
+// empty while all four neighbours were drawn, which only gaps between
+// adjacent triangles of the closed model can cause.
+static int bench_subpixel(const char* model_path) {
+    Model model(model_path);
+    if (model.nverts() == 0) {
+        std::cerr << "can't load " << model_path << "\n";
+        return 1;
+    }
+
+    const int width = 800;
+    const int height = 800;
+    const int ss = 4;
+    Vec3f light_dir(0.2f, 0.4f, -1.0f);
+    light_dir.normalize();
+
+    ModelPrep prep;
+    prepare_model(&model, light_dir, prep);
+    Framebuffer framebuffer(width, height);
+    const float empty = -std::numeric_limits<float>::max();
+
+    const RasterMode modes[] = { RASTER_SCANLINE, RASTER_EDGE_SIMD, RASTER_SUBPIXEL };
+    const char* mode_names[] = { "scanline", "simd", "subpixel" };
+    double error[3] = {};
+    long long cracks[3] = {};
+    double elapsed[3] = {};
+
+    std::vector<float> reference;
+    for (int view = 0; view < num_views; view++) {
+        const ViewConfig& config = view_configs[view];
+        Camera camera(config.eye, config.target, config.up, config.fov, (float)width / height, 0.1f, 100.0f);
+        render_reference(prep, &model, camera, RASTER_SUBPIXEL, width, height, ss, reference);
+
+        for (int m = 0; m < 3; m++) {
+            bench_clock::time_point start = bench_clock::now();
+            render_model_only(prep, &model, camera, modes[m], TEXTURE_NEAREST, framebuffer);
+            elapsed[m] += seconds_since(start);
+            error[m] += image_error(framebuffer, reference);
+
+            for (int y = 1; y < height - 1; y++) {
+                for (int x = 1; x < width - 1; x++) {
+                    if (framebuffer.get_depth(x, y) == empty && framebuffer.get_depth(x - 1, y) != empty &&
+                        framebuffer.get_depth(x + 1, y) != empty && framebuffer.get_depth(x, y - 1) != empty &&
+                        framebuffer.get_depth(x, y + 1) != empty) {
+                        cracks[m]++;
+                    }
+                }
+            }
+        }
+    }
+
+    for (int m = 0; m < 3; m++) {
+        std::cout << "subpixel/" << mode_names[m]
+            << std::fixed << std::setprecision(3)
+            << "  ms/frame=" << elapsed[m] * 1000.0 / num_views
+            << "  mean abs error=" << error[m] / ((double)width * height * 3 * num_views)
+            << std::defaultfloat
+            << "  cracks=" << cracks[m] / num_views << "/frame" << std::endl;
+    }
+    return 0;
+}
+
+// Texture filters on a turntable moving away from the model, against the
+// model rendered with 4x4 supersampling from the full-size texture.
+static int bench_texture(const char* model_path) {
+    Model model(model_path);
+    if (model.nverts() == 0) {
+        std::cerr << "can't load " << model_path << "\n";
+        return 1;
+    }
+
+    const int width = 800;
+    const int height = 800;
+    const int views = 4;
+    Vec3f light_dir(0.2f, 0.4f, -1.0f);
+    light_dir.normalize();
+
+    ModelPrep prep;
+    prepare_model(&model, light_dir, prep);
+    Framebuffer framebuffer(width, height);
+    std::vector<float> reference;
+
+    const TextureFilter filters[] = { TEXTURE_NEAREST, TEXTURE_POINT, TEXTURE_BILINEAR, TEXTURE_TRILINEAR };
+    const char* filter_names[] = { "nearest", "point", "bilinear", "trilinear" };
+    const float distances[] = { 3.0f, 12.0f, 40.0f };
+
+    for (int d = 0; d < 3; d++) {
+        std::vector<Camera> cameras = make_turntable(views, distances[d], 0.3f, 45.0f, (float)width / height);
+        double elapsed[4] = {};
+        double error[4] = {};
+        long long pixels = 0;
+        for (int view = 0; view < views; view++) {
+            render_reference(prep, &model, cameras[view], RASTER_SUBPIXEL, width, height, 4, reference);
+            for (int f = 0; f < 4; f++) {
+                // the first run of each view warms the caches for the rest
+                render_model_only(prep, &model, cameras[view], RASTER_SUBPIXEL, filters[f], framebuffer);
+                bench_clock::time_point start = bench_clock::now();
+                for (int rep = 0; rep < 5; rep++) {
+                    render_model_only(prep, &model, cameras[view], RASTER_SUBPIXEL, filters[f], framebuffer);
+                }
+                elapsed[f] += seconds_since(start) / 5;
+                error[f] += image_error(framebuffer, reference);
+            }
+            pixels += framebuffer.covered();
+        }
+
+        for (int f = 0; f < 4; f++) {
+            std::cout << "texture/distance=" << distances[d] << "/" << filter_names[f]
+                << std::fixed << std::setprecision(3)
+                << "  ms/frame=" << elapsed[f] * 1000.0 / views
+                << "  mean abs error=" << (pixels ? error[f] / (pixels * 3.0) : 0.0) << "/covered channel"
+                << std::defaultfloat << "  pixels=" << pixels / views << "/frame" << std::endl;
+        }
+    }
+    return 0;
+}
+
+// Frame time of the model pass with the flat per-face lighting against the
+// per-pixel MapShader modes, close up (most pixels covered) and at the usual
+// turntable distance, in each raster mode.
+static int bench_shading(const char* model_path) {
+    Model model(model_path);
+    if (model.nverts() == 0) {
+        std::cerr << "can't load " << model_path << "\n";
+        return 1;
+    }
+
+    const int width = 800;
+    const int height = 800;
+    const int views = 4;
+    const int reps = 5;
+    const float material_specular = 0.5f;
+    const float shininess = 32.0f;
+    Vec3f light_dir(0.2f, 0.4f, -1.0f);
+    light_dir.normalize();
+
+    ModelPrep prep;
+    prepare_model(&model, light_dir, prep);
+    Framebuffer framebuffer(width, height);
+
+    MapShader phong(light_dir, material_specular, shininess, SHADE_PHONG);
+    MapShader blinn(light_dir, material_specular, shininess, SHADE_BLINN);
+    const FragmentShader* shaders[] = { nullptr, &phong, &blinn };
+    const char* shader_names[] = { "flat", "phong", "blinn" };
+    const RasterMode modes[] = { RASTER_SCANLINE, RASTER_EDGE_SIMD, RASTER_SUBPIXEL };
+    const char* mode_names[] = { "scanline", "simd", "subpixel" };
+    const float distances[] = { 3.0f, 5.0f };
+
+    for (int d = 0; d < 2; d++) {
+        std::vector<Camera> cameras = make_turntable(views, distances[d], 0.3f, 45.0f, (float)width / height);
+        for (int m = 0; m < 3; m++) {
+            for (int s = 0; s < 3; s++) {
+                double elapsed = 0.0;
+                for (int view = 0; view < views; view++) {
+                    // the first run of each view warms the caches for the rest
+                    render_model_only(prep, &model, cameras[view], modes[m], TEXTURE_NEAREST, framebuffer, shaders[s]);
+                    bench_clock::time_point start = bench_clock::now();
+                    for (int rep = 0; rep < reps; rep++) {
+                        render_model_only(prep, &model, cameras[view], modes[m], TEXTURE_NEAREST, framebuffer, shaders[s]);
+                    }
+                    elapsed += seconds_since(start) / reps;
+                }
+                std::cout << "shading/distance=" << distances[d] << "/" << mode_names[m] << "/" << shader_names[s]
+                    << std::fixed << std::setprecision(3)
+                    << "  ms/frame=" << elapsed * 1000.0 / views
+                    << std::defaultfloat << std::endl;
+            }
+        }
+    }
+    return 0;
+}
+
+// G-buffer pass and lighting pass timed apart, against the number of point
+// lights, with and without the per-tile light culling.
+static int bench_deferred(const char* model_path) {
+    Model model(model_path);
+    if (model.nverts() == 0) {
+        std::cerr << "can't load " << model_path << "\n";
+        return 1;
+    }
+
+    const int width = 800;
+    const int height = 800;
+    const int views = 4;
+    const int reps = 5;
+    Vec3f light_dir(0.2f, 0.4f, -1.0f);
+    light_dir.normalize();
+
+    ModelPrep prep;
+    prepare_model(&model, light_dir, prep);
+    Framebuffer framebuffer(width, height);
+    GBuffer gbuffer(width, height);
+    Material material = { &model, 0.5f, 32.0f };
+    gbuffer.add_material(material);
+    std::vector<Camera> cameras = make_turntable(views, 3.0f, 0.3f, 45.0f, (float)width / height);
+    ThreadPool& pool = ThreadPool::shared();
+    Rasterizer raster(framebuffer, &pool);
+    raster.set_gbuffer(&gbuffer);
+
+    auto fill_gbuffer = [&](const Camera& camera) {
+        framebuffer.clear();
+        gbuffer.clear();
+        render_model(prep, &model, camera, raster);
+        raster.flush();
+    };
+
+    double gbuffer_time = 0.0;
+    for (int view = 0; view < views; view++) {
+        fill_gbuffer(cameras[view]);
+        bench_clock::time_point start = bench_clock::now();
+        for (int rep = 0; rep < reps; rep++) fill_gbuffer(cameras[view]);
+        gbuffer_time += seconds_since(start) / reps;
+    }
+    std::cout << "deferred/gbuffer" << std::fixed << std::setprecision(3)
+        << "  ms/frame=" << gbuffer_time * 1000.0 / views << std::defaultfloat << std::endl;
+
+    const int counts[] = { 1, 8, 32, 128 };
+    for (int c = 0; c < 4; c++) {
+        std::vector<Light> lights = make_light_ring(counts[c], 1.0f, 0.5f, 0.8f);
+        lights.push_back(Light::directional(light_dir, Vec3f(0.5f, 0.5f, 0.5f)));
+        for (int cull = 1; cull >= 0; cull--) {
+            double elapsed = 0.0;
+            LightingStats stats;
+            for (int view = 0; view < views; view++) {
+                fill_gbuffer(cameras[view]);
+                light_gbuffer(gbuffer, framebuffer, cameras[view], lights, &pool, 0.25f, 32, cull != 0, &stats);
+                bench_clock::time_point start = bench_clock::now();
+                for (int rep = 0; rep < reps; rep++) {
+                    light_gbuffer(gbuffer, framebuffer, cameras[view], lights, &pool, 0.25f, 32, cull != 0);
+                }
+                elapsed += seconds_since(start) / reps;
+            }
+            std::cout << "deferred/lights=" << counts[c] << "+1/" << (cull ? "tile_culled" : "all")
+                << std::fixed << std::setprecision(3)
+                << "  lighting ms/frame=" << elapsed * 1000.0 / views
+                << std::setprecision(1)
+                << "  lights/pixel=" << (double)stats.light_tests / stats.pixels
+                << std::defaultfloat << std::endl;
+        }
+    }
+    return 0;
+}
+
+// Screen-aligned quad as two triangles, depth constant.
+static void queue_quad(Rasterizer& raster, int x0, int y0, int x1, int y1, int z, TGAColor color, bool transparent) {
+    Vec2i uv;
+    raster.triangle(Vec3i(x0, y0, z), Vec3i(x1, y0, z), Vec3i(x1, y1, z), uv, uv, uv, 1.0f, transparent, color);
+    raster.triangle(Vec3i(x0, y0, z), Vec3i(x1, y1, z), Vec3i(x0, y1, z), uv, uv, uv, 1.0f, transparent, color);
+}
+
+// Pixels of a that differ from b and the largest channel difference.
+static void image_diff(const Framebuffer& a, const Framebuffer& b, long long& pixels, int& max_diff) {
+    pixels = 0;
+    max_diff = 0;
+    for (int y = 0; y < a.get_height(); y++) {
+        for (int x = 0; x < a.get_width(); x++) {
+            TGAColor ca = a.get(x, y);
+            TGAColor cb = b.get(x, y);
+            int d = std::max(std::abs(ca.r - cb.r), std::max(std::abs(ca.g - cb.g), std::abs(ca.b - cb.b)));
+            if (d) pixels++;
+            max_diff = std::max(max_diff, d);
+        }
+    }
+}
+
+// N overlapping translucent quads over an opaque one, queued in shuffled
+// order. The reference is in-order blending with the quads sorted far to
+// near by hand; in-order blending of the shuffled queue shows the error OIT
+// removes, OIT with room for every fragment should match the reference, and
+// OIT with fewer layers per pixel or the default arena shows what the caps
+// cost.
+static int bench_oit() {
+    const int width = 800;
+    const int height = 800;
+    const int reps = 5;
+    const int side = 400;
+    Framebuffer framebuffer(width, height);
+    Framebuffer reference(width, height);
+    ThreadPool& pool = ThreadPool::shared();
+
+    const int counts[] = { 1, 2, 4, 8, 16, 32 };
+    for (int c = 0; c < 6; c++) {
+        int layers = counts[c];
+        std::vector<int> order(layers);
+        for (int i = 0; i < layers; i++) order[i] = i;
+        srand(layers);
+        for (int i = layers - 1; i > 0; i--) std::swap(order[i], order[rand() % (i + 1)]);
+
+        auto draw = [&](Framebuffer& target, TransparencyMode mode, bool sorted, int max_fragments, int max_layers,
+            RasterStats* stats) {
+            Rasterizer raster(target, &pool);
+            raster.set_mode(RASTER_EDGE_SIMD);
+            raster.set_transparency(mode);
+            raster.set_layer_limits(max_fragments, max_layers);
+            double elapsed = 0.0;
+            for (int rep = 0; rep <= reps; rep++) {
+                bench_clock::time_point start = bench_clock::now();
+                target.clear();
+                raster.reset_stats();
+                queue_quad(raster, 100, 100, width - 100, height - 100, -900, TGAColor(40, 60, 90), false);
+                for (int i = 0; i < layers; i++) {
+                    // layer k sits at depth 10 k, the farthest first when sorted
+                    int k = sorted ? i : order[i];
+                    int x0 = 120 + k * 11;
+                    int y0 = 120 + k * 7;
+                    TGAColor color((unsigned char)(80 + k * 37 % 176), (unsigned char)(200 - k * 23 % 150),
+                        (unsigned char)(60 + k * 53 % 190), 90);
+                    queue_quad(raster, x0, y0, x0 + side, y0 + side, 10 * k, color, true);
+                }
+                raster.flush();
+                // the first frame allocates the arena
+                if (rep > 0) elapsed += seconds_since(start);
+            }
+            if (stats) *stats = raster.stats();
+            return std::make_pair(elapsed * 1000.0 / reps, raster.layer_memory() / (1024.0 * 1024.0));
+        };
+
+        double ref_ms = draw(reference, TRANSPARENCY_BLEND, true, 0, 1, nullptr).first;
+        std::cout << "oit/layers=" << layers << "/blend_sorted" << std::fixed << std::setprecision(3)
+            << "  ms/frame=" << ref_ms << std::defaultfloat << std::endl;
+
+        struct Case {
+            const char* name;
+            TransparencyMode mode;
+            int max_fragments;
+            int max_layers;
+        };
+        const Case cases[] = {
+            { "blend_shuffled", TRANSPARENCY_BLEND, 0, 1 },
+            { "oit_uncapped", TRANSPARENCY_OIT, layers * side * side, 64 },
+            { "oit_layers=8", TRANSPARENCY_OIT, layers * side * side, 8 },
+            { "oit_default", TRANSPARENCY_OIT, 0, 8 },
+        };
+        for (int k = 0; k < 4; k++) {
+            RasterStats stats;
+            std::pair<double, double> run = draw(framebuffer, cases[k].mode, false, cases[k].max_fragments, cases[k].max_layers, &stats);
+            long long wrong = 0;
+            int max_diff = 0;
+            image_diff(framebuffer, reference, wrong, max_diff);
+            std::cout << "oit/layers=" << layers << "/" << cases[k].name << std::fixed << std::setprecision(3)
+                << "  ms/frame=" << run.first
+                << std::setprecision(1) << "  arena_mb=" << run.second
+                << "  kept=" << stats.layers << "  dropped=" << stats.layers_dropped
+                << "  wrong_pixels=" << wrong << "  max_diff=" << max_diff
+                << std::defaultfloat << std::endl;
+        }
+    }
+    return 0;
+}
+
+// Per-frame cost of the render target: clearing the TGAImage and z-buffer
+// the way render targets used to, against Framebuffer cleared eagerly
+// (clear + resolve) and lazily, in both layouts, with the whole scene drawn
+// on top. All four framebuffers must end up with the same image.
+static int bench_framebuffer(const char* model_path) {
+    Model model(model_path);
+    if (model.nverts() == 0) {
+        std::cerr << "can't load " << model_path << "\n";
+        return 1;
+    }
+
+    const int width = 800;
+    const int height = 800;
+    const int frames = 40;
+    Vec3f light_dir(0.2f, 0.4f, -1.0f);
+    light_dir.normalize();
+    ModelPrep prep;
+    prepare_model(&model, light_dir, prep);
+    ThreadPool& pool = ThreadPool::shared();
+
+    {
+        // a frame drawn elsewhere between clears, so they start from caches
+        // as cold as in a real frame
+        TGAImage image(width, height, TGAImage::RGB);
+        std::vector<float> zbuffer(width * height);
+        Framebuffer scratch(width, height);
+        Rasterizer raster(scratch, &pool);
+        double clear_time = 0.0;
+        for (int frame = 0; frame < frames; frame++) {
+            const ViewConfig& config = view_configs[frame % num_views];
+            Camera camera(config.eye, config.target, config.up, config.fov, (float)width / height, 0.1f, 100.0f);
+            scratch.clear();
+            render_model(prep, &model, camera, raster);
+            raster.flush();
+            bench_clock::time_point start = bench_clock::now();
+            image.clear();
+            std::fill(zbuffer.begin(), zbuffer.end(), -std::numeric_limits<float>::max());
+            clear_time += seconds_since(start);
+        }
+        std::cout << "framebuffer/tga_image" << std::fixed << std::setprecision(3)
+            << "  clear ms/frame=" << clear_time * 1000.0 / frames << std::defaultfloat << std::endl;
+    }
+
+    const FramebufferLayout layouts[] = { LAYOUT_LINEAR, LAYOUT_TILED };
+    const char* layout_names[] = { "linear", "tiled" };
+    Framebuffer reference(width, height);
+    bool first = true;
+    for (int l = 0; l < 2; l++) {
+        for (int lazy = 0; lazy < 2; lazy++) {
+            Framebuffer framebuffer(width, height, 64, layouts[l]);
+            Rasterizer raster(framebuffer, &pool);
+            raster.set_mode(RASTER_EDGE_SIMD);
+            double clear_time = 0.0;
+            double frame_time = 0.0;
+            for (int frame = 0; frame <= frames; frame++) {
+                const ViewConfig& config = view_configs[frame % num_views];
+                Camera camera(config.eye, config.target, config.up, config.fov, (float)width / height, 0.1f, 100.0f);
+                bench_clock::time_point start = bench_clock::now();
+                framebuffer.clear();
+                if (!lazy) framebuffer.resolve();
+                double cleared = seconds_since(start);
+                render_cube_with_layers(camera, raster, light_dir);
+                render_model(prep, &model, camera, raster);
+                render_front_cube_faces(camera, raster, light_dir);
+                raster.flush();
+                // the first frame only warms up
+                if (frame > 0) {
+                    clear_time += cleared;
+                    frame_time += seconds_since(start);
+                }
+            }
+
+            // the last frame is view 0 for every framebuffer
+            long long wrong = 0;
+            int max_diff = 0;
+            if (first) {
+                Rasterizer ref(reference, &pool);
+                ref.set_mode(RASTER_EDGE_SIMD);
+                const ViewConfig& config = view_configs[frames % num_views];
+                Camera camera(config.eye, config.target, config.up, config.fov, (float)width / height, 0.1f, 100.0f);
+                reference.clear();
+                render_cube_with_layers(camera, ref, light_dir);
+                render_model(prep, &model, camera, ref);
+                render_front_cube_faces(camera, ref, light_dir);
+                ref.flush();
+                first = false;
+            }
+            image_diff(framebuffer, reference, wrong, max_diff);
+
+            TGAImage image;
+            framebuffer.to_image(image);
+            bench_clock::time_point start = bench_clock::now();
+            for (int frame = 0; frame < frames; frame++) framebuffer.to_image(image);
+            double convert_time = seconds_since(start);
+
+            int prepared = 0;
+            for (int tile = 0; tile < framebuffer.ntiles(); tile++) prepared += framebuffer.tile_prepared(tile);
+            std::cout << "framebuffer/" << layout_names[l] << "/" << (lazy ? "lazy" : "eager")
+                << std::fixed << std::setprecision(3)
+                << "  clear ms/frame=" << clear_time * 1000.0 / frames
+                << "  frame ms=" << frame_time * 1000.0 / frames
+                << "  to_image ms=" << convert_time * 1000.0 / frames
+                << std::defaultfloat
+                << "  tiles filled=" << prepared << "/" << framebuffer.ntiles()
+                << (wrong ? "  MISMATCH" : "  identical") << std::endl;
+        }
+    }
+    return 0;
+}
+
+// The vector-of-vectors Matrix this project used before Mat<R, C, T>, kept
+// here only as the baseline for bench_matrix.
+class LegacyMatrix {
+private:
+    std::vector<std::vector<float> > m;
+    int rows, cols;
+public:
+    LegacyMatrix(int r = 4, int c = 4) : rows(r), cols(c) {
+        m.resize(rows);
+        for (int i = 0; i < rows; i++) m[i].resize(cols, 0);
+    }
+
+    static LegacyMatrix identity(int dimensions) {
+        LegacyMatrix E(dimensions, dimensions);
+        for (int i = 0; i < dimensions; i++) E[i][i] = 1;
+        return E;
+    }
+
+    std::vector<float>& operator[](const int i) { return m[i]; }
+    const std::vector<float>& operator[](const int i) const { return m[i]; }
+
+    LegacyMatrix operator*(const LegacyMatrix& a) const {
+        LegacyMatrix result(rows, a.cols);
+        for (int i = 0; i < rows; i++) {
+            for (int j = 0; j < a.cols; j++) {
+                result.m[i][j] = 0.0f;
+                for (int k = 0; k < cols; k++) result.m[i][j] += m[i][k] * a.m[k][j];
+            }
+        }
+        return result;
+    }
+
+    Vec3f operator*(const Vec3f& v) const {
+        float x = m[0][0] * v.x + m[0][1] * v.y + m[0][2] * v.z + m[0][3];
+        float y = m[1][0] * v.x + m[1][1] * v.y + m[1][2] * v.z + m[1][3];
+        float z = m[2][0] * v.x + m[2][1] * v.y + m[2][2] * v.z + m[2][3];
+        float w = m[3][0] * v.x + m[3][1] * v.y + m[3][2] * v.z + m[3][3];
+        if (w != 0.0f) { x /= w; y /= w; z /= w; }
+        return Vec3f(x, y, z);
+    }
+
+    LegacyMatrix transpose() const {
+        LegacyMatrix result(cols, rows);
+        for (int i = 0; i < rows; i++) {
+            for (int j = 0; j < cols; j++) result[j][i] = m[i][j];
+        }
+        return result;
+    }
+};
+
+static volatile float bench_sink;
+
+template <class F>
+static void report_op(const char* name, int iterations, F op) {
+    AllocationScope allocations;
+    bench_clock::time_point start = bench_clock::now();
+    float acc = 0.0f;
+    for (int i = 0; i < iterations; i++) acc += op(i);
+    double elapsed = seconds_since(start);
+    long long allocs = allocations.count();
+    bench_sink = acc;
+
+    std::cout << "matrix/" << name << std::fixed << std::setprecision(2)
+        << "  ns/op=" << elapsed * 1e9 / iterations
+        << "  allocs/op=" << (double)allocs / iterations
+        << std::defaultfloat << std::endl;
+}
+
+// Cost of the instrumentation: the same batch of views with the profiler
+// off and on. With PROFILING=0 both rows time the stripped build.
+static int bench_profiler(const char* model_path) {
+    Model model(model_path);
+    if (model.nverts() == 0) {
+        std::cerr << "can't load " << model_path << "\n";
+        return 1;
+    }
+
+    const int width = 800;
+    const int height = 800;
+    const int views = 12;
+    const int rounds = 3;
+    Vec3f light_dir(0.2f, 0.4f, -1.0f);
+    light_dir.normalize();
+    std::vector<Camera> cameras = make_turntable(views, 5.0f, 1.5f, 45.0f, (float)width / height);
+    BatchRenderer batch(&model, width, height, light_dir, &ThreadPool::shared());
+    batch.render(cameras, ViewCallback());
+
+    Profiler& profiler = Profiler::instance();
+    bool was_enabled = Profiler::enabled();
+    double ms[2];
+    for (int enabled = 0; enabled < 2; enabled++) {
+        Profiler::set_enabled(enabled != 0);
+        profiler.reset();
+        // best of a few rounds, the difference is small next to the noise
+        double best = std::numeric_limits<double>::max();
+        for (int round = 0; round < rounds; round++) {
+            bench_clock::time_point start = bench_clock::now();
+            batch.render(cameras, ViewCallback());
+            best = std::min(best, seconds_since(start));
+        }
+        ms[enabled] = best * 1000.0 / views;
+        std::cout << "profiler/" << (enabled ? "enabled" : "disabled") << "/compiled=" << PROFILING
+            << std::fixed << std::setprecision(3)
+            << "  ms/view=" << ms[enabled]
+            << std::defaultfloat
+            << "  events=" << profiler.events()
+            << "  triangles=" << profiler.counter(COUNTER_TRIANGLES_IN) / rounds
+            << "  overdraw=" << (profiler.counter(COUNTER_PIXELS_COVERED)
+                ? (double)profiler.counter(COUNTER_FRAGMENTS_SHADED) / profiler.counter(COUNTER_PIXELS_COVERED) : 0.0)
+            << std::endl;
+    }
+    std::cout << "profiler/overhead" << std::fixed << std::setprecision(2)
+        << "  percent=" << (ms[1] - ms[0]) * 100.0 / ms[0] << std::defaultfloat << std::endl;
+    profiler.reset();
+    Profiler::set_enabled(was_enabled);
+    return 0;
+}
+
+// Many small jobs through the render server: one 256x256 view each, with
+// the model cache off, so every job loads the mesh and its textures again
+// as a process per asset would, and on.
+static int bench_server(const char* model_path) {
+    const int jobs = 32;
+    std::vector<std::string> lines;
+    for (int i = 0; i < jobs; i++) {
+        char line[512];
+        snprintf(line, sizeof(line), "{\"id\":%d,\"mesh\":\"%s\",\"cameras\":[\"%s\"],"
+            "\"outputs\":[\"bench_server_%d.tga\"],\"width\":256,\"height\":256}",
+            i, model_path, view_names[i % num_views], i % num_views);
+        lines.push_back(line);
+    }
+
+    double jobs_per_s[2];
+    for (int cached = 0; cached < 2; cached++) {
+        RenderServer server(0, cached ? 16 : 0);
+        std::atomic<int> failed(0);
+        ReplyCallback reply = [&](const std::string& text) {
+            if (text.find("\"ok\":true") == std::string::npos) {
+                if (!failed++) std::cerr << text << "\n";
+            }
+        };
+        bench_clock::time_point start = bench_clock::now();
+        for (int i = 0; i < jobs; i++) server.submit(lines[i], reply);
+        server.wait_idle();
+        double elapsed = seconds_since(start);
+        jobs_per_s[cached] = jobs / elapsed;
+        ModelCacheStats stats = server.cache().stats();
+        std::cout << "server/" << (cached ? "cached" : "uncached") << "/jobs=" << jobs
+            << "/workers=" << server.workers() << std::fixed << std::setprecision(3)
+            << "  ms/job=" << elapsed * 1000.0 / jobs
+            << "  jobs/s=" << jobs_per_s[cached]
+            << std::defaultfloat
+            << "  loads=" << stats.misses
+            << "  failed=" << failed << std::endl;
+        if (failed) return 1;
+    }
+    std::cout << "server/speedup" << std::fixed << std::setprecision(2)
+        << "  x=" << jobs_per_s[1] / jobs_per_s[0] << std::defaultfloat << std::endl;
+    for (int view = 0; view < num_views; view++) {
+        char name[64];
+        snprintf(name, sizeof(name), "bench_server_%d.tga", view);
+        std::remove(name);
+    }
+    return 0;
+}
+
+// A turntable written out as it renders: encode and write in the render
+// callback, then on one and two background writer threads.
+static int bench_writer(const char* model_path, int views) {
+    Model model(model_path);
+    if (model.nverts() == 0) {
+        std::cerr << "can't load " << model_path << "\n";
+        return 1;
+    }
+
+    const int width = 800;
+    const int height = 800;
+    Vec3f light_dir(0.2f, 0.4f, -1.0f);
+    light_dir.normalize();
+    std::vector<Camera> cameras = make_turntable(views, 5.0f, 1.5f, 45.0f, (float)width / height);
+    BatchRenderer batch(&model, width, height, light_dir, &ThreadPool::shared());
+    batch.render(cameras, ViewCallback());
+    bench_clock::time_point start = bench_clock::now();
+    batch.render(cameras, ViewCallback());
+    std::cout << "writer/none/views=" << views << std::fixed << std::setprecision(3)
+        << "  ms/view=" << seconds_since(start) * 1000.0 / views << std::defaultfloat << std::endl;
+
+    double base = 0.0;
+    for (int threads = 0; threads <= 2; threads++) {
+        start = bench_clock::now();
+        ImageWriter writer(threads);
+        batch.render(cameras, [&](const ViewResult& result) {
+            char name[64];
+            snprintf(name, sizeof(name), "bench_writer_%03d.tga", result.view);
+            writer.write(*result.framebuffer, name);
+        });
+        double render_s = seconds_since(start);
+        bool ok = writer.finish();
+        double elapsed = seconds_since(start);
+        if (threads == 0) base = elapsed;
+        std::cout << "writer/threads=" << threads << "/views=" << views << std::fixed << std::setprecision(3)
+            << "  ms/view=" << elapsed * 1000.0 / views
+            << "  render ms/view=" << render_s * 1000.0 / views
+            << "  speedup=" << base / elapsed
+            << std::defaultfloat
+            << "  stalls=" << writer.stalls()
+            << "  images=" << writer.images_allocated() << std::endl;
+        if (!ok) return 1;
+    }
+    for (int view = 0; view < views; view++) {
+        char name[64];
+        snprintf(name, sizeof(name), "bench_writer_%03d.tga", view);
+        std::remove(name);
+    }
+    return 0;
+}
+
+// Compares the old heap-backed matrix with Mat4f on the operations the
+// renderer uses: identity, product, transpose, point transform and a full
+// camera view-projection build.
+static int bench_matrix() {
+    const int iterations = 1000000;
+    Camera camera(Vec3f(3, 2, 4), Vec3f(0, 0, 0), Vec3f(0, 1, 0), 50.0f, 1.0f, 0.1f, 100.0f);
+
+    LegacyMatrix la = LegacyMatrix::identity(4);
+    Mat4f ma = camera.getViewProjectionMatrix();
+    for (int i = 0; i < 4; i++) {
+        for (int j = 0; j < 4; j++) la[i][j] = ma[i][j];
+    }
+    LegacyMatrix lb = la.transpose();
+    Mat4f mb = ma.transpose();
+
+    report_op("legacy/identity", iterations, [&](int i) { return LegacyMatrix::identity(4)[i & 3][i & 3]; });
+    report_op("mat4f/identity", iterations, [&](int i) { return Mat4f::identity()[i & 3][i & 3]; });
+    report_op("legacy/multiply", iterations, [&](int i) { la[0][0] = (float)(i & 7); return (la * lb)[1][2]; });
+    report_op("mat4f/multiply", iterations, [&](int i) { ma[0][0] = (float)(i & 7); return (ma * mb)[1][2]; });
+    report_op("legacy/transpose", iterations, [&](int i) { la[0][1] = (float)(i & 7); return la.transpose()[1][0]; });
+    report_op("mat4f/transpose", iterations, [&](int i) { ma[0][1] = (float)(i & 7); return ma.transpose()[1][0]; });
+    report_op("legacy/transform", iterations, [&](int i) { return (la * Vec3f((float)(i & 15), 1.0f, 2.0f)).x; });
+    report_op("mat4f/transform", iterations, [&](int i) { return (ma * Vec3f((float)(i & 15), 1.0f, 2.0f)).x; });
+    report_op("legacy/view_projection", iterations / 10, [&](int i) {
+        // what Camera::getViewProjectionMatrix cost before: two identities and a product
+        LegacyMatrix view = LegacyMatrix::identity(4);
+        LegacyMatrix proj = LegacyMatrix::identity(4);
+        view[0][3] = (float)(i & 7);
+        proj[3][2] = 1.0f;
+        return (proj * view)[0][3];
+    });
+    report_op("mat4f/view_projection", iterations / 10, [&](int i) { return camera.getViewProjectionMatrix()[i & 3][3]; });
+    return 0;
+}
+
+static double file_mb(const char* filename) {
+    unsigned long long size;
+    long long mtime;
+    return file_stat(filename, size, mtime) ? size / 1e6 : 0.0;
+}
+
+// Read and write throughput of the TGA path, in MB/s of decoded pixel data
+// and of bytes on disk, for the raw and RLE encodings.
+static int bench_tga(const char* filename) {
+    const char* files[] = { filename, "object_nm.tga", "object_spec.tga", "object_diffuse.tga" };
+    const char* tmp = "bench_tmp.tga";
+    const int iterations = 10;
+
+    for (int f = 0; f < 4; f++) {
+        if (f > 0 && !strcmp(files[f], filename)) continue;
+        TGAImage image;
+        if (!image.read_tga_file(files[f])) continue;
+        double pixel_mb = (double)image.get_width() * image.get_height() * image.get_bytespp() / 1e6;
+
+        bench_clock::time_point start = bench_clock::now();
+        for (int i = 0; i < iterations; i++) image.read_tga_file(files[f]);
+        double elapsed = seconds_since(start);
+        std::cout << "tga/read/" << files[f] << std::fixed << std::setprecision(1)
+            << "  pixels MB/s=" << pixel_mb * iterations / elapsed
+            << "  file MB/s=" << file_mb(files[f]) * iterations / elapsed
+            << std::defaultfloat << std::endl;
+
+        for (int rle = 0; rle < 2; rle++) {
+            start = bench_clock::now();
+            for (int i = 0; i < iterations; i++) image.write_tga_file(tmp, rle != 0);
+            elapsed = seconds_since(start);
+            std::cout << "tga/write_" << (rle ? "rle/" : "raw/") << files[f] << std::fixed << std::setprecision(1)
+                << "  pixels MB/s=" << pixel_mb * iterations / elapsed
+                << "  file MB/s=" << file_mb(tmp) * iterations / elapsed
+                << std::defaultfloat << std::endl;
+
+            start = bench_clock::now();
+            for (int i = 0; i < iterations; i++) image.read_tga_file(tmp);
+            elapsed = seconds_since(start);
+            std::cout << "tga/read_" << (rle ? "rle/" : "raw/") << files[f] << std::fixed << std::setprecision(1)
+                << "  pixels MB/s=" << pixel_mb * iterations / elapsed
+                << std::defaultfloat << std::endl;
+        }
+    }
+    std::remove(tmp);
+    return 0;
+}
+
+// Encode and write cost of each output format for one rendered view, next
+// to the TGA RLE path every frame went through before.
+static int bench_formats(const char* model_path) {
+    Model model(model_path);
+    if (model.nverts() == 0) {
+        std::cerr << "can't load " << model_path << "\n";
+        return 1;
+    }
+
+    const int width = 800;
+    const int height = 800;
+    const int iterations = 10;
+    Vec3f light_dir(0.2f, 0.4f, -1.0f);
+    light_dir.normalize();
+    std::vector<Camera> cameras = make_turntable(1, 5.0f, 1.5f, 45.0f, (float)width / height);
+    BatchRenderer batch(&model, width, height, light_dir, &ThreadPool::shared());
+    TGAImage image;
+    batch.render(cameras, [&](const ViewResult& result) { result.framebuffer->to_image(image); });
+    double pixel_mb = (double)image.get_width() * image.get_height() * image.get_bytespp() / 1e6;
+
+    struct FormatCase {
+        const char* name;
+        const char* filename;
+        bool compress;
+    };
+    const FormatCase cases[] = {
+        { "tga_rle", "bench_format.tga", true },
+        { "tga_raw", "bench_format.tga", false },
+        { "ppm", "bench_format.ppm", false },
+        { "pam", "bench_format.pam", false },
+        { "png_stored", "bench_format.png", false },
+        { "png_fixed", "bench_format.png", true },
+    };
+    double base = 0.0;
+    for (const FormatCase& c : cases) {
+        ImageFormat format = image_format_for(c.filename);
+        if (!write_image(image, c.filename, format, c.compress)) return 1;
+        bench_clock::time_point start = bench_clock::now();
+        for (int i = 0; i < iterations; i++) write_image(image, c.filename, format, c.compress);
+        double elapsed = seconds_since(start);
+        if (base == 0.0) base = elapsed;
+        std::cout << "formats/" << c.name << std::fixed << std::setprecision(1)
+            << "  ms/image=" << elapsed * 1000.0 / iterations
+            << "  pixels MB/s=" << pixel_mb * iterations / elapsed
+            << std::setprecision(3)
+            << "  file MB=" << file_mb(c.filename)
+            << "  vs tga_rle=" << base / elapsed
+            << std::defaultfloat << std::endl;
+        std::remove(c.filename);
+    }
+    return 0;
+}
+
+struct RleCase {
+    std::string name;
+    std::vector<unsigned char> pixels;
+    int bytespp;
+};
+
+// Flat areas, short runs and noise, so both packet kinds get exercised.
+static RleCase synthetic_rle_case(const char* name, int bytespp, int period) {
+    RleCase c;
+    c.name = name;
+    c.bytespp = bytespp;
+    c.pixels.resize((size_t)1024 * 1024 * bytespp);
+    unsigned state = 12345;
+    for (size_t i = 0; i < c.pixels.size(); i++) {
+        state = state * 1103515245u + 12345u;
+        size_t pixel = i / bytespp;
+        c.pixels[i] = period ? (unsigned char)((pixel / period) * 37 + i % bytespp) : (unsigned char)(state >> 24);
+    }
+    return c;
+}
+
+// Vectorized RLE encoder/decoder against the scalar reference: output must be
+// byte-identical, throughput in MB/s of pixel data.
+static int bench_rle() {
+    std::vector<RleCase> cases;
+    const char* files[] = { "object_nm.tga", "object_spec.tga", "object_diffuse.tga" };
+    for (int f = 0; f < 3; f++) {
+        TGAImage image;
+        if (!image.read_tga_file(files[f])) continue;
+        RleCase c;
+        c.name = files[f];
+        c.bytespp = image.get_bytespp();
+        c.pixels.assign(image.buffer(), image.buffer() + (size_t)image.get_width() * image.get_height() * c.bytespp);
+        cases.push_back(c);
+    }
+    cases.push_back(synthetic_rle_case("flat4", 4, 1 << 30));
+    cases.push_back(synthetic_rle_case("runs4_7", 4, 7));
+    cases.push_back(synthetic_rle_case("runs3_300", 3, 300));
+    cases.push_back(synthetic_rle_case("runs1_2", 1, 2));
+    cases.push_back(synthetic_rle_case("noise3", 3, 0));
+    cases.push_back(synthetic_rle_case("noise1", 1, 0));
+
+    const int iterations = 20;
+    int status = 0;
+    for (size_t c = 0; c < cases.size(); c++) {
+        const RleCase& rc = cases[c];
+        size_t npixels = rc.pixels.size() / rc.bytespp;
+        double pixel_mb = rc.pixels.size() / 1e6;
+        std::vector<unsigned char> ref(npixels * (rc.bytespp + 1)), out(ref.size()), decoded(rc.pixels.size());
+
+        size_t ref_size = rle_encode_scalar(rc.pixels.data(), npixels, rc.bytespp, ref.data());
+        size_t out_size = rle_encode(rc.pixels.data(), npixels, rc.bytespp, out.data());
+        bool same = ref_size == out_size && !memcmp(ref.data(), out.data(), ref_size);
+        bool roundtrip = rle_decode(out.data(), out_size, npixels, rc.bytespp, decoded.data())
+            && decoded == rc.pixels;
+        if (!same || !roundtrip) status = 1;
+
+        bench_clock::time_point start = bench_clock::now();
+        for (int i = 0; i < iterations; i++) rle_encode_scalar(rc.pixels.data(), npixels, rc.bytespp, ref.data());
+        double scalar = pixel_mb * iterations / seconds_since(start);
+        start = bench_clock::now();
+        for (int i = 0; i < iterations; i++) rle_encode(rc.pixels.data(), npixels, rc.bytespp, out.data());
+        double simd = pixel_mb * iterations / seconds_since(start);
+        start = bench_clock::now();
+        for (int i = 0; i < iterations; i++) rle_decode(out.data(), out_size, npixels, rc.bytespp, decoded.data());
+        double decode = pixel_mb * iterations / seconds_since(start);
+
+        std::cout << "rle/" << rc.name << "  bpp=" << rc.bytespp << std::fixed << std::setprecision(1)
+            << "  ratio=" << (double)rc.pixels.size() / out_size
+            << "  encode_scalar MB/s=" << scalar
+            << "  encode MB/s=" << simd
+            << "  decode MB/s=" << decode
+            << std::defaultfloat
+            << (same ? "  identical" : "  MISMATCH")
+            << (roundtrip ? "" : "  ROUNDTRIP FAILED") << std::endl;
+    }
+    return status;
+}
+
+// A turntable rendered the way main.cpp used to (fresh z-buffer and full
+// per-face setup for every view, one view at a time) against BatchRenderer.
+static int bench_batch(const char* model_path, int views) {
+    Model model(model_path);
+    if (model.nverts() == 0) {
+        std::cerr << "can't load " << model_path << "\n";
+        return 1;
+    }
+
+    const int width = 800;
+    const int height = 800;
+    Vec3f light_dir(0.2f, 0.4f, -1.0f);
+    light_dir.normalize();
+    std::vector<Camera> cameras = make_turntable(views, 5.0f, 1.5f, 45.0f, (float)width / height);
+    ThreadPool& pool = ThreadPool::shared();
+
+    AllocationScope allocations;
+    long long allocs_before = allocations.count();
+    bench_clock::time_point start = bench_clock::now();
+    for (int view = 0; view < views; view++) {
+        Framebuffer framebuffer(width, height);
+        framebuffer.clear();
+        Rasterizer raster(framebuffer, &pool);
+        render_cube_with_layers(cameras[view], raster, light_dir);
+        render_model(&model, cameras[view], raster, light_dir);
+        render_front_cube_faces(cameras[view], raster, light_dir);
+        raster.flush();
+    }
+    double elapsed = seconds_since(start);
+    std::cout << "batch/per_view/views=" << views << std::fixed << std::setprecision(3)
+        << "  ms/view=" << elapsed * 1000.0 / views
+        << "  total s=" << elapsed
+        << std::defaultfloat
+        << "  allocs/view=" << (allocations.count() - allocs_before) / views << std::endl;
+
+    allocs_before = allocations.count();
+    start = bench_clock::now();
+    BatchRenderer batch(&model, width, height, light_dir, &pool);
+    batch.render(cameras, ViewCallback());
+    elapsed = seconds_since(start);
+    std::cout << "batch/batched/views=" << views << "/threads=" << pool.size() << std::fixed << std::setprecision(3)
+        << "  ms/view=" << elapsed * 1000.0 / views
+        << "  total s=" << elapsed
+        << std::defaultfloat
+        << "  allocs/view=" << (allocations.count() - allocs_before) / views
+        << "  targets=" << batch.targets_allocated() << std::endl;
+    return 0;
+}
+
+int run_benchmarks(int argc, char** argv) {
+    std::string name = argc > 0 ? argv[0] : "all";
+    const char* model_path = argc > 1 ? argv[1] : "object.obj";
+    bool all = (name == "all");
+    bool found = all;
+    int status = 0;
+
+    if (all || name == "raster") {
+        found = true;
+        status |= bench_raster(model_path);
+    }
+
+    if (all || name == "overdraw") {
+        found = true;
+        status |= bench_overdraw(model_path);
+    }
+
+    if (all || name == "cull") {
+        found = true;
+        status |= bench_cull(model_path);
+    }
+
+    if (all || name == "clip") {
+        found = true;
+        status |= bench_clip(model_path);
+    }
+
+    if (all || name == "subpixel") {
+        found = true;
+        status |= bench_subpixel(model_path);
+    }
+
+    if (all || name == "texture") {
+        found = true;
+        status |= bench_texture(model_path);
+    }
+
+    if (all || name == "shading") {
+        found = true;
+        status |= bench_shading(model_path);
+    }
+
+    if (all || name == "deferred") {
+        found = true;
+        status |= bench_deferred(model_path);
+    }
+
+    if (all || name == "oit") {
+        found = true;
+        status |= bench_oit();
+    }
+
+    if (all || name == "framebuffer") {
+        found = true;
+        status |= bench_framebuffer(model_path);
+    }
+
+    if (all || name == "profiler") {
+        found = true;
+        status |= bench_profiler(model_path);
+    }
+
+    if (all || name == "server") {
+        found = true;
+        status |= bench_server(model_path);
+    }
+
+    if (all || name == "writer") {
+        found = true;
+        status |= bench_writer(model_path, argc > 2 ? atoi(argv[2]) : 24);
+    }
+
+    if (all || name == "formats") {
+        found = true;
+        status |= bench_formats(model_path);
+    }
+
+    if (all || name == "matrix") {
+        found = true;
+        status |= bench_matrix();
+    }
+
+    if (all || name == "tga") {
+        found = true;
+        status |= bench_tga(argc > 1 ? argv[1] : "object_nm.tga");
+    }
+
+    if (all || name == "batch") {
+        found = true;
+        status |= bench_batch(model_path, argc > 2 ? atoi(argv[2]) : 36);
+    }
+
+    if (all || name == "rle") {
+        found = true;
+        status |= bench_rle();
+    }
+
+    if (!found) {
+        std::cerr << "unknown benchmark " << name << "\n";
+        return 1;
+    }
+    return status;
+}
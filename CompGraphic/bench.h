@@ -0,0 +1,8 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+// Entry point for "CompGraphic --bench [name] [input file]".
+// Without a name every benchmark runs.
+int run_benchmarks(int argc, char** argv);
+
+#endif // BENCH_H
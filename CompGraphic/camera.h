@@ -26,12 +26,12 @@ public:
         up.normalize();
     }
 
-    Matrix getViewMatrix() {
+    Mat4f getViewMatrix() const {
         Vec3f z = (eye - target).normalize();
         Vec3f x = cross(up, z).normalize();
         Vec3f y = cross(z, x).normalize();
 
-        Matrix view = Matrix::identity(4);
+        Mat4f view = Mat4f::identity();
 
         view[0][0] = x.x; view[0][1] = x.y; view[0][2] = x.z;
         view[1][0] = y.x; view[1][1] = y.y; view[1][2] = y.z;
@@ -44,8 +44,8 @@ public:
         return view;
     }
 
-    Matrix getProjectionMatrix() {
-        Matrix proj = Matrix::identity(4);
+    Mat4f getProjectionMatrix() const {
+        Mat4f proj = Mat4f::identity();
 
         float tanHalfFov = tan(fov * 3.14159265f / 360.0f);
         float range = znear - zfar;
@@ -60,7 +60,7 @@ public:
         return proj;
     }
 
-    Matrix getViewProjectionMatrix() {
+    Mat4f getViewProjectionMatrix() const {
         return getProjectionMatrix() * getViewMatrix();
     }
 
@@ -73,11 +73,11 @@ public:
     float getZFar() const { return zfar; }
 
 private:
-    float dot(const Vec3f& a, const Vec3f& b) {
+    static float dot(const Vec3f& a, const Vec3f& b) {
         return a.x * b.x + a.y * b.y + a.z * b.z;
     }
 
-    Vec3f cross(const Vec3f& a, const Vec3f& b) {
+    static Vec3f cross(const Vec3f& a, const Vec3f& b) {
         return Vec3f(
             a.y * b.z - a.z * b.y,
             a.z * b.x - a.x * b.z,
@@ -86,4 +86,38 @@ private:
     }
 };
 
+// Planes of a camera's view volume, for culling bounding spheres.
+class Frustum {
+private:
+    Mat4f view;
+    float tanX, tanY;   // half-extent of the view per unit of distance
+    float normX, normY; // 1 / length of the side plane normals
+    float znear, zfar;
+
+public:
+    explicit Frustum(const Camera& camera) : view(camera.getViewMatrix()) {
+        // a little wider than the screen: vertices just outside still round onto the border pixels
+        tanY = std::tan(camera.getFov() * 3.14159265f / 360.0f) * 1.02f;
+        tanX = tanY * camera.getAspect();
+        normX = 1.0f / std::sqrt(1.0f + tanX * tanX);
+        normY = 1.0f / std::sqrt(1.0f + tanY * tanY);
+        znear = camera.getZNear();
+        zfar = camera.getZFar();
+    }
+
+    bool intersectsSphere(const Vec3f& center, float radius) const {
+        float x = view[0][0] * center.x + view[0][1] * center.y + view[0][2] * center.z + view[0][3];
+        float y = view[1][0] * center.x + view[1][1] * center.y + view[1][2] * center.z + view[1][3];
+        float dist = -(view[2][0] * center.x + view[2][1] * center.y + view[2][2] * center.z + view[2][3]);
+
+        if (dist + radius < znear) return false;
+        if (dist - radius > zfar) return false;
+        if ((x - dist * tanX) * normX > radius) return false;
+        if ((-x - dist * tanX) * normX > radius) return false;
+        if ((y - dist * tanY) * normY > radius) return false;
+        if ((-y - dist * tanY) * normY > radius) return false;
+        return true;
+    }
+};
+
 #endif // CAMERA_H
\ No newline at end of file
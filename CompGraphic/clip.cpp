@@ -0,0 +1,57 @@
+#include <algorithm>
+#include "clip.h"
+
+// Signed distance of v to a clip plane, >= 0 on the inner side.
+static inline float plane_distance(const Vec4f& v, int plane, const ClipVolume& volume) {
+    float d = -v.w;
+    switch (plane) {
+    case 0: return d - volume.znear;
+    case 1: return volume.zfar - d;
+    case 2: return v.x + d * volume.guard;
+    case 3: return d * volume.guard - v.x;
+    case 4: return v.y + d * volume.guard;
+    default: return d * volume.guard - v.y;
+    }
+}
+
+static inline ClipVertex lerp(const ClipVertex& a, const ClipVertex& b, float t) {
+    ClipVertex v;
+    v.pos = a.pos + (b.pos - a.pos) * t;
+    v.uv = a.uv + (b.uv - a.uv) * t;
+    return v;
+}
+
+int clip_polygon(ClipVertex* poly, int n, const ClipVolume& volume) {
+    ClipVertex buffer[clip_max_verts];
+    ClipVertex* in = poly;
+    ClipVertex* out = buffer;
+
+    // near first: once it is done every w is negative and the side planes are well defined
+    for (int plane = 0; plane < 6 && n > 0; plane++) {
+        float dist[clip_max_verts];
+        bool outside = false;
+        for (int i = 0; i < n; i++) {
+            dist[i] = plane_distance(in[i].pos, plane, volume);
+            if (dist[i] < 0.0f) outside = true;
+        }
+        if (!outside) continue;
+
+        int m = 0;
+        for (int i = 0; i < n; i++) {
+            int j = (i + 1 == n) ? 0 : i + 1;
+            bool in_i = dist[i] >= 0.0f;
+            bool in_j = dist[j] >= 0.0f;
+            if (in_i) out[m++] = in[i];
+            if (in_i != in_j && m < clip_max_verts) {
+                out[m++] = lerp(in[i], in[j], dist[i] / (dist[i] - dist[j]));
+            }
+        }
+        n = m;
+        std::swap(in, out);
+    }
+
+    if (in != poly) {
+        for (int i = 0; i < n; i++) poly[i] = in[i];
+    }
+    return n;
+}
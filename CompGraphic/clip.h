@@ -0,0 +1,65 @@
+#ifndef CLIP_H
+#define CLIP_H
+
+#include "geometry.h"
+#include "camera.h"
+
+// Clip space of Camera::getViewProjectionMatrix(): w is the view-space depth,
+// negative in front of the eye, and a point is on screen when |x| and |y| are
+// at most -w.
+enum ClipCode {
+    CLIP_NEAR = 1,
+    CLIP_FAR = 2,
+    CLIP_LEFT = 4,
+    CLIP_RIGHT = 8,
+    CLIP_BOTTOM = 16,
+    CLIP_TOP = 32,
+    CLIP_GUARD = 64    // x or y past the guard band
+};
+
+// A triangle whose three codes share one of these bits is entirely off screen.
+const unsigned clip_outside = CLIP_NEAR | CLIP_FAR | CLIP_LEFT | CLIP_RIGHT | CLIP_BOTTOM | CLIP_TOP;
+
+// Bits of a triangle's codes that make it go through clip_polygon. The sides
+// of the screen only need clipping past the guard band; closer in the
+// rasterizer's bounds already cut the triangle at the screen edge.
+const unsigned clip_needed = CLIP_NEAR | CLIP_FAR | CLIP_GUARD;
+
+// A clipped triangle has at most one more vertex per plane.
+const int clip_max_verts = 9;
+
+struct ClipVolume {
+    float znear;
+    float zfar;
+    float guard;   // x and y are clipped against guard * -w
+
+    explicit ClipVolume(const Camera& camera, float guard_band = 8.0f)
+        : znear(camera.getZNear()), zfar(camera.getZFar()), guard(guard_band) {}
+};
+
+struct ClipVertex {
+    Vec4f pos;
+    Vec2f uv;
+};
+
+// Planes the point is outside of, as ClipCode bits.
+inline unsigned clip_code(const Vec4f& v, const ClipVolume& volume) {
+    float d = -v.w;
+    float g = d * volume.guard;
+    unsigned code = 0;
+    if (d < volume.znear) code |= CLIP_NEAR;
+    if (d > volume.zfar) code |= CLIP_FAR;
+    if (v.x < -d) code |= CLIP_LEFT;
+    if (v.x > d) code |= CLIP_RIGHT;
+    if (v.y < -d) code |= CLIP_BOTTOM;
+    if (v.y > d) code |= CLIP_TOP;
+    if (v.x < -g || v.x > g || v.y < -g || v.y > g) code |= CLIP_GUARD;
+    return code;
+}
+
+// Sutherland-Hodgman against the near and far planes and the guard band.
+// poly holds n vertices and room for clip_max_verts; returns the vertex count
+// left, 0 when nothing is inside.
+int clip_polygon(ClipVertex* poly, int n, const ClipVolume& volume);
+
+#endif // CLIP_H
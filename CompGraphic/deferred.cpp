@@ -0,0 +1,424 @@
+#include <algorithm>
+#include <cmath>
+#include "deferred.h"
+#include "rasterizer.h"
+#include "thread_pool.h"
+#include "shading_simd.h"
+#include "profiler.h"
+
+// Tiles are lit from arrays on the stack, so their size is capped.
+static const int max_light_tile = 32;
+static const int max_tile_pixels = max_light_tile * max_light_tile;
+
+Light Light::directional(Vec3f direction, Vec3f color) {
+    Light l;
+    l.type = LIGHT_DIRECTIONAL;
+    l.direction = direction.normalize();
+    l.color = color;
+    l.radius = 0.0f;
+    return l;
+}
+
+Light Light::point(Vec3f position, float radius, Vec3f color) {
+    Light l;
+    l.type = LIGHT_POINT;
+    l.position = position;
+    l.color = color;
+    l.radius = radius;
+    return l;
+}
+
+std::vector<Light> make_light_ring(int count, float radius, float height, float range) {
+    static const Vec3f palette[6] = {
+        Vec3f(1.0f, 0.4f, 0.3f), Vec3f(0.3f, 1.0f, 0.4f), Vec3f(0.3f, 0.5f, 1.0f),
+        Vec3f(1.0f, 0.9f, 0.3f), Vec3f(0.9f, 0.3f, 1.0f), Vec3f(0.3f, 1.0f, 1.0f)
+    };
+    std::vector<Light> lights;
+    lights.reserve(count);
+    for (int i = 0; i < count; i++) {
+        float angle = 2.0f * 3.14159265f * i / count;
+        // alternate above and below the ring so the lights do not all share a plane
+        float y = (i % 2 ? height : -height);
+        Vec3f position(radius * std::sin(angle), y, radius * std::cos(angle));
+        lights.push_back(Light::point(position, range, palette[i % 6]));
+    }
+    return lights;
+}
+
+GBuffer::GBuffer(int width, int height)
+    : width_(width), height_(height), filter_(TEXTURE_NEAREST), nx(width * height), ny(width * height), nz(width * height),
+    u(width * height), v(width * height), lod(width * height), material(width * height) {
+}
+
+int GBuffer::add_material(const Material& m) {
+    for (int i = 0; i < (int)materials_.size(); i++) {
+        if (materials_[i].model == m.model) {
+            materials_[i] = m;
+            return i + 1;
+        }
+    }
+    if (materials_.size() >= 255) return 0;
+    materials_.push_back(m);
+    return (int)materials_.size();
+}
+
+void GBuffer::clear() {
+    std::fill(material.begin(), material.end(), 0);
+}
+
+void GBuffer::store(const RasterTriangle& tri, const FragmentBatch& batch) {
+    unsigned char id = 0;
+    for (int i = 0; i < (int)materials_.size(); i++) {
+        if (materials_[i].model == tri.model) id = (unsigned char)(i + 1);
+    }
+    for (int i = 0; i < batch.n; i++) {
+        int idx = batch.x[i] + batch.y[i] * width_;
+        nx[idx] = tri.normal.x;
+        ny[idx] = tri.normal.y;
+        nz[idx] = tri.normal.z;
+        u[idx] = batch.u[i];
+        v[idx] = batch.v[i];
+        lod[idx] = batch.lod[i];
+        material[idx] = id;
+    }
+}
+
+// Per-pixel inputs of one material's pixels in a tile. The arrays run on to
+// a whole number of quads, the extra entries copies of the last pixel.
+struct TilePixels {
+    int count;
+    int padded;
+    int index[max_tile_pixels];
+    float sx[max_tile_pixels], sy[max_tile_pixels];  // NDC position over the projection scale
+    float zv[max_tile_pixels];                       // view-space depth
+    float u[max_tile_pixels], v[max_tile_pixels], lod[max_tile_pixels];
+    float px[max_tile_pixels], py[max_tile_pixels], pz[max_tile_pixels];  // world position
+    float nx[max_tile_pixels], ny[max_tile_pixels], nz[max_tile_pixels];  // unit normal
+    float vx[max_tile_pixels], vy[max_tile_pixels], vz[max_tile_pixels];  // unit vector to the eye
+    float exponent[max_tile_pixels];
+    unsigned int texel[max_tile_pixels];
+    unsigned int normal[max_tile_pixels];
+};
+
+// A pixel at view-space depth zv sits at eye + zv * (X * sx + Y * sy + Z),
+// with X, Y and Z the camera axes.
+struct ViewRays {
+    Vec3f eye;
+    Vec3f axis_x, axis_y, axis_z;
+};
+
+// Positions, view vectors, normals and exponents of the pixels, and the
+// bounding box of the positions. The normal comes from the normal texel
+// when there is a normal map and stays the face normal otherwise.
+static void prepare_tile(TilePixels& p, const ViewRays& rays, bool mapped_normal, bool mapped_exponent,
+    float shininess, Vec3f& lo, Vec3f& hi) {
+#ifdef SHADING_SSE2
+    const __m128 one = _mm_set1_ps(1.0f);
+    const __m128 scale = _mm_set1_ps(2.0f / 255.0f);
+    const __m128 tiny = _mm_set1_ps(1e-12f);
+    __m128 lo_x = _mm_set1_ps(1e30f), lo_y = lo_x, lo_z = lo_x;
+    __m128 hi_x = _mm_set1_ps(-1e30f), hi_y = hi_x, hi_z = hi_x;
+    for (int i = 0; i < p.padded; i += 4) {
+        __m128 sx = _mm_loadu_ps(p.sx + i), sy = _mm_loadu_ps(p.sy + i), zv = _mm_loadu_ps(p.zv + i);
+        __m128 rx = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(rays.axis_x.x), sx), _mm_mul_ps(_mm_set1_ps(rays.axis_y.x), sy)), _mm_set1_ps(rays.axis_z.x));
+        __m128 ry = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(rays.axis_x.y), sx), _mm_mul_ps(_mm_set1_ps(rays.axis_y.y), sy)), _mm_set1_ps(rays.axis_z.y));
+        __m128 rz = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(rays.axis_x.z), sx), _mm_mul_ps(_mm_set1_ps(rays.axis_y.z), sy)), _mm_set1_ps(rays.axis_z.z));
+        rx = _mm_mul_ps(rx, zv);
+        ry = _mm_mul_ps(ry, zv);
+        rz = _mm_mul_ps(rz, zv);
+        __m128 px = _mm_add_ps(_mm_set1_ps(rays.eye.x), rx);
+        __m128 py = _mm_add_ps(_mm_set1_ps(rays.eye.y), ry);
+        __m128 pz = _mm_add_ps(_mm_set1_ps(rays.eye.z), rz);
+        _mm_storeu_ps(p.px + i, px);
+        _mm_storeu_ps(p.py + i, py);
+        _mm_storeu_ps(p.pz + i, pz);
+        lo_x = _mm_min_ps(lo_x, px); lo_y = _mm_min_ps(lo_y, py); lo_z = _mm_min_ps(lo_z, pz);
+        hi_x = _mm_max_ps(hi_x, px); hi_y = _mm_max_ps(hi_y, py); hi_z = _mm_max_ps(hi_z, pz);
+
+        // eye - position is -zv times the ray
+        __m128 r = rsqrt_ps(_mm_max_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(rx, rx), _mm_mul_ps(ry, ry)), _mm_mul_ps(rz, rz)), tiny));
+        r = _mm_sub_ps(_mm_setzero_ps(), r);
+        _mm_storeu_ps(p.vx + i, _mm_mul_ps(rx, r));
+        _mm_storeu_ps(p.vy + i, _mm_mul_ps(ry, r));
+        _mm_storeu_ps(p.vz + i, _mm_mul_ps(rz, r));
+
+        __m128i nm = _mm_loadu_si128((const __m128i*)(p.normal + i));
+        if (mapped_normal) {
+            __m128 nx = _mm_sub_ps(_mm_mul_ps(channel(nm, 16), scale), one);
+            __m128 ny = _mm_sub_ps(_mm_mul_ps(channel(nm, 8), scale), one);
+            __m128 nz = _mm_sub_ps(_mm_mul_ps(channel(nm, 0), scale), one);
+            __m128 n = rsqrt_ps(_mm_max_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(nx, nx), _mm_mul_ps(ny, ny)), _mm_mul_ps(nz, nz)), tiny));
+            _mm_storeu_ps(p.nx + i, _mm_mul_ps(nx, n));
+            _mm_storeu_ps(p.ny + i, _mm_mul_ps(ny, n));
+            _mm_storeu_ps(p.nz + i, _mm_mul_ps(nz, n));
+        }
+        _mm_storeu_ps(p.exponent + i, mapped_exponent ? channel(nm, 24) : _mm_set1_ps(shininess));
+    }
+    float l[3][4], h[3][4];
+    _mm_storeu_ps(l[0], lo_x); _mm_storeu_ps(l[1], lo_y); _mm_storeu_ps(l[2], lo_z);
+    _mm_storeu_ps(h[0], hi_x); _mm_storeu_ps(h[1], hi_y); _mm_storeu_ps(h[2], hi_z);
+    for (int a = 0; a < 3; a++) {
+        lo[a] = std::min(std::min(l[a][0], l[a][1]), std::min(l[a][2], l[a][3]));
+        hi[a] = std::max(std::max(h[a][0], h[a][1]), std::max(h[a][2], h[a][3]));
+    }
+#else
+    lo = Vec3f(1e30f, 1e30f, 1e30f);
+    hi = Vec3f(-1e30f, -1e30f, -1e30f);
+    for (int i = 0; i < p.padded; i++) {
+        Vec3f ray = (rays.axis_x * p.sx[i] + rays.axis_y * p.sy[i] + rays.axis_z) * p.zv[i];
+        Vec3f pos = rays.eye + ray;
+        p.px[i] = pos.x; p.py[i] = pos.y; p.pz[i] = pos.z;
+        for (int a = 0; a < 3; a++) {
+            lo[a] = std::min(lo[a], pos[a]);
+            hi[a] = std::max(hi[a], pos[a]);
+        }
+        float len = ray.norm();
+        Vec3f to_eye = len > 0.0f ? ray * (-1.0f / len) : Vec3f();
+        p.vx[i] = to_eye.x; p.vy[i] = to_eye.y; p.vz[i] = to_eye.z;
+
+        unsigned int c = p.normal[i];
+        if (mapped_normal) {
+            Vec3f n((float)((c >> 16) & 0xff), (float)((c >> 8) & 0xff), (float)(c & 0xff));
+            n = n * (2.0f / 255.0f) - Vec3f(1.0f, 1.0f, 1.0f);
+            if (n.norm() > 0.0f) n.normalize();
+            p.nx[i] = n.x; p.ny[i] = n.y; p.nz[i] = n.z;
+        }
+        p.exponent[i] = mapped_exponent ? (float)(c >> 24) : shininess;
+    }
+#endif
+}
+
+// The lights of one tile, one array per component, with room for every
+// light in the scene so culling never has to drop one.
+struct TileLights {
+    int count;
+    std::vector<float> x, y, z;  // direction for directional lights, position for point lights
+    std::vector<float> r, g, b;
+    std::vector<float> inv_radius2;  // 0 for directional lights
+
+    explicit TileLights(size_t capacity)
+        : count(0), x(capacity), y(capacity), z(capacity), r(capacity), g(capacity), b(capacity),
+          inv_radius2(capacity) {}
+};
+
+// Writes the lit colors of the first count pixels.
+static void write_pixels(unsigned int* color, const int* index, const unsigned int* colors, int count) {
+    for (int i = 0; i < count; i++) color[index[i]] = colors[i];
+}
+
+// Sums the tile's lights over its pixels and returns the packed colors in out.
+static void shade_tile(const TilePixels& p, const TileLights& lights, float ambient, float specular, unsigned int* out) {
+#ifdef SHADING_SSE2
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 one = _mm_set1_ps(1.0f);
+    const __m128 sign = _mm_set1_ps(-0.0f);
+    const __m128 ks = _mm_set1_ps(specular);
+    for (int i = 0; i < p.padded; i += 4) {
+        __m128 px = _mm_loadu_ps(p.px + i), py = _mm_loadu_ps(p.py + i), pz = _mm_loadu_ps(p.pz + i);
+        __m128 nx = _mm_loadu_ps(p.nx + i), ny = _mm_loadu_ps(p.ny + i), nz = _mm_loadu_ps(p.nz + i);
+        __m128 vx = _mm_loadu_ps(p.vx + i), vy = _mm_loadu_ps(p.vy + i), vz = _mm_loadu_ps(p.vz + i);
+        __m128 exponent = _mm_loadu_ps(p.exponent + i);
+        __m128 nv = _mm_add_ps(_mm_add_ps(_mm_mul_ps(nx, vx), _mm_mul_ps(ny, vy)), _mm_mul_ps(nz, vz));
+        __m128 acc_r = zero, acc_g = zero, acc_b = zero;
+
+        for (int k = 0; k < lights.count; k++) {
+            __m128 lx = _mm_set1_ps(lights.x[k]), ly = _mm_set1_ps(lights.y[k]), lz = _mm_set1_ps(lights.z[k]);
+            __m128 att = one;
+            if (lights.inv_radius2[k] > 0.0f) {
+                lx = _mm_sub_ps(lx, px);
+                ly = _mm_sub_ps(ly, py);
+                lz = _mm_sub_ps(lz, pz);
+                __m128 d2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(lx, lx), _mm_mul_ps(ly, ly)), _mm_mul_ps(lz, lz));
+                // (1 - d^2 / r^2)^2: smooth, and exactly zero from the radius on
+                att = _mm_max_ps(zero, _mm_sub_ps(one, _mm_mul_ps(d2, _mm_set1_ps(lights.inv_radius2[k]))));
+                if (!_mm_movemask_ps(_mm_cmpgt_ps(att, zero))) continue;
+                att = _mm_mul_ps(att, att);
+                __m128 r = rsqrt_ps(_mm_max_ps(d2, _mm_set1_ps(1e-12f)));
+                lx = _mm_mul_ps(lx, r);
+                ly = _mm_mul_ps(ly, r);
+                lz = _mm_mul_ps(lz, r);
+            }
+            __m128 nl = _mm_add_ps(_mm_add_ps(_mm_mul_ps(nx, lx), _mm_mul_ps(ny, ly)), _mm_mul_ps(nz, lz));
+            __m128 lv = _mm_add_ps(_mm_add_ps(_mm_mul_ps(lx, vx), _mm_mul_ps(ly, vy)), _mm_mul_ps(lz, vz));
+            // r * v with r = 2 (n * l) n - l, the same highlight as the forward path
+            __m128 highlight = _mm_sub_ps(_mm_mul_ps(_mm_add_ps(nl, nl), nv), lv);
+            __m128 w = _mm_andnot_ps(sign, nl);
+            if (_mm_movemask_ps(_mm_cmpgt_ps(highlight, zero))) {
+                w = _mm_add_ps(w, _mm_mul_ps(ks, pow_ps(_mm_max_ps(highlight, zero), exponent)));
+            }
+            w = _mm_mul_ps(w, att);
+            acc_r = _mm_add_ps(acc_r, _mm_mul_ps(w, _mm_set1_ps(lights.r[k])));
+            acc_g = _mm_add_ps(acc_g, _mm_mul_ps(w, _mm_set1_ps(lights.g[k])));
+            acc_b = _mm_add_ps(acc_b, _mm_mul_ps(w, _mm_set1_ps(lights.b[k])));
+        }
+
+        __m128 base = _mm_set1_ps(ambient);
+        acc_r = _mm_min_ps(one, _mm_add_ps(base, acc_r));
+        acc_g = _mm_min_ps(one, _mm_add_ps(base, acc_g));
+        acc_b = _mm_min_ps(one, _mm_add_ps(base, acc_b));
+        __m128i c = _mm_loadu_si128((const __m128i*)(p.texel + i));
+        __m128i b = _mm_cvttps_epi32(_mm_mul_ps(channel(c, 0), acc_b));
+        __m128i g = _mm_cvttps_epi32(_mm_mul_ps(channel(c, 8), acc_g));
+        __m128i r = _mm_cvttps_epi32(_mm_mul_ps(channel(c, 16), acc_r));
+        __m128i alpha = _mm_and_si128(c, _mm_set1_epi32((int)0xff000000u));
+        __m128i packed = _mm_or_si128(_mm_or_si128(b, _mm_slli_epi32(g, 8)), _mm_or_si128(_mm_slli_epi32(r, 16), alpha));
+        _mm_storeu_si128((__m128i*)(out + i), packed);
+    }
+#else
+    for (int i = 0; i < p.count; i++) {
+        Vec3f pos(p.px[i], p.py[i], p.pz[i]);
+        Vec3f n(p.nx[i], p.ny[i], p.nz[i]);
+        Vec3f view(p.vx[i], p.vy[i], p.vz[i]);
+        float nv = n * view;
+        float acc[3] = { 0.0f, 0.0f, 0.0f };
+        for (int k = 0; k < lights.count; k++) {
+            Vec3f l(lights.x[k], lights.y[k], lights.z[k]);
+            float att = 1.0f;
+            if (lights.inv_radius2[k] > 0.0f) {
+                l = l - pos;
+                float d2 = l * l;
+                att = std::max(0.0f, 1.0f - d2 * lights.inv_radius2[k]);
+                if (att == 0.0f) continue;
+                att *= att;
+                l = l * (1.0f / std::sqrt(std::max(d2, 1e-12f)));
+            }
+            float nl = n * l;
+            float highlight = 2.0f * nl * nv - l * view;
+            float w = std::abs(nl);
+            if (highlight > 0.0f) w += specular * std::pow(highlight, p.exponent[i]);
+            w *= att;
+            acc[0] += w * lights.r[k];
+            acc[1] += w * lights.g[k];
+            acc[2] += w * lights.b[k];
+        }
+        TGAColor color((int)p.texel[i], 4);
+        color.r = (unsigned char)(color.r * std::min(1.0f, ambient + acc[0]));
+        color.g = (unsigned char)(color.g * std::min(1.0f, ambient + acc[1]));
+        color.b = (unsigned char)(color.b * std::min(1.0f, ambient + acc[2]));
+        out[i] = color.val;
+    }
+#endif
+}
+
+// Distance from c to the box [lo, hi] is within radius.
+static bool sphere_touches_box(const Vec3f& c, float radius, const Vec3f& lo, const Vec3f& hi) {
+    float d2 = 0.0f;
+    for (int a = 0; a < 3; a++) {
+        float d = std::max(0.0f, std::max(lo[a] - c[a], c[a] - hi[a]));
+        d2 += d * d;
+    }
+    return d2 <= radius * radius;
+}
+
+void light_gbuffer(const GBuffer& gbuffer, Framebuffer& framebuffer, const Camera& camera,
+    const std::vector<Light>& lights, ThreadPool* pool,
+    float ambient, int tile_size, bool cull_lights, LightingStats* stats) {
+    PROFILE_SCOPE(STAGE_SHADE, "light gbuffer");
+    int width = gbuffer.get_width();
+    int height = gbuffer.get_height();
+    tile_size = std::max(4, std::min(max_light_tile, tile_size));
+    int tiles_x = (width + tile_size - 1) / tile_size;
+    int tiles_y = (height + tile_size - 1) / tile_size;
+    int nlights = (int)lights.size();
+
+    // sx and sy are the NDC position over the projection scale; view-space
+    // depth follows from NDC depth, which the z-buffer holds times 1000
+    Mat4f view = camera.getViewMatrix();
+    Mat4f proj = camera.getProjectionMatrix();
+    ViewRays rays;
+    rays.eye = camera.getEye();
+    rays.axis_x = Vec3f(view[0][0], view[0][1], view[0][2]);
+    rays.axis_y = Vec3f(view[1][0], view[1][1], view[1][2]);
+    rays.axis_z = Vec3f(view[2][0], view[2][1], view[2][2]);
+    float p22 = proj[2][2], p23 = proj[2][3];
+    float sx_step = 2.0f / (width * proj[0][0]), sx0 = -1.0f / proj[0][0];
+    float sy_step = 2.0f / (height * proj[1][1]), sy0 = -1.0f / proj[1][1];
+    TextureFilter filter = gbuffer.get_filter();
+    const float* zbuffer = framebuffer.depth();
+
+    std::vector<LightingStats> tile_stats(tiles_x * tiles_y);
+    auto light_tile = [&](int tile) {
+        int x0 = (tile % tiles_x) * tile_size, y0 = (tile / tiles_x) * tile_size;
+        int x1 = std::min(width, x0 + tile_size), y1 = std::min(height, y0 + tile_size);
+        LightingStats& ts = tile_stats[tile];
+        TilePixels p;
+        TileLights tl(nlights);
+        unsigned int colors[max_tile_pixels];
+
+        for (int id = 1; id <= gbuffer.nmaterials(); id++) {
+            const Material& m = gbuffer.get_material(id);
+            int count = 0;
+            for (int y = y0; y < y1; y++) {
+                float sy = sy0 + y * sy_step;
+                for (int x = x0; x < x1; x++) {
+                    int idx = x + y * width;
+                    if (gbuffer.material[idx] != id) continue;
+                    int i = count++;
+                    int fb = framebuffer.index(x, y);
+                    p.index[i] = fb;
+                    p.sx[i] = sx0 + x * sx_step;
+                    p.sy[i] = sy;
+                    p.zv[i] = p23 / (zbuffer[fb] * 0.001f - p22);
+                    p.u[i] = gbuffer.u[idx];
+                    p.v[i] = gbuffer.v[idx];
+                    p.lod[i] = gbuffer.lod[idx];
+                    p.nx[i] = gbuffer.nx[idx];
+                    p.ny[i] = gbuffer.ny[idx];
+                    p.nz[i] = gbuffer.nz[idx];
+                }
+            }
+            if (count == 0) continue;
+            p.count = count;
+            for (p.padded = count; p.padded % 4; p.padded++) {
+                int i = p.padded, last = count - 1;
+                p.sx[i] = p.sx[last]; p.sy[i] = p.sy[last]; p.zv[i] = p.zv[last];
+                p.u[i] = p.u[last]; p.v[i] = p.v[last]; p.lod[i] = p.lod[last];
+                p.nx[i] = p.nx[last]; p.ny[i] = p.ny[last]; p.nz[i] = p.nz[last];
+            }
+
+            const Texture& surface = m.model->surface_texture();
+            bool mapped_normal = surface.nlevels() > 0;
+            if (mapped_normal) {
+                unsigned int* layers[2] = { p.texel, p.normal };
+                surface.sample_layers(p.u, p.v, p.lod, p.padded, filter, layers);
+            }
+            else {
+                m.model->diffuse_texture().sample(p.u, p.v, p.lod, p.padded, filter, p.texel);
+                std::fill(p.normal, p.normal + p.padded, 0u);
+            }
+            Vec3f lo, hi;
+            prepare_tile(p, rays, mapped_normal, mapped_normal && m.model->has_specular_map(), m.shininess, lo, hi);
+
+            tl.count = 0;
+            for (int k = 0; k < nlights; k++) {
+                const Light& light = lights[k];
+                Vec3f at = light.direction;
+                float inv_radius2 = 0.0f;
+                if (light.type == LIGHT_POINT) {
+                    if (!(light.radius > 0.0f)) continue;
+                    if (cull_lights && !sphere_touches_box(light.position, light.radius, lo, hi)) continue;
+                    at = light.position;
+                    inv_radius2 = 1.0f / (light.radius * light.radius);
+                }
+                int j = tl.count++;
+                tl.x[j] = at.x; tl.y[j] = at.y; tl.z[j] = at.z;
+                tl.r[j] = light.color.x; tl.g[j] = light.color.y; tl.b[j] = light.color.z;
+                tl.inv_radius2[j] = inv_radius2;
+            }
+
+            shade_tile(p, tl, ambient, m.specular, colors);
+            write_pixels(framebuffer.color(), p.index, colors, count);
+            ts.pixels += count;
+            ts.light_tests += (long long)count * tl.count;
+        }
+        if (ts.pixels > 0) ts.tiles++;
+    };
+
+    int ntiles = tiles_x * tiles_y;
+    if (pool) pool->parallel_for(ntiles, light_tile);
+    else for (int tile = 0; tile < ntiles; tile++) light_tile(tile);
+
+    if (stats) {
+        for (int tile = 0; tile < ntiles; tile++) *stats += tile_stats[tile];
+    }
+}
@@ -0,0 +1,111 @@
+#ifndef DEFERRED_H
+#define DEFERRED_H
+
+#include <vector>
+#include "geometry.h"
+#include "tgaimage.h"
+#include "model.h"
+#include "camera.h"
+#include "shading.h"
+#include "framebuffer.h"
+
+class ThreadPool;
+struct RasterTriangle;
+
+enum LightType {
+    LIGHT_DIRECTIONAL,
+    LIGHT_POINT
+};
+
+struct Light {
+    LightType type;
+    Vec3f position;   // LIGHT_POINT
+    Vec3f direction;  // LIGHT_DIRECTIONAL, unit vector towards the light
+    Vec3f color;      // per channel, 1 for the full surface color
+    float radius;     // LIGHT_POINT: the falloff reaches zero here
+
+    static Light directional(Vec3f direction, Vec3f color = Vec3f(1, 1, 1));
+    static Light point(Vec3f position, float radius, Vec3f color = Vec3f(1, 1, 1));
+};
+
+// count colored point lights evenly spaced on a circle around the origin,
+// for scenes that need many lights.
+std::vector<Light> make_light_ring(int count, float radius, float height, float range);
+
+struct Material {
+    Model* model;
+    float specular;
+    float shininess;  // highlight exponent where the model has no specular map
+};
+
+// Surface attributes of the opaque model pixels of a frame, one array per
+// attribute. Depth is not kept twice: the rasterizer's z-buffer is the depth
+// plane. Only the material plane is cleared between frames; the others are
+// read just where it is set.
+class GBuffer {
+private:
+    int width_;
+    int height_;
+    TextureFilter filter_;
+    std::vector<Material> materials_;
+public:
+    std::vector<float> nx, ny, nz;        // face normal
+    std::vector<float> u, v, lod;         // diffuse map coordinates as Texture::sample takes them
+    std::vector<unsigned char> material;  // 1 + index into the materials, 0 where nothing was stored
+
+    GBuffer(int width, int height);
+
+    // Models must be added before their triangles are flushed; at most 255.
+    int add_material(const Material& m);
+    const Material& get_material(int id) const { return materials_[id - 1]; }
+    int nmaterials() const { return (int)materials_.size(); }
+    void clear_materials() { materials_.clear(); }
+
+    void clear();
+    // Stores the batch's fragments in place of shading them. Different
+    // tiles may call it at once, as they never share pixels.
+    void store(const RasterTriangle& tri, const FragmentBatch& batch);
+    // Marks the pixel as not part of the buffer, for opaque pixels drawn
+    // over it without going through store().
+    void erase(int x, int y) { material[x + y * width_] = 0; }
+
+    // How the lighting pass samples the materials' maps; TEXTURE_NEAREST by default.
+    void set_filter(TextureFilter filter) { filter_ = filter; }
+    TextureFilter get_filter() const { return filter_; }
+
+    int get_width() const { return width_; }
+    int get_height() const { return height_; }
+};
+
+struct LightingStats {
+    long long pixels;        // G-buffer pixels lit
+    long long light_tests;   // light/pixel pairs evaluated
+    long long tiles;         // tiles with at least one G-buffer pixel
+
+    LightingStats() : pixels(0), light_tests(0), tiles(0) {}
+
+    LightingStats& operator+=(const LightingStats& s) {
+        pixels += s.pixels;
+        light_tests += s.light_tests;
+        tiles += s.tiles;
+        return *this;
+    }
+};
+
+// Lights every G-buffer pixel into the framebuffer and leaves the rest of it
+// alone.
+// The lighting is render_model's (ambient, two-sided diffuse, Phong
+// highlight with the exponent from the specular map) summed over the lights,
+// with the normal from the material's normal map when it has one. Positions
+// come back from the framebuffer's depth through the camera.
+//
+// The screen is split into tile_size square tiles, lit in parallel. Each
+// tile first finds the bounding box of its pixels and keeps only the point
+// lights whose sphere reaches it, so the cost grows with the lights per tile
+// rather than with every light in the scene. cull_lights = false evaluates
+// every light everywhere, for comparison.
+void light_gbuffer(const GBuffer& gbuffer, Framebuffer& framebuffer, const Camera& camera,
+    const std::vector<Light>& lights, ThreadPool* pool = nullptr,
+    float ambient = 0.25f, int tile_size = 32, bool cull_lights = true, LightingStats* stats = nullptr);
+
+#endif // DEFERRED_H
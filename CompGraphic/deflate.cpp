@@ -0,0 +1,224 @@
+#include <algorithm>
+#include <cstring>
+#include "deflate.h"
+
+namespace {
+
+const int length_base[29] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99,
+    115, 131, 163, 195, 227, 258 };
+const int length_extra[29] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+const int distance_base[30] = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025,
+    1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+const int distance_extra[30] = { 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12,
+    12, 13, 13 };
+
+unsigned reverse_bits(unsigned code, int n) {
+    unsigned r = 0;
+    for (int i = 0; i < n; i++) {
+        r = (r << 1) | (code & 1);
+        code >>= 1;
+    }
+    return r;
+}
+
+// The fixed Huffman codes of RFC 1951 3.2.6, bit-reversed because deflate
+// sends Huffman codes most significant bit first into an LSB-first stream,
+// and the symbol of every match length and distance.
+struct FixedCodes {
+    unsigned short literal[288];
+    unsigned char literal_bits[288];
+    unsigned char distance[30];
+    unsigned char length_symbol[259];
+    unsigned char distance_symbol[512];  // distance - 1 below 256, else 256 + ((distance - 1) >> 7)
+
+    FixedCodes() {
+        for (int s = 0; s < 288; s++) {
+            unsigned code;
+            int bits;
+            if (s < 144) { code = 0x30 + s; bits = 8; }
+            else if (s < 256) { code = 0x190 + (s - 144); bits = 9; }
+            else if (s < 280) { code = s - 256; bits = 7; }
+            else { code = 0xc0 + (s - 280); bits = 8; }
+            literal[s] = (unsigned short)reverse_bits(code, bits);
+            literal_bits[s] = (unsigned char)bits;
+        }
+        for (int d = 0; d < 30; d++) distance[d] = (unsigned char)reverse_bits(d, 5);
+        for (int s = 0; s < 29; s++) {
+            int top = s == 28 ? 258 : std::min(258, length_base[s] + (1 << length_extra[s]) - 1);
+            for (int len = length_base[s]; len <= top; len++) length_symbol[len] = (unsigned char)s;
+        }
+        // 258 also falls in the range of symbol 27; it has a code of its own
+        length_symbol[258] = 28;
+        for (int d = 0; d < 30; d++) {
+            int last = d == 29 ? 32768 : distance_base[d + 1] - 1;
+            for (int dist = distance_base[d]; dist <= last; dist++) {
+                int k = dist - 1;
+                int index = k < 256 ? k : 256 + (k >> 7);
+                distance_symbol[index] = (unsigned char)d;
+            }
+        }
+    }
+};
+
+const FixedCodes codes;
+
+} // namespace
+
+Deflater::Deflater(DeflateMode mode, int max_chain)
+    : mode_(mode), max_chain_(std::max(1, max_chain)), pos_(0), end_(0), block_open_(false), bits_(0), nbits_(0),
+    adler_a_(1), adler_b_(0) {
+    in_.resize(buffer_size);
+    if (mode_ == DEFLATE_FIXED) {
+        head_.assign(1 << hash_bits, -1);
+        prev_.assign(buffer_size, -1);
+    }
+    // zlib header: deflate with a 32K window, check bits making it a multiple of 31
+    out_.push_back(0x78);
+    out_.push_back(0x01);
+}
+
+void Deflater::put_bits(unsigned value, int n) {
+    bits_ |= (unsigned long long)value << nbits_;
+    nbits_ += n;
+    while (nbits_ >= 8) {
+        out_.push_back((unsigned char)bits_);
+        bits_ >>= 8;
+        nbits_ -= 8;
+    }
+}
+
+void Deflater::align() {
+    if (nbits_ > 0) put_bits(0, 8 - nbits_);
+}
+
+void Deflater::insert(int pos) {
+    unsigned h = ((unsigned)in_[pos] << 10 ^ (unsigned)in_[pos + 1] << 5 ^ in_[pos + 2]) & ((1 << hash_bits) - 1);
+    prev_[pos] = head_[h];
+    head_[h] = pos;
+}
+
+void Deflater::slide() {
+    // the last window stays as history for matches
+    memmove(in_.data(), in_.data() + window_size, window_size);
+    pos_ -= window_size;
+    end_ -= window_size;
+    for (size_t i = 0; i < head_.size(); i++) head_[i] = head_[i] >= window_size ? head_[i] - window_size : -1;
+    for (int i = 0; i < window_size; i++) {
+        int p = prev_[i + window_size];
+        prev_[i] = p >= window_size ? p - window_size : -1;
+    }
+}
+
+void Deflater::compress(bool all) {
+    if (!block_open_) {
+        put_bits(0, 1);  // not final
+        put_bits(1, 2);  // fixed Huffman
+        block_open_ = true;
+    }
+    // without `all`, stop while a longest match could still run past the input
+    int stop = all ? end_ : end_ - max_match - min_match;
+    while (pos_ < stop) {
+        int avail = end_ - pos_;
+        int best_len = 0;
+        int best_dist = 0;
+        if (avail >= min_match) {
+            int limit = std::min(avail, max_match);
+            const unsigned char* cur = &in_[pos_];
+            int chain = max_chain_;
+            for (int cand = head_[((unsigned)cur[0] << 10 ^ (unsigned)cur[1] << 5 ^ cur[2]) & ((1 << hash_bits) - 1)];
+                cand >= 0 && pos_ - cand <= window_size && chain-- > 0; cand = prev_[cand]) {
+                const unsigned char* m = &in_[cand];
+                if (m[best_len] != cur[best_len] || m[0] != cur[0] || m[1] != cur[1]) continue;
+                int len = 2;
+                while (len < limit && m[len] == cur[len]) len++;
+                if (len > best_len) {
+                    best_len = len;
+                    best_dist = pos_ - cand;
+                    if (len == limit) break;
+                }
+            }
+            insert(pos_);
+        }
+        if (best_len >= min_match) {
+            int s = codes.length_symbol[best_len];
+            put_bits(codes.literal[257 + s], codes.literal_bits[257 + s]);
+            put_bits(best_len - length_base[s], length_extra[s]);
+            int k = best_dist - 1;
+            int d = codes.distance_symbol[k < 256 ? k : 256 + (k >> 7)];
+            put_bits(codes.distance[d], 5);
+            put_bits(best_dist - distance_base[d], distance_extra[d]);
+            for (int i = 1; i < best_len; i++) {
+                if (pos_ + i + min_match <= end_) insert(pos_ + i);
+            }
+            pos_ += best_len;
+        }
+        else {
+            put_bits(codes.literal[in_[pos_]], codes.literal_bits[in_[pos_]]);
+            pos_++;
+        }
+    }
+}
+
+void Deflater::stored_block(bool final) {
+    put_bits(final ? 1 : 0, 1);
+    put_bits(0, 2);
+    align();
+    unsigned len = (unsigned)end_;
+    out_.push_back((unsigned char)len);
+    out_.push_back((unsigned char)(len >> 8));
+    out_.push_back((unsigned char)~len);
+    out_.push_back((unsigned char)(~len >> 8));
+    out_.insert(out_.end(), in_.begin(), in_.begin() + end_);
+    end_ = 0;
+}
+
+void Deflater::write(const unsigned char* data, size_t size) {
+    // Adler-32 of the uncompressed stream, reduced before the sums can overflow
+    for (size_t done = 0; done < size;) {
+        size_t n = std::min<size_t>(size - done, 5552);
+        for (size_t i = 0; i < n; i++) {
+            adler_a_ += data[done + i];
+            adler_b_ += adler_a_;
+        }
+        adler_a_ %= 65521;
+        adler_b_ %= 65521;
+        done += n;
+    }
+
+    const int stored_max = 65535;
+    while (size > 0) {
+        if (mode_ == DEFLATE_STORED) {
+            int n = (int)std::min<size_t>(size, stored_max - end_);
+            memcpy(&in_[end_], data, n);
+            end_ += n;
+            data += n;
+            size -= n;
+            if (end_ == stored_max) stored_block(false);
+            continue;
+        }
+        if (end_ == buffer_size) slide();
+        int n = (int)std::min<size_t>(size, buffer_size - end_);
+        memcpy(&in_[end_], data, n);
+        end_ += n;
+        data += n;
+        size -= n;
+        compress(false);
+    }
+}
+
+void Deflater::finish() {
+    if (mode_ == DEFLATE_STORED) {
+        stored_block(true);
+    }
+    else {
+        compress(true);
+        put_bits(codes.literal[256], codes.literal_bits[256]);  // end of the open block
+        // an empty final block, as the end was not known when the last one began
+        put_bits(1, 1);
+        put_bits(1, 2);
+        put_bits(codes.literal[256], codes.literal_bits[256]);
+    }
+    align();
+    unsigned adler = adler_b_ << 16 | adler_a_;
+    for (int shift = 24; shift >= 0; shift -= 8) out_.push_back((unsigned char)(adler >> shift));
+}
@@ -0,0 +1,58 @@
+#ifndef DEFLATE_H
+#define DEFLATE_H
+
+#include <cstddef>
+#include <vector>
+
+enum DeflateMode {
+    DEFLATE_STORED,  // no compression, blocks of up to 64K copied through
+    DEFLATE_FIXED    // LZ77 over a 32K window, fixed Huffman codes
+};
+
+// Streaming zlib (RFC 1950/1951) compressor, without dynamic Huffman
+// blocks. Input is fed in pieces of any size; compressed bytes collect in
+// output(), which the caller drains as it likes. Memory stays at the
+// window, its hash chains and whatever output has not been drained.
+class Deflater {
+private:
+    static constexpr int window_size = 1 << 15;
+    static constexpr int buffer_size = 2 * window_size;  // history, then input not yet compressed
+    static constexpr int hash_bits = 15;
+    static constexpr int min_match = 3;
+    static constexpr int max_match = 258;
+
+    DeflateMode mode_;
+    int max_chain_;
+    std::vector<unsigned char> in_;
+    int pos_;  // next byte of in_ to compress
+    int end_;  // bytes in in_
+    std::vector<int> head_;  // latest position of each hash, -1 for none
+    std::vector<int> prev_;  // earlier position with the same hash
+    bool block_open_;
+    unsigned long long bits_;
+    int nbits_;
+    unsigned adler_a_;
+    unsigned adler_b_;
+    std::vector<unsigned char> out_;
+
+    void put_bits(unsigned value, int n);
+    void align();
+    void insert(int pos);
+    void compress(bool all);
+    void slide();
+    void stored_block(bool final);
+    Deflater(const Deflater&);
+    Deflater& operator =(const Deflater&);
+public:
+    // max_chain bounds the candidates tried per position: longer is
+    // smaller output and slower.
+    explicit Deflater(DeflateMode mode = DEFLATE_FIXED, int max_chain = 8);
+
+    void write(const unsigned char* data, size_t size);
+    // Ends the stream; nothing may be written after.
+    void finish();
+
+    std::vector<unsigned char>& output() { return out_; }
+};
+
+#endif // DEFLATE_H
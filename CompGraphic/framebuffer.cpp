@@ -0,0 +1,130 @@
+#include <algorithm>
+#include <cstdint>
+#include "framebuffer.h"
+#include "profiler.h"
+
+// Planes start on a cache line; the storage is over-allocated by one line.
+static const int plane_alignment = 64;
+
+template <class T>
+static T* align_plane(std::vector<T>& storage, int size) {
+    storage.assign(size + plane_alignment / sizeof(T), T());
+    uintptr_t p = (uintptr_t)storage.data();
+    return (T*)((p + plane_alignment - 1) & ~(uintptr_t)(plane_alignment - 1));
+}
+
+Framebuffer::Framebuffer(int width, int height, int tile_size, FramebufferLayout layout)
+    : width_(width), height_(height), layout_(layout), clear_color_(0),
+    clear_depth_(-std::numeric_limits<float>::max()), frame_(1) {
+    if (tile_size <= 0) tile_size = std::max(width_, height_);
+    tile_shift_ = 4;
+    while ((1 << tile_shift_) < tile_size) tile_shift_++;
+    tile_size_ = 1 << tile_shift_;
+    tiles_x_ = (width_ + tile_size_ - 1) / tile_size_;
+    tiles_y_ = (height_ + tile_size_ - 1) / tile_size_;
+
+    // tiles on the right and bottom edges are padded to full size
+    stride_ = (width_ + 15) & ~15;
+    size_ = layout_ == LAYOUT_LINEAR ? stride_ * height_ : tiles_x_ * tiles_y_ * tile_size_ * tile_size_;
+    color_ = align_plane(color_storage_, size_);
+    depth_ = align_plane(depth_storage_, size_);
+    // frame 0 never comes, so every tile starts out cleared
+    tile_frame_.assign(tiles_x_ * tiles_y_, 0);
+}
+
+void Framebuffer::clear(TGAColor color, float depth) {
+    clear_color_ = color.val;
+    clear_depth_ = depth;
+    frame_++;
+    if (frame_ == 0) {
+        // wrapped: forget every tile rather than mistake one for prepared
+        std::fill(tile_frame_.begin(), tile_frame_.end(), 0u);
+        frame_ = 1;
+    }
+}
+
+void Framebuffer::fill_tile(int tile) {
+    int x0 = (tile % tiles_x_) * tile_size_;
+    int y0 = (tile / tiles_x_) * tile_size_;
+    int x1 = std::min(width_, x0 + tile_size_);
+    int y1 = std::min(height_, y0 + tile_size_);
+    if (layout_ == LAYOUT_TILED) {
+        // the whole block, padding too, in two streaming fills
+        int n = tile_size_ * tile_size_;
+        std::fill(color_ + tile * n, color_ + (tile + 1) * n, clear_color_);
+        std::fill(depth_ + tile * n, depth_ + (tile + 1) * n, clear_depth_);
+    }
+    else {
+        for (int y = y0; y < y1; y++) {
+            int row = row_offset(x0, y);
+            std::fill(color_ + row + x0, color_ + row + x1, clear_color_);
+            std::fill(depth_ + row + x0, depth_ + row + x1, clear_depth_);
+        }
+    }
+    tile_frame_[tile] = frame_;
+}
+
+void Framebuffer::resolve() {
+    for (int tile = 0; tile < ntiles(); tile++) prepare_tile(tile);
+}
+
+long long Framebuffer::covered() const {
+    long long n = 0;
+    for (int tile = 0; tile < ntiles(); tile++) {
+        if (!tile_prepared(tile)) continue;
+        int x0 = (tile % tiles_x_) * tile_size_;
+        int y0 = (tile / tiles_x_) * tile_size_;
+        int x1 = std::min(width_, x0 + tile_size_);
+        int y1 = std::min(height_, y0 + tile_size_);
+        for (int y = y0; y < y1; y++) {
+            const float* row = depth_ + row_offset(x0, y);
+            for (int x = x0; x < x1; x++) n += row[x] != clear_depth_;
+        }
+    }
+    return n;
+}
+
+TGAColor Framebuffer::get(int x, int y) const {
+    if (x < 0 || y < 0 || x >= width_ || y >= height_) return TGAColor();
+    unsigned int val = tile_prepared(tile_at(x, y)) ? color_[index(x, y)] : clear_color_;
+    return TGAColor((int)val, 4);
+}
+
+float Framebuffer::get_depth(int x, int y) const {
+    if (x < 0 || y < 0 || x >= width_ || y >= height_) return clear_depth_;
+    return tile_prepared(tile_at(x, y)) ? depth_[index(x, y)] : clear_depth_;
+}
+
+void Framebuffer::to_image(TGAImage& image) const {
+    PROFILE_SCOPE(STAGE_ENCODE, "to_image");
+    if (image.get_width() != width_ || image.get_height() != height_ || image.get_bytespp() != TGAImage::RGB) {
+        image = TGAImage(width_, height_, TGAImage::RGB);
+    }
+    unsigned char* data = image.buffer();
+    for (int ty = 0; ty < tiles_y_; ty++) {
+        for (int tx = 0; tx < tiles_x_; tx++) {
+            int tile = tx + ty * tiles_x_;
+            bool prepared = tile_prepared(tile);
+            int x0 = tx * tile_size_;
+            int y0 = ty * tile_size_;
+            int x1 = std::min(width_, x0 + tile_size_);
+            int y1 = std::min(height_, y0 + tile_size_);
+            for (int y = y0; y < y1; y++) {
+                const unsigned int* src = color_ + row_offset(x0, y);
+                unsigned char* p = data + (x0 + y * width_) * 3;
+                for (int x = x0; x < x1; x++, p += 3) {
+                    unsigned int c = prepared ? src[x] : clear_color_;
+                    p[0] = (unsigned char)c;
+                    p[1] = (unsigned char)(c >> 8);
+                    p[2] = (unsigned char)(c >> 16);
+                }
+            }
+        }
+    }
+}
+
+bool Framebuffer::write_tga_file(const char* filename, bool rle) const {
+    TGAImage image;
+    to_image(image);
+    return image.write_tga_file(filename, rle);
+}
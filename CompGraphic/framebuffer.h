@@ -0,0 +1,101 @@
+#ifndef FRAMEBUFFER_H
+#define FRAMEBUFFER_H
+
+#include <vector>
+#include <limits>
+#include "tgaimage.h"
+
+enum FramebufferLayout {
+    LAYOUT_LINEAR,  // whole rows of the image, each padded to a multiple of 16 pixels
+    LAYOUT_TILED    // tile after tile, the rows of a tile next to each other
+};
+
+// Color and depth target of the rasterizer: a plane of 32-bit colors as in
+// TGAColor::val and a plane of float depths, both 64-byte aligned. The
+// image is split into square tiles whose size is a power of two. Rows are
+// padded so that no cache line is shared by two tiles; LAYOUT_TILED goes
+// further and makes each tile one contiguous block of both planes. Linear
+// is the default, as it measured slightly faster with --bench framebuffer.
+//
+// Clearing is lazy. clear() only records the clear values and starts a new
+// frame; a tile is filled with them the first time prepare_tile() is called
+// for it in that frame, and tiles nobody prepared read as cleared without
+// ever being written. The planes are allocated once and reused by every
+// frame. TGAImage only comes in when the frame is written out.
+class Framebuffer {
+private:
+    int width_;
+    int height_;
+    int tile_size_;
+    int tile_shift_;
+    int tiles_x_;
+    int tiles_y_;
+    FramebufferLayout layout_;
+    int stride_;  // LAYOUT_LINEAR: pixels from one row to the next
+    int size_;    // entries per plane, padding included
+    std::vector<unsigned int> color_storage_;
+    std::vector<float> depth_storage_;
+    unsigned int* color_;
+    float* depth_;
+    unsigned int clear_color_;
+    float clear_depth_;
+    unsigned int frame_;
+    std::vector<unsigned int> tile_frame_;  // frame each tile was last filled in
+
+    void fill_tile(int tile);
+public:
+    // tile_size is rounded up to a power of two, at least 16 so that a tile
+    // row fills whole cache lines; <= 0 makes one tile of the whole image.
+    Framebuffer(int width, int height, int tile_size = 64, FramebufferLayout layout = LAYOUT_LINEAR);
+
+    // Plane index of pixel (x, y).
+    int index(int x, int y) const {
+        if (layout_ == LAYOUT_LINEAR) return x + y * stride_;
+        int mask = tile_size_ - 1;
+        int tile = (x >> tile_shift_) + (y >> tile_shift_) * tiles_x_;
+        return (tile << (2 * tile_shift_)) + ((y & mask) << tile_shift_) + (x & mask);
+    }
+    // Row y of the tile holding x: pixel (x', y) of that tile is at
+    // row_offset(x, y) + x', so a row is walked without a lookup per pixel.
+    int row_offset(int x, int y) const { return index(x, y) - x; }
+    int tile_at(int x, int y) const { return (x >> tile_shift_) + (y >> tile_shift_) * tiles_x_; }
+
+    // Starts a new frame; constant time, no pixel is written.
+    void clear(TGAColor color = TGAColor(0, 0, 0, 0), float depth = -std::numeric_limits<float>::max());
+    // Fills the tile with the clear values unless it already was this
+    // frame. Different tiles may be prepared at once.
+    void prepare_tile(int tile) {
+        if (tile_frame_[tile] != frame_) fill_tile(tile);
+    }
+    bool tile_prepared(int tile) const { return tile_frame_[tile] == frame_; }
+    // Prepares every tile, before the planes are used directly.
+    void resolve();
+    // Pixels whose depth differs from the clear depth, i.e. drawn this frame.
+    long long covered() const;
+
+    // Pixel (x, y), the clear values in tiles not prepared yet.
+    TGAColor get(int x, int y) const;
+    float get_depth(int x, int y) const;
+
+    // The planes, valid in prepared tiles only.
+    unsigned int* color() { return color_; }
+    float* depth() { return depth_; }
+    const unsigned int* color() const { return color_; }
+    const float* depth() const { return depth_; }
+
+    // Color plane as an RGB image of the same size; image is reallocated
+    // only when its size or format differ.
+    void to_image(TGAImage& image) const;
+    bool write_tga_file(const char* filename, bool rle = true) const;
+
+    int get_width() const { return width_; }
+    int get_height() const { return height_; }
+    int get_tile_size() const { return tile_size_; }
+    int tiles_x() const { return tiles_x_; }
+    int tiles_y() const { return tiles_y_; }
+    int ntiles() const { return tiles_x_ * tiles_y_; }
+    int size() const { return size_; }
+    FramebufferLayout get_layout() const { return layout_; }
+};
+
+#endif // FRAMEBUFFER_H
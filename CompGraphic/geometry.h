@@ -111,10 +111,23 @@ template <class t> struct Vec3 {
     }
 };
 
+// Homogeneous point, as it comes out of a projection before the divide.
+template <class t> struct Vec4 {
+    t x, y, z, w;
+
+    Vec4() : x(t()), y(t()), z(t()), w(t()) {}
+    Vec4(t _x, t _y, t _z, t _w) : x(_x), y(_y), z(_z), w(_w) {}
+
+    Vec4<t> operator +(const Vec4<t>& v) const { return Vec4<t>(x + v.x, y + v.y, z + v.z, w + v.w); }
+    Vec4<t> operator -(const Vec4<t>& v) const { return Vec4<t>(x - v.x, y - v.y, z - v.z, w - v.w); }
+    Vec4<t> operator *(float f) const { return Vec4<t>(x * f, y * f, z * f, w * f); }
+};
+
 typedef Vec2<float> Vec2f;
 typedef Vec2<int>   Vec2i;
 typedef Vec3<float> Vec3f;
 typedef Vec3<int>   Vec3i;
+typedef Vec4<float> Vec4f;
 
 template <class t>
 std::ostream& operator<<(std::ostream& s, const Vec2<t>& v) {
@@ -128,17 +141,137 @@ std::ostream& operator<<(std::ostream& s, const Vec3<t>& v) {
     return s;
 }
 
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#define GEOMETRY_SSE 1
+#include <xmmintrin.h>
+#endif
+
+// Fixed-size matrix with inline, row-major storage: no heap traffic, usable in
+// constant expressions. 4x4 float products have an SSE kernel below.
+template <int R, int C, class T> struct Mat {
+    alignas(16) T m[R][C];
+
+    constexpr Mat() : m{} {}
+
+    static constexpr Mat identity() {
+        Mat E;
+        for (int i = 0; i < R && i < C; i++) {
+            E.m[i][i] = T(1);
+        }
+        return E;
+    }
+
+    constexpr int nrows() const { return R; }
+    constexpr int ncols() const { return C; }
+
+    T* operator[](const int i) {
+        assert(i >= 0 && i < R);
+        return m[i];
+    }
+
+    constexpr const T* operator[](const int i) const {
+        return m[i];
+    }
+
+    constexpr Mat<C, R, T> transpose() const {
+        Mat<C, R, T> result;
+        for (int i = 0; i < R; i++) {
+            for (int j = 0; j < C; j++) {
+                result.m[j][i] = m[i][j];
+            }
+        }
+        return result;
+    }
+};
+
+typedef Mat<4, 4, float> Mat4f;
+
+template <int R, int K, int C, class T>
+constexpr Mat<R, C, T> operator*(const Mat<R, K, T>& a, const Mat<K, C, T>& b) {
+    Mat<R, C, T> result;
+    for (int i = 0; i < R; i++) {
+        for (int j = 0; j < C; j++) {
+            T sum = T(0);
+            for (int k = 0; k < K; k++) {
+                sum += a.m[i][k] * b.m[k][j];
+            }
+            result.m[i][j] = sum;
+        }
+    }
+    return result;
+}
+
+// Each result row is a combination of the rows of b, accumulated in the same
+// order as the generic loop.
+inline Mat4f operator*(const Mat4f& a, const Mat4f& b) {
+    Mat4f result;
+#ifdef GEOMETRY_SSE
+    __m128 b0 = _mm_load_ps(b.m[0]);
+    __m128 b1 = _mm_load_ps(b.m[1]);
+    __m128 b2 = _mm_load_ps(b.m[2]);
+    __m128 b3 = _mm_load_ps(b.m[3]);
+    for (int i = 0; i < 4; i++) {
+        __m128 r = _mm_mul_ps(_mm_set1_ps(a.m[i][0]), b0);
+        r = _mm_add_ps(r, _mm_mul_ps(_mm_set1_ps(a.m[i][1]), b1));
+        r = _mm_add_ps(r, _mm_mul_ps(_mm_set1_ps(a.m[i][2]), b2));
+        r = _mm_add_ps(r, _mm_mul_ps(_mm_set1_ps(a.m[i][3]), b3));
+        _mm_store_ps(result.m[i], r);
+    }
+#else
+    for (int i = 0; i < 4; i++) {
+        for (int j = 0; j < 4; j++) {
+            result.m[i][j] = a.m[i][0] * b.m[0][j] + a.m[i][1] * b.m[1][j] + a.m[i][2] * b.m[2][j] + a.m[i][3] * b.m[3][j];
+        }
+    }
+#endif
+    return result;
+}
+
+// Transforms a point (w = 1) and divides by the resulting w when it is non-zero.
+template <class T>
+Vec3<T> operator*(const Mat<4, 4, T>& a, const Vec3<T>& v) {
+    T x = a.m[0][0] * v.x + a.m[0][1] * v.y + a.m[0][2] * v.z + a.m[0][3];
+    T y = a.m[1][0] * v.x + a.m[1][1] * v.y + a.m[1][2] * v.z + a.m[1][3];
+    T z = a.m[2][0] * v.x + a.m[2][1] * v.y + a.m[2][2] * v.z + a.m[2][3];
+    T w = a.m[3][0] * v.x + a.m[3][1] * v.y + a.m[3][2] * v.z + a.m[3][3];
+
+    if (w != T(0)) {
+        x /= w;
+        y /= w;
+        z /= w;
+    }
+
+    return Vec3<T>(x, y, z);
+}
+
+template <int R, int C, class T>
+std::ostream& operator<<(std::ostream& s, const Mat<R, C, T>& m) {
+    for (int i = 0; i < R; i++) {
+        for (int j = 0; j < C; j++) {
+            s << m.m[i][j] << "\t";
+        }
+        s << "\n";
+    }
+    return s;
+}
+
+// Compatibility wrapper keeping the old run-time sized interface (up to 4x4)
+// on top of inline storage. New code should use Mat<R, C, T> directly.
 class Matrix {
 private:
-    std::vector<std::vector<float> > m;
+    Mat4f m;
     int rows, cols;
 
 public:
-    Matrix(int r = 4, int c = 4) : rows(r), cols(c) {
-        m.resize(rows);
-        for (int i = 0; i < rows; i++) {
-            m[i].resize(cols, 0);
-        }
+    Matrix(int r = 4, int c = 4) : m(), rows(r), cols(c) {
+        assert(r > 0 && r <= 4 && c > 0 && c <= 4);
+    }
+
+    Matrix(const Mat4f& a) : m(a), rows(4), cols(4) {}
+
+    operator Mat4f() const {
+        assert(rows == 4 && cols == 4);
+        return m;
     }
 
     static Matrix identity(int dimensions) {
@@ -152,53 +285,31 @@ public:
     int nrows() const { return rows; }
     int ncols() const { return cols; }
 
-    std::vector<float>& operator[](const int i) {
+    float* operator[](const int i) {
         assert(i >= 0 && i < rows);
-        return m[i];
+        return m.m[i];
     }
 
-    const std::vector<float>& operator[](const int i) const {
+    const float* operator[](const int i) const {
         assert(i >= 0 && i < rows);
-        return m[i];
+        return m.m[i];
     }
 
     Matrix operator*(const Matrix& a) const {
         assert(cols == a.rows);
         Matrix result(rows, a.cols);
-        for (int i = 0; i < rows; i++) {
-            for (int j = 0; j < a.cols; j++) {
-                result.m[i][j] = 0.0f;
-                for (int k = 0; k < cols; k++) {
-                    result.m[i][j] += m[i][k] * a.m[k][j];
-                }
-            }
-        }
+        result.m = m * a.m; // unused rows/columns are zero, so the 4x4 product is exact
         return result;
     }
 
     Vec3f operator*(const Vec3f& v) const {
         assert(rows == 4 && cols == 4);
-        float x = m[0][0] * v.x + m[0][1] * v.y + m[0][2] * v.z + m[0][3];
-        float y = m[1][0] * v.x + m[1][1] * v.y + m[1][2] * v.z + m[1][3];
-        float z = m[2][0] * v.x + m[2][1] * v.y + m[2][2] * v.z + m[2][3];
-        float w = m[3][0] * v.x + m[3][1] * v.y + m[3][2] * v.z + m[3][3];
-
-        if (w != 0.0f) {
-            x /= w;
-            y /= w;
-            z /= w;
-        }
-
-        return Vec3f(x, y, z);
+        return m * v;
     }
 
     Matrix transpose() const {
         Matrix result(cols, rows);
-        for (int i = 0; i < rows; i++) {
-            for (int j = 0; j < cols; j++) {
-                result[j][i] = m[i][j];
-            }
-        }
+        result.m = m.transpose();
         return result;
     }
 
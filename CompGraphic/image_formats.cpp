@@ -0,0 +1,272 @@
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <vector>
+#include "image_formats.h"
+#include "profiler.h"
+
+static const char* format_names[] = { "tga", "ppm", "pam", "png" };
+
+ImageFormat image_format_for(const std::string& filename) {
+    size_t dot = filename.find_last_of('.');
+    if (dot == std::string::npos) return IMAGE_TGA;
+    std::string ext = filename.substr(dot + 1);
+    for (size_t i = 0; i < ext.size(); i++) ext[i] = (char)tolower((unsigned char)ext[i]);
+    ImageFormat format;
+    if (ext == "pgm") return IMAGE_PPM;
+    return parse_image_format(ext, format) ? format : IMAGE_TGA;
+}
+
+const char* image_format_extension(ImageFormat format) {
+    return format_names[format];
+}
+
+bool parse_image_format(const std::string& name, ImageFormat& format) {
+    for (int f = 0; f < 4; f++) {
+        if (name == format_names[f]) {
+            format = (ImageFormat)f;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Row y in RGB(A) order; grayscale rows are copied as they are.
+static void rgb_row(TGAImage& image, int y, int channels, unsigned char* row) {
+    int bytespp = image.get_bytespp();
+    const unsigned char* src = image.buffer() + (size_t)y * image.get_width() * bytespp;
+    int width = image.get_width();
+    if (bytespp == TGAImage::GRAYSCALE) {
+        std::copy(src, src + width, row);
+        return;
+    }
+    // one loop per layout, so each compiles to plain byte shuffles
+    if (channels == 4) {
+        for (int x = 0; x < width; x++, src += 4, row += 4) {
+            unsigned char b = src[0], g = src[1], r = src[2], a = src[3];
+            row[0] = r;
+            row[1] = g;
+            row[2] = b;
+            row[3] = a;
+        }
+    }
+    else {
+        for (int x = 0; x < width; x++, src += bytespp, row += 3) {
+            unsigned char b = src[0], g = src[1], r = src[2];
+            row[0] = r;
+            row[1] = g;
+            row[2] = b;
+        }
+    }
+}
+
+static bool write_netpbm(TGAImage& image, std::ostream& out, bool pam) {
+    if (!image.buffer()) return false;
+    int width = image.get_width();
+    int height = image.get_height();
+    int bytespp = image.get_bytespp();
+    int channels = bytespp == TGAImage::RGBA && !pam ? 3 : bytespp;
+    char header[128];
+    if (pam) {
+        const char* tuple = bytespp == TGAImage::GRAYSCALE ? "GRAYSCALE" : bytespp == TGAImage::RGBA ? "RGB_ALPHA" : "RGB";
+        snprintf(header, sizeof(header), "P7\nWIDTH %d\nHEIGHT %d\nDEPTH %d\nMAXVAL 255\nTUPLTYPE %s\nENDHDR\n",
+            width, height, channels, tuple);
+    }
+    else {
+        snprintf(header, sizeof(header), "P%c\n%d %d\n255\n", bytespp == TGAImage::GRAYSCALE ? '5' : '6', width, height);
+    }
+    out << header;
+    // a few rows per write; a filebuf passes anything over 1K straight to
+    // the system, so single rows would cost a call each
+    size_t row_size = (size_t)width * channels;
+    int block_rows = std::max(1, (int)((1 << 16) / std::max<size_t>(row_size, 1)));
+    std::vector<unsigned char> block(row_size * block_rows);
+    for (int y = 0; y < height; y += block_rows) {
+        int rows = std::min(block_rows, height - y);
+        for (int r = 0; r < rows; r++) rgb_row(image, y + r, channels, &block[r * row_size]);
+        out.write((const char*)block.data(), row_size * rows);
+    }
+    return out.good();
+}
+
+bool write_ppm(TGAImage& image, std::ostream& out) {
+    PROFILE_SCOPE(STAGE_ENCODE, "encode ppm");
+    return write_netpbm(image, out, false);
+}
+
+bool write_pam(TGAImage& image, std::ostream& out) {
+    PROFILE_SCOPE(STAGE_ENCODE, "encode pam");
+    return write_netpbm(image, out, true);
+}
+
+// CRC-32 of PNG chunks, four bytes per step: entry[k][n] is the CRC of
+// byte n followed by k zero bytes. Built at startup.
+static const struct CrcTable {
+    unsigned entry[4][256];
+
+    CrcTable() {
+        for (unsigned n = 0; n < 256; n++) {
+            unsigned c = n;
+            for (int k = 0; k < 8; k++) c = c & 1 ? 0xedb88320u ^ (c >> 1) : c >> 1;
+            entry[0][n] = c;
+        }
+        for (unsigned n = 0; n < 256; n++) {
+            for (int k = 1; k < 4; k++) entry[k][n] = entry[0][entry[k - 1][n] & 0xff] ^ (entry[k - 1][n] >> 8);
+        }
+    }
+} crc_table;
+
+static unsigned update_crc(unsigned crc, const unsigned char* data, size_t size) {
+    const unsigned (*t)[256] = crc_table.entry;
+    for (; size >= 4; size -= 4, data += 4) {
+        crc ^= (unsigned)data[0] | (unsigned)data[1] << 8 | (unsigned)data[2] << 16 | (unsigned)data[3] << 24;
+        crc = t[3][crc & 0xff] ^ t[2][(crc >> 8) & 0xff] ^ t[1][(crc >> 16) & 0xff] ^ t[0][crc >> 24];
+    }
+    for (; size > 0; size--) crc = t[0][(crc ^ *data++) & 0xff] ^ (crc >> 8);
+    return crc;
+}
+
+static void put_u32(unsigned char* p, unsigned v) {
+    p[0] = (unsigned char)(v >> 24);
+    p[1] = (unsigned char)(v >> 16);
+    p[2] = (unsigned char)(v >> 8);
+    p[3] = (unsigned char)v;
+}
+
+static void write_chunk(std::ostream& out, const char* type, const unsigned char* data, size_t size) {
+    unsigned char head[8];
+    put_u32(head, (unsigned)size);
+    std::copy(type, type + 4, head + 4);
+    unsigned crc = update_crc(0xffffffffu, head + 4, 4);
+    if (size) crc = update_crc(crc, data, size);
+    unsigned char tail[4];
+    put_u32(tail, crc ^ 0xffffffffu);
+    out.write((const char*)head, 8);
+    if (size) out.write((const char*)data, size);
+    out.write((const char*)tail, 4);
+}
+
+static int paeth(int a, int b, int c) {
+    int p = a + b - c;
+    int pa = abs(p - a), pb = abs(p - b), pc = abs(p - c);
+    if (pa <= pb && pa <= pc) return a;
+    return pb <= pc ? b : c;
+}
+
+// Fills the five filtered versions of row (filter type byte first) and
+// returns the type whose bytes, taken as signed, have the smallest sum.
+static int filter_row(const unsigned char* row, const unsigned char* prev, int size, int bpp,
+    std::vector<unsigned char>* filtered) {
+    unsigned char* none = filtered[0].data() + 1;
+    unsigned char* sub = filtered[1].data() + 1;
+    unsigned char* up = filtered[2].data() + 1;
+    unsigned char* avg = filtered[3].data() + 1;
+    unsigned char* pth = filtered[4].data() + 1;
+    // the first pixel has no left neighbour
+    for (int i = 0; i < bpp && i < size; i++) {
+        none[i] = row[i];
+        sub[i] = row[i];
+        up[i] = (unsigned char)(row[i] - prev[i]);
+        avg[i] = (unsigned char)(row[i] - (prev[i] >> 1));
+        pth[i] = (unsigned char)(row[i] - prev[i]);
+    }
+    for (int i = bpp; i < size; i++) {
+        int a = row[i - bpp];
+        int b = prev[i];
+        int c = prev[i - bpp];
+        none[i] = row[i];
+        sub[i] = (unsigned char)(row[i] - a);
+        up[i] = (unsigned char)(row[i] - b);
+        avg[i] = (unsigned char)(row[i] - ((a + b) >> 1));
+        pth[i] = (unsigned char)(row[i] - paeth(a, b, c));
+    }
+
+    long long best_sum = -1;
+    int best = 0;
+    for (int type = 0; type < 5; type++) {
+        const unsigned char* v = filtered[type].data() + 1;
+        long long sum = 0;
+        for (int i = 0; i < size; i++) sum += v[i] < 128 ? v[i] : 256 - v[i];
+        if (best_sum < 0 || sum < best_sum) {
+            best_sum = sum;
+            best = type;
+        }
+    }
+    filtered[best][0] = (unsigned char)best;
+    return best;
+}
+
+bool write_png(TGAImage& image, std::ostream& out, DeflateMode mode) {
+    PROFILE_SCOPE(STAGE_ENCODE, "encode png");
+    if (!image.buffer()) return false;
+    int width = image.get_width();
+    int height = image.get_height();
+    int channels = image.get_bytespp();
+    int row_size = width * channels;
+
+    static const unsigned char signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+    out.write((const char*)signature, 8);
+    unsigned char ihdr[13];
+    put_u32(ihdr, width);
+    put_u32(ihdr + 4, height);
+    ihdr[8] = 8;  // bits per channel
+    ihdr[9] = channels == TGAImage::GRAYSCALE ? 0 : channels == TGAImage::RGBA ? 6 : 2;
+    ihdr[10] = 0;  // deflate
+    ihdr[11] = 0;  // adaptive filtering
+    ihdr[12] = 0;  // not interlaced
+    write_chunk(out, "IHDR", ihdr, sizeof(ihdr));
+
+    const size_t idat_size = 1 << 16;
+    Deflater deflater(mode);
+    std::vector<unsigned char> row(row_size), prev(row_size, 0);
+    std::vector<unsigned char> filtered[5];
+    for (int type = 0; type < 5; type++) filtered[type].resize(row_size + 1);
+    for (int y = 0; y < height; y++) {
+        rgb_row(image, y, channels, row.data());
+        int type = 0;
+        if (mode == DEFLATE_STORED) {
+            filtered[0][0] = 0;
+            std::copy(row.begin(), row.end(), filtered[0].begin() + 1);
+        }
+        else {
+            type = filter_row(row.data(), prev.data(), row_size, channels, filtered);
+        }
+        deflater.write(filtered[type].data(), row_size + 1);
+        row.swap(prev);
+
+        std::vector<unsigned char>& z = deflater.output();
+        if (z.size() >= idat_size) {
+            write_chunk(out, "IDAT", z.data(), z.size());
+            z.clear();
+        }
+    }
+    deflater.finish();
+    std::vector<unsigned char>& z = deflater.output();
+    write_chunk(out, "IDAT", z.data(), z.size());
+    write_chunk(out, "IEND", nullptr, 0);
+    return out.good();
+}
+
+bool write_image(TGAImage& image, const char* filename, ImageFormat format, bool compress) {
+    if (format == IMAGE_TGA) return image.write_tga_file(filename, compress);
+
+    std::ofstream out;
+    out.open(filename, std::ios::binary);
+    if (!out.is_open()) {
+        std::cerr << "can't open file " << filename << "\n";
+        return false;
+    }
+    bool ok;
+    if (format == IMAGE_PPM) ok = write_ppm(image, out);
+    else if (format == IMAGE_PAM) ok = write_pam(image, out);
+    else ok = write_png(image, out, compress ? DEFLATE_FIXED : DEFLATE_STORED);
+    out.close();
+    if (!ok || out.fail()) {
+        std::cerr << "can't write " << filename << "\n";
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,38 @@
+#ifndef IMAGE_FORMATS_H
+#define IMAGE_FORMATS_H
+
+#include <ostream>
+#include <string>
+#include "tgaimage.h"
+#include "deflate.h"
+
+enum ImageFormat {
+    IMAGE_TGA,  // TGAImage::write_tga_file, RLE unless told otherwise
+    IMAGE_PPM,  // binary PPM (P6), or PGM (P5) for grayscale; alpha is dropped
+    IMAGE_PAM,  // PAM (P7) with the image's own channels
+    IMAGE_PNG   // 8 bits per channel, zlib from Deflater
+};
+
+// By the extension of filename, case-insensitive; IMAGE_TGA for anything
+// unknown.
+ImageFormat image_format_for(const std::string& filename);
+const char* image_format_extension(ImageFormat format);
+// "tga", "ppm", "pam" or "png"; false for anything else.
+bool parse_image_format(const std::string& name, ImageFormat& format);
+
+// The writers below stream the image one row at a time, straight from
+// TGAImage::buffer() with the channels swapped to RGB order, top row first
+// as in the TGA files. None of them holds more than 64K of rows besides
+// the stream's own buffer.
+bool write_ppm(TGAImage& image, std::ostream& out);
+bool write_pam(TGAImage& image, std::ostream& out);
+// Every row is filtered with whichever PNG filter gives the smallest sum
+// of absolute differences, then compressed; IDAT chunks go out whenever
+// 64K of compressed data have collected. DEFLATE_STORED skips filtering.
+bool write_png(TGAImage& image, std::ostream& out, DeflateMode mode = DEFLATE_FIXED);
+
+// Writes image in format. compress selects TGA RLE and PNG fixed Huffman
+// over raw TGA and stored PNG; PPM and PAM are never compressed.
+bool write_image(TGAImage& image, const char* filename, ImageFormat format, bool compress = true);
+
+#endif // IMAGE_FORMATS_H
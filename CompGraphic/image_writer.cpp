@@ -0,0 +1,95 @@
+#include <algorithm>
+#include "image_writer.h"
+#include "image_formats.h"
+
+ImageWriter::ImageWriter(int threads, int capacity, bool compress)
+    : capacity_(std::max(1, capacity)), compress_(compress), stop_(false), written_(0), failed_(0), stalls_(0) {
+    for (int i = 0; i < threads; i++) {
+        threads_.emplace_back(&ImageWriter::thread_loop, this);
+    }
+}
+
+ImageWriter::~ImageWriter() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_ = true;
+    }
+    ready_.notify_all();
+    // the threads drain the queue before they exit
+    for (size_t i = 0; i < threads_.size(); i++) threads_[i].join();
+}
+
+void ImageWriter::write_slot(Slot* slot) {
+    bool saved = write_image(slot->image, slot->filename.c_str(), image_format_for(slot->filename), compress_);
+    if (saved) written_++;
+    else failed_++;
+    if (slot->done) slot->done(slot->filename, saved);
+}
+
+void ImageWriter::write(const Framebuffer& framebuffer, const std::string& filename, const WriteCallback& done) {
+    if (threads_.empty()) {
+        Slot slot;
+        framebuffer.to_image(slot.image);
+        slot.filename = filename;
+        slot.done = done;
+        write_slot(&slot);
+        return;
+    }
+
+    Slot* slot;
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        if (free_slots_.empty() && (int)slots_.size() < capacity_) {
+            slots_.emplace_back(new Slot());
+            free_slots_.push_back(slots_.back().get());
+        }
+        if (free_slots_.empty()) {
+            stalls_++;
+            slot_freed_.wait(lock, [&] { return !free_slots_.empty(); });
+        }
+        slot = free_slots_.back();
+        free_slots_.pop_back();
+    }
+    // the copy is the only part the renderer waits for
+    framebuffer.to_image(slot->image);
+    slot->filename = filename;
+    slot->done = done;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        queue_.push_back(slot);
+    }
+    ready_.notify_one();
+}
+
+void ImageWriter::thread_loop() {
+    for (;;) {
+        Slot* slot;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            ready_.wait(lock, [&] { return stop_ || !queue_.empty(); });
+            if (queue_.empty()) return;
+            slot = queue_.front();
+            queue_.pop_front();
+        }
+        write_slot(slot);
+        slot->done = WriteCallback();
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            free_slots_.push_back(slot);
+        }
+        slot_freed_.notify_all();
+    }
+}
+
+bool ImageWriter::finish() {
+    if (!threads_.empty()) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        slot_freed_.wait(lock, [&] { return free_slots_.size() == slots_.size(); });
+    }
+    return failed_ == 0;
+}
+
+int ImageWriter::images_allocated() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return (int)slots_.size();
+}
@@ -0,0 +1,70 @@
+#ifndef IMAGE_WRITER_H
+#define IMAGE_WRITER_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "framebuffer.h"
+#include "tgaimage.h"
+
+// Called once per image after it was written, or failed to be, from the
+// thread that wrote it.
+typedef std::function<void(const std::string& filename, bool saved)> WriteCallback;
+
+// Writes finished frames on background threads, in the format the file
+// name's extension asks for, so encoding and I/O of one view overlap with
+// rendering the next. write() copies the framebuffer into one of at most
+// `capacity` images and returns; when all of them are still waiting to be
+// written it blocks until one is free, which bounds memory however far
+// rendering runs ahead. The images are reused from frame to frame.
+class ImageWriter {
+private:
+    struct Slot {
+        TGAImage image;
+        std::string filename;
+        WriteCallback done;
+    };
+
+    int capacity_;
+    bool compress_;
+    std::vector<std::thread> threads_;
+    std::mutex mutex_;
+    std::condition_variable ready_;       // queue_ got an image, or stop_
+    std::condition_variable slot_freed_;  // a slot came back
+    std::vector<std::unique_ptr<Slot> > slots_;
+    std::vector<Slot*> free_slots_;
+    std::deque<Slot*> queue_;
+    bool stop_;
+    std::atomic<long long> written_;
+    std::atomic<long long> failed_;
+    std::atomic<long long> stalls_;
+
+    void thread_loop();
+    void write_slot(Slot* slot);
+    ImageWriter(const ImageWriter&);
+    ImageWriter& operator =(const ImageWriter&);
+public:
+    // threads == 0 writes in the calling thread, like a plain
+    // write_image; capacity is then unused. compress as in write_image.
+    explicit ImageWriter(int threads = 1, int capacity = 4, bool compress = true);
+    // Writes everything still queued.
+    ~ImageWriter();
+
+    // Safe to call from several rendering threads at once.
+    void write(const Framebuffer& framebuffer, const std::string& filename, const WriteCallback& done = WriteCallback());
+    // Blocks until every image handed to write() is on disk; false if any failed.
+    bool finish();
+
+    long long written() const { return written_; }
+    long long failed() const { return failed_; }
+    long long stalls() const { return stalls_; }  // write() calls that waited for a free image
+    int images_allocated();
+};
+
+#endif // IMAGE_WRITER_H
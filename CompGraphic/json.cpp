@@ -0,0 +1,262 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include "json.h"
+
+const JsonValue* JsonValue::get(const char* key) const {
+    if (type != JSON_OBJECT) return nullptr;
+    for (size_t i = 0; i < members.size(); i++) {
+        if (members[i].first == key) return &members[i].second;
+    }
+    return nullptr;
+}
+
+namespace {
+
+// Recursive descent over the whole text; nesting is limited so a hostile
+// line cannot run the stack out.
+class JsonParser {
+private:
+    const char* p_;
+    const char* begin_;
+    const char* end_;
+    std::string error_;
+    static const int max_depth = 64;
+
+    bool fail(const char* what) {
+        if (error_.empty()) error_ = std::string(what) + " at offset " + std::to_string(p_ - begin_);
+        return false;
+    }
+    void skip_space() {
+        while (p_ < end_ && (*p_ == ' ' || *p_ == '\t' || *p_ == '\n' || *p_ == '\r')) p_++;
+    }
+    bool literal(const char* word) {
+        size_t n = strlen(word);
+        if ((size_t)(end_ - p_) < n || memcmp(p_, word, n) != 0) return fail("bad literal");
+        p_ += n;
+        return true;
+    }
+    bool hex4(unsigned& code) {
+        if (end_ - p_ < 4) return fail("short \\u escape");
+        code = 0;
+        for (int i = 0; i < 4; i++) {
+            char c = *p_++;
+            code <<= 4;
+            if (c >= '0' && c <= '9') code |= c - '0';
+            else if (c >= 'a' && c <= 'f') code |= c - 'a' + 10;
+            else if (c >= 'A' && c <= 'F') code |= c - 'A' + 10;
+            else return fail("bad \\u escape");
+        }
+        return true;
+    }
+    static void put_utf8(std::string& out, unsigned code) {
+        if (code < 0x80) {
+            out += (char)code;
+        }
+        else if (code < 0x800) {
+            out += (char)(0xc0 | (code >> 6));
+            out += (char)(0x80 | (code & 0x3f));
+        }
+        else if (code < 0x10000) {
+            out += (char)(0xe0 | (code >> 12));
+            out += (char)(0x80 | ((code >> 6) & 0x3f));
+            out += (char)(0x80 | (code & 0x3f));
+        }
+        else {
+            out += (char)(0xf0 | (code >> 18));
+            out += (char)(0x80 | ((code >> 12) & 0x3f));
+            out += (char)(0x80 | ((code >> 6) & 0x3f));
+            out += (char)(0x80 | (code & 0x3f));
+        }
+    }
+    bool string(std::string& out) {
+        p_++;  // opening quote
+        while (p_ < end_ && *p_ != '"') {
+            char c = *p_++;
+            if ((unsigned char)c < 0x20) return fail("control character in string");
+            if (c != '\\') {
+                out += c;
+                continue;
+            }
+            if (p_ >= end_) break;
+            c = *p_++;
+            switch (c) {
+            case '"': out += '"'; break;
+            case '\\': out += '\\'; break;
+            case '/': out += '/'; break;
+            case 'b': out += '\b'; break;
+            case 'f': out += '\f'; break;
+            case 'n': out += '\n'; break;
+            case 'r': out += '\r'; break;
+            case 't': out += '\t'; break;
+            case 'u': {
+                unsigned code = 0;
+                if (!hex4(code)) return false;
+                if (code >= 0xd800 && code < 0xdc00 && end_ - p_ >= 6 && p_[0] == '\\' && p_[1] == 'u') {
+                    p_ += 2;
+                    unsigned low = 0;
+                    if (!hex4(low)) return false;
+                    code = 0x10000 + ((code - 0xd800) << 10) + (low - 0xdc00);
+                }
+                put_utf8(out, code);
+                break;
+            }
+            default:
+                return fail("bad escape");
+            }
+        }
+        if (p_ >= end_) return fail("unterminated string");
+        p_++;
+        return true;
+    }
+    bool number(double& out) {
+        const char* start = p_;
+        if (p_ < end_ && *p_ == '-') p_++;
+        while (p_ < end_ && ((*p_ >= '0' && *p_ <= '9') || *p_ == '.' || *p_ == 'e' || *p_ == 'E'
+            || *p_ == '+' || *p_ == '-')) p_++;
+        std::string text(start, p_);
+        char* stop;
+        out = strtod(text.c_str(), &stop);
+        if (text.empty() || *stop) return fail("bad number");
+        return true;
+    }
+    bool value(JsonValue& out, int depth) {
+        if (depth > max_depth) return fail("nested too deep");
+        skip_space();
+        if (p_ >= end_) return fail("unexpected end");
+        switch (*p_) {
+        case 'n':
+            out.type = JsonValue::JSON_NULL;
+            return literal("null");
+        case 't':
+            out.type = JsonValue::JSON_BOOL;
+            out.boolean = true;
+            return literal("true");
+        case 'f':
+            out.type = JsonValue::JSON_BOOL;
+            out.boolean = false;
+            return literal("false");
+        case '"':
+            out.type = JsonValue::JSON_STRING;
+            return string(out.string);
+        case '[':
+            out.type = JsonValue::JSON_ARRAY;
+            p_++;
+            skip_space();
+            if (p_ < end_ && *p_ == ']') {
+                p_++;
+                return true;
+            }
+            for (;;) {
+                out.items.push_back(JsonValue());
+                if (!value(out.items.back(), depth + 1)) return false;
+                skip_space();
+                if (p_ < end_ && *p_ == ',') {
+                    p_++;
+                    continue;
+                }
+                if (p_ < end_ && *p_ == ']') {
+                    p_++;
+                    return true;
+                }
+                return fail("expected ',' or ']'");
+            }
+        case '{':
+            out.type = JsonValue::JSON_OBJECT;
+            p_++;
+            skip_space();
+            if (p_ < end_ && *p_ == '}') {
+                p_++;
+                return true;
+            }
+            for (;;) {
+                skip_space();
+                if (p_ >= end_ || *p_ != '"') return fail("expected member name");
+                out.members.push_back(std::make_pair(std::string(), JsonValue()));
+                if (!string(out.members.back().first)) return false;
+                skip_space();
+                if (p_ >= end_ || *p_ != ':') return fail("expected ':'");
+                p_++;
+                if (!value(out.members.back().second, depth + 1)) return false;
+                skip_space();
+                if (p_ < end_ && *p_ == ',') {
+                    p_++;
+                    continue;
+                }
+                if (p_ < end_ && *p_ == '}') {
+                    p_++;
+                    return true;
+                }
+                return fail("expected ',' or '}'");
+            }
+        default:
+            out.type = JsonValue::JSON_NUMBER;
+            return number(out.number);
+        }
+    }
+public:
+    JsonParser(const std::string& text) : p_(text.data()), begin_(text.data()), end_(text.data() + text.size()) {}
+
+    bool parse(JsonValue& out, std::string& error) {
+        bool ok = value(out, 0);
+        skip_space();
+        if (ok && p_ != end_) ok = fail("trailing characters");
+        if (!ok) error = error_;
+        return ok;
+    }
+};
+
+} // namespace
+
+bool parse_json(const std::string& text, JsonValue& value, std::string& error) {
+    value = JsonValue();
+    JsonParser parser(text);
+    return parser.parse(value, error);
+}
+
+std::string json_quote(const std::string& s) {
+    std::string out = "\"";
+    for (size_t i = 0; i < s.size(); i++) {
+        unsigned char c = (unsigned char)s[i];
+        if (c == '"') out += "\\\"";
+        else if (c == '\\') out += "\\\\";
+        else if (c == '\n') out += "\\n";
+        else if (c == '\r') out += "\\r";
+        else if (c == '\t') out += "\\t";
+        else if (c < 0x20) {
+            char esc[8];
+            snprintf(esc, sizeof(esc), "\\u%04x", c);
+            out += esc;
+        }
+        else out += (char)c;
+    }
+    return out + "\"";
+}
+
+std::string json_text(const JsonValue& value) {
+    switch (value.type) {
+    case JsonValue::JSON_BOOL:
+        return value.boolean ? "true" : "false";
+    case JsonValue::JSON_NUMBER: {
+        char text[32];
+        snprintf(text, sizeof(text), "%.17g", value.number);
+        return text;
+    }
+    case JsonValue::JSON_STRING:
+        return json_quote(value.string);
+    case JsonValue::JSON_ARRAY: {
+        std::string out = "[";
+        for (size_t i = 0; i < value.items.size(); i++) out += (i ? "," : "") + json_text(value.items[i]);
+        return out + "]";
+    }
+    case JsonValue::JSON_OBJECT: {
+        std::string out = "{";
+        for (size_t i = 0; i < value.members.size(); i++) {
+            out += (i ? "," : "") + json_quote(value.members[i].first) + ":" + json_text(value.members[i].second);
+        }
+        return out + "}";
+    }
+    default:
+        return "null";
+    }
+}
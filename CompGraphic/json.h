@@ -0,0 +1,37 @@
+#ifndef JSON_H
+#define JSON_H
+
+#include <string>
+#include <vector>
+#include <utility>
+
+// Just enough JSON for the render server's job lines: a parsed value tree
+// and string quoting for the replies.
+struct JsonValue {
+    enum Type { JSON_NULL, JSON_BOOL, JSON_NUMBER, JSON_STRING, JSON_ARRAY, JSON_OBJECT };
+
+    Type type;
+    bool boolean;
+    double number;
+    std::string string;
+    std::vector<JsonValue> items;                             // JSON_ARRAY
+    std::vector<std::pair<std::string, JsonValue> > members;  // JSON_OBJECT, in file order
+
+    JsonValue() : type(JSON_NULL), boolean(false), number(0.0) {}
+
+    bool is_number() const { return type == JSON_NUMBER; }
+    bool is_string() const { return type == JSON_STRING; }
+    bool is_array() const { return type == JSON_ARRAY; }
+    bool is_object() const { return type == JSON_OBJECT; }
+    // Member of an object, nullptr if missing or not an object.
+    const JsonValue* get(const char* key) const;
+};
+
+// Parses one complete value; on failure error says what and where.
+bool parse_json(const std::string& text, JsonValue& value, std::string& error);
+// value written back as JSON text
+std::string json_text(const JsonValue& value);
+// s as a JSON string literal, quotes included
+std::string json_quote(const std::string& s);
+
+#endif // JSON_H
@@ -3,277 +3,183 @@
 #include <cstring> 
 #include <limits>  
 #include <iostream>
+#include <string>
 #include <algorithm>
+#include <mutex>
+#include <cstdio>
+#include <cstdlib>
 #include "tgaimage.h"
 #include "model.h"
 #include "geometry.h"
 #include "camera.h"
+#include "rasterizer.h"
+#include "renderer.h"
+#include "batch_renderer.h"
+#include "bench.h"
+#include "thread_pool.h"
+#include "profiler.h"
+#include "render_server.h"
+#include "image_writer.h"
+#include "image_formats.h"
 
-const TGAColor white = TGAColor(255, 255, 255, 255);
 const TGAColor red = TGAColor(255, 0, 0, 255);
 const TGAColor green = TGAColor(0, 255, 0, 255);
-const TGAColor ice_color = TGAColor(180, 220, 255, 180); 
 
 Model* model = NULL;
 const int width = 800;
 const int height = 800;
 
-TGAColor blend_colors(const TGAColor& bg, const TGAColor& fg) {
-    float alpha = fg.a / 255.0f;
-
-    unsigned char r = static_cast<unsigned char>(bg.r * (1.0f - alpha) + fg.r * alpha);
-    unsigned char g = static_cast<unsigned char>(bg.g * (1.0f - alpha) + fg.g * alpha);
-    unsigned char b = static_cast<unsigned char>(bg.b * (1.0f - alpha) + fg.b * alpha);
-
-    return TGAColor(r, g, b, 255);
-}
-
-void triangle(Vec3i t0, Vec3i t1, Vec3i t2, Vec2i uv0, Vec2i uv1, Vec2i uv2,
-    TGAImage& image, float intensity, float* zbuffer,
-    bool is_transparent = false, TGAColor transparent_color = TGAColor(255, 255, 255, 255),
-    Model* model = nullptr) {
-
-    if (t0.y < 0 && t1.y < 0 && t2.y < 0) return;
-    if (t0.y >= height && t1.y >= height && t2.y >= height) return;
-    if (t0.x < 0 && t1.x < 0 && t2.x < 0) return;
-    if (t0.x >= width && t1.x >= width && t2.x >= width) return;
-
-    if (t0.y == t1.y && t0.y == t2.y) return;
-
-    if (t0.y > t1.y) { std::swap(t0, t1); std::swap(uv0, uv1); }
-    if (t0.y > t2.y) { std::swap(t0, t2); std::swap(uv0, uv2); }
-    if (t1.y > t2.y) { std::swap(t1, t2); std::swap(uv1, uv2); }
-
-    int total_height = t2.y - t0.y;
-
-    for (int y = t0.y; y <= t2.y; y++) {
-        if (y < 0 || y >= height) continue;
-
-        bool second_half = y > t1.y || t1.y == t0.y;
-        int segment_height = second_half ? t2.y - t1.y : t1.y - t0.y;
-        if (segment_height == 0) segment_height = 1;
-
-        float alpha = (float)(y - t0.y) / total_height;
-        float beta = second_half ? (float)(y - t1.y) / segment_height : (float)(y - t0.y) / segment_height;
-
-        int xA = t0.x + (t2.x - t0.x) * alpha;
-        int xB = second_half ? t1.x + (t2.x - t1.x) * beta : t0.x + (t1.x - t0.x) * beta;
-
-        float zA = t0.z + (t2.z - t0.z) * alpha;
-        float zB = second_half ? t1.z + (t2.z - t1.z) * beta : t0.z + (t1.z - t0.z) * beta;
-
-        Vec2i uvA = uv0 + (uv2 - uv0) * alpha;
-        Vec2i uvB = second_half ? uv1 + (uv2 - uv1) * beta : uv0 + (uv1 - uv0) * beta;
-
-        if (xA > xB) {
-            std::swap(xA, xB);
-            std::swap(zA, zB);
-            std::swap(uvA, uvB);
+int main(int argc, char** argv) {
+    const char* model_path = "object.obj";
+    RasterMode raster_mode = RASTER_SCANLINE;
+    DrawMode draw_mode = DRAW_IMMEDIATE;
+    TextureFilter filter = TEXTURE_NEAREST;
+    ShadingMode shading = SHADE_FLAT;
+    TransparencyMode transparency = TRANSPARENCY_BLEND;
+    int turntable = 0;
+    int point_lights = 0;
+    bool cull_backfaces = false;
+    std::string profile_path;
+    std::string trace_path;
+    bool serve = false;
+    std::string socket_path;
+    int workers = 0;
+    int cache_size = 16;
+    int writers = 1;
+    ImageFormat format = IMAGE_TGA;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--bench") {
+            return run_benchmarks(argc - i - 1, argv + i + 1);
         }
-
-        for (int x = xA; x <= xB; x++) {
-            if (x < 0 || x >= width) continue;
-
-            float phi = (xA == xB) ? 1.0f : (float)(x - xA) / (float)(xB - xA);
-
-            float z = zA + (zB - zA) * phi;
-            Vec2i uv = uvA + (uvB - uvA) * phi;
-
-            int idx = x + y * width;
-
-            if (is_transparent) {
-                if (zbuffer[idx] < z) {
-                    zbuffer[idx] = z;
-
-                    TGAColor color_with_intensity = transparent_color;
-                    color_with_intensity.r = (unsigned char)(transparent_color.r * intensity);
-                    color_with_intensity.g = (unsigned char)(transparent_color.g * intensity);
-                    color_with_intensity.b = (unsigned char)(transparent_color.b * intensity);
-
-                    TGAColor current_color = image.get(x, y);
-                    TGAColor blended = blend_colors(current_color, color_with_intensity);
-                    image.set(x, y, blended);
-                }
+        else if (arg == "--raster=scanline") {
+            raster_mode = RASTER_SCANLINE;
+        }
+        else if (arg == "--raster=simd") {
+            raster_mode = RASTER_EDGE_SIMD;
+        }
+        else if (arg == "--raster=subpixel") {
+            raster_mode = RASTER_SUBPIXEL;
+        }
+        else if (arg == "--draw=immediate") {
+            draw_mode = DRAW_IMMEDIATE;
+        }
+        else if (arg == "--draw=sorted") {
+            draw_mode = DRAW_FRONT_TO_BACK;
+        }
+        else if (arg == "--draw=prepass") {
+            draw_mode = DRAW_DEPTH_PREPASS;
+        }
+        else if (arg == "--filter=nearest") {
+            filter = TEXTURE_NEAREST;
+        }
+        else if (arg == "--filter=point") {
+            filter = TEXTURE_POINT;
+        }
+        else if (arg == "--filter=bilinear") {
+            filter = TEXTURE_BILINEAR;
+        }
+        else if (arg == "--filter=trilinear") {
+            filter = TEXTURE_TRILINEAR;
+        }
+        else if (arg == "--shading=flat") {
+            shading = SHADE_FLAT;
+        }
+        else if (arg == "--shading=phong") {
+            shading = SHADE_PHONG;
+        }
+        else if (arg == "--shading=blinn") {
+            shading = SHADE_BLINN;
+        }
+        else if (arg == "--shading=deferred") {
+            shading = SHADE_DEFERRED;
+        }
+        else if (arg == "--transparency=blend") {
+            transparency = TRANSPARENCY_BLEND;
+        }
+        else if (arg == "--transparency=oit") {
+            transparency = TRANSPARENCY_OIT;
+        }
+        else if (arg == "--cull-backfaces") {
+            cull_backfaces = true;
+        }
+        else if (!arg.compare(0, 12, "--turntable=")) {
+            turntable = atoi(arg.c_str() + 12);
+            if (turntable <= 0) {
+                std::cout << "Bad view count: " << arg << std::endl;
+                return 1;
             }
-            else if (model) {
-                if (zbuffer[idx] < z) {
-                    zbuffer[idx] = z;
-
-                    TGAColor color = model->diffuse(uv);
-                    color.r = (unsigned char)(color.r * intensity);
-                    color.g = (unsigned char)(color.g * intensity);
-                    color.b = (unsigned char)(color.b * intensity);
-
-                    image.set(x, y, color);
-                }
+        }
+        else if (!arg.compare(0, 9, "--lights=")) {
+            point_lights = atoi(arg.c_str() + 9);
+            if (point_lights <= 0) {
+                std::cout << "Bad light count: " << arg << std::endl;
+                return 1;
             }
-            else {
-                if (zbuffer[idx] < z) {
-                    zbuffer[idx] = z;
-
-                    TGAColor color = transparent_color;
-                    color.r = (unsigned char)(transparent_color.r * intensity);
-                    color.g = (unsigned char)(transparent_color.g * intensity);
-                    color.b = (unsigned char)(transparent_color.b * intensity);
-
-                    image.set(x, y, color);
-                }
+        }
+        else if (!arg.compare(0, 10, "--profile=")) {
+            profile_path = arg.substr(10);
+        }
+        else if (!arg.compare(0, 8, "--trace=")) {
+            trace_path = arg.substr(8);
+        }
+        else if (arg == "--serve") {
+            serve = true;
+        }
+        else if (!arg.compare(0, 8, "--serve=")) {
+            serve = true;
+            socket_path = arg.substr(8);
+        }
+        else if (!arg.compare(0, 10, "--workers=")) {
+            workers = atoi(arg.c_str() + 10);
+            if (workers <= 0) {
+                std::cout << "Bad worker count: " << arg << std::endl;
+                return 1;
             }
         }
-    }
-}
-
-std::vector<Vec3f> cube_vertices = {
-    Vec3f(-1.4f, -1.4f, -1.4f), 
-    Vec3f(1.4f, -1.4f, -1.4f), 
-    Vec3f(1.4f,  1.4f, -1.4f), 
-    Vec3f(-1.4f,  1.4f, -1.4f), 
-    Vec3f(-1.4f, -1.4f,  1.4f), 
-    Vec3f(1.4f, -1.4f,  1.4f), 
-    Vec3f(1.4f,  1.4f,  1.4f), 
-    Vec3f(-1.4f,  1.4f,  1.4f) 
-};
-
-struct CubeFace {
-    std::vector<int> indices;
-    bool is_front; 
-    Vec3f normal; 
-};
-
-Vec3f calculate_face_normal(const std::vector<Vec3f>& vertices, const std::vector<int>& indices) {
-    if (indices.size() < 3) return Vec3f(0, 0, 1);
-
-    Vec3f v0 = vertices[indices[0]];
-    Vec3f v1 = vertices[indices[1]];
-    Vec3f v2 = vertices[indices[2]];
-
-    Vec3f normal = (v2 - v0) ^ (v1 - v0);
-    normal.normalize();
-    return normal;
-}
-
-std::vector<CubeFace> get_cube_faces(const Camera& camera) {
-    std::vector<CubeFace> faces;
-
-    std::vector<std::pair<std::vector<int>, Vec3f>> raw_faces = {
-        {{0, 1, 2, 3}, Vec3f(0, 0, -1)},
-        {{4, 5, 6, 7}, Vec3f(0, 0, 1)},
-        {{0, 3, 7, 4}, Vec3f(-1, 0, 0)},
-        {{1, 2, 6, 5}, Vec3f(1, 0, 0)},
-        {{0, 1, 5, 4}, Vec3f(0, -1, 0)},
-        {{3, 2, 6, 7}, Vec3f(0, 1, 0)}
-    };
-
-    Vec3f camera_pos = camera.getEye();
-
-    for (const auto& face : raw_faces) {
-        CubeFace cube_face;
-
-        const std::vector<int>& quad = face.first;
-        cube_face.indices = { quad[0], quad[1], quad[2], quad[0], quad[2], quad[3] };
-        cube_face.normal = face.second;
-
-        Vec3f face_center(0, 0, 0);
-        for (int idx : quad) {
-            face_center = face_center + cube_vertices[idx];
+        else if (!arg.compare(0, 8, "--cache=")) {
+            cache_size = atoi(arg.c_str() + 8);
+            if (cache_size < 0) {
+                std::cout << "Bad cache size: " << arg << std::endl;
+                return 1;
+            }
         }
-        face_center = face_center * (1.0f / quad.size());
-
-        Vec3f to_camera = camera_pos - face_center;
-        to_camera.normalize();
-
-        float dot_product = cube_face.normal * to_camera;
-        cube_face.is_front = (dot_product > 0.1f);
-
-        faces.push_back(cube_face);
-    }
-
-    return faces;
-}
-
-void render_cube_with_layers(Camera& camera, TGAImage& image, float* zbuffer, Vec3f light_dir) {
-    std::vector<CubeFace> faces = get_cube_faces(camera);
-
-    for (const auto& face : faces) {
-        if (!face.is_front) {
-            for (int tri = 0; tri < 2; tri++) {
-                Vec3i screen_coords[3];
-                Vec3f world_coords[3];
-
-                for (int j = 0; j < 3; j++) {
-                    int idx = face.indices[tri * 3 + j];
-                    Vec3f v = cube_vertices[idx];
-                    world_coords[j] = v;
-
-                    Matrix viewProj = camera.getViewProjectionMatrix();
-                    Vec3f transformed = viewProj * v;
-
-                    screen_coords[j] = Vec3i(
-                        (int)((transformed.x + 1.0f) * width / 2.0f + 0.5f),
-                        (int)((transformed.y + 1.0f) * height / 2.0f + 0.5f),
-                        (int)(transformed.z * 1000.0f)
-                    );
-                }
-
-                float intensity = 0.6f + 0.2f * std::abs(face.normal * light_dir);
-                intensity = std::min(0.8f, std::max(0.5f, intensity));
-
-                triangle(screen_coords[0], screen_coords[1], screen_coords[2],
-                    Vec2i(0, 0), Vec2i(0, 0), Vec2i(0, 0),
-                    image, intensity, zbuffer, false, ice_color, nullptr);
+        else if (!arg.compare(0, 10, "--writers=")) {
+            writers = atoi(arg.c_str() + 10);
+            if (writers < 0) {
+                std::cout << "Bad writer count: " << arg << std::endl;
+                return 1;
             }
         }
-    }
-
-}
-
-void render_front_cube_faces(Camera& camera, TGAImage& image, float* zbuffer, Vec3f light_dir) {
-    std::vector<CubeFace> faces = get_cube_faces(camera);
-
-    for (const auto& face : faces) {
-        if (face.is_front) {
-            for (int tri = 0; tri < 2; tri++) {
-                Vec3i screen_coords[3];
-                Vec3f world_coords[3];
-
-                for (int j = 0; j < 3; j++) {
-                    int idx = face.indices[tri * 3 + j];
-                    Vec3f v = cube_vertices[idx];
-                    world_coords[j] = v;
-
-                    Matrix viewProj = camera.getViewProjectionMatrix();
-                    Vec3f transformed = viewProj * v;
-
-                    screen_coords[j] = Vec3i(
-                        (int)((transformed.x + 1.0f) * width / 2.0f + 0.5f),
-                        (int)((transformed.y + 1.0f) * height / 2.0f + 0.5f),
-                        (int)(transformed.z * 1000.0f)
-                    );
-                }
-
-                // Освещение для передней грани
-                float intensity = 0.5f + 0.3f * std::abs(face.normal * light_dir);
-                intensity = std::min(0.7f, std::max(0.4f, intensity));
-
-                // Рендерим как прозрачную грань
-                triangle(screen_coords[0], screen_coords[1], screen_coords[2],
-                    Vec2i(0, 0), Vec2i(0, 0), Vec2i(0, 0),
-                    image, intensity, zbuffer, true, ice_color, nullptr);
+        else if (!arg.compare(0, 9, "--format=")) {
+            if (!parse_image_format(arg.substr(9), format)) {
+                std::cout << "Bad image format: " << arg << std::endl;
+                return 1;
             }
         }
+        else if (!arg.compare(0, 2, "--")) {
+            std::cout << "Unknown option: " << arg << std::endl;
+            return 1;
+        }
+        else {
+            model_path = argv[i];
+        }
     }
-}
 
-int main(int argc, char** argv) {
+    // stdout carries the replies in server mode, so nothing else goes there
+    if (serve) return run_server(socket_path.empty() ? nullptr : socket_path.c_str(), workers, cache_size);
     std::cout << "=== 3D Renderer with Object INSIDE Transparent Ice Cube ===" << std::endl;
 
-    if (argc == 2) {
-        model = new Model(argv[1]);
-    }
-    else {
-        model = new Model("object.obj");
+    if (!profile_path.empty() || !trace_path.empty()) {
+#if PROFILING
+        Profiler::set_enabled(true);
+#else
+        std::cout << "Built without profiling; --profile and --trace write empty reports" << std::endl;
+#endif
     }
 
+    model = new Model(model_path);
+
     if (model->nverts() == 0) {
         std::cout << "ERROR: Failed to load model!" << std::endl;
         return 1;
@@ -288,140 +194,79 @@ int main(int argc, char** argv) {
     float material_specular = 0.5f;
     float shininess = 32.0f;
 
-    const char* view_names[] = { "front", "side", "top", "three_quarter" };
-
-    struct ViewConfig {
-        Vec3f eye;
-        Vec3f target;
-        Vec3f up;
-        float fov;
-    };
-
-    ViewConfig view_configs[] = {
-        {Vec3f(0, 0, 5), Vec3f(0, 0, 0), Vec3f(0, 1, 0), 45.0f},
-        {Vec3f(5, 0, 0), Vec3f(0, 0, 0), Vec3f(0, 1, 0), 45.0f},
-        {Vec3f(0, 5, 0), Vec3f(0, 0, 0), Vec3f(0, 0, -1), 45.0f},
-        {Vec3f(3, 2, 4), Vec3f(0, 0, 0), Vec3f(0, 1, 0), 50.0f}
-    };
-
-    for (int view = 0; view < 4; view++) {
-        std::cout << "\n=== Rendering " << view_names[view] << " view... ===" << std::endl;
-
-        ViewConfig config = view_configs[view];
-        Camera camera(config.eye, config.target, config.up,
-            config.fov, (float)width / height, 0.1f, 100.0f);
-
-        TGAImage image(width, height, TGAImage::RGB);
-        float* zbuffer = new float[width * height];
-        for (int i = 0; i < width * height; i++) {
-            zbuffer[i] = -std::numeric_limits<float>::max();
+    std::vector<Camera> cameras;
+    std::vector<std::string> names;
+    if (turntable > 0) {
+        cameras = make_turntable(turntable, 5.0f, 1.5f, 45.0f, (float)width / height);
+        for (int view = 0; view < turntable; view++) {
+            char name[32];
+            snprintf(name, sizeof(name), "turntable_%03d", view);
+            names.push_back(name);
         }
-
-        std::cout << "1. Rendering back faces of ice cube... ";
-        render_cube_with_layers(camera, image, zbuffer, light_dir);
-        std::cout << "Done" << std::endl;
-
-        std::cout << "2. Rendering object inside cube... ";
-
-        int rendered_faces = 0;
-        int total_faces = model->nfaces();
-
-        // Рендерим объект (голову)
-        for (int i = 0; i < total_faces; i++) {
-            if (i % (total_faces / 50) == 0) {
-                std::cout << ".";
-                std::cout.flush();
-            }
-
-            std::vector<int> face = model->face(i);
-            if (face.size() < 3) continue;
-
-            Vec3i screen_coords[3];
-            Vec3f world_coords[3];
-            Vec2i uv_coords[3];
-
-            for (int j = 0; j < 3; j++) {
-                int vert_idx = face[j];
-                if (vert_idx < 0 || vert_idx >= model->nverts()) {
-                    screen_coords[j] = Vec3i(0, 0, 0);
-                    continue;
-                }
-
-                Vec3f v = model->vert(vert_idx);
-                world_coords[j] = v;
-
-                Matrix viewProj = camera.getViewProjectionMatrix();
-                Vec3f transformed = viewProj * v;
-
-                screen_coords[j] = Vec3i(
-                    (int)((transformed.x + 1.0f) * width / 2.0f + 0.5f),
-                    (int)((transformed.y + 1.0f) * height / 2.0f + 0.5f),
-                    (int)(transformed.z * 1000.0f)
-                );
-
-                uv_coords[j] = model->uv(i, j);
-            }
-
-            bool outside = true;
-            for (int j = 0; j < 3; j++) {
-                if (screen_coords[j].x >= -100 && screen_coords[j].x < width + 100 &&
-                    screen_coords[j].y >= -100 && screen_coords[j].y < height + 100) {
-                    outside = false;
-                    break;
-                }
-            }
-
-            if (outside) continue;
-
-            Vec3f n = (world_coords[2] - world_coords[0]) ^ (world_coords[1] - world_coords[0]);
-            float norm = n.norm();
-            if (norm > 0) {
-                n.normalize();
-
-                Vec3f view_dir = (camera.getEye() - world_coords[0]);
-                view_dir.normalize();
-
-                Vec3f light_dir_neg = light_dir * (-1.0f);
-                Vec3f reflect_dir = light_dir_neg.reflect(n);
-                reflect_dir.normalize();
-
-                float ambient = 0.25f;
-                float diffuse = std::abs(n * light_dir);
-                float specular = material_specular * std::pow(std::max(0.0f, view_dir * reflect_dir), shininess);
-
-                float intensity = ambient + diffuse + specular;
-                intensity = std::min(1.0f, std::max(0.0f, intensity));
-
-                if (intensity > 0.0f) {
-                    rendered_faces++;
-                    triangle(screen_coords[0], screen_coords[1], screen_coords[2],
-                        uv_coords[0], uv_coords[1], uv_coords[2],
-                        image, intensity, zbuffer, false, white, model);
-                }
-            }
+    }
+    else {
+        for (int view = 0; view < num_views; view++) {
+            const ViewConfig& config = view_configs[view];
+            cameras.push_back(Camera(config.eye, config.target, config.up,
+                config.fov, (float)width / height, 0.1f, 100.0f));
+            names.push_back(std::string(view_names[view]) + "_layered_ice");
         }
+    }
 
-        std::cout << " Done" << std::endl;
-
-        std::cout << "3. Rendering front (transparent) faces of ice cube... ";
-        render_front_cube_faces(camera, image, zbuffer, light_dir);
-        std::cout << "Done" << std::endl;
-
-        std::cout << "Faces rendered: " << rendered_faces << "/" << total_faces << std::endl;
-
-        std::string filename = std::string("output_") + view_names[view] + "_layered_ice.tga";
-        if (image.write_tga_file(filename.c_str())) {
+    std::cout << "Rendering " << cameras.size() << " views: back faces of ice cube, "
+        << "object inside cube, front (transparent) faces..." << std::endl;
+
+    BatchRenderer batch(model, width, height, light_dir, &ThreadPool::shared(), material_specular, shininess);
+    batch.set_mode(raster_mode);
+    batch.set_draw_mode(draw_mode);
+    batch.set_filter(filter);
+    batch.set_shading(shading);
+    if (point_lights > 0) {
+        // a ring of colored lights around the head, on top of the dimmed main light
+        std::vector<Light> lights = make_light_ring(point_lights, 1.0f, 0.5f, 0.8f);
+        lights.push_back(Light::directional(light_dir, Vec3f(0.5f, 0.5f, 0.5f)));
+        batch.set_lights(lights);
+    }
+    batch.set_cull_backfaces(cull_backfaces);
+    batch.set_transparency(transparency);
+
+    std::mutex log_mutex;
+    int failed = 0;
+    // encoding and writing run behind rendering; --writers=0 writes each
+    // view before the next one starts
+    ImageWriter writer(writers);
+    WriteCallback on_saved = [&](const std::string& filename, bool saved) {
+        std::lock_guard<std::mutex> lock(log_mutex);
+        if (saved) {
             std::cout << "Saved: " << filename << std::endl;
         }
         else {
             std::cout << "ERROR saving: " << filename << std::endl;
+            failed++;
         }
-
-        delete[] zbuffer;
-    }
+    };
+    batch.render(cameras, [&](const ViewResult& result) {
+        writer.write(*result.framebuffer, "output_" + names[result.view] + "." + image_format_extension(format), on_saved);
+
+        std::lock_guard<std::mutex> lock(log_mutex);
+        std::cout << "\n=== " << names[result.view] << " ===" << std::endl;
+        std::cout << "Faces rendered: " << result.rendered_faces << "/" << model->nfaces() << std::endl;
+        std::cout << "Clusters culled: " << result.cull.clusters_frustum_culled << " outside, "
+            << result.cull.clusters_backface_culled << " facing away, of " << result.cull.clusters << std::endl;
+        if (result.stats.layers_dropped > 0) {
+            std::cout << "Transparent fragments dropped: " << result.stats.layers_dropped << std::endl;
+        }
+        if (result.lighting.pixels > 0) {
+            std::cout << "Lights per pixel after tile culling: "
+                << (double)result.lighting.light_tests / result.lighting.pixels << std::endl;
+        }
+    });
+    writer.finish();
 
     delete model;
-    std::cout << "\n=== All 4 views rendered with Object INSIDE Layered Ice Cube! ===" << std::endl;
+    if (!profile_path.empty() && !Profiler::instance().write_json(profile_path.c_str())) failed++;
+    if (!trace_path.empty() && !Profiler::instance().write_trace(trace_path.c_str())) failed++;
+    std::cout << "\n=== All " << cameras.size() << " views rendered with Object INSIDE Layered Ice Cube! ===" << std::endl;
 
-    return 0;
+    return failed ? 1 : 0;
 }
\ No newline at end of file
@@ -0,0 +1,112 @@
+#include "mapped_file.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#ifdef _WIN32
+
+MappedFile::MappedFile() : data_(NULL), size_(0), open_(false), file_(INVALID_HANDLE_VALUE), mapping_(NULL) {
+}
+
+bool MappedFile::open(const char* filename) {
+    close();
+    HANDLE file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (file == INVALID_HANDLE_VALUE) return false;
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file, &size)) {
+        CloseHandle(file);
+        return false;
+    }
+    file_ = file;
+    size_ = (size_t)size.QuadPart;
+    open_ = true;
+    if (size_ == 0) return true; // empty files cannot be mapped
+    mapping_ = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (mapping_) data_ = (const char*)MapViewOfFile(mapping_, FILE_MAP_READ, 0, 0, 0);
+    if (!data_) {
+        close();
+        return false;
+    }
+    return true;
+}
+
+void MappedFile::close() {
+    if (data_) UnmapViewOfFile(data_);
+    if (mapping_) CloseHandle(mapping_);
+    if (file_ != INVALID_HANDLE_VALUE) CloseHandle(file_);
+    data_ = NULL;
+    mapping_ = NULL;
+    file_ = INVALID_HANDLE_VALUE;
+    size_ = 0;
+    open_ = false;
+}
+
+#else
+
+MappedFile::MappedFile() : data_(NULL), size_(0), open_(false), fd_(-1) {
+}
+
+bool MappedFile::open(const char* filename) {
+    close();
+    int fd = ::open(filename, O_RDONLY);
+    if (fd < 0) return false;
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        ::close(fd);
+        return false;
+    }
+    fd_ = fd;
+    size_ = (size_t)st.st_size;
+    open_ = true;
+    if (size_ == 0) return true; // empty files cannot be mapped
+    void* p = mmap(NULL, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (p == MAP_FAILED) {
+        close();
+        return false;
+    }
+    data_ = (const char*)p;
+    madvise(p, size_, MADV_SEQUENTIAL);
+    return true;
+}
+
+void MappedFile::close() {
+    if (data_) munmap((void*)data_, size_);
+    if (fd_ >= 0) ::close(fd_);
+    data_ = NULL;
+    fd_ = -1;
+    size_ = 0;
+    open_ = false;
+}
+
+#endif
+
+MappedFile::~MappedFile() {
+    close();
+}
+
+bool file_stat(const char* filename, unsigned long long& size, long long& mtime) {
+#ifdef _WIN32
+    struct _stat64 st;
+    if (_stat64(filename, &st) != 0) return false;
+#else
+    struct stat st;
+    if (stat(filename, &st) != 0) return false;
+#endif
+    size = (unsigned long long)st.st_size;
+#if defined(__linux__)
+    mtime = (long long)st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+#else
+    mtime = (long long)st.st_mtime;
+#endif
+    return true;
+}
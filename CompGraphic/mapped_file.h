@@ -0,0 +1,37 @@
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <cstddef>
+
+// Read-only memory mapping of a whole file.
+class MappedFile {
+private:
+    const char* data_;
+    size_t size_;
+    bool open_;
+#ifdef _WIN32
+    void* file_;
+    void* mapping_;
+#else
+    int fd_;
+#endif
+
+    MappedFile(const MappedFile&);
+    MappedFile& operator =(const MappedFile&);
+public:
+    MappedFile();
+    ~MappedFile();
+
+    bool open(const char* filename);
+    void close();
+
+    bool is_open() const { return open_; }
+    const char* data() const { return data_; }
+    size_t size() const { return size_; }
+};
+
+// Size in bytes and a modification time stamp of a file. The stamp is only
+// meant for comparison; its resolution depends on the platform.
+bool file_stat(const char* filename, unsigned long long& size, long long& mtime);
+
+#endif // MAPPED_FILE_H
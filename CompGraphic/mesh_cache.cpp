@@ -0,0 +1,239 @@
+#include <iostream>
+#include <fstream>
+#include <cstring>
+#include <cstdio>
+#include <cstddef>
+#include <functional>
+#include <thread>
+#include "mesh_cache.h"
+
+#ifdef _WIN32
+#include <process.h>
+#define getpid _getpid
+#else
+#include <unistd.h>
+#endif
+
+namespace {
+
+const char cache_magic[8] = { 'C', 'G', 'M', 'E', 'S', 'H', 0, 0 };
+const unsigned cache_version = 1;
+const unsigned long long cache_align = 64;
+
+enum {
+    ARRAY_VERTS, ARRAY_UVS, ARRAY_NORMS, ARRAY_FACE_OFFSETS,
+    ARRAY_FACE_VERTS, ARRAY_FACE_UVS, ARRAY_FACE_NORMS, ARRAY_COUNT
+};
+
+#pragma pack(push,1)
+struct MeshCacheHeader {
+    char magic[8];
+    unsigned version;
+    unsigned header_size;
+    unsigned long long source_size;
+    long long source_mtime;
+    unsigned long long source_hash;
+    int nverts;
+    int nuvs;
+    int nnorms;
+    int nfaces;
+    int ncorners;
+    int reserved;
+    unsigned long long offsets[ARRAY_COUNT];
+    unsigned long long sizes[ARRAY_COUNT];
+};
+#pragma pack(pop)
+
+// FNV-1a over 8-byte words (bytes for the tail)
+unsigned long long hash_bytes(const char* data, size_t size) {
+    const unsigned long long prime = 1099511628211ULL;
+    unsigned long long h = 14695981039346656037ULL;
+    size_t i = 0;
+    for (; i + 8 <= size; i += 8) {
+        unsigned long long w;
+        memcpy(&w, data + i, 8);
+        h = (h ^ w) * prime;
+    }
+    for (; i < size; i++) h = (h ^ (unsigned char)data[i]) * prime;
+    return h ^ size;
+}
+
+unsigned long long align_up(unsigned long long n) {
+    return (n + cache_align - 1) & ~(cache_align - 1);
+}
+
+void array_sizes(const MeshView& mesh, unsigned long long sizes[ARRAY_COUNT]) {
+    sizes[ARRAY_VERTS] = (unsigned long long)mesh.nverts * sizeof(Vec3f);
+    sizes[ARRAY_UVS] = (unsigned long long)mesh.nuvs * sizeof(Vec2f);
+    sizes[ARRAY_NORMS] = (unsigned long long)mesh.nnorms * sizeof(Vec3f);
+    sizes[ARRAY_FACE_OFFSETS] = (unsigned long long)(mesh.nfaces + 1) * sizeof(int);
+    sizes[ARRAY_FACE_VERTS] = (unsigned long long)mesh.ncorners * sizeof(int);
+    sizes[ARRAY_FACE_UVS] = (unsigned long long)mesh.ncorners * sizeof(int);
+    sizes[ARRAY_FACE_NORMS] = (unsigned long long)mesh.ncorners * sizeof(int);
+}
+
+// Overwrites the source mtime recorded in a cache; the file must not be
+// mapped, since Windows maps it without write sharing.
+bool set_source_mtime(const std::string& path, long long mtime) {
+    std::fstream file(path.c_str(), std::ios::in | std::ios::out | std::ios::binary);
+    if (!file.is_open()) return false;
+    file.seekp(offsetof(MeshCacheHeader, source_mtime));
+    file.write((const char*)&mtime, sizeof(mtime));
+    file.close();
+    return !file.fail();
+}
+
+bool open_cache(const char* obj_filename, MappedFile& cache, MeshView& mesh, bool refresh_mtime) {
+    unsigned long long source_size;
+    long long source_mtime;
+    if (!file_stat(obj_filename, source_size, source_mtime)) return false;
+
+    std::string path = mesh_cache_path(obj_filename);
+    if (!cache.open(path.c_str())) return false;
+
+    MeshCacheHeader header;
+    if (cache.size() < sizeof(header)) {
+        cache.close();
+        return false;
+    }
+    memcpy(&header, cache.data(), sizeof(header));
+    if (memcmp(header.magic, cache_magic, sizeof(cache_magic)) || header.version != cache_version ||
+        header.header_size != sizeof(header) || header.source_size != source_size) {
+        cache.close();
+        return false;
+    }
+
+    if (header.source_mtime != source_mtime) {
+        // touched but maybe not modified: the content hash decides
+        MappedFile source;
+        if (!source.open(obj_filename) || hash_bytes(source.data(), source.size()) != header.source_hash) {
+            cache.close();
+            return false;
+        }
+        if (refresh_mtime) {
+            // only touched: record the new time so later loads skip the
+            // hash, or fail and let the caller write a fresh cache
+            cache.close();
+            if (!set_source_mtime(path, source_mtime)) return false;
+            return open_cache(obj_filename, cache, mesh, false);
+        }
+    }
+
+    MeshView m;
+    m.nverts = header.nverts;
+    m.nuvs = header.nuvs;
+    m.nnorms = header.nnorms;
+    m.nfaces = header.nfaces;
+    m.ncorners = header.ncorners;
+    if (m.nverts < 0 || m.nuvs < 0 || m.nnorms < 0 || m.nfaces < 0 || m.ncorners < 0) {
+        cache.close();
+        return false;
+    }
+
+    unsigned long long sizes[ARRAY_COUNT];
+    array_sizes(m, sizes);
+    for (int i = 0; i < ARRAY_COUNT; i++) {
+        if (sizes[i] != header.sizes[i] || header.offsets[i] % cache_align ||
+            header.offsets[i] + sizes[i] > cache.size()) {
+            cache.close();
+            return false;
+        }
+    }
+
+    const char* base = cache.data();
+    m.verts = (const Vec3f*)(base + header.offsets[ARRAY_VERTS]);
+    m.uvs = (const Vec2f*)(base + header.offsets[ARRAY_UVS]);
+    m.norms = (const Vec3f*)(base + header.offsets[ARRAY_NORMS]);
+    m.face_offsets = (const int*)(base + header.offsets[ARRAY_FACE_OFFSETS]);
+    m.face_verts = (const int*)(base + header.offsets[ARRAY_FACE_VERTS]);
+    m.face_uvs = (const int*)(base + header.offsets[ARRAY_FACE_UVS]);
+    m.face_norms = (const int*)(base + header.offsets[ARRAY_FACE_NORMS]);
+    // a truncated or mixed file must not send face lookups out of the arrays
+    bool offsets_ok = m.face_offsets[0] == 0 && m.face_offsets[m.nfaces] == m.ncorners;
+    for (int f = 0; f < m.nfaces && offsets_ok; f++) {
+        offsets_ok = m.face_offsets[f] <= m.face_offsets[f + 1];
+    }
+    if (!offsets_ok) {
+        cache.close();
+        return false;
+    }
+    mesh = m;
+    return true;
+}
+
+} // namespace
+
+std::string mesh_cache_path(const char* obj_filename) {
+    return std::string(obj_filename) + ".mcache";
+}
+
+
+bool open_mesh_cache(const char* obj_filename, MappedFile& cache, MeshView& mesh) {
+    return open_cache(obj_filename, cache, mesh, true);
+}
+
+bool write_mesh_cache(const char* obj_filename, const char* source, size_t source_size, const MeshView& mesh) {
+    unsigned long long size;
+    long long mtime;
+    if (!file_stat(obj_filename, size, mtime) || size != source_size) return false;
+
+    MeshCacheHeader header;
+    memset((void*)&header, 0, sizeof(header));
+    memcpy(header.magic, cache_magic, sizeof(cache_magic));
+    header.version = cache_version;
+    header.header_size = sizeof(header);
+    header.source_size = size;
+    header.source_mtime = mtime;
+    header.source_hash = hash_bytes(source, source_size);
+    header.nverts = mesh.nverts;
+    header.nuvs = mesh.nuvs;
+    header.nnorms = mesh.nnorms;
+    header.nfaces = mesh.nfaces;
+    header.ncorners = mesh.ncorners;
+    array_sizes(mesh, header.sizes);
+
+    const void* arrays[ARRAY_COUNT] = {
+        mesh.verts, mesh.uvs, mesh.norms, mesh.face_offsets,
+        mesh.face_verts, mesh.face_uvs, mesh.face_norms
+    };
+    unsigned long long offset = align_up(sizeof(header));
+    for (int i = 0; i < ARRAY_COUNT; i++) {
+        header.offsets[i] = offset;
+        offset = align_up(offset + header.sizes[i]);
+    }
+
+    // written under a temporary name and renamed, so readers never see half
+    // a file; the name is unique to this process and thread, so concurrent
+    // writers of the same cache never share one
+    std::string path = mesh_cache_path(obj_filename);
+    char suffix[64];
+    snprintf(suffix, sizeof(suffix), ".%d.%zx.tmp", (int)getpid(), std::hash<std::thread::id>()(std::this_thread::get_id()));
+    std::string tmp = path + suffix;
+    std::ofstream out;
+    out.open(tmp.c_str(), std::ios::binary);
+    if (!out.is_open()) {
+        std::cerr << "can't write mesh cache " << tmp << "\n";
+        return false;
+    }
+    static const char zeros[64] = { 0 };
+    unsigned long long pos = 0;
+    out.write((const char*)&header, sizeof(header));
+    pos += sizeof(header);
+    for (int i = 0; i < ARRAY_COUNT; i++) {
+        out.write(zeros, (std::streamsize)(header.offsets[i] - pos));
+        if (header.sizes[i]) out.write((const char*)arrays[i], (std::streamsize)header.sizes[i]);
+        pos = header.offsets[i] + header.sizes[i];
+    }
+    out.close();
+    if (!out.good()) {
+        std::cerr << "can't write mesh cache " << tmp << "\n";
+        std::remove(tmp.c_str());
+        return false;
+    }
+    std::remove(path.c_str());
+    if (std::rename(tmp.c_str(), path.c_str()) != 0) {
+        std::remove(tmp.c_str());
+        return false;
+    }
+    return true;
+}
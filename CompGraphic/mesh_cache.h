@@ -0,0 +1,41 @@
+#ifndef MESH_CACHE_H
+#define MESH_CACHE_H
+
+#include <string>
+#include "geometry.h"
+#include "mapped_file.h"
+
+// Flat mesh arrays as Model reads them. The pointers refer either to arrays
+// owned by the Model or straight into a memory-mapped cache file.
+struct MeshView {
+    const Vec3f* verts;
+    const Vec2f* uvs;
+    const Vec3f* norms;
+    const int* face_offsets;  // nfaces + 1 entries
+    const int* face_verts;    // ncorners entries each
+    const int* face_uvs;
+    const int* face_norms;
+    int nverts;
+    int nuvs;
+    int nnorms;
+    int nfaces;
+    int ncorners;
+
+    MeshView() : verts(NULL), uvs(NULL), norms(NULL), face_offsets(NULL), face_verts(NULL),
+        face_uvs(NULL), face_norms(NULL), nverts(0), nuvs(0), nnorms(0), nfaces(0), ncorners(0) {}
+};
+
+// Binary cache written next to an OBJ ("<file>.obj.mcache"): a versioned
+// header with the source size, mtime and content hash, followed by the
+// MeshView arrays, each 64-byte aligned so they can be used in place.
+std::string mesh_cache_path(const char* obj_filename);
+
+// Maps the cache and points mesh into it. Fails if the cache is missing,
+// malformed, from another format version, or its source no longer matches.
+// A source that was only touched is hashed once and its new mtime stored.
+bool open_mesh_cache(const char* obj_filename, MappedFile& cache, MeshView& mesh);
+
+// source is the OBJ file contents the mesh was parsed from.
+bool write_mesh_cache(const char* obj_filename, const char* source, size_t source_size, const MeshView& mesh);
+
+#endif // MESH_CACHE_H
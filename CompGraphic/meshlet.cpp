@@ -0,0 +1,168 @@
+#include <cmath>
+#include <algorithm>
+#include "meshlet.h"
+#include "thread_pool.h"
+
+namespace {
+
+// First three corners of the face, or false if there are not three valid ones.
+bool face_corners(const MeshView& mesh, int face, const int*& fv) {
+    int begin = mesh.face_offsets[face];
+    if (mesh.face_offsets[face + 1] - begin < 3) return false;
+    fv = mesh.face_verts + begin;
+    for (int j = 0; j < 3; j++) {
+        if (fv[j] < 0 || fv[j] >= mesh.nverts) return false;
+    }
+    return true;
+}
+
+// Unit counter-clockwise normal, or zero for degenerate and invalid faces.
+Vec3f face_normal(const MeshView& mesh, int face) {
+    const int* fv;
+    if (!face_corners(mesh, face, fv)) return Vec3f(0, 0, 0);
+    Vec3f v0 = mesh.verts[fv[0]];
+    Vec3f n = (mesh.verts[fv[1]] - v0) ^ (mesh.verts[fv[2]] - v0);
+    float len = n.norm();
+    return len > 0 ? n * (1.0f / len) : Vec3f(0, 0, 0);
+}
+
+void cluster_bounds(const MeshView& mesh, const int* faces, const int* verts, const Vec3f* normals, MeshCluster& c) {
+    c.center = Vec3f(0, 0, 0);
+    c.radius = 0.0f;
+    c.cone_axis = Vec3f(0, 0, 0);
+    c.cone_cutoff = 2.0f;
+    if (c.nverts == 0) return;
+
+    Vec3f lo = mesh.verts[verts[0]];
+    Vec3f hi = lo;
+    for (int i = 1; i < c.nverts; i++) {
+        const Vec3f& v = mesh.verts[verts[i]];
+        lo = Vec3f(std::min(lo.x, v.x), std::min(lo.y, v.y), std::min(lo.z, v.z));
+        hi = Vec3f(std::max(hi.x, v.x), std::max(hi.y, v.y), std::max(hi.z, v.z));
+    }
+    c.center = (lo + hi) * 0.5f;
+    float r2 = 0.0f;
+    for (int i = 0; i < c.nverts; i++) {
+        Vec3f d = mesh.verts[verts[i]] - c.center;
+        r2 = std::max(r2, d * d);
+    }
+    c.radius = std::sqrt(r2);
+
+    // cone around the mean normal; the eye is behind every face once the
+    // angle between the axis and the direction to the eye exceeds 90 degrees
+    // plus the cone half-angle (plus the sphere's angular size)
+    Vec3f sum(0, 0, 0);
+    for (int i = 0; i < c.nfaces; i++) sum = sum + normals[faces[i]];
+    float len = sum.norm();
+    if (!(len > 0)) return;
+    Vec3f axis = sum * (1.0f / len);
+
+    float min_dot = 1.0f;
+    for (int i = 0; i < c.nfaces; i++) {
+        const Vec3f& n = normals[faces[i]];
+        if (n * n == 0.0f) continue;
+        min_dot = std::min(min_dot, n * axis);
+    }
+    if (min_dot <= 0.0f) return;
+    c.cone_axis = axis;
+    // a little slack for rounding in the test
+    c.cone_cutoff = std::sqrt(std::max(0.0f, 1.0f - min_dot * min_dot)) + 1e-3f;
+}
+
+} // namespace
+
+void build_clusters(const MeshView& mesh, MeshClusters& out) {
+    out.clusters.clear();
+    out.faces.clear();
+    out.verts.clear();
+    out.face_cluster.assign(mesh.nfaces, -1);
+    if (mesh.nfaces == 0) return;
+
+    ThreadPool& pool = ThreadPool::shared();
+    std::vector<Vec3f> normals(mesh.nfaces);
+    pool.parallel_for((mesh.nfaces + 4095) / 4096, [&](int block) {
+        int end = std::min(mesh.nfaces, (block + 1) * 4096);
+        for (int f = block * 4096; f < end; f++) normals[f] = face_normal(mesh, f);
+    });
+
+    // faces around each vertex
+    std::vector<int> vert_face_begin(mesh.nverts + 1, 0);
+    for (int c = 0; c < mesh.ncorners; c++) {
+        int v = mesh.face_verts[c];
+        if (v >= 0 && v < mesh.nverts) vert_face_begin[v + 1]++;
+    }
+    for (int v = 0; v < mesh.nverts; v++) vert_face_begin[v + 1] += vert_face_begin[v];
+    std::vector<int> vert_faces(vert_face_begin[mesh.nverts]);
+    {
+        std::vector<int> fill(vert_face_begin.begin(), vert_face_begin.end() - 1);
+        for (int f = 0; f < mesh.nfaces; f++) {
+            for (int c = mesh.face_offsets[f]; c < mesh.face_offsets[f + 1]; c++) {
+                int v = mesh.face_verts[c];
+                if (v >= 0 && v < mesh.nverts) vert_faces[fill[v]++] = f;
+            }
+        }
+    }
+
+    std::vector<int> vert_stamp(mesh.nverts, -1);  // cluster that last listed the vertex
+    std::vector<int> face_stamp(mesh.nfaces, -1);  // cluster that last queued the face
+    std::vector<int> queue;
+    const float max_spread = 0.5f;                 // cos 60 degrees, from the mean normal so far
+
+    for (int seed = 0; seed < mesh.nfaces; seed++) {
+        if (out.face_cluster[seed] >= 0) continue;
+
+        int id = (int)out.clusters.size();
+        MeshCluster c = MeshCluster();
+        c.first_face = (int)out.faces.size();
+        c.first_vert = (int)out.verts.size();
+        Vec3f normal_sum(0, 0, 0);
+
+        queue.clear();
+        queue.push_back(seed);
+        face_stamp[seed] = id;
+        for (size_t head = 0; head < queue.size() && c.nfaces < cluster_max_faces; head++) {
+            int f = queue[head];
+            if (out.face_cluster[f] >= 0) continue;
+
+            // against the mean so far, which can drift from the seed as the
+            // cluster grows; the cone stored at the end bounds every face
+            const Vec3f& n = normals[f];
+            if (c.nfaces > 0 && n * n > 0.0f && normal_sum * normal_sum > 0.0f &&
+                n * normal_sum < max_spread * normal_sum.norm()) continue;
+
+            int fresh = 0;
+            for (int k = mesh.face_offsets[f]; k < mesh.face_offsets[f + 1]; k++) {
+                int v = mesh.face_verts[k];
+                if (v >= 0 && v < mesh.nverts && vert_stamp[v] != id) fresh++;
+            }
+            if (c.nfaces > 0 && c.nverts + fresh > cluster_max_verts) continue;
+
+            out.face_cluster[f] = id;
+            out.faces.push_back(f);
+            c.nfaces++;
+            normal_sum = normal_sum + n;
+            for (int k = mesh.face_offsets[f]; k < mesh.face_offsets[f + 1]; k++) {
+                int v = mesh.face_verts[k];
+                if (v < 0 || v >= mesh.nverts) continue;
+                if (vert_stamp[v] != id) {
+                    vert_stamp[v] = id;
+                    out.verts.push_back(v);
+                    c.nverts++;
+                }
+                for (int a = vert_face_begin[v]; a < vert_face_begin[v + 1]; a++) {
+                    int g = vert_faces[a];
+                    if (out.face_cluster[g] < 0 && face_stamp[g] != id) {
+                        face_stamp[g] = id;
+                        queue.push_back(g);
+                    }
+                }
+            }
+        }
+        out.clusters.push_back(c);
+    }
+
+    pool.parallel_for((int)out.clusters.size(), [&](int i) {
+        MeshCluster& cl = out.clusters[i];
+        cluster_bounds(mesh, &out.faces[cl.first_face], &out.verts[cl.first_vert], normals.data(), cl);
+    });
+}
@@ -0,0 +1,45 @@
+#ifndef MESHLET_H
+#define MESHLET_H
+
+#include <vector>
+#include "geometry.h"
+#include "mesh_cache.h"
+
+// A patch of neighbouring faces small enough to be culled as a unit.
+struct MeshCluster {
+    int first_face;    // into the cluster face list
+    int nfaces;
+    int first_vert;    // into the cluster vertex list: distinct vertices used by the faces
+    int nverts;
+    Vec3f center;      // bounding sphere
+    float radius;
+    // Normal cone of the faces, counter-clockwise winding taken as front:
+    // cone_cutoff is the sine of the largest angle between cone_axis and a
+    // face normal. Above 1 the cone is too wide to ever cull the cluster.
+    Vec3f cone_axis;
+    float cone_cutoff;
+};
+
+const int cluster_max_faces = 128;
+const int cluster_max_verts = 128;
+
+struct MeshClusters {
+    std::vector<MeshCluster> clusters;
+    std::vector<int> faces;        // face indices, grouped by cluster
+    std::vector<int> verts;        // vertex indices, grouped by cluster
+    std::vector<int> face_cluster; // cluster of every face
+};
+
+// Grows clusters of at most cluster_max_faces faces and cluster_max_verts
+// vertices outwards from a seed face across shared vertices, taking in only
+// faces within 60 degrees of the cluster's mean normal so the normal cones
+// stay narrow enough to cull.
+void build_clusters(const MeshView& mesh, MeshClusters& out);
+
+// True when no face of the cluster can face a camera at eye.
+inline bool cluster_backfacing(const MeshCluster& c, const Vec3f& eye) {
+    Vec3f d = c.center - eye;
+    return d * c.cone_axis >= c.cone_cutoff * d.norm() + c.radius;
+}
+
+#endif // MESHLET_H
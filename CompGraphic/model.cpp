@@ -1,96 +1,463 @@
 #include <iostream>
 #include <string>
-#include <fstream>
-#include <sstream>
+#include <cstring>
+#include <cmath>
 #include <vector>
+#include <algorithm>
 #include "model.h"
+#include "mapped_file.h"
+#include "thread_pool.h"
+#include "profiler.h"
 
-Model::Model(const char* filename) : verts_(), faces_(), norms_(), uv_() {
-    std::ifstream in;
-    in.open(filename, std::ifstream::in);
-    if (in.fail()) return;
-    std::string line;
-    while (!in.eof()) {
-        std::getline(in, line);
-        std::istringstream iss(line.c_str());
-        char trash;
-        if (!line.compare(0, 2, "v ")) {
-            iss >> trash;
+namespace {
+
+// Per-chunk parse output. Face indices from the file are stored 0-based and
+// absolute; negative (relative) indices can only be resolved once the number
+// of elements in earlier chunks is known, so they are stored relative to the
+// chunk start and listed in the *_rel arrays for fix-up while stitching.
+struct ObjChunk {
+    std::vector<Vec3f> verts;
+    std::vector<Vec3f> norms;
+    std::vector<Vec2f> uvs;
+    std::vector<int> face_sizes;
+    std::vector<int> fv, ft, fn;
+    std::vector<int> fv_rel, ft_rel, fn_rel;
+};
+
+const double pow10_table[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+inline bool is_digit(char c) { return c >= '0' && c <= '9'; }
+inline bool is_blank(char c) { return c == ' ' || c == '\t' || c == '\r'; }
+
+inline const char* skip_blanks(const char* p, const char* end) {
+    while (p < end && is_blank(*p)) p++;
+    return p;
+}
+
+// Locale-independent decimal parser. Returns p unchanged when there is no number.
+const char* parse_float(const char* p, const char* end, float& out) {
+    const char* start = p;
+    bool neg = false;
+    if (p < end && (*p == '-' || *p == '+')) neg = (*p++ == '-');
+
+    unsigned long long mant = 0;
+    int digits = 0;
+    int exp10 = 0;
+    bool any = false;
+    for (; p < end && is_digit(*p); p++) {
+        any = true;
+        if (digits < 19) {
+            mant = mant * 10 + (*p - '0');
+            if (mant) digits++;
+        }
+        else {
+            exp10++;
+        }
+    }
+    if (p < end && *p == '.') {
+        for (p++; p < end && is_digit(*p); p++) {
+            any = true;
+            if (digits < 19) {
+                mant = mant * 10 + (*p - '0');
+                if (mant) digits++;
+                exp10--;
+            }
+        }
+    }
+    if (!any) return start;
+
+    if (p < end && (*p == 'e' || *p == 'E')) {
+        const char* q = p + 1;
+        bool eneg = false;
+        if (q < end && (*q == '-' || *q == '+')) eneg = (*q++ == '-');
+        if (q < end && is_digit(*q)) {
+            int e = 0;
+            for (; q < end && is_digit(*q); q++) {
+                if (e < 10000) e = e * 10 + (*q - '0');
+            }
+            exp10 += eneg ? -e : e;
+            p = q;
+        }
+    }
+
+    double v = (double)mant;
+    if (exp10 < 0) v = exp10 >= -22 ? v / pow10_table[-exp10] : v * std::pow(10.0, exp10);
+    else if (exp10 > 0) v = exp10 <= 22 ? v * pow10_table[exp10] : v * std::pow(10.0, exp10);
+    out = (float)(neg ? -v : v);
+    return p;
+}
+
+const char* parse_int(const char* p, const char* end, int& out) {
+    const char* start = p;
+    bool neg = false;
+    if (p < end && (*p == '-' || *p == '+')) neg = (*p++ == '-');
+    if (p >= end || !is_digit(*p)) return start;
+    long long v = 0;
+    for (; p < end && is_digit(*p); p++) {
+        if (v < 0x7fffffff) v = v * 10 + (*p - '0');
+    }
+    out = (int)(neg ? -v : v);
+    return p;
+}
+
+template <class V>
+const char* parse_floats(const char* p, const char* end, V& v, int n) {
+    for (int i = 0; i < n; i++) {
+        p = skip_blanks(p, end);
+        p = parse_float(p, end, v[i]);
+    }
+    return p;
+}
+
+// Stores a 1-based (or negative, relative) OBJ index as described at ObjChunk.
+inline void push_index(int raw, int local_count, std::vector<int>& out, std::vector<int>& rel) {
+    if (raw < 0) {
+        rel.push_back((int)out.size());
+        out.push_back(local_count + raw);
+    }
+    else {
+        out.push_back(raw - 1);
+    }
+}
+
+void parse_face(const char* p, const char* end, ObjChunk& c) {
+    int corners = 0;
+    for (;;) {
+        p = skip_blanks(p, end);
+        int v = 0, t = 0, n = 0;
+        const char* q = parse_int(p, end, v);
+        if (q == p) break;
+        p = q;
+        if (p < end && *p == '/') {
+            p++;
+            p = parse_int(p, end, t);      // empty for the v//n form
+            if (p < end && *p == '/') {
+                p++;
+                p = parse_int(p, end, n);
+            }
+        }
+        push_index(v, (int)c.verts.size(), c.fv, c.fv_rel);
+        if (t) push_index(t, (int)c.uvs.size(), c.ft, c.ft_rel);
+        else c.ft.push_back(-1);
+        if (n) push_index(n, (int)c.norms.size(), c.fn, c.fn_rel);
+        else c.fn.push_back(-1);
+        corners++;
+        while (p < end && !is_blank(*p)) p++; // skip anything malformed in this corner
+    }
+    if (corners > 0) c.face_sizes.push_back(corners);
+}
+
+void parse_chunk(const char* p, const char* end, ObjChunk& c) {
+    while (p < end) {
+        const char* eol = (const char*)memchr(p, '\n', end - p);
+        if (!eol) eol = end;
+        const char* q = skip_blanks(p, eol);
+
+        if (eol - q >= 2 && q[0] == 'v' && is_blank(q[1])) {
             Vec3f v;
-            for (int i = 0; i < 3; i++) iss >> v[i];
-            verts_.push_back(v);
+            parse_floats(q + 2, eol, v, 3);
+            c.verts.push_back(v);
         }
-        else if (!line.compare(0, 3, "vn ")) {
-            iss >> trash >> trash;
+        else if (eol - q >= 3 && q[0] == 'v' && q[1] == 'n' && is_blank(q[2])) {
             Vec3f n;
-            for (int i = 0; i < 3; i++) iss >> n[i];
-            norms_.push_back(n);
+            parse_floats(q + 3, eol, n, 3);
+            c.norms.push_back(n);
         }
-        else if (!line.compare(0, 3, "vt ")) {
-            iss >> trash >> trash;
+        else if (eol - q >= 3 && q[0] == 'v' && q[1] == 't' && is_blank(q[2])) {
             Vec2f uv;
-            for (int i = 0; i < 2; i++) iss >> uv[i];
-            uv_.push_back(uv);
+            parse_floats(q + 3, eol, uv, 2);
+            c.uvs.push_back(uv);
+        }
+        else if (eol - q >= 2 && q[0] == 'f' && is_blank(q[1])) {
+            parse_face(q + 2, eol, c);
         }
-        else if (!line.compare(0, 2, "f ")) {
-            std::vector<Vec3i> f;
-            Vec3i tmp;
-            iss >> trash;
-            while (iss >> tmp[0] >> trash >> tmp[1] >> trash >> tmp[2]) {
-                for (int i = 0; i < 3; i++) tmp[i]--; 
-                f.push_back(tmp);
+        p = eol + 1;
+    }
+}
+
+void fix_relative(std::vector<int>& idx, const std::vector<int>& rel, int base) {
+    for (size_t i = 0; i < rel.size(); i++) idx[rel[i]] += base;
+}
+
+// "<name><suffix>" for the OBJ "<name>.obj", empty without an extension.
+std::string texture_path(const std::string& filename, const char* suffix) {
+    size_t dot = filename.find_last_of(".");
+    if (dot == std::string::npos) return std::string();
+    return filename.substr(0, dot) + suffix;
+}
+
+// Rescales every normal of the map to unit length, as near as bytes allow,
+// so shading can use level 0 texels without normalizing them again.
+void normalize_normals(TGAImage& normals) {
+    int bytespp = normals.get_bytespp();
+    if (!normals.buffer() || bytespp < 3) return;
+    unsigned char* p = normals.buffer();
+    size_t count = (size_t)normals.get_width() * normals.get_height();
+    for (size_t i = 0; i < count; i++, p += bytespp) {
+        Vec3f n(p[2] * (2.0f / 255.0f) - 1.0f, p[1] * (2.0f / 255.0f) - 1.0f, p[0] * (2.0f / 255.0f) - 1.0f);
+        float len = n.norm();
+        if (len == 0.0f) continue;
+        n = n * (1.0f / len);
+        p[2] = (unsigned char)std::lround((n.x + 1.0f) * 127.5f);
+        p[1] = (unsigned char)std::lround((n.y + 1.0f) * 127.5f);
+        p[0] = (unsigned char)std::lround((n.z + 1.0f) * 127.5f);
+    }
+}
+
+// Writes the first channel of the specular map into the alpha of the normal
+// map, made RGBA first if it is not, so shading gets both from one texel.
+bool pack_specular(TGAImage& normals, TGAImage& specular) {
+    int w = normals.get_width();
+    int h = normals.get_height();
+    int sw = specular.get_width();
+    int sh = specular.get_height();
+    if (!normals.buffer() || !specular.buffer() || w <= 0 || h <= 0 || sw <= 0 || sh <= 0) return false;
+
+    if (normals.get_bytespp() != TGAImage::RGBA) {
+        TGAImage rgba(w, h, TGAImage::RGBA);
+        for (int y = 0; y < h; y++) {
+            for (int x = 0; x < w; x++) {
+                TGAColor c = normals.get(x, y);
+                rgba.set(x, y, TGAColor(c.r, c.g, c.b, 255));
             }
-            faces_.push_back(f);
         }
+        normals = rgba;
     }
-    std::cerr << "# v# " << verts_.size() << " f# " << faces_.size() << " vt# " << uv_.size() << " vn# " << norms_.size() << std::endl;
-    load_texture(filename, "_diffuse.tga", diffusemap_);
+
+    unsigned char* dst = normals.buffer();
+    const unsigned char* src = specular.buffer();
+    int sbpp = specular.get_bytespp();
+    for (int y = 0; y < h; y++) {
+        int sy = (int)((long long)y * sh / h);
+        for (int x = 0; x < w; x++) {
+            int sx = (int)((long long)x * sw / w);
+            dst[(x + y * w) * 4 + 3] = src[(sx + sy * sw) * sbpp];
+        }
+    }
+    return true;
+}
+
+} // namespace
+
+Model::Model(const char* filename) : verts_(), face_offsets_(1, 0), face_verts_(), face_uvs_(), face_norms_(), norms_(), uv_(),
+    filename_(filename), normal_map_(false), surface_(false), specular_map_(false) {
+    PROFILE_SCOPE(STAGE_LOAD, "load model");
+    use_own_arrays();
+    if (open_mesh_cache(filename, cache_, mesh_)) {
+        std::cerr << "mesh cache " << mesh_cache_path(filename) << " ok" << std::endl;
+    }
+    else if (!load_obj(filename)) {
+        return;
+    }
+    std::cerr << "# v# " << mesh_.nverts << " f# " << mesh_.nfaces << " vt# " << mesh_.nuvs << " vn# " << mesh_.nnorms << std::endl;
+    build_clusters(mesh_, clusters_);
+    TGAImage diffusemap;
+    load_texture(filename, "_diffuse.tga", diffusemap);
+    // room for the normal map next to the diffuse texels, filled on demand
+    unsigned long long size;
+    long long mtime;
+    normal_map_ = diffusemap.buffer() && file_stat(texture_path(filename, "_nm.tga").c_str(), size, mtime);
+    diffuse_.build(diffusemap, normal_map_ ? 2 : 1);
+}
+
+// Flat shading never needs the normal and specular maps, so they are
+// decoded only when a shader first asks for them.
+void Model::load_surface() {
+    if (!normal_map_) return;
+    PROFILE_SCOPE(STAGE_LOAD, "load surface maps");
+    TGAImage normalmap;
+    load_texture(filename_, "_nm.tga", normalmap);
+    normalize_normals(normalmap);
+    TGAImage specularmap;
+    load_texture(filename_, "_spec.tga", specularmap);
+    bool packed = pack_specular(normalmap, specularmap);
+    if (!normalmap.buffer()) return;
+    if (normalmap.get_width() != diffuse_.width() || normalmap.get_height() != diffuse_.height()) {
+        normalmap.scale(diffuse_.width(), diffuse_.height());
+    }
+    surface_ = diffuse_.fill_layer(1, normalmap);
+    specular_map_ = surface_ && packed;
+}
+
+const Texture& Model::surface_texture() {
+    static const Texture none;
+    std::call_once(surface_once_, &Model::load_surface, this);
+    return surface_ ? diffuse_ : none;
+}
+
+bool Model::has_specular_map() {
+    std::call_once(surface_once_, &Model::load_surface, this);
+    return specular_map_;
+}
+
+void Model::use_own_arrays() {
+    mesh_.verts = verts_.data();
+    mesh_.uvs = uv_.data();
+    mesh_.norms = norms_.data();
+    mesh_.face_offsets = face_offsets_.data();
+    mesh_.face_verts = face_verts_.data();
+    mesh_.face_uvs = face_uvs_.data();
+    mesh_.face_norms = face_norms_.data();
+    mesh_.nverts = (int)verts_.size();
+    mesh_.nuvs = (int)uv_.size();
+    mesh_.nnorms = (int)norms_.size();
+    mesh_.nfaces = (int)face_offsets_.size() - 1;
+    mesh_.ncorners = (int)face_verts_.size();
+}
+
+// The file is memory-mapped and cut into chunks at line boundaries. Chunks are
+// parsed in parallel into their own arrays, which are then stitched together
+// in order, shifting relative face indices by the element counts before them.
+bool Model::load_obj(const char* filename) {
+    MappedFile file;
+    if (!file.open(filename)) return false;
+    const char* data = file.data();
+    size_t size = file.size();
+
+    ThreadPool& pool = ThreadPool::shared();
+    const size_t min_chunk = 1 << 20;
+    size_t nchunks = std::max<size_t>(1, std::min<size_t>((size_t)pool.size() * 4, size / min_chunk));
+
+    std::vector<size_t> bounds(nchunks + 1, size);
+    bounds[0] = 0;
+    for (size_t k = 1; k < nchunks; k++) {
+        size_t pos = std::max(bounds[k - 1], size * k / nchunks);
+        const char* nl = (const char*)memchr(data + pos, '\n', size - pos);
+        bounds[k] = nl ? (size_t)(nl - data) + 1 : size;
+    }
+
+    std::vector<ObjChunk> chunks(nchunks);
+    pool.parallel_for((int)nchunks, [&](int k) {
+        parse_chunk(data + bounds[k], data + bounds[k + 1], chunks[k]);
+    });
+
+    std::vector<size_t> vbase(nchunks + 1, 0), tbase(nchunks + 1, 0), nbase(nchunks + 1, 0);
+    std::vector<size_t> fbase(nchunks + 1, 0), cbase(nchunks + 1, 0);
+    for (size_t k = 0; k < nchunks; k++) {
+        vbase[k + 1] = vbase[k] + chunks[k].verts.size();
+        tbase[k + 1] = tbase[k] + chunks[k].uvs.size();
+        nbase[k + 1] = nbase[k] + chunks[k].norms.size();
+        fbase[k + 1] = fbase[k] + chunks[k].face_sizes.size();
+        cbase[k + 1] = cbase[k] + chunks[k].fv.size();
+    }
+
+    verts_.resize(vbase[nchunks]);
+    uv_.resize(tbase[nchunks]);
+    norms_.resize(nbase[nchunks]);
+    face_offsets_.resize(fbase[nchunks] + 1);
+    face_verts_.resize(cbase[nchunks]);
+    face_uvs_.resize(cbase[nchunks]);
+    face_norms_.resize(cbase[nchunks]);
+
+    pool.parallel_for((int)nchunks, [&](int k) {
+        ObjChunk& c = chunks[k];
+        fix_relative(c.fv, c.fv_rel, (int)vbase[k]);
+        fix_relative(c.ft, c.ft_rel, (int)tbase[k]);
+        fix_relative(c.fn, c.fn_rel, (int)nbase[k]);
+
+        std::copy(c.verts.begin(), c.verts.end(), verts_.begin() + vbase[k]);
+        std::copy(c.uvs.begin(), c.uvs.end(), uv_.begin() + tbase[k]);
+        std::copy(c.norms.begin(), c.norms.end(), norms_.begin() + nbase[k]);
+        std::copy(c.fv.begin(), c.fv.end(), face_verts_.begin() + cbase[k]);
+        std::copy(c.ft.begin(), c.ft.end(), face_uvs_.begin() + cbase[k]);
+        std::copy(c.fn.begin(), c.fn.end(), face_norms_.begin() + cbase[k]);
+
+        int offset = (int)cbase[k];
+        for (size_t f = 0; f < c.face_sizes.size(); f++) {
+            offset += c.face_sizes[f];
+            face_offsets_[fbase[k] + f + 1] = offset;
+        }
+        c = ObjChunk(); // release the chunk as soon as it is copied
+    });
+
+    use_own_arrays();
+    if (mesh_.nverts > 0) write_mesh_cache(filename, data, size, mesh_);
+    return true;
 }
 
 Model::~Model() {
 }
 
 int Model::nverts() {
-    return (int)verts_.size();
+    return mesh_.nverts;
 }
 
 int Model::nfaces() {
-    return (int)faces_.size();
+    return mesh_.nfaces;
 }
 
 std::vector<int> Model::face(int idx) {
-    std::vector<int> face;
-    for (int i = 0; i < (int)faces_[idx].size(); i++) face.push_back(faces_[idx][i][0]);
-    return face;
+    const int* verts = face_verts(idx);
+    return std::vector<int>(verts, verts + face_size(idx));
+}
+
+int Model::face_size(int idx) {
+    return mesh_.face_offsets[idx + 1] - mesh_.face_offsets[idx];
+}
+
+const int* Model::face_verts(int idx) {
+    return mesh_.face_verts + mesh_.face_offsets[idx];
+}
+
+const int* Model::face_uvs(int idx) {
+    return mesh_.face_uvs + mesh_.face_offsets[idx];
+}
+
+const int* Model::face_norms(int idx) {
+    return mesh_.face_norms + mesh_.face_offsets[idx];
+}
+
+int Model::nclusters() {
+    return (int)clusters_.clusters.size();
+}
+
+const MeshCluster& Model::cluster(int idx) {
+    return clusters_.clusters[idx];
+}
+
+const int* Model::cluster_faces(int idx) {
+    return clusters_.faces.data() + clusters_.clusters[idx].first_face;
+}
+
+const int* Model::cluster_verts(int idx) {
+    return clusters_.verts.data() + clusters_.clusters[idx].first_vert;
+}
+
+int Model::face_cluster(int iface) {
+    return clusters_.face_cluster[iface];
 }
 
 Vec3f Model::vert(int i) {
-    return verts_[i];
+    return mesh_.verts[i];
+}
+
+const Vec3f* Model::verts() {
+    return mesh_.verts;
 }
 
 void Model::load_texture(std::string filename, const char* suffix, TGAImage& img) {
-    std::string texfile(filename);
-    size_t dot = texfile.find_last_of(".");
-    if (dot != std::string::npos) {
-        texfile = texfile.substr(0, dot) + std::string(suffix);
+    std::string texfile = texture_path(filename, suffix);
+    if (!texfile.empty()) {
         std::cerr << "texture file " << texfile << " loading " << (img.read_tga_file(texfile.c_str()) ? "ok" : "failed") << std::endl;
         img.flip_vertically();
     }
 }
 
 TGAColor Model::diffuse(Vec2i uv) {
-    int u = std::max(0, std::min(diffusemap_.get_width() - 1, uv.x));
-    int v = std::max(0, std::min(diffusemap_.get_height() - 1, uv.y));
-    return diffusemap_.get(u, v);
+    return diffuse_.get(uv.x, uv.y);
 }
 
 Vec2i Model::uv(int iface, int nvert) {
-    int idx = faces_[iface][nvert][1];
-    int u = (int)(uv_[idx].x * (float)diffusemap_.get_width());
-    int v = (int)(uv_[idx].y * (float)diffusemap_.get_height());
+    int idx = mesh_.face_uvs[mesh_.face_offsets[iface] + nvert];
+    if (idx < 0 || idx >= mesh_.nuvs) return Vec2i(0, 0);
+    int u = (int)(mesh_.uvs[idx].x * (float)diffuse_.width());
+    int v = (int)(mesh_.uvs[idx].y * (float)diffuse_.height());
 
-    u = std::max(0, std::min(diffusemap_.get_width() - 1, u));
-    v = std::max(0, std::min(diffusemap_.get_height() - 1, v));
+    u = std::max(0, std::min(diffuse_.width() - 1, u));
+    v = std::max(0, std::min(diffuse_.height() - 1, v));
 
     return Vec2i(u, v);
 }
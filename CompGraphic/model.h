@@ -1,27 +1,76 @@
 #ifndef __MODEL_H__
 #define __MODEL_H__
 
+#include <mutex>
+#include <string>
 #include <vector>
 #include "geometry.h"
 #include "tgaimage.h"
+#include "mapped_file.h"
+#include "mesh_cache.h"
+#include "meshlet.h"
+#include "texture.h"
 
 class Model {
 private:
 	std::vector<Vec3f> verts_;  // vershins (x, y, z)
-	std::vector<std::vector<Vec3i> > faces_;   // grani 
+	// grani: corner indices of all faces back to back, face i owns
+	// corners [face_offsets_[i], face_offsets_[i + 1])
+	std::vector<int> face_offsets_;
+	std::vector<int> face_verts_;
+	std::vector<int> face_uvs_;
+	std::vector<int> face_norms_;
 	std::vector<Vec3f> norms_; // normali vershin
 	std::vector<Vec2f> uv_;  // texture coordinats (u, v)
-	TGAImage diffusemap_; // diffusnai texture
+	// what the accessors read: the arrays above, or a mapped mesh cache
+	MeshView mesh_;
+	MappedFile cache_;
+	MeshClusters clusters_;
+	// diffusnai texture, with mip levels. Where "<name>_nm.tga" exists it
+	// has a layer 1 for per-pixel shading, filled the first time a shader
+	// asks for it: object-space normals, made unit length, in rgb and the
+	// highlight exponent from "<name>_spec.tga" in alpha
+	Texture diffuse_;
+	std::string filename_;
+	bool normal_map_;              // diffuse_ has layer 1
+	std::once_flag surface_once_;
+	bool surface_;                 // layer 1 is filled
+	bool specular_map_;
+	void load_surface();
 	void load_texture(std::string filename, const char* suffix, TGAImage& img);
+	bool load_obj(const char* filename);
+	void use_own_arrays();
+	Model(const Model&);
+	Model& operator =(const Model&);
 public:
+	// Loads from "<filename>.mcache" when it matches the OBJ, otherwise
+	// parses the OBJ and writes the cache for the next run.
 	Model(const char* filename);
 	~Model();
 	int nverts();
 	int nfaces();
 	Vec3f vert(int i);
+	const Vec3f* verts();
 	Vec2i uv(int iface, int nvert);
 	TGAColor diffuse(Vec2i uv);
+	// Filtered lookup at texel coordinates (u, v), lod as texture_lod() gives it.
+	TGAColor diffuse(float u, float v, float lod, TextureFilter filter) { return diffuse_.sample(u, v, lod, filter); }
+	const Texture& diffuse_texture() { return diffuse_; }
+	// The diffuse texture with the normal map in layer 1, or an empty
+	// texture without one; the maps are loaded on the first call.
+	const Texture& surface_texture();
+	bool has_specular_map(); // alpha of surface layer 1 is valid
 	std::vector<int> face(int idx);
+	int face_size(int idx);
+	const int* face_verts(int idx); // vertex indices of the face corners, no copy
+	const int* face_uvs(int idx);
+	const int* face_norms(int idx);
+	// Faces in patches of up to 128, built at load time for culling.
+	int nclusters();
+	const MeshCluster& cluster(int idx);
+	const int* cluster_faces(int idx);
+	const int* cluster_verts(int idx); // distinct vertex indices of the cluster's faces
+	int face_cluster(int iface);
 };
 
 #endif //__MODEL_H__
\ No newline at end of file
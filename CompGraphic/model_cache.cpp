@@ -0,0 +1,99 @@
+#include "model_cache.h"
+#include "mapped_file.h"
+
+ModelCache::ModelCache(int capacity, Vec3f light_dir) : capacity_(capacity), light_dir_(light_dir) {
+    stats_.hits = 0;
+    stats_.misses = 0;
+    stats_.evictions = 0;
+    stats_.reloads = 0;
+}
+
+void ModelCache::erase(std::list<Entry>::iterator it) {
+    index_.erase(it->path);
+    entries_.erase(it);
+}
+
+std::shared_ptr<Model> ModelCache::get(const std::string& path, std::string& error, bool* hit,
+    const ModelPrep** prep) {
+    unsigned long long size;
+    long long mtime;
+    if (!file_stat(path.c_str(), size, mtime)) {
+        error = "can't open file " + path;
+        return nullptr;
+    }
+
+    ModelFuture future;
+    std::promise<std::shared_ptr<Loaded> > promise;
+    bool load = false;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        std::map<std::string, std::list<Entry>::iterator>::iterator found = index_.find(path);
+        if (found != index_.end() && (found->second->size != size || found->second->mtime != mtime)) {
+            erase(found->second);
+            found = index_.end();
+            stats_.reloads++;
+        }
+        if (found != index_.end()) {
+            entries_.splice(entries_.begin(), entries_, found->second);
+            future = found->second->model;
+            stats_.hits++;
+        }
+        else {
+            future = promise.get_future().share();
+            load = true;
+            stats_.misses++;
+            if (capacity_ > 0) {
+                Entry entry = { path, size, mtime, future };
+                entries_.push_front(entry);
+                index_[path] = entries_.begin();
+                while ((int)entries_.size() > capacity_) {
+                    erase(--entries_.end());
+                    stats_.evictions++;
+                }
+            }
+        }
+    }
+    if (hit) *hit = !load;
+
+    if (load) {
+        // outside the lock: other paths load and hit meanwhile
+        std::shared_ptr<Loaded> loaded(new Loaded(path.c_str()));
+        if (loaded->model.nverts() > 0) {
+            prepare_model(&loaded->model, light_dir_, loaded->prep);
+        }
+        else {
+            loaded.reset();
+            std::lock_guard<std::mutex> lock(mutex_);
+            std::map<std::string, std::list<Entry>::iterator>::iterator found = index_.find(path);
+            // a failed load is not kept, the next request tries again
+            if (found != index_.end() && found->second->mtime == mtime && found->second->size == size) {
+                erase(found->second);
+            }
+        }
+        promise.set_value(loaded);
+    }
+
+    std::shared_ptr<Loaded> loaded = future.get();
+    if (!loaded) {
+        error = "can't load " + path;
+        return nullptr;
+    }
+    if (prep) *prep = &loaded->prep;
+    return std::shared_ptr<Model>(loaded, &loaded->model);
+}
+
+void ModelCache::clear() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    entries_.clear();
+    index_.clear();
+}
+
+int ModelCache::size() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return (int)entries_.size();
+}
+
+ModelCacheStats ModelCache::stats() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return stats_;
+}
@@ -0,0 +1,67 @@
+#ifndef MODEL_CACHE_H
+#define MODEL_CACHE_H
+
+#include <future>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include "model.h"
+#include "renderer.h"
+
+struct ModelCacheStats {
+    long long hits;
+    long long misses;     // loads, failed ones included
+    long long evictions;  // least recently used entries dropped at capacity
+    long long reloads;    // entries dropped because the OBJ changed on disk
+};
+
+// Loaded models with their textures and their ModelPrep for the cache's
+// light, least recently used first out. An entry is keyed by the OBJ path
+// and is only reused while the file's size and modification time are
+// unchanged. Callers share the Model, so an evicted one stays valid until
+// the last of them lets go. A model is loaded once however many threads ask
+// for it at the same time; the others wait for that load.
+class ModelCache {
+private:
+    struct Loaded {
+        Model model;
+        ModelPrep prep;
+        explicit Loaded(const char* path) : model(path) {}
+    };
+    typedef std::shared_future<std::shared_ptr<Loaded> > ModelFuture;
+    struct Entry {
+        std::string path;
+        unsigned long long size;
+        long long mtime;
+        ModelFuture model;
+    };
+
+    int capacity_;
+    Vec3f light_dir_;
+    std::mutex mutex_;
+    std::list<Entry> entries_;  // most recently used first
+    std::map<std::string, std::list<Entry>::iterator> index_;
+    ModelCacheStats stats_;
+
+    void erase(std::list<Entry>::iterator it);
+    ModelCache(const ModelCache&);
+    ModelCache& operator =(const ModelCache&);
+public:
+    // capacity 0 loads every model anew, as separate runs would. light_dir
+    // is the light the models are prepared for.
+    ModelCache(int capacity, Vec3f light_dir);
+
+    // nullptr with error set when the file is missing or has no vertices.
+    // prep, if given, is pointed at the model's ModelPrep, which lives as
+    // long as the returned pointer.
+    std::shared_ptr<Model> get(const std::string& path, std::string& error, bool* hit = nullptr,
+        const ModelPrep** prep = nullptr);
+    void clear();
+
+    int size();
+    ModelCacheStats stats();
+};
+
+#endif // MODEL_CACHE_H
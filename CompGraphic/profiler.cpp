@@ -0,0 +1,150 @@
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include "profiler.h"
+
+std::atomic<bool> Profiler::enabled_(false);
+
+static const std::chrono::steady_clock::time_point profile_epoch = std::chrono::steady_clock::now();
+
+Profiler::Profiler() : dropped_(0) {
+    for (int s = 0; s < STAGE_COUNT; s++) {
+        stage_ns_[s] = 0;
+        stage_calls_[s] = 0;
+    }
+    for (int c = 0; c < COUNTER_COUNT; c++) counters_[c] = 0;
+}
+
+Profiler& Profiler::instance() {
+    static Profiler profiler;
+    return profiler;
+}
+
+long long Profiler::now_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - profile_epoch).count();
+}
+
+Profiler::ThreadEvents& Profiler::local_events() {
+    thread_local ThreadEvents* local = nullptr;
+    if (!local) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        threads_.emplace_back(new ThreadEvents());
+        local = threads_.back().get();
+        local->thread = (int)threads_.size() - 1;
+    }
+    return *local;
+}
+
+void Profiler::record(ProfileStage stage, const char* name, long long start_ns, long long duration_ns) {
+    stage_ns_[stage].fetch_add(duration_ns, std::memory_order_relaxed);
+    stage_calls_[stage].fetch_add(1, std::memory_order_relaxed);
+    if (!name) return;
+    ThreadEvents& local = local_events();
+    if ((int)local.events.size() >= max_events) {
+        dropped_.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    ProfileEvent event = { name, stage, start_ns, duration_ns };
+    local.events.push_back(event);
+}
+
+void Profiler::reset() {
+    for (int s = 0; s < STAGE_COUNT; s++) {
+        stage_ns_[s] = 0;
+        stage_calls_[s] = 0;
+    }
+    for (int c = 0; c < COUNTER_COUNT; c++) counters_[c] = 0;
+    dropped_ = 0;
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (size_t t = 0; t < threads_.size(); t++) threads_[t]->events.clear();
+}
+
+long long Profiler::events() const {
+    long long n = 0;
+    for (size_t t = 0; t < threads_.size(); t++) n += (long long)threads_[t]->events.size();
+    return n;
+}
+
+const char* Profiler::stage_name(ProfileStage stage) {
+    static const char* names[STAGE_COUNT] = { "load", "transform", "cull", "raster", "shade", "blend", "encode", "write" };
+    return names[stage];
+}
+
+const char* Profiler::counter_name(ProfileCounter counter) {
+    static const char* names[COUNTER_COUNT] = { "triangles_in", "triangles_culled", "fragments_tested",
+        "fragments_passed", "fragments_shaded", "pixels_covered" };
+    return names[counter];
+}
+
+static bool open_output(const char* filename, std::ofstream& file, std::ostream*& out) {
+    if (std::string(filename) == "-") {
+        out = &std::cout;
+        return true;
+    }
+    file.open(filename);
+    if (!file.is_open()) {
+        std::cerr << "can't open file " << filename << "\n";
+        return false;
+    }
+    out = &file;
+    return true;
+}
+
+bool Profiler::write_json(const char* filename) const {
+    std::ofstream file;
+    std::ostream* out;
+    if (!open_output(filename, file, out)) return false;
+
+    *out << "{\n  \"stages\": {";
+    for (int s = 0; s < STAGE_COUNT; s++) {
+        *out << (s ? "," : "") << "\n    \"" << stage_name((ProfileStage)s) << "\": { \"ms\": "
+            << std::fixed << std::setprecision(3) << stage_ms((ProfileStage)s) << std::defaultfloat
+            << ", \"calls\": " << stage_calls((ProfileStage)s) << " }";
+    }
+    *out << "\n  },\n  \"counters\": {";
+    for (int c = 0; c < COUNTER_COUNT; c++) {
+        *out << (c ? "," : "") << "\n    \"" << counter_name((ProfileCounter)c) << "\": " << counter((ProfileCounter)c);
+    }
+    long long covered = counter(COUNTER_PIXELS_COVERED);
+    double overdraw = covered > 0 ? (double)counter(COUNTER_FRAGMENTS_SHADED) / covered : 0.0;
+    *out << "\n  },\n  \"overdraw\": " << std::fixed << std::setprecision(3) << overdraw << std::defaultfloat
+        << ",\n  \"events\": " << events() << ",\n  \"events_dropped\": " << dropped_.load() << "\n}\n";
+    out->flush();
+    return out->good();
+}
+
+bool Profiler::write_trace(const char* filename) const {
+    std::ofstream file;
+    std::ostream* out;
+    if (!open_output(filename, file, out)) return false;
+
+    // complete ("X") events in microseconds, one trace thread per recording thread
+    *out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+    bool first = true;
+    long long end_ns = 0;
+    *out << std::fixed << std::setprecision(3);
+    for (size_t t = 0; t < threads_.size(); t++) {
+        const ThreadEvents& te = *threads_[t];
+        for (size_t i = 0; i < te.events.size(); i++) {
+            const ProfileEvent& e = te.events[i];
+            *out << (first ? "\n" : ",\n") << "{\"name\":\"" << e.name << "\",\"cat\":\"" << stage_name(e.stage)
+                << "\",\"ph\":\"X\",\"ts\":" << e.start_ns * 1e-3 << ",\"dur\":" << e.duration_ns * 1e-3
+                << ",\"pid\":1,\"tid\":" << te.thread << "}";
+            first = false;
+            end_ns = std::max(end_ns, e.start_ns + e.duration_ns);
+        }
+    }
+    // the counters once, at the end of the trace
+    for (int c = 0; c < COUNTER_COUNT; c++) {
+        *out << (first ? "\n" : ",\n") << "{\"name\":\"" << counter_name((ProfileCounter)c)
+            << "\",\"ph\":\"C\",\"ts\":" << end_ns * 1e-3 << ",\"pid\":1,\"args\":{\"value\":"
+            << counter((ProfileCounter)c) << "}}";
+        first = false;
+    }
+    *out << std::defaultfloat << "\n]}\n";
+    out->flush();
+    return out->good();
+}
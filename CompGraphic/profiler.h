@@ -0,0 +1,123 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+// Build with PROFILING=0 to compile every PROFILE_* macro away. Compiled in,
+// the profiler still records nothing until Profiler::set_enabled(true); a
+// disabled scope costs one relaxed atomic load.
+#ifndef PROFILING
+#define PROFILING 1
+#endif
+
+enum ProfileStage {
+    STAGE_LOAD,       // model and texture files
+    STAGE_TRANSFORM,  // vertices to screen space and per-face setup
+    STAGE_CULL,       // cluster culling
+    STAGE_RASTER,     // binning and tiles, including the shading and blending inside them
+    STAGE_SHADE,      // fragment shaders and deferred lighting
+    STAGE_BLEND,      // transparent triangles and OIT compositing
+    STAGE_ENCODE,     // framebuffer to TGAImage and TGA encoding
+    STAGE_WRITE,      // file output
+    STAGE_COUNT
+};
+
+enum ProfileCounter {
+    COUNTER_TRIANGLES_IN,      // model faces given to render_model
+    COUNTER_TRIANGLES_CULLED,  // of those, dropped by cluster, frustum or back-face culling
+    COUNTER_FRAGMENTS_TESTED,  // covered pixels that reached the depth test
+    COUNTER_FRAGMENTS_PASSED,
+    COUNTER_FRAGMENTS_SHADED,
+    COUNTER_PIXELS_COVERED,    // pixels drawn in finished frames; overdraw = shaded / covered
+    COUNTER_COUNT
+};
+
+struct ProfileEvent {
+    const char* name;
+    ProfileStage stage;
+    long long start_ns;     // since the profiler was created
+    long long duration_ns;
+};
+
+// Process-wide timings and counters. Stage totals and counters are atomics;
+// timed events go to a buffer per thread, so recording takes no lock after
+// a thread's first event. reset() and the writers must not run while
+// anything is being recorded.
+class Profiler {
+private:
+    struct ThreadEvents {
+        int thread;
+        std::vector<ProfileEvent> events;
+    };
+
+    static std::atomic<bool> enabled_;
+    std::atomic<long long> stage_ns_[STAGE_COUNT];
+    std::atomic<long long> stage_calls_[STAGE_COUNT];
+    std::atomic<long long> counters_[COUNTER_COUNT];
+    std::atomic<long long> dropped_;
+    std::mutex mutex_;
+    std::vector<std::unique_ptr<ThreadEvents> > threads_;
+
+    Profiler();
+    ThreadEvents& local_events();
+public:
+    // Events kept per thread; later ones only count towards the totals.
+    static const int max_events = 1 << 20;
+
+    static Profiler& instance();
+    static bool enabled() { return enabled_.load(std::memory_order_relaxed); }
+    static void set_enabled(bool enabled) { enabled_.store(enabled, std::memory_order_relaxed); }
+    static long long now_ns();
+
+    // name == nullptr adds to the stage total only, for scopes too short
+    // or too frequent to be worth a trace event each.
+    void record(ProfileStage stage, const char* name, long long start_ns, long long duration_ns);
+    void count(ProfileCounter counter, long long n) { counters_[counter].fetch_add(n, std::memory_order_relaxed); }
+    void reset();
+
+    double stage_ms(ProfileStage stage) const { return stage_ns_[stage].load() * 1e-6; }
+    long long stage_calls(ProfileStage stage) const { return stage_calls_[stage].load(); }
+    long long counter(ProfileCounter counter) const { return counters_[counter].load(); }
+    long long events() const;
+
+    // Stage totals, counters and overdraw as one JSON object; "-" writes
+    // to stdout.
+    bool write_json(const char* filename) const;
+    // Every event in Chrome trace-event format, for chrome://tracing or
+    // Perfetto.
+    bool write_trace(const char* filename) const;
+
+    static const char* stage_name(ProfileStage stage);
+    static const char* counter_name(ProfileCounter counter);
+};
+
+// Times its own lifetime into a stage.
+class ProfileScope {
+private:
+    ProfileStage stage_;
+    const char* name_;
+    long long start_;  // -1 when the profiler was off on entry
+public:
+    explicit ProfileScope(ProfileStage stage, const char* name = nullptr)
+        : stage_(stage), name_(name), start_(Profiler::enabled() ? Profiler::now_ns() : -1) {}
+    ~ProfileScope() {
+        if (start_ >= 0) Profiler::instance().record(stage_, name_, start_, Profiler::now_ns() - start_);
+    }
+};
+
+#define PROFILE_CONCAT_(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_(a, b)
+
+#if PROFILING
+#define PROFILE_SCOPE(stage, name) ProfileScope PROFILE_CONCAT(profile_scope_, __LINE__)(stage, name)
+#define PROFILE_COUNT(counter, n) \
+    do { if (Profiler::enabled()) Profiler::instance().count(counter, n); } while (0)
+#else
+#define PROFILE_SCOPE(stage, name) ((void)0)
+#define PROFILE_COUNT(counter, n) ((void)0)
+#endif
+
+#endif // PROFILER_H
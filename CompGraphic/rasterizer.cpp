@@ -0,0 +1,1090 @@
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include "rasterizer.h"
+#include "thread_pool.h"
+#include "deferred.h"
+#include "profiler.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define RASTER_SSE2 1
+#include <emmintrin.h>
+#endif
+
+// Edge functions are evaluated in 32-bit lanes; triangles reaching further
+// out than this fall back to the scanline path to stay clear of overflow.
+static const int guard_band = 4096;
+static const int block_size = 8;
+// composite_layers sorts a pixel's fragments in a fixed array
+static const int layer_limit = 64;
+
+TGAColor blend_colors(const TGAColor& bg, const TGAColor& fg) {
+    float alpha = fg.a / 255.0f;
+
+    unsigned char r = static_cast<unsigned char>(bg.r * (1.0f - alpha) + fg.r * alpha);
+    unsigned char g = static_cast<unsigned char>(bg.g * (1.0f - alpha) + fg.g * alpha);
+    unsigned char b = static_cast<unsigned char>(bg.b * (1.0f - alpha) + fg.b * alpha);
+
+    return TGAColor(r, g, b, 255);
+}
+
+Rasterizer::Rasterizer(Framebuffer& framebuffer, ThreadPool* pool)
+    : framebuffer_(framebuffer), color_(framebuffer.color()), zbuffer_(framebuffer.depth()),
+    width_(framebuffer.get_width()), height_(framebuffer.get_height()), tile_size_(framebuffer.get_tile_size()),
+    tiles_x_(framebuffer.tiles_x()), tiles_y_(framebuffer.tiles_y()), pool_(pool), mode_(RASTER_SCANLINE), draw_mode_(DRAW_IMMEDIATE),
+    filter_(TEXTURE_NEAREST), shader_(nullptr), gbuffer_(nullptr), transparency_(TRANSPARENCY_BLEND),
+    max_layers_(8), max_fragments_(0), arena_used_(0) {
+    bins_.resize(tiles_x_ * tiles_y_);
+    tile_stats_.resize(tiles_x_ * tiles_y_);
+    tile_visible_.resize(tiles_x_ * tiles_y_);
+
+    // one depth bound per 8x8 block; set_hiz() keeps culling off when the
+    // blocks would straddle tiles and be shared by two workers
+    hiz_w_ = (width_ + block_size - 1) / block_size;
+    hiz_h_ = (height_ + block_size - 1) / block_size;
+    hiz_min_.resize(hiz_w_ * hiz_h_);
+    hiz_dirty_.resize(hiz_w_ * hiz_h_, 1);
+    set_hiz(true);
+}
+
+void Rasterizer::set_layer_limits(int max_fragments, int max_layers) {
+    max_fragments_ = std::max(0, max_fragments);
+    max_layers_ = std::max(1, std::min(layer_limit, max_layers));
+}
+
+// Snaps the vertices to 1/16 pixel and sets up the attribute planes from the
+// snapped positions, so neighbouring triangles agree on their shared edges.
+static SubpixelTriangle setup_subpixel(const RasterVertex& a, const RasterVertex& b, const RasterVertex& c) {
+    const RasterVertex* v[3] = { &a, &b, &c };
+    SubpixelTriangle s;
+    for (int i = 0; i < 3; i++) {
+        s.X[i] = (int)std::floor(v[i]->x * 16.0f + 0.5f);
+        s.Y[i] = (int)std::floor(v[i]->y * 16.0f + 0.5f);
+    }
+
+    long long area = (long long)(s.X[1] - s.X[0]) * (s.Y[2] - s.Y[0]) - (long long)(s.Y[1] - s.Y[0]) * (s.X[2] - s.X[0]);
+    s.valid = area != 0;
+    if (!s.valid) return s;
+    if (area < 0) {
+        std::swap(v[1], v[2]);
+        std::swap(s.X[1], s.X[2]);
+        std::swap(s.Y[1], s.Y[2]);
+    }
+
+    s.x0 = s.X[0] / 16.0f;
+    s.y0 = s.Y[0] / 16.0f;
+    double dx1 = (s.X[1] - s.X[0]) / 16.0, dy1 = (s.Y[1] - s.Y[0]) / 16.0;
+    double dx2 = (s.X[2] - s.X[0]) / 16.0, dy2 = (s.Y[2] - s.Y[0]) / 16.0;
+    double inv_det = 1.0 / (dx1 * dy2 - dy1 * dx2);
+
+    // f at v0 and its gradient from f1 - f0 and f2 - f0
+    auto plane = [&](float f0, float f1, float f2, float& f, float& dfdx, float& dfdy) {
+        double d1 = (double)f1 - f0;
+        double d2 = (double)f2 - f0;
+        f = f0;
+        dfdx = (float)((d1 * dy2 - d2 * dy1) * inv_det);
+        dfdy = (float)((d2 * dx1 - d1 * dx2) * inv_det);
+    };
+    float q[3];
+    for (int i = 0; i < 3; i++) q[i] = v[i]->w != 0.0f ? 1.0f / v[i]->w : 1.0f;
+    plane(v[0]->z, v[1]->z, v[2]->z, s.z0, s.dzdx, s.dzdy);
+    plane(q[0], q[1], q[2], s.q0, s.dqdx, s.dqdy);
+    plane(v[0]->uv.x * q[0], v[1]->uv.x * q[1], v[2]->uv.x * q[2], s.u0, s.dudx, s.dudy);
+    plane(v[0]->uv.y * q[0], v[1]->uv.y * q[1], v[2]->uv.y * q[2], s.v0, s.dvdx, s.dvdy);
+    return s;
+}
+
+static bool offscreen(const Vec3i& t0, const Vec3i& t1, const Vec3i& t2, int width, int height) {
+    if (t0.y < 0 && t1.y < 0 && t2.y < 0) return true;
+    if (t0.y >= height && t1.y >= height && t2.y >= height) return true;
+    if (t0.x < 0 && t1.x < 0 && t2.x < 0) return true;
+    if (t0.x >= width && t1.x >= width && t2.x >= width) return true;
+    return false;
+}
+
+void Rasterizer::triangle(Vec3i t0, Vec3i t1, Vec3i t2, Vec2i uv0, Vec2i uv1, Vec2i uv2,
+    float intensity, bool is_transparent, TGAColor color, Model* model, Vec3f view_dir,
+    Vec3f normal) {
+
+    if (offscreen(t0, t1, t2, width_, height_)) return;
+
+    if (t0.y == t1.y && t0.y == t2.y) return;
+
+    if (mode_ == RASTER_SUBPIXEL) {
+        const Vec3i* t[3] = { &t0, &t1, &t2 };
+        const Vec2i* uv[3] = { &uv0, &uv1, &uv2 };
+        RasterVertex v[3];
+        for (int i = 0; i < 3; i++) {
+            v[i].x = (float)t[i]->x;
+            v[i].y = (float)t[i]->y;
+            v[i].z = (float)t[i]->z;
+            v[i].w = 1.0f;
+            v[i].uv = Vec2f((float)uv[i]->x, (float)uv[i]->y);
+        }
+        subpixel_.push_back(setup_subpixel(v[0], v[1], v[2]));
+    }
+
+    if (t0.y > t1.y) { std::swap(t0, t1); std::swap(uv0, uv1); }
+    if (t0.y > t2.y) { std::swap(t0, t2); std::swap(uv0, uv2); }
+    if (t1.y > t2.y) { std::swap(t1, t2); std::swap(uv1, uv2); }
+
+    RasterTriangle tri;
+    tri.t0 = t0; tri.t1 = t1; tri.t2 = t2;
+    tri.uv0 = uv0; tri.uv1 = uv1; tri.uv2 = uv2;
+    tri.intensity = intensity;
+    tri.is_transparent = is_transparent;
+    tri.color = color;
+    tri.model = model;
+    tri.view_dir = view_dir;
+    tri.normal = normal;
+    tris_.push_back(tri);
+}
+
+void Rasterizer::triangle(const RasterVertex& v0, const RasterVertex& v1, const RasterVertex& v2,
+    float intensity, bool is_transparent, TGAColor color, Model* model, Vec3f view_dir,
+    Vec3f normal) {
+    const RasterVertex* v[3] = { &v0, &v1, &v2 };
+    Vec3i t[3];
+    Vec2i uv[3];
+    for (int i = 0; i < 3; i++) {
+        t[i] = Vec3i((int)(v[i]->x + 0.5f), (int)(v[i]->y + 0.5f), (int)v[i]->z);
+        uv[i] = Vec2i((int)(v[i]->uv.x + 0.5f), (int)(v[i]->uv.y + 0.5f));
+    }
+    if (mode_ != RASTER_SUBPIXEL) {
+        triangle(t[0], t[1], t[2], uv[0], uv[1], uv[2], intensity, is_transparent, color, model, view_dir, normal);
+        return;
+    }
+
+    // the rounded vertices still bound the covered pixel centers, so binning
+    // and the depth bounds work from them; a triangle rounding to a single row
+    // can cover pixels of it here and is kept
+    if (offscreen(t[0], t[1], t[2], width_, height_)) return;
+    SubpixelTriangle sub = setup_subpixel(v0, v1, v2);
+    if (!sub.valid) return;
+
+    if (t[0].y > t[1].y) { std::swap(t[0], t[1]); std::swap(uv[0], uv[1]); }
+    if (t[0].y > t[2].y) { std::swap(t[0], t[2]); std::swap(uv[0], uv[2]); }
+    if (t[1].y > t[2].y) { std::swap(t[1], t[2]); std::swap(uv[1], uv[2]); }
+
+    RasterTriangle tri;
+    tri.t0 = t[0]; tri.t1 = t[1]; tri.t2 = t[2];
+    tri.uv0 = uv[0]; tri.uv1 = uv[1]; tri.uv2 = uv[2];
+    tri.intensity = intensity;
+    tri.is_transparent = is_transparent;
+    tri.color = color;
+    tri.model = model;
+    tri.view_dir = view_dir;
+    tri.normal = normal;
+    tris_.push_back(tri);
+    subpixel_.push_back(sub);
+}
+
+void Rasterizer::bin_triangles() {
+    for (size_t i = 0; i < bins_.size(); i++) bins_[i].clear();
+
+    int count = (int)tris_.size();
+    order_.resize(count);
+    for (int i = 0; i < count; i++) order_[i] = i;
+    if (draw_mode_ == DRAW_FRONT_TO_BACK) {
+        // opaque triangles by their nearest vertex, larger z is closer;
+        // transparent ones keep their order behind them
+        std::vector<int>::iterator opaque_end = std::stable_partition(order_.begin(), order_.end(),
+            [this](int i) { return !tris_[i].is_transparent; });
+        sort_keys_.resize(count);
+        for (int i = 0; i < count; i++) {
+            const RasterTriangle& tri = tris_[i];
+            sort_keys_[i] = (float)std::max(tri.t0.z, std::max(tri.t1.z, tri.t2.z));
+        }
+        std::stable_sort(order_.begin(), opaque_end,
+            [this](int a, int b) { return sort_keys_[a] > sort_keys_[b]; });
+    }
+
+    for (int k = 0; k < count; k++) {
+        int i = order_[k];
+        const RasterTriangle& tri = tris_[i];
+        int xmin = std::max(0, std::min(tri.t0.x, std::min(tri.t1.x, tri.t2.x)));
+        int xmax = std::min(width_ - 1, std::max(tri.t0.x, std::max(tri.t1.x, tri.t2.x)));
+        int ymin = std::max(0, tri.t0.y);
+        int ymax = std::min(height_ - 1, tri.t2.y);
+        if (xmin > xmax || ymin > ymax) continue;
+
+        for (int ty = ymin / tile_size_; ty <= ymax / tile_size_; ty++) {
+            for (int tx = xmin / tile_size_; tx <= xmax / tile_size_; tx++) {
+                bins_[tx + ty * tiles_x_].push_back(i);
+            }
+        }
+    }
+}
+
+void Rasterizer::flush() {
+    if (tris_.empty()) return;
+    {
+        PROFILE_SCOPE(STAGE_RASTER, "bin");
+        bin_triangles();
+    }
+
+    // the z-buffer may have been cleared or drawn into since the last flush
+    std::fill(hiz_dirty_.begin(), hiz_dirty_.end(), (unsigned char)1);
+    if (draw_mode_ == DRAW_DEPTH_PREPASS) owner_.resize(framebuffer_.size());
+    if (transparency_ == TRANSPARENCY_OIT) {
+        // composite_layers leaves every list empty again, so only the arena is reset
+        if (layer_head_.empty()) {
+            layer_head_.assign(framebuffer_.size(), -1);
+            layer_count_.assign(framebuffer_.size(), 0);
+        }
+        size_t capacity = max_fragments_ > 0 ? (size_t)max_fragments_ : 2 * (size_t)width_ * height_;
+        if (arena_.size() != capacity) {
+            arena_.resize(capacity);
+            arena_.shrink_to_fit();
+        }
+        arena_used_.store(0, std::memory_order_relaxed);
+    }
+
+    int ntiles = (int)bins_.size();
+    if (pool_) {
+        pool_->parallel_for(ntiles, [this](int tile) { raster_tile(tile); });
+    }
+    else {
+        for (int tile = 0; tile < ntiles; tile++) raster_tile(tile);
+    }
+
+    RasterStats flushed;
+    flushed.triangles = (long long)tris_.size();
+    for (int tile = 0; tile < ntiles; tile++) {
+        flushed += tile_stats_[tile];
+        tile_stats_[tile] = RasterStats();
+    }
+    stats_ += flushed;
+    PROFILE_COUNT(COUNTER_FRAGMENTS_TESTED, flushed.fragments);
+    PROFILE_COUNT(COUNTER_FRAGMENTS_PASSED, flushed.fragments_passed);
+    PROFILE_COUNT(COUNTER_FRAGMENTS_SHADED, flushed.fragments_shaded);
+    tris_.clear();
+    subpixel_.clear();
+}
+
+static bool inside_guard_band(const RasterTriangle& tri) {
+    const Vec3i* v[3] = { &tri.t0, &tri.t1, &tri.t2 };
+    for (int i = 0; i < 3; i++) {
+        if (v[i]->x < -guard_band || v[i]->x > guard_band || v[i]->y < -guard_band || v[i]->y > guard_band) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Largest depth any pixel of the triangle can get, with room for the rounding
+// of either rasterizer's interpolation.
+static float nearest_depth(const RasterTriangle& tri) {
+    float zmax = (float)std::max(tri.t0.z, std::max(tri.t1.z, tri.t2.z));
+    float zmin = (float)std::min(tri.t0.z, std::min(tri.t1.z, tri.t2.z));
+    return zmax + 1.0f + (std::fabs(zmax) + (zmax - zmin)) * 1e-4f;
+}
+
+// True when every pixel of [x0, x1] x [y0, y1] already holds a depth >= z,
+// i.e. nothing at depth z or farther can pass the depth test there.
+bool Rasterizer::hiz_occluded(int x0, int y0, int x1, int y1, float z) {
+    for (int by = y0 / block_size; by <= y1 / block_size; by++) {
+        for (int bx = x0 / block_size; bx <= x1 / block_size; bx++) {
+            int b = bx + by * hiz_w_;
+            if (hiz_dirty_[b]) {
+                int px0 = bx * block_size;
+                int px1 = std::min(width_, px0 + block_size);
+                int py1 = std::min(height_, (by + 1) * block_size);
+                float m = std::numeric_limits<float>::max();
+#ifdef RASTER_SSE2
+                if (px1 - px0 == 8) {
+                    __m128 m4 = _mm_set1_ps(m);
+                    for (int y = by * block_size; y < py1; y++) {
+                        const float* row = zbuffer_ + framebuffer_.index(px0, y);
+                        m4 = _mm_min_ps(m4, _mm_min_ps(_mm_loadu_ps(row), _mm_loadu_ps(row + 4)));
+                    }
+                    m4 = _mm_min_ps(m4, _mm_shuffle_ps(m4, m4, _MM_SHUFFLE(1, 0, 3, 2)));
+                    m4 = _mm_min_ps(m4, _mm_shuffle_ps(m4, m4, _MM_SHUFFLE(2, 3, 0, 1)));
+                    m = _mm_cvtss_f32(m4);
+                }
+                else
+#endif
+                {
+                    for (int y = by * block_size; y < py1; y++) {
+                        const float* row = zbuffer_ + framebuffer_.row_offset(px0, y);
+                        for (int x = px0; x < px1; x++) m = std::min(m, row[x]);
+                    }
+                }
+                hiz_min_[b] = m;
+                hiz_dirty_[b] = 0;
+            }
+            if (hiz_min_[b] < z) return false;
+        }
+    }
+    return true;
+}
+
+// Depth only grows, so a stale bound stays a valid (if loose) lower bound;
+// blocks are marked for a tighter recount the next time they are tested.
+void Rasterizer::hiz_touch(int x0, int y0, int x1, int y1) {
+    for (int by = y0 / block_size; by <= y1 / block_size; by++) {
+        for (int bx = x0 / block_size; bx <= x1 / block_size; bx++) {
+            hiz_dirty_[bx + by * hiz_w_] = 1;
+        }
+    }
+}
+
+void Rasterizer::raster_tile(int tile) {
+    int x0 = (tile % tiles_x_) * tile_size_;
+    int y0 = (tile / tiles_x_) * tile_size_;
+    int x1 = std::min(width_, x0 + tile_size_);
+    int y1 = std::min(height_, y0 + tile_size_);
+    if (bins_[tile].empty()) return;
+    PROFILE_SCOPE(STAGE_RASTER, "tile");
+    framebuffer_.prepare_tile(tile);
+
+    if (draw_mode_ == DRAW_DEPTH_PREPASS) {
+        raster_tile_prepass(tile, x0, y0, x1, y1);
+        return;
+    }
+
+    RasterStats& stats = tile_stats_[tile];
+    const std::vector<int>& bin = bins_[tile];
+    bool layered = transparency_ == TRANSPARENCY_OIT;
+    for (size_t i = 0; i < bin.size(); i++) {
+        if (tris_[bin[i]].is_transparent) {
+            if (layered) continue;
+            PROFILE_SCOPE(STAGE_BLEND, nullptr);
+            raster_culled(bin[i], PASS_COLOR, x0, y0, x1, y1, stats);
+        }
+        else {
+            raster_culled(bin[i], PASS_COLOR, x0, y0, x1, y1, stats);
+        }
+    }
+    if (layered) composite_layers(tile, x0, y0, x1, y1);
+}
+
+void Rasterizer::raster_tile_prepass(int tile, int x0, int y0, int x1, int y1) {
+    RasterStats& stats = tile_stats_[tile];
+    const std::vector<int>& bin = bins_[tile];
+    std::vector<int>& visible = tile_visible_[tile];
+
+    for (int y = y0; y < y1; y++) {
+        int row = framebuffer_.row_offset(x0, y);
+        std::fill(owner_.begin() + row + x0, owner_.begin() + row + x1, -1);
+    }
+
+    visible.clear();
+    for (size_t i = 0; i < bin.size(); i++) {
+        if (tris_[bin[i]].is_transparent) continue;
+        if (raster_culled(bin[i], PASS_DEPTH, x0, y0, x1, y1, stats)) visible.push_back(bin[i]);
+    }
+    // a triangle that won no pixel while the depth was being resolved can't own one now
+    for (size_t i = 0; i < visible.size(); i++) {
+        raster(visible[i], PASS_SHADE, x0, y0, x1, y1, stats);
+    }
+    if (transparency_ == TRANSPARENCY_OIT) {
+        composite_layers(tile, x0, y0, x1, y1);
+        return;
+    }
+    PROFILE_SCOPE(STAGE_BLEND, nullptr);
+    for (size_t i = 0; i < bin.size(); i++) {
+        if (tris_[bin[i]].is_transparent) raster_culled(bin[i], PASS_COLOR, x0, y0, x1, y1, stats);
+    }
+}
+
+// Transparent triangles of the tile against its finished z-buffer, then
+// every pixel's fragments blended over it from the farthest to the nearest.
+// Fragments at equal depth go in submission order, as they would blend
+// without sorting.
+void Rasterizer::composite_layers(int tile, int x0, int y0, int x1, int y1) {
+    PROFILE_SCOPE(STAGE_BLEND, "composite");
+    RasterStats& stats = tile_stats_[tile];
+    const std::vector<int>& bin = bins_[tile];
+    bool any = false;
+    for (size_t i = 0; i < bin.size(); i++) {
+        if (!tris_[bin[i]].is_transparent) continue;
+        raster_culled(bin[i], PASS_LAYER, x0, y0, x1, y1, stats);
+        any = true;
+    }
+    if (!any) return;
+
+    const Layer* sorted[layer_limit];
+    for (int y = y0; y < y1; y++) {
+        int row = framebuffer_.row_offset(x0, y);
+        for (int x = x0; x < x1; x++) {
+            int idx = row + x;
+            int n = 0;
+            for (int k = layer_head_[idx]; k >= 0; k = arena_[k].next) {
+                // insertion sort, lists are short
+                const Layer* layer = &arena_[k];
+                int j = n++;
+                while (j > 0 && (sorted[j - 1]->z > layer->z || (sorted[j - 1]->z == layer->z && sorted[j - 1]->id > layer->id))) {
+                    sorted[j] = sorted[j - 1];
+                    j--;
+                }
+                sorted[j] = layer;
+            }
+            if (n == 0) continue;
+
+            TGAColor color((int)color_[idx], 4);
+            for (int j = 0; j < n; j++) color = blend_colors(color, TGAColor((int)sorted[j]->color, 4));
+            color_[idx] = color.val;
+            layer_head_[idx] = -1;
+            layer_count_[idx] = 0;
+        }
+    }
+}
+
+// Links a PASS_LAYER fragment into its pixel's list. A full list keeps its
+// nearest fragments: the new one replaces the farthest if it is in front of
+// it. A full arena drops it.
+void Rasterizer::add_layer(const RasterTriangle& tri, int id, int idx, float z, RasterStats& stats) {
+    TGAColor color = tri.color;
+    color.r = (unsigned char)(tri.color.r * tri.intensity);
+    color.g = (unsigned char)(tri.color.g * tri.intensity);
+    color.b = (unsigned char)(tri.color.b * tri.intensity);
+
+    if (layer_count_[idx] >= max_layers_) {
+        stats.layers_dropped++;
+        int farthest = layer_head_[idx];
+        for (int k = arena_[farthest].next; k >= 0; k = arena_[k].next) {
+            if (arena_[k].z < arena_[farthest].z) farthest = k;
+        }
+        Layer& layer = arena_[farthest];
+        if (z > layer.z) {
+            layer.z = z;
+            layer.id = id;
+            layer.color = color.val;
+        }
+        return;
+    }
+
+    int k = arena_used_.fetch_add(1, std::memory_order_relaxed);
+    if (k >= (int)arena_.size()) {
+        stats.layers_dropped++;
+        return;
+    }
+    Layer& layer = arena_[k];
+    layer.z = z;
+    layer.id = id;
+    layer.color = color.val;
+    layer.next = layer_head_[idx];
+    layer_head_[idx] = k;
+    layer_count_[idx]++;
+    stats.layers++;
+}
+
+void Rasterizer::raster(int id, RasterPass pass, int x0, int y0, int x1, int y1, RasterStats& stats) {
+    const RasterTriangle& tri = tris_[id];
+    if (mode_ == RASTER_SUBPIXEL && subpixel_.size() == tris_.size() && inside_guard_band(tri)) {
+        raster_subpixel(tri, subpixel_[id], id, pass, x0, y0, x1, y1, stats);
+    }
+    else if (mode_ == RASTER_EDGE_SIMD && inside_guard_band(tri)) {
+        raster_edge(tri, id, pass, x0, y0, x1, y1, stats);
+    }
+    else if (tri.t0.y != tri.t2.y) {
+        raster_scanline(tri, id, pass, x0, y0, x1, y1, stats);
+    }
+}
+
+// Depth-tested pass over one triangle with hierarchical Z culling. Returns
+// whether any of its pixels passed the depth test.
+bool Rasterizer::raster_culled(int id, RasterPass pass, int x0, int y0, int x1, int y1, RasterStats& stats) {
+    const RasterTriangle& tri = tris_[id];
+    stats.tile_triangles++;
+
+    int bx0 = 0, by0 = 0, bx1 = 0, by1 = 0;
+    if (hiz_) {
+        bx0 = std::max(x0, std::min(tri.t0.x, std::min(tri.t1.x, tri.t2.x)));
+        bx1 = std::min(x1 - 1, std::max(tri.t0.x, std::max(tri.t1.x, tri.t2.x)));
+        by0 = std::max(y0, tri.t0.y);
+        by1 = std::min(y1 - 1, tri.t2.y);
+        if (hiz_occluded(bx0, by0, bx1, by1, nearest_depth(tri))) {
+            stats.hiz_culled++;
+            return false;
+        }
+    }
+
+    long long passed = stats.fragments_passed;
+    raster(id, pass, x0, y0, x1, y1, stats);
+    bool any = stats.fragments_passed != passed;
+    if (hiz_ && any && pass != PASS_LAYER) hiz_touch(bx0, by0, bx1, by1);
+    return any;
+}
+
+void Rasterizer::shade(const RasterTriangle& tri, int x, int y, Vec2i uv) {
+    float intensity = tri.intensity;
+
+    if (tri.is_transparent) {
+        TGAColor color_with_intensity = tri.color;
+        color_with_intensity.r = (unsigned char)(tri.color.r * intensity);
+        color_with_intensity.g = (unsigned char)(tri.color.g * intensity);
+        color_with_intensity.b = (unsigned char)(tri.color.b * intensity);
+
+        unsigned int& pixel = color_[framebuffer_.index(x, y)];
+        pixel = blend_colors(TGAColor((int)pixel, 4), color_with_intensity).val;
+    }
+    else if (tri.model) {
+        TGAColor color = tri.model->diffuse(uv);
+        color.r = (unsigned char)(color.r * intensity);
+        color.g = (unsigned char)(color.g * intensity);
+        color.b = (unsigned char)(color.b * intensity);
+
+        color_[framebuffer_.index(x, y)] = color.val;
+    }
+    else {
+        TGAColor color = tri.color;
+        color.r = (unsigned char)(tri.color.r * intensity);
+        color.g = (unsigned char)(tri.color.g * intensity);
+        color.b = (unsigned char)(tri.color.b * intensity);
+
+        color_[framebuffer_.index(x, y)] = color.val;
+        if (gbuffer_) gbuffer_->erase(x, y);
+    }
+}
+
+// Textured pixel with the diffuse map filtered at (u, v). Integer uv name
+// texels, so their centers are half a texel further on.
+void Rasterizer::shade(const RasterTriangle& tri, int x, int y, float u, float v, float lod) {
+    float intensity = tri.intensity;
+    TGAColor color = tri.model->diffuse(u + 0.5f, v + 0.5f, lod, filter_);
+    color.r = (unsigned char)(color.r * intensity);
+    color.g = (unsigned char)(color.g * intensity);
+    color.b = (unsigned char)(color.b * intensity);
+
+    color_[framebuffer_.index(x, y)] = color.val;
+}
+
+// u and v as shade() takes them: integer values name texels, whose centers
+// are half a texel further on.
+void Rasterizer::queue_fragment(const RasterTriangle& tri, FragmentBatch& batch, int x, int y, float u, float v, float lod) {
+    int i = batch.n++;
+    batch.x[i] = x;
+    batch.y[i] = y;
+    batch.u[i] = u + 0.5f;
+    batch.v[i] = v + 0.5f;
+    batch.lod[i] = lod;
+    if (batch.n == fragment_batch_size) shade_batch(tri, batch);
+}
+
+// Runs shader_ over the queued fragments and stores their colors, or hands
+// them to the G-buffer when there is one.
+void Rasterizer::shade_batch(const RasterTriangle& tri, FragmentBatch& batch) {
+    if (batch.n == 0) return;
+    if (gbuffer_) {
+        gbuffer_->store(tri, batch);
+        batch.n = 0;
+        return;
+    }
+    unsigned int colors[fragment_batch_size];
+    {
+        PROFILE_SCOPE(STAGE_SHADE, nullptr);
+        shader_->shade(tri, batch, colors);
+    }
+
+    for (int i = 0; i < batch.n; i++) color_[framebuffer_.index(batch.x[i], batch.y[i])] = colors[i];
+    batch.n = 0;
+}
+
+// Mip level of a triangle whose uv is affine in screen space.
+static float affine_lod(const RasterTriangle& tri) {
+    float dx1 = (float)(tri.t1.x - tri.t0.x), dy1 = (float)(tri.t1.y - tri.t0.y);
+    float dx2 = (float)(tri.t2.x - tri.t0.x), dy2 = (float)(tri.t2.y - tri.t0.y);
+    float det = dx1 * dy2 - dy1 * dx2;
+    if (det == 0.0f) return 0.0f;
+    float du1 = (float)(tri.uv1.x - tri.uv0.x), du2 = (float)(tri.uv2.x - tri.uv0.x);
+    float dv1 = (float)(tri.uv1.y - tri.uv0.y), dv2 = (float)(tri.uv2.y - tri.uv0.y);
+    return texture_lod((du1 * dy2 - du2 * dy1) / det, (dv1 * dy2 - dv2 * dy1) / det,
+        (du2 * dx1 - du1 * dx2) / det, (dv2 * dx1 - dv1 * dx2) / det);
+}
+
+// Draws the part of the triangle inside [x0, x1) x [y0, y1).
+void Rasterizer::raster_scanline(const RasterTriangle& tri, int id, RasterPass pass, int x0, int y0, int x1, int y1, RasterStats& stats) {
+    const Vec3i& t0 = tri.t0;
+    const Vec3i& t1 = tri.t1;
+    const Vec3i& t2 = tri.t2;
+    const Vec2i& uv0 = tri.uv0;
+    const Vec2i& uv1 = tri.uv1;
+    const Vec2i& uv2 = tri.uv2;
+
+    bool filter = filtered(tri);
+    float lod = filter ? affine_lod(tri) : 0.0f;
+    bool batch_fragments = batched(tri);
+    FragmentBatch batch;
+    batch.filter = filter_;
+
+    int total_height = t2.y - t0.y;
+    int ystart = std::max(t0.y, y0);
+    int yend = std::min(t2.y, y1 - 1);
+
+    for (int y = ystart; y <= yend; y++) {
+        int row = framebuffer_.row_offset(x0, y);
+        bool second_half = y > t1.y || t1.y == t0.y;
+        int segment_height = second_half ? t2.y - t1.y : t1.y - t0.y;
+        if (segment_height == 0) segment_height = 1;
+
+        float alpha = (float)(y - t0.y) / total_height;
+        float beta = second_half ? (float)(y - t1.y) / segment_height : (float)(y - t0.y) / segment_height;
+
+        int xA = t0.x + (t2.x - t0.x) * alpha;
+        int xB = second_half ? t1.x + (t2.x - t1.x) * beta : t0.x + (t1.x - t0.x) * beta;
+
+        float zA = t0.z + (t2.z - t0.z) * alpha;
+        float zB = second_half ? t1.z + (t2.z - t1.z) * beta : t0.z + (t1.z - t0.z) * beta;
+
+        Vec2i uvA = uv0 + (uv2 - uv0) * alpha;
+        Vec2i uvB = second_half ? uv1 + (uv2 - uv1) * beta : uv0 + (uv1 - uv0) * beta;
+
+        // the same interpolation without truncating to whole texels
+        Vec2f fuvA, fuvB;
+        if (filter) {
+            fuvA = Vec2f(uv0) + Vec2f(uv2 - uv0) * alpha;
+            fuvB = second_half ? Vec2f(uv1) + Vec2f(uv2 - uv1) * beta : Vec2f(uv0) + Vec2f(uv1 - uv0) * beta;
+        }
+
+        if (xA > xB) {
+            std::swap(xA, xB);
+            std::swap(zA, zB);
+            std::swap(uvA, uvB);
+            std::swap(fuvA, fuvB);
+        }
+
+        int xstart = std::max(xA, x0);
+        int xend = std::min(xB, x1 - 1);
+
+        for (int x = xstart; x <= xend; x++) {
+            float phi = (xA == xB) ? 1.0f : (float)(x - xA) / (float)(xB - xA);
+
+            float z = zA + (zB - zA) * phi;
+            Vec2i uv = uvA + (uvB - uvA) * phi;
+
+            int idx = row + x;
+            if (pass == PASS_SHADE) {
+                if (owner_[idx] != id) continue;
+            }
+            else {
+                stats.fragments++;
+                if (!(zbuffer_[idx] < z)) continue;
+                stats.fragments_passed++;
+                if (pass == PASS_LAYER) {
+                    add_layer(tri, id, idx, z, stats);
+                    continue;
+                }
+                zbuffer_[idx] = z;
+                if (pass == PASS_DEPTH) {
+                    owner_[idx] = id;
+                    continue;
+                }
+            }
+
+            stats.fragments_shaded++;
+            if (batch_fragments) {
+                Vec2f fuv = filter ? fuvA + (fuvB - fuvA) * phi : Vec2f(uv);
+                queue_fragment(tri, batch, x, y, fuv.x, fuv.y, lod);
+            }
+            else if (filter) {
+                Vec2f fuv = fuvA + (fuvB - fuvA) * phi;
+                shade(tri, x, y, fuv.x, fuv.y, lod);
+            }
+            else {
+                shade(tri, x, y, uv);
+            }
+        }
+    }
+    if (batch_fragments) shade_batch(tri, batch);
+}
+
+// Half-space rasterization of the part of the triangle inside [x0, x1) x [y0, y1).
+// The bounding box is walked in 8x8 blocks: blocks entirely outside one edge are
+// skipped, blocks entirely inside all edges skip the coverage test, and the rest
+// are tested four pixels at a time. Edges follow the top-left fill rule, so a
+// pixel on an edge shared by two triangles is drawn by exactly one of them.
+void Rasterizer::raster_edge(const RasterTriangle& tri, int id, RasterPass pass, int x0, int y0, int x1, int y1, RasterStats& stats) {
+    Vec3i v[3] = { tri.t0, tri.t1, tri.t2 };
+    Vec2i uv[3] = { tri.uv0, tri.uv1, tri.uv2 };
+
+    long long area = (long long)(v[1].x - v[0].x) * (v[2].y - v[0].y) - (long long)(v[1].y - v[0].y) * (v[2].x - v[0].x);
+    if (area == 0) return;
+    if (area < 0) {
+        std::swap(v[1], v[2]);
+        std::swap(uv[1], uv[2]);
+        area = -area;
+    }
+
+    int xmin = std::max(x0, std::min(v[0].x, std::min(v[1].x, v[2].x)));
+    int xmax = std::min(x1 - 1, std::max(v[0].x, std::max(v[1].x, v[2].x)));
+    int ymin = std::max(y0, std::min(v[0].y, std::min(v[1].y, v[2].y)));
+    int ymax = std::min(y1 - 1, std::max(v[0].y, std::max(v[1].y, v[2].y)));
+    if (xmin > xmax || ymin > ymax) return;
+
+    // E_i(x, y) = A[i] * (x - xmin) + B[i] * (y - ymin) + E0[i]; edge i is opposite vertex i.
+    // bias[i] is -1 for edges that are not top or left, so inside means E + bias >= 0.
+    bool cull_blocks = hiz_ && pass != PASS_SHADE;
+    float znear = cull_blocks ? nearest_depth(tri) : 0.0f;
+
+    int A[3], B[3], E0[3], bias[3];
+    for (int i = 0; i < 3; i++) {
+        const Vec3i& a = v[(i + 1) % 3];
+        const Vec3i& b = v[(i + 2) % 3];
+        A[i] = a.y - b.y;
+        B[i] = b.x - a.x;
+        E0[i] = A[i] * (xmin - a.x) + B[i] * (ymin - a.y);
+        bool top_left = (b.y < a.y) || (b.y == a.y && b.x < a.x);
+        bias[i] = top_left ? 0 : -1;
+    }
+
+    // depth and uv are affine in screen space: f(x, y) = f0 + dfdx * (x - xmin) + dfdy * (y - ymin)
+    float inv_area = 1.0f / (float)area;
+    float w0[3];
+    for (int i = 0; i < 3; i++) w0[i] = E0[i] * inv_area;
+    float z0 = v[0].z * w0[0] + v[1].z * w0[1] + v[2].z * w0[2];
+    float dzdx = (v[0].z * A[0] + v[1].z * A[1] + v[2].z * A[2]) * inv_area;
+    float dzdy = (v[0].z * B[0] + v[1].z * B[1] + v[2].z * B[2]) * inv_area;
+    float u0 = uv[0].x * w0[0] + uv[1].x * w0[1] + uv[2].x * w0[2];
+    float dudx = (uv[0].x * A[0] + uv[1].x * A[1] + uv[2].x * A[2]) * inv_area;
+    float dudy = (uv[0].x * B[0] + uv[1].x * B[1] + uv[2].x * B[2]) * inv_area;
+    float t0 = uv[0].y * w0[0] + uv[1].y * w0[1] + uv[2].y * w0[2];
+    float dtdx = (uv[0].y * A[0] + uv[1].y * A[1] + uv[2].y * A[2]) * inv_area;
+    float dtdy = (uv[0].y * B[0] + uv[1].y * B[1] + uv[2].y * B[2]) * inv_area;
+    bool filter = filtered(tri);
+    float lod = filter ? texture_lod(dudx, dtdx, dudy, dtdy) : 0.0f;
+    bool batch_fragments = batched(tri);
+    FragmentBatch batch;
+    batch.filter = filter_;
+
+#ifdef RASTER_SSE2
+    __m128i lane_A[3];
+    for (int i = 0; i < 3; i++) lane_A[i] = _mm_setr_epi32(0, A[i], 2 * A[i], 3 * A[i]);
+    const __m128 lane_dz = _mm_setr_ps(0.0f, dzdx, 2.0f * dzdx, 3.0f * dzdx);
+#endif
+
+    for (int by = ymin; by <= ymax; by += block_size) {
+        int bh = std::min(block_size, ymax - by + 1);
+        for (int bx = xmin; bx <= xmax; bx += block_size) {
+            int bw = std::min(block_size, xmax - bx + 1);
+
+            int eb[3];
+            bool reject = false;
+            bool full = true;
+            for (int i = 0; i < 3; i++) {
+                eb[i] = E0[i] + A[i] * (bx - xmin) + B[i] * (by - ymin) + bias[i];
+                int emax = eb[i] + std::max(A[i], 0) * (bw - 1) + std::max(B[i], 0) * (bh - 1);
+                int emin = eb[i] + std::min(A[i], 0) * (bw - 1) + std::min(B[i], 0) * (bh - 1);
+                if (emax < 0) reject = true;
+                if (emin < 0) full = false;
+            }
+            if (reject) continue;
+            if (cull_blocks && hiz_occluded(bx, by, bx + bw - 1, by + bh - 1, znear)) {
+                stats.hiz_blocks_culled++;
+                continue;
+            }
+
+            for (int y = by; y < by + bh; y++) {
+                int ey[3];
+                for (int i = 0; i < 3; i++) ey[i] = eb[i] + B[i] * (y - by);
+                float zrow = z0 + dzdx * (bx - xmin) + dzdy * (y - ymin);
+                int row = framebuffer_.row_offset(bx, y);
+                float* zrow_ptr = zbuffer_ + row;
+
+                for (int qx = bx; qx < bx + bw; qx += 4) {
+                    int lanes = std::min(4, bx + bw - qx);
+                    int dx = qx - bx;
+                    float zq = zrow + dzdx * dx;
+                    unsigned lane_bits = (1u << lanes) - 1;
+                    unsigned covered = lane_bits;
+                    unsigned passed = 0;
+
+#ifdef RASTER_SSE2
+                    __m128i outside = _mm_setzero_si128();
+                    if (!full) {
+                        // a lane is outside when any edge value is negative, i.e. has its sign bit set
+                        __m128i e0 = _mm_add_epi32(_mm_set1_epi32(ey[0] + A[0] * dx), lane_A[0]);
+                        __m128i e1 = _mm_add_epi32(_mm_set1_epi32(ey[1] + A[1] * dx), lane_A[1]);
+                        __m128i e2 = _mm_add_epi32(_mm_set1_epi32(ey[2] + A[2] * dx), lane_A[2]);
+                        outside = _mm_srai_epi32(_mm_or_si128(_mm_or_si128(e0, e1), e2), 31);
+                        covered = ~(unsigned)_mm_movemask_ps(_mm_castsi128_ps(outside)) & lane_bits;
+                    }
+#else
+                    if (!full) {
+                        covered = 0;
+                        for (int l = 0; l < lanes; l++) {
+                            if (ey[0] + A[0] * (dx + l) >= 0 && ey[1] + A[1] * (dx + l) >= 0 && ey[2] + A[2] * (dx + l) >= 0) {
+                                covered |= 1u << l;
+                            }
+                        }
+                    }
+#endif
+                    if (!covered) continue;
+
+                    if (pass == PASS_SHADE) {
+                        const int* owner = &owner_[row + qx];
+                        for (int l = 0; l < lanes; l++) {
+                            if ((covered & (1u << l)) && owner[l] == id) passed |= 1u << l;
+                        }
+                    }
+#ifdef RASTER_SSE2
+                    else if (lanes == 4) {
+                        __m128 z = _mm_add_ps(_mm_set1_ps(zq), lane_dz);
+                        __m128 zb = _mm_loadu_ps(zrow_ptr + qx);
+                        __m128 write = _mm_andnot_ps(_mm_castsi128_ps(outside), _mm_cmplt_ps(zb, z));
+                        passed = (unsigned)_mm_movemask_ps(write);
+                        if (passed && pass != PASS_LAYER) {
+                            _mm_storeu_ps(zrow_ptr + qx, _mm_or_ps(_mm_and_ps(write, z), _mm_andnot_ps(write, zb)));
+                        }
+                    }
+                    else
+#endif
+                    {
+                        // partial quads at the right edge of the box must not touch pixels of the next tile
+                        for (int l = 0; l < lanes; l++) {
+                            if (!(covered & (1u << l))) continue;
+                            float z = zq + dzdx * l;
+                            if (!(zrow_ptr[qx + l] < z)) continue;
+                            if (pass != PASS_LAYER) zrow_ptr[qx + l] = z;
+                            passed |= 1u << l;
+                        }
+                    }
+
+                    int ncovered = 0;
+                    for (int l = 0; l < lanes; l++) {
+                        if (covered & (1u << l)) ncovered++;
+                        if (!(passed & (1u << l))) continue;
+                        int x = qx + l;
+                        if (pass == PASS_DEPTH) {
+                            owner_[row + x] = id;
+                            stats.fragments_passed++;
+                            continue;
+                        }
+                        if (pass == PASS_LAYER) {
+                            stats.fragments_passed++;
+                            add_layer(tri, id, row + x, zq + dzdx * l, stats);
+                            continue;
+                        }
+                        float fx = (float)(x - xmin);
+                        float fy = (float)(y - ymin);
+                        if (pass == PASS_COLOR) stats.fragments_passed++;
+                        stats.fragments_shaded++;
+                        float u = u0 + dudx * fx + dudy * fy;
+                        float t = t0 + dtdx * fx + dtdy * fy;
+                        if (batch_fragments) {
+                            if (!filter) {
+                                u = (float)(int)u;
+                                t = (float)(int)t;
+                            }
+                            queue_fragment(tri, batch, x, y, u, t, lod);
+                        }
+                        else if (filter) {
+                            shade(tri, x, y, u, t, lod);
+                        }
+                        else {
+                            shade(tri, x, y, Vec2i((int)u, (int)t));
+                        }
+                    }
+                    if (pass != PASS_SHADE) stats.fragments += ncovered;
+                }
+            }
+        }
+    }
+    if (batch_fragments) shade_batch(tri, batch);
+}
+
+// raster_edge on the 28.4 fixed-point vertices of a SubpixelTriangle. Pixel
+// (x, y) is covered when its integer coordinates are inside, with the same
+// top-left rule, so shared edges neither overlap nor leave cracks. Edge
+// values are set up per block in 64 bits; across one block they change by
+// far less than 2^31, so an edge the block straddles is tested in 32-bit
+// lanes from the block corner and an edge it lies fully inside is skipped.
+// Depth is taken unquantized from its plane, uv divided by the interpolated
+// 1 / w: one reciprocal per shaded pixel.
+void Rasterizer::raster_subpixel(const RasterTriangle& tri, const SubpixelTriangle& sub, int id, RasterPass pass,
+    int x0, int y0, int x1, int y1, RasterStats& stats) {
+    const int* X = sub.X;
+    const int* Y = sub.Y;
+
+    // covered pixels lie between the rounded-in vertex extremes
+    int xmin = std::max(x0, (std::min(X[0], std::min(X[1], X[2])) + 15) >> 4);
+    int xmax = std::min(x1 - 1, std::max(X[0], std::max(X[1], X[2])) >> 4);
+    int ymin = std::max(y0, (std::min(Y[0], std::min(Y[1], Y[2])) + 15) >> 4);
+    int ymax = std::min(y1 - 1, std::max(Y[0], std::max(Y[1], Y[2])) >> 4);
+    if (xmin > xmax || ymin > ymax) return;
+
+    bool cull_blocks = hiz_ && pass != PASS_SHADE;
+    float znear = cull_blocks ? nearest_depth(tri) : 0.0f;
+    bool textured = tri.model && !tri.is_transparent;
+    bool filter = filtered(tri);
+    bool batch_fragments = batched(tri);
+    FragmentBatch batch;
+    batch.filter = filter_;
+
+    // E_i(x, y) = A[i] * 16x + B[i] * 16y + C[i] at pixel (x, y); edge i is opposite vertex i
+    long long A[3], B[3], C[3];
+    for (int i = 0; i < 3; i++) {
+        int a = (i + 1) % 3;
+        int b = (i + 2) % 3;
+        A[i] = Y[a] - Y[b];
+        B[i] = X[b] - X[a];
+        bool top_left = (Y[b] < Y[a]) || (Y[b] == Y[a] && X[b] < X[a]);
+        C[i] = -A[i] * X[a] - B[i] * Y[a] + (top_left ? 0 : -1);
+    }
+
+    for (int by = ymin; by <= ymax; by += block_size) {
+        int bh = std::min(block_size, ymax - by + 1);
+        for (int bx = xmin; bx <= xmax; bx += block_size) {
+            int bw = std::min(block_size, xmax - bx + 1);
+
+            int eb[3], sa[3], sb[3];
+            bool reject = false;
+            bool full = true;
+            for (int i = 0; i < 3; i++) {
+                long long e = A[i] * 16 * bx + B[i] * 16 * by + C[i];
+                long long emax = e + std::max(A[i], 0LL) * 16 * (bw - 1) + std::max(B[i], 0LL) * 16 * (bh - 1);
+                long long emin = e + std::min(A[i], 0LL) * 16 * (bw - 1) + std::min(B[i], 0LL) * 16 * (bh - 1);
+                if (emax < 0) reject = true;
+                if (emin >= 0) {
+                    eb[i] = 0;
+                    sa[i] = 0;
+                    sb[i] = 0;
+                }
+                else {
+                    eb[i] = (int)e;
+                    sa[i] = (int)(A[i] * 16);
+                    sb[i] = (int)(B[i] * 16);
+                    full = false;
+                }
+            }
+            if (reject) continue;
+            if (cull_blocks && hiz_occluded(bx, by, bx + bw - 1, by + bh - 1, znear)) {
+                stats.hiz_blocks_culled++;
+                continue;
+            }
+
+#ifdef RASTER_SSE2
+            __m128i lane_A[3];
+            for (int i = 0; i < 3; i++) lane_A[i] = _mm_setr_epi32(0, sa[i], 2 * sa[i], 3 * sa[i]);
+            const __m128 lane_dz = _mm_setr_ps(0.0f, sub.dzdx, 2.0f * sub.dzdx, 3.0f * sub.dzdx);
+#endif
+
+            for (int y = by; y < by + bh; y++) {
+                int ey[3];
+                for (int i = 0; i < 3; i++) ey[i] = eb[i] + sb[i] * (y - by);
+                float fy = (float)y - sub.y0;
+                float zrow = sub.z0 + sub.dzdx * ((float)bx - sub.x0) + sub.dzdy * fy;
+                int row = framebuffer_.row_offset(bx, y);
+                float* zrow_ptr = zbuffer_ + row;
+
+                for (int qx = bx; qx < bx + bw; qx += 4) {
+                    int lanes = std::min(4, bx + bw - qx);
+                    int dx = qx - bx;
+                    float zq = zrow + sub.dzdx * dx;
+                    unsigned lane_bits = (1u << lanes) - 1;
+                    unsigned covered = lane_bits;
+                    unsigned passed = 0;
+
+#ifdef RASTER_SSE2
+                    __m128i outside = _mm_setzero_si128();
+                    if (!full) {
+                        __m128i e0 = _mm_add_epi32(_mm_set1_epi32(ey[0] + sa[0] * dx), lane_A[0]);
+                        __m128i e1 = _mm_add_epi32(_mm_set1_epi32(ey[1] + sa[1] * dx), lane_A[1]);
+                        __m128i e2 = _mm_add_epi32(_mm_set1_epi32(ey[2] + sa[2] * dx), lane_A[2]);
+                        outside = _mm_srai_epi32(_mm_or_si128(_mm_or_si128(e0, e1), e2), 31);
+                        covered = ~(unsigned)_mm_movemask_ps(_mm_castsi128_ps(outside)) & lane_bits;
+                    }
+#else
+                    if (!full) {
+                        covered = 0;
+                        for (int l = 0; l < lanes; l++) {
+                            if (ey[0] + sa[0] * (dx + l) >= 0 && ey[1] + sa[1] * (dx + l) >= 0 && ey[2] + sa[2] * (dx + l) >= 0) {
+                                covered |= 1u << l;
+                            }
+                        }
+                    }
+#endif
+                    if (!covered) continue;
+
+                    if (pass == PASS_SHADE) {
+                        const int* owner = &owner_[row + qx];
+                        for (int l = 0; l < lanes; l++) {
+                            if ((covered & (1u << l)) && owner[l] == id) passed |= 1u << l;
+                        }
+                    }
+#ifdef RASTER_SSE2
+                    else if (lanes == 4) {
+                        __m128 z = _mm_add_ps(_mm_set1_ps(zq), lane_dz);
+                        __m128 zb = _mm_loadu_ps(zrow_ptr + qx);
+                        __m128 write = _mm_andnot_ps(_mm_castsi128_ps(outside), _mm_cmplt_ps(zb, z));
+                        passed = (unsigned)_mm_movemask_ps(write);
+                        if (passed && pass != PASS_LAYER) {
+                            _mm_storeu_ps(zrow_ptr + qx, _mm_or_ps(_mm_and_ps(write, z), _mm_andnot_ps(write, zb)));
+                        }
+                    }
+                    else
+#endif
+                    {
+                        for (int l = 0; l < lanes; l++) {
+                            if (!(covered & (1u << l))) continue;
+                            float z = zq + sub.dzdx * l;
+                            if (!(zrow_ptr[qx + l] < z)) continue;
+                            if (pass != PASS_LAYER) zrow_ptr[qx + l] = z;
+                            passed |= 1u << l;
+                        }
+                    }
+
+                    // perspective-correct uv of the quad: one reciprocal per lane
+                    float pu[4], pv[4], pw[4];
+                    if (passed && textured && pass != PASS_DEPTH) {
+                        float fx = (float)qx - sub.x0;
+#ifdef RASTER_SSE2
+                        const __m128 lane = _mm_setr_ps(0.0f, 1.0f, 2.0f, 3.0f);
+                        __m128 px = _mm_add_ps(_mm_set1_ps(fx), lane);
+                        __m128 q = _mm_add_ps(_mm_set1_ps(sub.q0 + sub.dqdy * fy), _mm_mul_ps(_mm_set1_ps(sub.dqdx), px));
+                        __m128 u = _mm_add_ps(_mm_set1_ps(sub.u0 + sub.dudy * fy), _mm_mul_ps(_mm_set1_ps(sub.dudx), px));
+                        __m128 v = _mm_add_ps(_mm_set1_ps(sub.v0 + sub.dvdy * fy), _mm_mul_ps(_mm_set1_ps(sub.dvdx), px));
+                        __m128 w = _mm_div_ps(_mm_set1_ps(1.0f), q);
+                        _mm_storeu_ps(pu, _mm_mul_ps(u, w));
+                        _mm_storeu_ps(pv, _mm_mul_ps(v, w));
+                        _mm_storeu_ps(pw, w);
+#else
+                        for (int l = 0; l < lanes; l++) {
+                            pw[l] = 1.0f / (sub.q0 + sub.dqdx * (fx + l) + sub.dqdy * fy);
+                            pu[l] = (sub.u0 + sub.dudx * (fx + l) + sub.dudy * fy) * pw[l];
+                            pv[l] = (sub.v0 + sub.dvdx * (fx + l) + sub.dvdy * fy) * pw[l];
+                        }
+#endif
+                    }
+
+                    int ncovered = 0;
+                    for (int l = 0; l < lanes; l++) {
+                        if (covered & (1u << l)) ncovered++;
+                        if (!(passed & (1u << l))) continue;
+                        int x = qx + l;
+                        if (pass == PASS_DEPTH) {
+                            owner_[row + x] = id;
+                            stats.fragments_passed++;
+                            continue;
+                        }
+                        if (pass == PASS_LAYER) {
+                            stats.fragments_passed++;
+                            add_layer(tri, id, row + x, zq + sub.dzdx * l, stats);
+                            continue;
+                        }
+                        if (pass == PASS_COLOR) stats.fragments_passed++;
+                        stats.fragments_shaded++;
+                        float lod = 0.0f;
+                        if (filter) {
+                            // derivatives of u = (u / w) * w, by the quotient rule
+                            lod = texture_lod((sub.dudx - pu[l] * sub.dqdx) * pw[l], (sub.dvdx - pv[l] * sub.dqdx) * pw[l],
+                                (sub.dudy - pu[l] * sub.dqdy) * pw[l], (sub.dvdy - pv[l] * sub.dqdy) * pw[l]);
+                        }
+                        if (batch_fragments) {
+                            queue_fragment(tri, batch, x, y, filter ? pu[l] : (float)(int)pu[l], filter ? pv[l] : (float)(int)pv[l], lod);
+                        }
+                        else if (filter) {
+                            shade(tri, x, y, pu[l], pv[l], lod);
+                        }
+                        else {
+                            shade(tri, x, y, textured ? Vec2i((int)pu[l], (int)pv[l]) : Vec2i());
+                        }
+                    }
+                    if (pass != PASS_SHADE) stats.fragments += ncovered;
+                }
+            }
+        }
+    }
+    if (batch_fragments) shade_batch(tri, batch);
+}
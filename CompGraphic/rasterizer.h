@@ -0,0 +1,259 @@
+#ifndef RASTERIZER_H
+#define RASTERIZER_H
+
+#include <vector>
+#include <atomic>
+#include "geometry.h"
+#include "tgaimage.h"
+#include "model.h"
+#include "texture.h"
+#include "shading.h"
+#include "framebuffer.h"
+
+class ThreadPool;
+class GBuffer;
+
+enum RasterMode {
+    RASTER_SCANLINE,   // scanline walk with per-row interpolation
+    RASTER_EDGE_SIMD,  // half-space edge functions over 8x8 blocks, 4 pixels per lane group
+    RASTER_SUBPIXEL    // the same on 28.4 fixed-point vertices, unquantized depth, perspective-correct uv
+};
+
+enum DrawMode {
+    DRAW_IMMEDIATE,     // triangles in submission order, shaded whenever they pass the depth test
+    DRAW_FRONT_TO_BACK, // opaque triangles sorted nearest first, then transparent ones in order
+    DRAW_DEPTH_PREPASS  // depth-only pass over opaque triangles, then each pixel shaded once
+};
+
+enum TransparencyMode {
+    TRANSPARENCY_BLEND, // blended in submission order over the depth-tested image, writing depth
+    TRANSPARENCY_OIT    // kept per pixel, sorted by depth and blended back to front at the end of the flush
+};
+
+struct RasterStats {
+    long long triangles;        // triangles queued
+    long long tile_triangles;   // triangle/tile pairs after binning
+    long long hiz_culled;       // of those, rejected whole by the depth bounds
+    long long hiz_blocks_culled; // 8x8 blocks skipped inside the edge rasterizer
+    long long fragments;        // covered pixels that reached the depth test
+    long long fragments_passed; // pixels that passed it
+    long long fragments_shaded; // shaded pixels; above the number of visible pixels by the overdraw
+    long long layers;           // TRANSPARENCY_OIT fragments kept for compositing
+    long long layers_dropped;   // and those lost to the per-pixel or per-flush limit
+
+    RasterStats() : triangles(0), tile_triangles(0), hiz_culled(0), hiz_blocks_culled(0),
+        fragments(0), fragments_passed(0), fragments_shaded(0), layers(0), layers_dropped(0) {}
+
+    RasterStats& operator+=(const RasterStats& s) {
+        triangles += s.triangles;
+        tile_triangles += s.tile_triangles;
+        hiz_culled += s.hiz_culled;
+        hiz_blocks_culled += s.hiz_blocks_culled;
+        fragments += s.fragments;
+        fragments_passed += s.fragments_passed;
+        fragments_shaded += s.fragments_shaded;
+        layers += s.layers;
+        layers_dropped += s.layers_dropped;
+        return *this;
+    }
+};
+
+// Screen-space vertex before any rounding: position in pixels, depth on the
+// same scale as the integer path (1000 per NDC unit) and the clip-space w
+// that uv is divided by for perspective-correct interpolation.
+struct RasterVertex {
+    float x, y, z;
+    float w;
+    Vec2f uv;
+};
+
+// RASTER_SUBPIXEL setup of one triangle: vertices snapped to 1/16 pixel and
+// counter-clockwise, and every attribute as a plane
+// f(x, y) = f0 + dfdx * (x - x0) + dfdy * (y - y0) around the first vertex.
+struct SubpixelTriangle {
+    int X[3], Y[3];       // 28.4 fixed point
+    float x0, y0;
+    float z0, dzdx, dzdy;
+    float q0, dqdx, dqdy; // 1 / w
+    float u0, dudx, dudy; // u / w
+    float v0, dvdx, dvdy; // v / w
+    bool valid;           // false for zero area after snapping
+};
+
+// One queued triangle, vertices already sorted by y.
+struct RasterTriangle {
+    Vec3i t0, t1, t2;
+    Vec2i uv0, uv1, uv2;
+    float intensity;
+    bool is_transparent;
+    TGAColor color;
+    Model* model;
+    Vec3f view_dir;  // unit vector towards the eye, for the fragment shader
+    Vec3f normal;    // face normal, for the G-buffer
+};
+
+// Binning rasterizer: triangles are queued in submission order, sorted into
+// the framebuffer's tiles on flush() and the tiles are rasterized in
+// parallel. Each tile owns its pixels and z-buffer entries, so workers never
+// share memory and the result is identical to drawing the triangles one by
+// one. A tile is prepared (lazily cleared) by the worker that first draws
+// into it, and tiles no triangle reaches are left alone.
+//
+// Alongside the z-buffer it keeps the farthest depth of every 8x8 pixel block
+// (hierarchical Z). A triangle whose nearest point is no closer than that
+// bound over its whole footprint in a tile cannot pass a single depth test
+// and is dropped before rasterization; the edge rasterizer skips 8x8 blocks
+// the same way.
+//
+// DRAW_DEPTH_PREPASS rasterizes the opaque triangles of a tile twice: first
+// depth only, remembering which triangle won each pixel, then again shading
+// just the pixels each triangle won. The image is the same as in immediate
+// mode as long as transparent triangles are queued after the opaque ones,
+// which the scene passes do.
+//
+// TRANSPARENCY_OIT drops that requirement for transparent triangles: a tile
+// draws its opaque triangles first, then tests the transparent ones against
+// the finished z-buffer without writing it and links every passing fragment
+// into a list for its pixel. The lists live in one arena allocated up front;
+// at the end of the tile each pixel's fragments are sorted far to near and
+// blended over it, so overlapping translucent meshes composite the same in
+// any submission order.
+class Rasterizer {
+private:
+    enum RasterPass {
+        PASS_COLOR,  // depth test and shade
+        PASS_DEPTH,  // depth test, remember the winning triangle
+        PASS_SHADE,  // shade the pixels the triangle won in PASS_DEPTH
+        PASS_LAYER   // depth test without writing, keep the fragment for compositing
+    };
+
+    // One transparent fragment, linked to the next one of the same pixel.
+    struct Layer {
+        float z;
+        int id;              // triangle, to order fragments at equal depth
+        unsigned int color;  // TGAColor::val with the intensity applied
+        int next;            // arena index, -1 at the end of the list
+    };
+
+    Framebuffer& framebuffer_;
+    unsigned int* color_;
+    float* zbuffer_;
+    int width_;
+    int height_;
+    int tile_size_;
+    int tiles_x_;
+    int tiles_y_;
+    ThreadPool* pool_;
+    RasterMode mode_;
+    DrawMode draw_mode_;
+    TextureFilter filter_;
+    const FragmentShader* shader_;
+    GBuffer* gbuffer_;
+    std::vector<RasterTriangle> tris_;
+    std::vector<SubpixelTriangle> subpixel_;  // parallel to tris_ in RASTER_SUBPIXEL
+    std::vector<int> order_;                  // binning order of tris_
+    std::vector<float> sort_keys_;
+    std::vector<std::vector<int> > bins_;
+    std::vector<RasterStats> tile_stats_;
+    RasterStats stats_;
+    bool hiz_;
+    int hiz_w_;
+    int hiz_h_;
+    std::vector<float> hiz_min_;          // lower bound of the z-buffer per 8x8 block
+    std::vector<unsigned char> hiz_dirty_; // block written since its bound was computed
+    std::vector<int> owner_;               // PASS_DEPTH winner per framebuffer entry, -1 for none
+    std::vector<std::vector<int> > tile_visible_;
+    TransparencyMode transparency_;
+    int max_layers_;                     // per pixel
+    int max_fragments_;                  // per flush, the arena size; 0 for twice the pixel count
+    std::vector<Layer> arena_;
+    std::atomic<int> arena_used_;
+    std::vector<int> layer_head_;        // first arena entry per pixel, -1 for none
+    std::vector<unsigned char> layer_count_;
+
+    void bin_triangles();
+    void raster_tile(int tile);
+    void raster_tile_prepass(int tile, int x0, int y0, int x1, int y1);
+    void composite_layers(int tile, int x0, int y0, int x1, int y1);
+    void add_layer(const RasterTriangle& tri, int id, int idx, float z, RasterStats& stats);
+    bool raster_culled(int id, RasterPass pass, int x0, int y0, int x1, int y1, RasterStats& stats);
+    void raster(int id, RasterPass pass, int x0, int y0, int x1, int y1, RasterStats& stats);
+    void raster_scanline(const RasterTriangle& tri, int id, RasterPass pass, int x0, int y0, int x1, int y1, RasterStats& stats);
+    void raster_edge(const RasterTriangle& tri, int id, RasterPass pass, int x0, int y0, int x1, int y1, RasterStats& stats);
+    void raster_subpixel(const RasterTriangle& tri, const SubpixelTriangle& sub, int id, RasterPass pass,
+        int x0, int y0, int x1, int y1, RasterStats& stats);
+    void shade(const RasterTriangle& tri, int x, int y, Vec2i uv);
+    void shade(const RasterTriangle& tri, int x, int y, float u, float v, float lod);
+    bool filtered(const RasterTriangle& tri) const { return filter_ != TEXTURE_NEAREST && tri.model && !tri.is_transparent; }
+    bool batched(const RasterTriangle& tri) const { return (shader_ || gbuffer_) && tri.model && !tri.is_transparent; }
+    void queue_fragment(const RasterTriangle& tri, FragmentBatch& batch, int x, int y, float u, float v, float lod);
+    void shade_batch(const RasterTriangle& tri, FragmentBatch& batch);
+    bool hiz_occluded(int x0, int y0, int x1, int y1, float z);
+    void hiz_touch(int x0, int y0, int x1, int y1);
+public:
+    // Tiles are the framebuffer's. pool == nullptr rasterizes on the
+    // calling thread only.
+    Rasterizer(Framebuffer& framebuffer, ThreadPool* pool = nullptr);
+
+    void triangle(Vec3i t0, Vec3i t1, Vec3i t2, Vec2i uv0, Vec2i uv1, Vec2i uv2,
+        float intensity, bool is_transparent = false,
+        TGAColor color = TGAColor(255, 255, 255, 255), Model* model = nullptr, Vec3f view_dir = Vec3f(),
+        Vec3f normal = Vec3f());
+    // Precise vertices: RASTER_SUBPIXEL uses them as they are, the other modes
+    // round them the way transform_vertices does.
+    void triangle(const RasterVertex& v0, const RasterVertex& v1, const RasterVertex& v2,
+        float intensity, bool is_transparent = false,
+        TGAColor color = TGAColor(255, 255, 255, 255), Model* model = nullptr, Vec3f view_dir = Vec3f(),
+        Vec3f normal = Vec3f());
+
+    // Rasterizes everything queued since the last flush.
+    void flush();
+
+    void set_mode(RasterMode mode) { mode_ = mode; }
+    void set_pool(ThreadPool* pool) { pool_ = pool; }
+
+    // Hierarchical Z culling, on by default. It never changes the image, only
+    // how much work is spent on hidden triangles.
+    void set_hiz(bool enabled) { hiz_ = enabled && tile_size_ % 8 == 0; }
+    bool get_hiz() const { return hiz_; }
+    RasterMode get_mode() const { return mode_; }
+    void set_draw_mode(DrawMode mode) { draw_mode_ = mode; }
+    DrawMode get_draw_mode() const { return draw_mode_; }
+    // How model textures are sampled; TEXTURE_NEAREST by default. The mip
+    // level comes from the uv derivatives: per triangle in the affine modes,
+    // per pixel in RASTER_SUBPIXEL.
+    void set_filter(TextureFilter filter) { filter_ = filter; }
+    TextureFilter get_filter() const { return filter_; }
+    // Shader for the textured, opaque triangles of models, which then go to
+    // it in batches instead of being shaded pixel by pixel with their flat
+    // intensity. nullptr, the default, keeps the flat path. Not owned.
+    void set_shader(const FragmentShader* shader) { shader_ = shader; }
+    const FragmentShader* get_shader() const { return shader_; }
+    // With a G-buffer those triangles are not shaded at all: their pixels
+    // are stored in it for light_gbuffer() to light after the flush, ahead
+    // of the shader. Transparent triangles must come after that, in a later
+    // flush. nullptr by default. Not owned.
+    void set_gbuffer(GBuffer* gbuffer) { gbuffer_ = gbuffer; }
+    GBuffer* get_gbuffer() const { return gbuffer_; }
+    // TRANSPARENCY_BLEND by default. TRANSPARENCY_OIT keeps at most
+    // max_layers fragments per pixel (up to 64, the nearest win) and
+    // max_fragments per flush (0: twice the pixel count); the rest are
+    // dropped and counted in the stats.
+    void set_transparency(TransparencyMode mode) { transparency_ = mode; }
+    TransparencyMode get_transparency() const { return transparency_; }
+    void set_layer_limits(int max_fragments, int max_layers);
+    int get_max_layers() const { return max_layers_; }
+    // Bytes the arena holds once an OIT flush has allocated it.
+    size_t layer_memory() const { return arena_.capacity() * sizeof(Layer) + layer_head_.capacity() * sizeof(int) + layer_count_.capacity(); }
+
+    // Counters accumulated over all flushes so far.
+    const RasterStats& stats() const { return stats_; }
+    void reset_stats() { stats_ = RasterStats(); }
+
+    int get_width() const { return width_; }
+    int get_height() const { return height_; }
+};
+
+TGAColor blend_colors(const TGAColor& bg, const TGAColor& fg);
+
+#endif // RASTERIZER_H
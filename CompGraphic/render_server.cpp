@@ -0,0 +1,381 @@
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include "render_server.h"
+#include "renderer.h"
+#include "batch_renderer.h"
+#include "thread_pool.h"
+#include "json.h"
+#include "image_formats.h"
+
+#ifndef _WIN32
+#include <csignal>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+static bool read_vec3(const JsonValue* value, Vec3f& v) {
+    if (!value) return true;
+    if (!value->is_array() || value->items.size() != 3) return false;
+    for (int k = 0; k < 3; k++) {
+        if (!value->items[k].is_number()) return false;
+    }
+    v = Vec3f((float)value->items[0].number, (float)value->items[1].number, (float)value->items[2].number);
+    return true;
+}
+
+static bool read_camera(const JsonValue& value, float aspect, Camera& camera, std::string& error) {
+    if (value.is_string()) {
+        for (int view = 0; view < num_views; view++) {
+            if (value.string == view_names[view]) {
+                const ViewConfig& config = view_configs[view];
+                camera = Camera(config.eye, config.target, config.up, config.fov, aspect, 0.1f, 100.0f);
+                return true;
+            }
+        }
+        error = "unknown view " + value.string;
+        return false;
+    }
+    if (!value.is_object() || !value.get("eye")) {
+        error = "a camera is a view name or an object with an eye";
+        return false;
+    }
+    Vec3f eye, target(0, 0, 0), up(0, 1, 0);
+    float fov = 45.0f;
+    const JsonValue* f = value.get("fov");
+    if (!read_vec3(value.get("eye"), eye) || !read_vec3(value.get("target"), target) || !read_vec3(value.get("up"), up)
+        || (f && (!f->is_number() || f->number <= 0.0 || f->number >= 180.0))) {
+        error = "bad camera";
+        return false;
+    }
+    if (f) fov = (float)f->number;
+    camera = Camera(eye, target, up, fov, aspect, 0.1f, 100.0f);
+    return true;
+}
+
+static bool read_size(const JsonValue& job, const char* key, int& size, std::string& error) {
+    const JsonValue* value = job.get(key);
+    if (!value) return true;
+    if (!value->is_number() || value->number < 1 || value->number > 8192 || value->number != (int)value->number) {
+        error = std::string("bad ") + key;
+        return false;
+    }
+    size = (int)value->number;
+    return true;
+}
+
+static bool parse_job_value(const JsonValue& value, RenderJob& job, std::string& error) {
+    job.id = value.get("id") ? json_text(*value.get("id")) : "null";
+    job.width = 800;
+    job.height = 800;
+    job.shading = SHADE_FLAT;
+    job.transparency = TRANSPARENCY_BLEND;
+
+    const JsonValue* mesh = value.get("mesh");
+    if (!mesh || !mesh->is_string() || mesh->string.empty()) {
+        error = "missing mesh";
+        return false;
+    }
+    job.mesh = mesh->string;
+    if (!read_size(value, "width", job.width, error) || !read_size(value, "height", job.height, error)) return false;
+
+    const JsonValue* shading = value.get("shading");
+    if (shading) {
+        static const char* names[] = { "flat", "phong", "blinn", "deferred" };
+        static const ShadingMode modes[] = { SHADE_FLAT, SHADE_PHONG, SHADE_BLINN, SHADE_DEFERRED };
+        int k = 0;
+        while (k < 4 && !(shading->is_string() && shading->string == names[k])) k++;
+        if (k == 4) {
+            error = "bad shading";
+            return false;
+        }
+        job.shading = modes[k];
+    }
+    const JsonValue* transparency = value.get("transparency");
+    if (transparency) {
+        if (transparency->is_string() && transparency->string == "blend") job.transparency = TRANSPARENCY_BLEND;
+        else if (transparency->is_string() && transparency->string == "oit") job.transparency = TRANSPARENCY_OIT;
+        else {
+            error = "bad transparency";
+            return false;
+        }
+    }
+
+    const JsonValue* cameras = value.get("cameras");
+    const JsonValue* outputs = value.get("outputs");
+    if (!cameras || !cameras->is_array() || cameras->items.empty()) {
+        error = "missing cameras";
+        return false;
+    }
+    if (!outputs || !outputs->is_array() || outputs->items.size() != cameras->items.size()) {
+        error = "need one output per camera";
+        return false;
+    }
+    float aspect = (float)job.width / job.height;
+    for (size_t i = 0; i < cameras->items.size(); i++) {
+        Camera camera;
+        if (!read_camera(cameras->items[i], aspect, camera, error)) return false;
+        if (!outputs->items[i].is_string() || outputs->items[i].string.empty()) {
+            error = "bad output";
+            return false;
+        }
+        job.cameras.push_back(camera);
+        job.outputs.push_back(outputs->items[i].string);
+    }
+    return true;
+}
+
+bool parse_render_job(const std::string& line, RenderJob& job, std::string& error) {
+    JsonValue value;
+    if (!parse_json(line, value, error)) return false;
+    if (!value.is_object()) {
+        error = "a job is a JSON object";
+        return false;
+    }
+    job = RenderJob();
+    return parse_job_value(value, job, error);
+}
+
+static std::string error_reply(const std::string& id, const std::string& error) {
+    return "{\"id\":" + id + ",\"ok\":false,\"error\":" + json_quote(error) + "}";
+}
+
+RenderServer::RenderServer(int workers, int cache_capacity, int queue_capacity)
+    : light_dir_(Vec3f(0.2f, 0.4f, -1.0f).normalize()), cache_(cache_capacity, light_dir_), busy_(0), stop_(false),
+    jobs_(0), failed_(0) {
+    if (workers <= 0) workers = ThreadPool::default_threads();
+    queue_capacity_ = queue_capacity > 0 ? queue_capacity : 4 * workers;
+    for (int i = 0; i < workers; i++) {
+        workers_.emplace_back(&RenderServer::worker_loop, this);
+    }
+}
+
+RenderServer::~RenderServer() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_ = true;
+    }
+    wake_.notify_all();
+    for (size_t i = 0; i < workers_.size(); i++) workers_[i].join();
+}
+
+void RenderServer::submit(const std::string& line, const ReplyCallback& reply) {
+    Pending pending = { line, reply };
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        space_.wait(lock, [&] { return (int)queue_.size() < queue_capacity_; });
+        queue_.push_back(pending);
+    }
+    wake_.notify_one();
+}
+
+void RenderServer::wait_idle() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    idle_.wait(lock, [&] { return queue_.empty() && busy_ == 0; });
+}
+
+void RenderServer::worker_loop() {
+    TargetPools targets;
+    for (;;) {
+        Pending pending;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            // stopping still drains the queue
+            wake_.wait(lock, [&] { return stop_ || !queue_.empty(); });
+            if (queue_.empty()) return;
+            pending = queue_.front();
+            queue_.pop_front();
+            busy_++;
+        }
+        space_.notify_one();
+        std::string reply = run(pending.line, targets);
+        if (pending.reply) pending.reply(reply);
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            busy_--;
+        }
+        idle_.notify_all();
+    }
+}
+
+std::string RenderServer::stats_reply() {
+    ModelCacheStats stats = cache_.stats();
+    char text[256];
+    snprintf(text, sizeof(text), "{\"ok\":true,\"jobs\":%lld,\"failed\":%lld,\"cache\":{\"models\":%d,"
+        "\"hits\":%lld,\"misses\":%lld,\"evictions\":%lld,\"reloads\":%lld}}",
+        jobs_.load(), failed_.load(), cache_.size(), stats.hits, stats.misses, stats.evictions, stats.reloads);
+    return text;
+}
+
+std::string RenderServer::run(const std::string& line, TargetPools& targets) {
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    JsonValue value;
+    std::string error;
+    if (!parse_json(line, value, error) || !value.is_object()) {
+        jobs_++;
+        failed_++;
+        return error_reply("null", error.empty() ? "a job is a JSON object" : error);
+    }
+    const JsonValue* cmd = value.get("cmd");
+    if (cmd) {
+        if (cmd->is_string() && cmd->string == "stats") return stats_reply();
+        return error_reply(value.get("id") ? json_text(*value.get("id")) : "null", "unknown cmd");
+    }
+
+    RenderJob job;
+    jobs_++;
+    if (!parse_job_value(value, job, error)) {
+        failed_++;
+        return error_reply(job.id, error);
+    }
+    bool cached = false;
+    const ModelPrep* prep = nullptr;
+    std::shared_ptr<Model> model = cache_.get(job.mesh, error, &cached, &prep);
+    if (!model) {
+        failed_++;
+        return error_reply(job.id, error);
+    }
+
+    // a few sizes in turn keep their targets; past that start over rather
+    // than hold on to every size a client ever asked for
+    std::pair<int, int> size(job.width, job.height);
+    if (!targets.count(size) && targets.size() >= 4) targets.clear();
+    std::unique_ptr<RenderTargetPool>& size_targets = targets[size];
+    if (!size_targets) size_targets.reset(new RenderTargetPool(job.width, job.height));
+
+    // with one worker the jobs come one by one, so each can have the pool
+    ThreadPool* pool = workers_.size() == 1 ? &ThreadPool::shared() : nullptr;
+    BatchRenderer batch(model.get(), *prep, *size_targets, light_dir_, pool);
+    batch.set_shading(job.shading);
+    batch.set_transparency(job.transparency);
+    std::vector<unsigned char> saved(job.outputs.size(), 0);
+    batch.render(job.cameras, [&](const ViewResult& result) {
+        const std::string& output = job.outputs[result.view];
+        TGAImage image;
+        result.framebuffer->to_image(image);
+        saved[result.view] = write_image(image, output.c_str(), image_format_for(output));
+    });
+    for (size_t i = 0; i < saved.size(); i++) {
+        if (!saved[i]) {
+            failed_++;
+            return error_reply(job.id, "can't write " + job.outputs[i]);
+        }
+    }
+
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    char timing[64];
+    snprintf(timing, sizeof(timing), "%.3f", ms);
+    std::string reply = "{\"id\":" + job.id + ",\"ok\":true,\"ms\":" + timing
+        + ",\"cached\":" + (cached ? "true" : "false") + ",\"outputs\":[";
+    for (size_t i = 0; i < job.outputs.size(); i++) reply += (i ? "," : "") + json_quote(job.outputs[i]);
+    return reply + "]}";
+}
+
+static int serve_stdin(RenderServer& server) {
+    std::mutex out_mutex;
+    ReplyCallback reply = [&](const std::string& text) {
+        std::lock_guard<std::mutex> lock(out_mutex);
+        std::cout << text << "\n";
+        std::cout.flush();
+    };
+    std::string line;
+    while (std::getline(std::cin, line)) {
+        if (!line.empty() && line[line.size() - 1] == '\r') line.erase(line.size() - 1);
+        if (line.find_first_not_of(" \t") == std::string::npos) continue;
+        server.submit(line, reply);
+    }
+    server.wait_idle();
+    return 0;
+}
+
+#ifndef _WIN32
+// A client socket, closed when the reader and the last pending reply are
+// done with it.
+struct Connection {
+    int fd;
+    std::mutex mutex;
+
+    explicit Connection(int fd) : fd(fd) {}
+    ~Connection() { ::close(fd); }
+
+    void send_line(const std::string& text) {
+        std::string data = text + "\n";
+        std::lock_guard<std::mutex> lock(mutex);
+        size_t sent = 0;
+        while (sent < data.size()) {
+            ssize_t n = ::send(fd, data.data() + sent, data.size() - sent, 0);
+            if (n <= 0) return;  // the client went away; the job still ran
+            sent += (size_t)n;
+        }
+    }
+};
+
+static void read_connection(RenderServer& server, std::shared_ptr<Connection> connection) {
+    ReplyCallback reply = [connection](const std::string& text) { connection->send_line(text); };
+    std::string pending;
+    char buffer[65536];
+    for (;;) {
+        ssize_t n = ::recv(connection->fd, buffer, sizeof(buffer), 0);
+        if (n <= 0) break;
+        pending.append(buffer, (size_t)n);
+        size_t start = 0;
+        size_t nl;
+        while ((nl = pending.find('\n', start)) != std::string::npos) {
+            std::string line = pending.substr(start, nl - start);
+            start = nl + 1;
+            if (!line.empty() && line[line.size() - 1] == '\r') line.erase(line.size() - 1);
+            if (line.find_first_not_of(" \t") != std::string::npos) server.submit(line, reply);
+        }
+        pending.erase(0, start);
+    }
+}
+
+static int serve_socket(RenderServer& server, const char* path) {
+    sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(address.sun_path)) {
+        std::cerr << "socket path too long: " << path << "\n";
+        return 1;
+    }
+    strcpy(address.sun_path, path);
+
+    int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        std::cerr << "can't create socket\n";
+        return 1;
+    }
+    ::unlink(path);
+    if (::bind(fd, (sockaddr*)&address, sizeof(address)) != 0 || ::listen(fd, 64) != 0) {
+        std::cerr << "can't listen on " << path << "\n";
+        ::close(fd);
+        return 1;
+    }
+    // a client closing early must not kill the server in send()
+    signal(SIGPIPE, SIG_IGN);
+    std::cerr << "listening on " << path << std::endl;
+
+    for (;;) {
+        int client = ::accept(fd, nullptr, nullptr);
+        if (client < 0) continue;
+        std::shared_ptr<Connection> connection(new Connection(client));
+        std::thread(read_connection, std::ref(server), connection).detach();
+    }
+}
+#endif
+
+int run_server(const char* socket_path, int workers, int cache_capacity) {
+    RenderServer server(workers, cache_capacity);
+    std::cerr << "render server: " << server.workers() << " workers, " << cache_capacity << " cached models"
+        << std::endl;
+    if (!socket_path) return serve_stdin(server);
+#ifdef _WIN32
+    std::cerr << "--serve=PATH needs Unix domain sockets; use --serve and stdin\n";
+    return 1;
+#else
+    return serve_socket(server, socket_path);
+#endif
+}
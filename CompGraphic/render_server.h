@@ -0,0 +1,113 @@
+#ifndef RENDER_SERVER_H
+#define RENDER_SERVER_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "batch_renderer.h"
+#include "camera.h"
+#include "model_cache.h"
+#include "rasterizer.h"
+#include "shading.h"
+
+// One render job as the server reads it, a JSON object on a single line:
+//
+//   {"id": 7, "mesh": "assets/head.obj",
+//    "cameras": ["front", {"eye": [3, 2, 4], "target": [0, 0, 0], "up": [0, 1, 0], "fov": 50}],
+//    "outputs": ["head_front.tga", "head_34.tga"],
+//    "width": 800, "height": 800, "shading": "flat", "transparency": "blend"}
+//
+// A camera is one of view_names or an object; eye is required, the rest
+// default as shown. There is one output per camera, written as TGA, PPM,
+// PAM or PNG by its extension. Everything after "outputs" is optional and
+// defaults to the values above.
+struct RenderJob {
+    std::string id;  // the "id" member as JSON text, "null" without one
+    std::string mesh;
+    std::vector<Camera> cameras;
+    std::vector<std::string> outputs;
+    int width;
+    int height;
+    ShadingMode shading;
+    TransparencyMode transparency;
+};
+
+bool parse_render_job(const std::string& line, RenderJob& job, std::string& error);
+
+// Called with each reply line, without the newline, from the thread that
+// ran the job.
+typedef std::function<void(const std::string&)> ReplyCallback;
+
+// Runs render jobs on its own worker threads, one job per worker at a
+// time, drawing the same scene as a normal run. Models come from a shared
+// ModelCache, so a mesh is parsed, prepared and its textures decoded once
+// for all the jobs that use it, and each worker keeps its render targets
+// from job to job for the last few image sizes it drew. Replies are JSON
+// lines:
+//
+//   {"id": 7, "ok": true, "ms": 41.2, "cached": true, "outputs": [...]}
+//   {"id": 7, "ok": false, "error": "can't open file assets/head.obj"}
+//
+// in the order jobs finish, which need not be the order they came in.
+// {"cmd": "stats"} is answered with job and cache counts instead.
+class RenderServer {
+private:
+    struct Pending {
+        std::string line;
+        ReplyCallback reply;
+    };
+    // render targets of one worker, by image size
+    typedef std::map<std::pair<int, int>, std::unique_ptr<RenderTargetPool> > TargetPools;
+
+    Vec3f light_dir_;
+    ModelCache cache_;
+    std::vector<std::thread> workers_;
+    int queue_capacity_;
+    std::mutex mutex_;
+    std::condition_variable wake_;
+    std::condition_variable space_;  // queue_ dropped below queue_capacity_
+    std::condition_variable idle_;
+    std::deque<Pending> queue_;
+    int busy_;
+    bool stop_;
+    std::atomic<long long> jobs_;
+    std::atomic<long long> failed_;
+
+    void worker_loop();
+    std::string run(const std::string& line, TargetPools& targets);
+    std::string stats_reply();
+public:
+    // workers <= 0 starts one per hardware thread. A single worker
+    // rasterizes each job on the shared ThreadPool instead. At most
+    // queue_capacity jobs wait for a worker, 4 per worker when <= 0.
+    RenderServer(int workers = 0, int cache_capacity = 16, int queue_capacity = 0);
+    // Finishes the jobs already queued.
+    ~RenderServer();
+
+    // Queues one line; the reply comes later, from a worker. Blocks while
+    // the queue is full, which holds back a client that sends faster than
+    // the workers render.
+    void submit(const std::string& line, const ReplyCallback& reply);
+    // Blocks until every job submitted so far has been answered.
+    void wait_idle();
+
+    int workers() const { return (int)workers_.size(); }
+    ModelCache& cache() { return cache_; }
+    long long jobs() const { return jobs_; }
+    long long failed() const { return failed_; }
+};
+
+// "CompGraphic --serve" reads job lines from stdin and writes replies to
+// stdout until the input ends. With a socket path it listens on that Unix
+// domain socket instead, for any number of connections, each answered on
+// its own connection; that mode runs until the process is stopped.
+int run_server(const char* socket_path, int workers, int cache_capacity);
+
+#endif // RENDER_SERVER_H
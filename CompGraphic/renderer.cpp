@@ -0,0 +1,366 @@
+#include <vector>
+#include <cmath>
+#include <iostream>
+#include <algorithm>
+#include "renderer.h"
+#include "transform.h"
+#include "clip.h"
+#include "profiler.h"
+
+const TGAColor white = TGAColor(255, 255, 255, 255);
+const TGAColor ice_color = TGAColor(180, 220, 255, 180);
+
+const char* view_names[num_views] = { "front", "side", "top", "three_quarter" };
+
+const ViewConfig view_configs[num_views] = {
+    {Vec3f(0, 0, 5), Vec3f(0, 0, 0), Vec3f(0, 1, 0), 45.0f},
+    {Vec3f(5, 0, 0), Vec3f(0, 0, 0), Vec3f(0, 1, 0), 45.0f},
+    {Vec3f(0, 5, 0), Vec3f(0, 0, 0), Vec3f(0, 0, -1), 45.0f},
+    {Vec3f(3, 2, 4), Vec3f(0, 0, 0), Vec3f(0, 1, 0), 50.0f}
+};
+
+std::vector<Vec3f> cube_vertices = {
+    Vec3f(-1.4f, -1.4f, -1.4f), 
+    Vec3f(1.4f, -1.4f, -1.4f), 
+    Vec3f(1.4f,  1.4f, -1.4f), 
+    Vec3f(-1.4f,  1.4f, -1.4f), 
+    Vec3f(-1.4f, -1.4f,  1.4f), 
+    Vec3f(1.4f, -1.4f,  1.4f), 
+    Vec3f(1.4f,  1.4f,  1.4f), 
+    Vec3f(-1.4f,  1.4f,  1.4f) 
+};
+
+std::vector<Camera> make_turntable(int views, float radius, float height, float fov, float aspect) {
+    std::vector<Camera> cameras;
+    cameras.reserve(views);
+    for (int i = 0; i < views; i++) {
+        float angle = 2.0f * 3.14159265f * i / views;
+        Vec3f eye(radius * std::sin(angle), height, radius * std::cos(angle));
+        cameras.push_back(Camera(eye, Vec3f(0, 0, 0), Vec3f(0, 1, 0), fov, aspect, 0.1f, 100.0f));
+    }
+    return cameras;
+}
+
+// Vertices of one mesh as seen from one camera.
+struct ViewVerts {
+    std::vector<Vec3i> screen;
+    std::vector<Vec4f> clip;
+    std::vector<unsigned char> codes;
+
+    explicit ViewVerts(int n) : screen(n), clip(n), codes(n) {}
+
+    void transform(const Mat4f& view_proj, const ClipVolume& volume, const Vec3f* verts, const int* indices, int n,
+        int width, int height) {
+        transform_vertices(view_proj, volume, verts, indices, n, width, height, screen.data(), clip.data(), codes.data());
+    }
+
+    bool outside(const int* corners) const {
+        return (codes[corners[0]] & codes[corners[1]] & codes[corners[2]] & clip_outside) != 0;
+    }
+
+    bool needs_clip(const int* corners) const {
+        return ((codes[corners[0]] | codes[corners[1]] | codes[corners[2]]) & clip_needed) != 0;
+    }
+};
+
+// Clip-space point to the unrounded screen position RASTER_SUBPIXEL takes.
+static RasterVertex clip_to_raster(const Vec4f& v, Vec2f uv, float fw, float fh) {
+    RasterVertex r;
+    float inv_w = 1.0f / v.w;
+    r.x = (v.x * inv_w + 1.0f) * fw / 2.0f;
+    r.y = (v.y * inv_w + 1.0f) * fh / 2.0f;
+    r.z = v.z * inv_w * 1000.0f;
+    r.w = v.w;
+    r.uv = uv;
+    return r;
+}
+
+// Queues one triangle of verts, cut down to the view volume first when it
+// needs it. Returns the number of triangles queued.
+static int draw_triangle(Rasterizer& raster, const ClipVolume& volume, const ViewVerts& verts,
+    const int* corners, const Vec2i* uv, float intensity, bool is_transparent, const TGAColor& color, Model* model,
+    Vec3f view_dir = Vec3f(), Vec3f normal = Vec3f()) {
+    bool subpixel = raster.get_mode() == RASTER_SUBPIXEL;
+    if (!verts.needs_clip(corners) && !subpixel) {
+        raster.triangle(verts.screen[corners[0]], verts.screen[corners[1]], verts.screen[corners[2]],
+            uv[0], uv[1], uv[2], intensity, is_transparent, color, model, view_dir, normal);
+        return 1;
+    }
+
+    ClipVertex poly[clip_max_verts];
+    for (int j = 0; j < 3; j++) {
+        poly[j].pos = verts.clip[corners[j]];
+        poly[j].uv = Vec2f((float)uv[j].x, (float)uv[j].y);
+    }
+    int n = verts.needs_clip(corners) ? clip_polygon(poly, 3, volume) : 3;
+
+    float fw = (float)raster.get_width();
+    float fh = (float)raster.get_height();
+    if (subpixel) {
+        RasterVertex rv[clip_max_verts];
+        for (int j = 0; j < n; j++) rv[j] = clip_to_raster(poly[j].pos, poly[j].uv, fw, fh);
+        for (int j = 2; j < n; j++) {
+            raster.triangle(rv[0], rv[j - 1], rv[j], intensity, is_transparent, color, model, view_dir, normal);
+        }
+        return n >= 3 ? n - 2 : 0;
+    }
+
+    Vec3i screen[clip_max_verts];
+    Vec2i tex[clip_max_verts];
+    for (int j = 0; j < n; j++) {
+        screen[j] = clip_to_screen(poly[j].pos, fw, fh);
+        tex[j] = Vec2i((int)(poly[j].uv.x + 0.5f), (int)(poly[j].uv.y + 0.5f));
+    }
+    for (int j = 2; j < n; j++) {
+        raster.triangle(screen[0], screen[j - 1], screen[j], tex[0], tex[j - 1], tex[j],
+            intensity, is_transparent, color, model, view_dir, normal);
+    }
+    return n >= 3 ? n - 2 : 0;
+}
+
+Vec3f calculate_face_normal(const std::vector<Vec3f>& vertices, const std::vector<int>& indices) {
+    if (indices.size() < 3) return Vec3f(0, 0, 1);
+
+    Vec3f v0 = vertices[indices[0]];
+    Vec3f v1 = vertices[indices[1]];
+    Vec3f v2 = vertices[indices[2]];
+
+    Vec3f normal = (v2 - v0) ^ (v1 - v0);
+    normal.normalize();
+    return normal;
+}
+
+std::vector<CubeFace> get_cube_faces(const Camera& camera) {
+    std::vector<CubeFace> faces;
+
+    std::vector<std::pair<std::vector<int>, Vec3f>> raw_faces = {
+        {{0, 1, 2, 3}, Vec3f(0, 0, -1)},
+        {{4, 5, 6, 7}, Vec3f(0, 0, 1)},
+        {{0, 3, 7, 4}, Vec3f(-1, 0, 0)},
+        {{1, 2, 6, 5}, Vec3f(1, 0, 0)},
+        {{0, 1, 5, 4}, Vec3f(0, -1, 0)},
+        {{3, 2, 6, 7}, Vec3f(0, 1, 0)}
+    };
+
+    Vec3f camera_pos = camera.getEye();
+
+    for (const auto& face : raw_faces) {
+        CubeFace cube_face;
+
+        const std::vector<int>& quad = face.first;
+        cube_face.indices = { quad[0], quad[1], quad[2], quad[0], quad[2], quad[3] };
+        cube_face.normal = face.second;
+
+        Vec3f face_center(0, 0, 0);
+        for (int idx : quad) {
+            face_center = face_center + cube_vertices[idx];
+        }
+        face_center = face_center * (1.0f / quad.size());
+
+        Vec3f to_camera = camera_pos - face_center;
+        to_camera.normalize();
+
+        float dot_product = cube_face.normal * to_camera;
+        cube_face.is_front = (dot_product > 0.1f);
+
+        faces.push_back(cube_face);
+    }
+
+    return faces;
+}
+
+void render_cube_with_layers(const Camera& camera, Rasterizer& raster, Vec3f light_dir) {
+    std::vector<CubeFace> faces = get_cube_faces(camera);
+
+    ClipVolume volume(camera);
+    ViewVerts verts((int)cube_vertices.size());
+    verts.transform(camera.getViewProjectionMatrix(), volume, cube_vertices.data(), nullptr, (int)cube_vertices.size(),
+        raster.get_width(), raster.get_height());
+    const Vec2i uv[3];
+
+    for (const auto& face : faces) {
+        if (!face.is_front) {
+            for (int tri = 0; tri < 2; tri++) {
+                const int* corners = &face.indices[tri * 3];
+                if (verts.outside(corners)) continue;
+
+                float intensity = 0.6f + 0.2f * std::abs(face.normal * light_dir);
+                intensity = std::min(0.8f, std::max(0.5f, intensity));
+
+                draw_triangle(raster, volume, verts, corners, uv, intensity, false, ice_color, nullptr);
+            }
+        }
+    }
+
+}
+
+void render_front_cube_faces(const Camera& camera, Rasterizer& raster, Vec3f light_dir) {
+    std::vector<CubeFace> faces = get_cube_faces(camera);
+
+    ClipVolume volume(camera);
+    ViewVerts verts((int)cube_vertices.size());
+    verts.transform(camera.getViewProjectionMatrix(), volume, cube_vertices.data(), nullptr, (int)cube_vertices.size(),
+        raster.get_width(), raster.get_height());
+    const Vec2i uv[3];
+
+    for (const auto& face : faces) {
+        if (face.is_front) {
+            for (int tri = 0; tri < 2; tri++) {
+                const int* corners = &face.indices[tri * 3];
+                if (verts.outside(corners)) continue;
+
+                // Освещение для передней грани
+                float intensity = 0.5f + 0.3f * std::abs(face.normal * light_dir);
+                intensity = std::min(0.7f, std::max(0.4f, intensity));
+
+                // Рендерим как прозрачную грань
+                draw_triangle(raster, volume, verts, corners, uv, intensity, true, ice_color, nullptr);
+            }
+        }
+    }
+}
+
+void render_ice_cube(const Camera& camera, Rasterizer& raster, Vec3f light_dir) {
+    render_cube_with_layers(camera, raster, light_dir);
+    render_front_cube_faces(camera, raster, light_dir);
+}
+
+void prepare_model(Model* model, Vec3f light_dir, ModelPrep& prep) {
+    int total_faces = model->nfaces();
+    int nverts = model->nverts();
+    prep = ModelPrep();
+    prep.faces.reserve(total_faces);
+    prep.corners.reserve(total_faces * 3);
+    prep.uvs.reserve(total_faces * 3);
+
+    Vec3f light_dir_neg = light_dir * (-1.0f);
+    for (int i = 0; i < total_faces; i++) {
+        if (model->face_size(i) < 3) continue;
+        const int* face = model->face_verts(i);
+        if (face[0] < 0 || face[0] >= nverts || face[1] < 0 || face[1] >= nverts ||
+            face[2] < 0 || face[2] >= nverts) continue;
+
+        Vec3f world_coords[3];
+        for (int j = 0; j < 3; j++) world_coords[j] = model->vert(face[j]);
+
+        Vec3f n = (world_coords[2] - world_coords[0]) ^ (world_coords[1] - world_coords[0]);
+        if (!(n.norm() > 0)) continue;
+        n.normalize();
+
+        Vec3f reflect_dir = light_dir_neg.reflect(n);
+        reflect_dir.normalize();
+
+        prep.faces.push_back(i);
+        for (int j = 0; j < 3; j++) {
+            prep.corners.push_back(face[j]);
+            prep.uvs.push_back(model->uv(i, j));
+        }
+        prep.origins.push_back(world_coords[0]);
+        prep.diffuse.push_back(std::abs(n * light_dir));
+        prep.reflect.push_back(reflect_dir);
+        prep.normals.push_back(n);
+        prep.clusters.push_back(model->face_cluster(i));
+    }
+}
+
+int render_model(Model* model, const Camera& camera, Rasterizer& raster, Vec3f light_dir,
+    float material_specular, float shininess) {
+    ModelPrep prep;
+    prepare_model(model, light_dir, prep);
+    return render_model(prep, model, camera, raster, material_specular, shininess);
+}
+
+int render_model(const ModelPrep& prep, Model* model, const Camera& camera, Rasterizer& raster,
+    float material_specular, float shininess, bool cull_backfaces, CullStats* cull) {
+    int width = raster.get_width();
+    int height = raster.get_height();
+    int rendered_faces = 0;
+    Vec3f eye = camera.getEye();
+    Mat4f view_proj = camera.getViewProjectionMatrix();
+
+    // cluster culling comes first, so hidden clusters cost no vertex work
+    int nclusters = model->nclusters();
+    std::vector<unsigned char> keep(nclusters);
+    CullStats stats;
+    Frustum frustum(camera);
+    int kept = 0;
+    {
+        PROFILE_SCOPE(STAGE_CULL, "cluster cull");
+        for (int c = 0; c < nclusters; c++) {
+            const MeshCluster& cluster = model->cluster(c);
+            stats.clusters++;
+            if (!frustum.intersectsSphere(cluster.center, cluster.radius)) {
+                stats.clusters_frustum_culled++;
+            }
+            else if (cull_backfaces && cluster_backfacing(cluster, eye)) {
+                stats.clusters_backface_culled++;
+            }
+            else {
+                keep[c] = 1;
+                kept++;
+            }
+        }
+    }
+
+    ClipVolume volume(camera);
+    ViewVerts verts(model->nverts());
+    {
+        PROFILE_SCOPE(STAGE_TRANSFORM, "transform vertices");
+        if (kept == nclusters) {
+            verts.transform(view_proj, volume, model->verts(), nullptr, model->nverts(), width, height);
+        }
+        else {
+            for (int c = 0; c < nclusters; c++) {
+                if (!keep[c]) continue;
+                verts.transform(view_proj, volume, model->verts(), model->cluster_verts(c), model->cluster(c).nverts,
+                    width, height);
+            }
+        }
+    }
+
+    PROFILE_SCOPE(STAGE_TRANSFORM, "setup faces");
+    int total_faces = (int)prep.faces.size();
+    long long cluster_culled = 0;
+
+    // Рендерим объект (голову); faces stay in file order, which decides
+    // the winner between equally deep pixels
+    for (int i = 0; i < total_faces; i++) {
+        if (!keep[prep.clusters[i]]) {
+            cluster_culled++;
+            continue;
+        }
+
+        const int* corners = &prep.corners[i * 3];
+        if (verts.outside(corners)) {
+            stats.triangles_outside++;
+            continue;
+        }
+
+        Vec3f view_dir = (eye - prep.origins[i]);
+        if (cull_backfaces && !(prep.normals[i] * view_dir < 0.0f)) {
+            stats.triangles_backface_culled++;
+            continue;
+        }
+        view_dir.normalize();
+
+        float ambient = 0.25f;
+        float diffuse = prep.diffuse[i];
+        float specular = material_specular * std::pow(std::max(0.0f, view_dir * prep.reflect[i]), shininess);
+
+        float intensity = ambient + diffuse + specular;
+        intensity = std::min(1.0f, std::max(0.0f, intensity));
+
+        if (intensity > 0.0f) {
+            if (verts.needs_clip(corners)) stats.triangles_clipped++;
+            if (draw_triangle(raster, volume, verts, corners, &prep.uvs[i * 3], intensity, false, white, model,
+                view_dir, prep.normals[i])) {
+                rendered_faces++;
+            }
+        }
+    }
+
+    PROFILE_COUNT(COUNTER_TRIANGLES_IN, total_faces);
+    PROFILE_COUNT(COUNTER_TRIANGLES_CULLED, cluster_culled + stats.triangles_outside + stats.triangles_backface_culled);
+    if (cull) *cull += stats;
+    return rendered_faces;
+}
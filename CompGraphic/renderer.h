@@ -0,0 +1,99 @@
+#ifndef RENDERER_H
+#define RENDERER_H
+
+#include <vector>
+#include "geometry.h"
+#include "tgaimage.h"
+#include "model.h"
+#include "camera.h"
+#include "rasterizer.h"
+
+extern const TGAColor white;
+extern const TGAColor ice_color;
+
+extern std::vector<Vec3f> cube_vertices;
+
+struct ViewConfig {
+    Vec3f eye;
+    Vec3f target;
+    Vec3f up;
+    float fov;
+};
+
+const int num_views = 4;
+extern const char* view_names[num_views];
+extern const ViewConfig view_configs[num_views];
+
+struct CubeFace {
+    std::vector<int> indices;
+    bool is_front;
+    Vec3f normal;
+};
+
+// Cameras evenly spaced on a circle around the origin, looking at it.
+std::vector<Camera> make_turntable(int views, float radius, float height, float fov, float aspect);
+
+Vec3f calculate_face_normal(const std::vector<Vec3f>& vertices, const std::vector<int>& indices);
+std::vector<CubeFace> get_cube_faces(const Camera& camera);
+
+// Everything render_model needs per face that depends only on the model and
+// the light, so several views of one model can share it. Faces with fewer
+// than three valid corners or zero area are left out.
+struct ModelPrep {
+    std::vector<int> faces;      // source face index of each prepared face
+    std::vector<int> corners;    // 3 vertex indices per face
+    std::vector<Vec2i> uvs;      // 3 texture coordinates per face
+    std::vector<Vec3f> origins;  // first corner in world space
+    std::vector<float> diffuse;  // |n * light_dir|
+    std::vector<Vec3f> reflect;  // -light_dir reflected about n
+    std::vector<Vec3f> normals;  // n, pointing away from the counter-clockwise front
+    std::vector<int> clusters;   // model cluster the face belongs to
+};
+
+// What render_model dropped or had to clip. Clusters go before any
+// per-vertex work, single faces after their corners are transformed.
+struct CullStats {
+    long long clusters;
+    long long clusters_frustum_culled;
+    long long clusters_backface_culled;
+    long long triangles_backface_culled; // single faces in clusters that were kept
+    long long triangles_outside;         // faces entirely outside one plane of the view volume
+    long long triangles_clipped;         // faces cut at the near or far plane or the guard band
+
+    CullStats() : clusters(0), clusters_frustum_culled(0), clusters_backface_culled(0), triangles_backface_culled(0),
+        triangles_outside(0), triangles_clipped(0) {}
+
+    CullStats& operator+=(const CullStats& s) {
+        clusters += s.clusters;
+        clusters_frustum_culled += s.clusters_frustum_culled;
+        clusters_backface_culled += s.clusters_backface_culled;
+        triangles_backface_culled += s.triangles_backface_culled;
+        triangles_outside += s.triangles_outside;
+        triangles_clipped += s.triangles_clipped;
+        return *this;
+    }
+};
+
+void prepare_model(Model* model, Vec3f light_dir, ModelPrep& prep);
+
+// The scene is drawn in three passes: back faces of the ice cube, the model
+// inside it, then the transparent front faces blended over both. All of them
+// transform to clip space first; faces crossing the near or far plane are
+// clipped there before the perspective divide, faces outside the view are
+// dropped.
+void render_cube_with_layers(const Camera& camera, Rasterizer& raster, Vec3f light_dir);
+int render_model(Model* model, const Camera& camera, Rasterizer& raster, Vec3f light_dir,
+    float material_specular = 0.5f, float shininess = 32.0f);
+// Clusters outside the view are always skipped. With cull_backfaces, clusters
+// whose normal cone faces away from the eye and single back-facing faces are
+// skipped too; by default back faces are drawn like before.
+int render_model(const ModelPrep& prep, Model* model, const Camera& camera, Rasterizer& raster,
+    float material_specular = 0.5f, float shininess = 32.0f, bool cull_backfaces = false,
+    CullStats* cull = nullptr);
+void render_front_cube_faces(const Camera& camera, Rasterizer& raster, Vec3f light_dir);
+// The whole cube in one submission, for a rasterizer in TRANSPARENCY_OIT:
+// the front faces are sorted per pixel there, so they need not come after
+// the model and one flush draws the scene.
+void render_ice_cube(const Camera& camera, Rasterizer& raster, Vec3f light_dir);
+
+#endif // RENDERER_H
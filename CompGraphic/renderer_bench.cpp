@@ -0,0 +1,358 @@
+// renderer_bench: fixed scenes for measuring the renderer from one build to
+// the next. Each scene is object.obj or a synthetic torus of about 10K, 1M
+// or 10M triangles, drawn like the main program does (ice cube and model)
+// from the four view_configs. Reported per scene are OBJ parse and mesh
+// cache load speed in MB/s, and per view frames/s and model triangles/s.
+//
+// The first frame of every view is hashed and checked against a golden
+// file, so a change that makes the renderer faster but alters pixels fails
+// the run. Hashes depend on the compiler and its floating point settings;
+// after an intended change in output, or on a new toolchain, rewrite the
+// file with --update-golden.
+
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+#include <chrono>
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+#include <algorithm>
+#include "model.h"
+#include "camera.h"
+#include "renderer.h"
+#include "batch_renderer.h"
+#include "thread_pool.h"
+#include "mapped_file.h"
+
+#ifndef RENDERER_DATA_DIR
+#define RENDERER_DATA_DIR "."
+#endif
+
+typedef std::chrono::steady_clock bench_clock;
+
+static double seconds_since(bench_clock::time_point start) {
+    return std::chrono::duration<double>(bench_clock::now() - start).count();
+}
+
+struct Scene {
+    const char* name;
+    int torus_rings;  // 0 for object.obj; a torus of 4 * rings^2 triangles otherwise
+};
+
+static const Scene scenes[] = {
+    { "object", 0 },
+    { "10k", 50 },
+    { "1m", 500 },
+    { "10m", 1581 }
+};
+static const int num_scenes = sizeof(scenes) / sizeof(scenes[0]);
+
+// Writes a torus tilted towards the viewer, rings around the tube and
+// 2 * rings segments around the hole, with normals and texture
+// coordinates, plus a checker texture "<name>_diffuse.tga" for it. The
+// output depends on nothing but rings, so the golden hashes hold for files
+// generated anywhere.
+static bool write_torus(const std::string& path, int rings) {
+    const float major = 0.75f;
+    const float minor = 0.3f;
+    const float tilt = 0.5f;  // radians about x
+    const float pi = 3.14159265358979f;
+    int segments = 2 * rings;
+
+    std::string tmp = path + ".tmp";
+    FILE* f = fopen(tmp.c_str(), "wb");
+    if (!f) {
+        std::cerr << "can't open file " << tmp << "\n";
+        return false;
+    }
+    std::vector<char> buffer(1 << 20);
+    setvbuf(f, buffer.data(), _IOFBF, buffer.size());
+
+    float ct = std::cos(tilt), st = std::sin(tilt);
+    for (int pass = 0; pass < 2; pass++) {
+        const char* tag = pass ? "vn" : "v";
+        for (int i = 0; i < segments; i++) {
+            float u = 2.0f * pi * i / segments;
+            for (int j = 0; j < rings; j++) {
+                float v = 2.0f * pi * j / rings;
+                Vec3f n(std::cos(v) * std::cos(u), std::sin(v), std::cos(v) * std::sin(u));
+                Vec3f p = pass ? n : Vec3f(major * std::cos(u), 0.0f, major * std::sin(u)) + n * minor;
+                fprintf(f, "%s %.6f %.6f %.6f\n", tag, p.x, p.y * ct - p.z * st, p.y * st + p.z * ct);
+            }
+        }
+    }
+    for (int i = 0; i <= segments; i++) {
+        for (int j = 0; j <= rings; j++) {
+            fprintf(f, "vt %.6f %.6f\n", (float)i / segments, (float)j / rings);
+        }
+    }
+    // two counter-clockwise triangles per quad; positions and normals wrap
+    // around, texture coordinates have a seam
+    for (int i = 0; i < segments; i++) {
+        for (int j = 0; j < rings; j++) {
+            int i1 = (i + 1) % segments;
+            int j1 = (j + 1) % rings;
+            int v[4] = { i * rings + j, i * rings + j1, i1 * rings + j1, i1 * rings + j };
+            int t[4] = { i * (rings + 1) + j, i * (rings + 1) + j + 1, (i + 1) * (rings + 1) + j + 1,
+                (i + 1) * (rings + 1) + j };
+            static const int tris[2][3] = { { 0, 1, 2 }, { 0, 2, 3 } };
+            for (int k = 0; k < 2; k++) {
+                const int* c = tris[k];
+                fprintf(f, "f %d/%d/%d %d/%d/%d %d/%d/%d\n",
+                    v[c[0]] + 1, t[c[0]] + 1, v[c[0]] + 1,
+                    v[c[1]] + 1, t[c[1]] + 1, v[c[1]] + 1,
+                    v[c[2]] + 1, t[c[2]] + 1, v[c[2]] + 1);
+            }
+        }
+    }
+    bool ok = !ferror(f);
+    ok = fclose(f) == 0 && ok;
+    if (!ok || std::rename(tmp.c_str(), path.c_str()) != 0) {
+        std::cerr << "can't write " << path << "\n";
+        std::remove(tmp.c_str());
+        return false;
+    }
+
+    const int size = 256;
+    TGAImage texture(size, size, TGAImage::RGB);
+    for (int y = 0; y < size; y++) {
+        for (int x = 0; x < size; x++) {
+            bool dark = ((x >> 4) + (y >> 4)) & 1;
+            texture.set(x, y, TGAColor(dark ? 60 : 230, (unsigned char)(x * 255 / (size - 1)),
+                (unsigned char)(y * 255 / (size - 1)), 255));
+        }
+    }
+    std::string texfile = path.substr(0, path.size() - 4) + "_diffuse.tga";
+    return texture.write_tga_file(texfile.c_str());
+}
+
+static unsigned long long file_size(const std::string& path) {
+    unsigned long long size = 0;
+    long long mtime;
+    return file_stat(path.c_str(), size, mtime) ? size : 0;
+}
+
+// FNV-1a over the RGB bytes of the image as it would be written out.
+static std::string image_hash(const Framebuffer& framebuffer) {
+    TGAImage image;
+    framebuffer.to_image(image);
+    const unsigned char* data = image.buffer();
+    size_t n = (size_t)image.get_width() * image.get_height() * image.get_bytespp();
+    unsigned long long h = 14695981039346656037ull;
+    for (size_t i = 0; i < n; i++) {
+        h ^= data[i];
+        h *= 1099511628211ull;
+    }
+    char text[17];
+    snprintf(text, sizeof(text), "%016llx", h);
+    return text;
+}
+
+// "<scene> <view> <hash>" per line; '#' starts a comment.
+static bool read_golden(const std::string& path, std::map<std::string, std::string>& golden) {
+    std::ifstream in(path.c_str());
+    if (!in.is_open()) return false;
+    std::string line;
+    while (std::getline(in, line)) {
+        if (line.empty() || line[0] == '#') continue;
+        std::istringstream fields(line);
+        std::string scene, view, hash;
+        if (fields >> scene >> view >> hash) golden[scene + " " + view] = hash;
+    }
+    return true;
+}
+
+static bool write_golden(const std::string& path, const std::map<std::string, std::string>& golden) {
+    std::ofstream out(path.c_str());
+    if (!out.is_open()) {
+        std::cerr << "can't open file " << path << "\n";
+        return false;
+    }
+    out << "# renderer_bench image hashes: scene, view, FNV-1a of the RGB pixels\n";
+    for (std::map<std::string, std::string>::const_iterator it = golden.begin(); it != golden.end(); ++it) {
+        out << it->first << " " << it->second << "\n";
+    }
+    return out.good();
+}
+
+static void usage() {
+    std::cout << "usage: renderer_bench [--scenes=object,10k,1m,10m] [--frames=N] [--data=DIR]\n"
+        "                      [--work=DIR] [--golden=FILE] [--update-golden]\n"
+        "  --data    directory of object.obj and its textures\n"
+        "  --work    where the synthetic meshes are generated, once\n"
+        "  --frames  timed frames per view; by default about 2M triangles' worth, 1 to 20\n";
+}
+
+int main(int argc, char** argv) {
+    std::string data_dir = RENDERER_DATA_DIR;
+    std::string work_dir = ".";
+    std::string golden_path;
+    std::string scene_list = "object,10k,1m,10m";
+    int frames_override = 0;
+    bool update_golden = false;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (!arg.compare(0, 9, "--scenes=")) {
+            scene_list = arg.substr(9);
+        }
+        else if (!arg.compare(0, 9, "--frames=")) {
+            frames_override = atoi(arg.c_str() + 9);
+            if (frames_override <= 0) {
+                std::cout << "Bad frame count: " << arg << std::endl;
+                return 1;
+            }
+        }
+        else if (!arg.compare(0, 7, "--data=")) {
+            data_dir = arg.substr(7);
+        }
+        else if (!arg.compare(0, 7, "--work=")) {
+            work_dir = arg.substr(7);
+        }
+        else if (!arg.compare(0, 9, "--golden=")) {
+            golden_path = arg.substr(9);
+        }
+        else if (arg == "--update-golden") {
+            update_golden = true;
+        }
+        else {
+            usage();
+            return arg == "--help" ? 0 : 1;
+        }
+    }
+    if (golden_path.empty()) golden_path = data_dir + "/renderer_golden.txt";
+
+    std::vector<const Scene*> selected;
+    std::istringstream names(scene_list);
+    std::string name;
+    while (std::getline(names, name, ',')) {
+        const Scene* scene = nullptr;
+        for (int s = 0; s < num_scenes; s++) {
+            if (name == scenes[s].name) scene = &scenes[s];
+        }
+        if (!scene) {
+            std::cout << "Unknown scene: " << name << std::endl;
+            return 1;
+        }
+        selected.push_back(scene);
+    }
+
+    std::map<std::string, std::string> golden;
+    if (!read_golden(golden_path, golden) && !update_golden) {
+        std::cout << "No golden hashes in " << golden_path << "; run with --update-golden to create them" << std::endl;
+    }
+
+    const int width = 800;
+    const int height = 800;
+    Vec3f light_dir(0.2f, 0.4f, -1.0f);
+    light_dir.normalize();
+    std::vector<Camera> cameras;
+    for (int view = 0; view < num_views; view++) {
+        const ViewConfig& config = view_configs[view];
+        cameras.push_back(Camera(config.eye, config.target, config.up,
+            config.fov, (float)width / height, 0.1f, 100.0f));
+    }
+    ThreadPool& pool = ThreadPool::shared();
+
+    int mismatches = 0;
+    int failed = 0;
+    for (size_t s = 0; s < selected.size(); s++) {
+        const Scene& scene = *selected[s];
+        std::string path;
+        if (scene.torus_rings == 0) {
+            path = data_dir + "/object.obj";
+        }
+        else {
+            path = work_dir + "/torus_" + scene.name + ".obj";
+            if (file_size(path) == 0) {
+                bench_clock::time_point start = bench_clock::now();
+                if (!write_torus(path, scene.torus_rings)) {
+                    failed++;
+                    continue;
+                }
+                std::cout << "renderer/" << scene.name << "/generate" << std::fixed << std::setprecision(3)
+                    << "  s=" << seconds_since(start) << std::defaultfloat << std::endl;
+            }
+        }
+
+        // the first load parses the OBJ and writes the cache, the second
+        // maps the cache
+        std::string cache = path + ".mcache";
+        std::remove(cache.c_str());
+        bench_clock::time_point start = bench_clock::now();
+        std::unique_ptr<Model> model(new Model(path.c_str()));
+        double parse_s = seconds_since(start);
+        if (model->nverts() == 0) {
+            std::cerr << "can't load " << path << "\n";
+            failed++;
+            continue;
+        }
+        model.reset();
+        start = bench_clock::now();
+        model.reset(new Model(path.c_str()));
+        double cached_s = seconds_since(start);
+
+        // both loads read the textures too
+        static const char* suffixes[] = { "_diffuse.tga", "_nm.tga", "_spec.tga" };
+        double texture_mb = 0.0;
+        for (int k = 0; k < 3; k++) texture_mb += file_size(path.substr(0, path.size() - 4) + suffixes[k]) / 1048576.0;
+        double obj_mb = file_size(path) / 1048576.0;
+        double cache_mb = file_size(cache) / 1048576.0;
+        int triangles = model->nfaces();
+        std::cout << "renderer/" << scene.name << "/load" << std::fixed << std::setprecision(3)
+            << "  triangles=" << triangles
+            << "  obj MB=" << obj_mb
+            << "  texture MB=" << texture_mb
+            << "  parse MB/s=" << (obj_mb + texture_mb) / parse_s
+            << "  cache MB/s=" << (cache_mb + texture_mb) / cached_s
+            << std::defaultfloat << std::endl;
+
+        BatchRenderer batch(model.get(), width, height, light_dir, &pool);
+        int frames = frames_override ? frames_override : std::max(1, std::min(20, 2000000 / std::max(1, triangles)));
+        for (int view = 0; view < num_views; view++) {
+            std::vector<Camera> one(1, cameras[view]);
+            std::string hash;
+            // untimed first frame: warms the render target and gives the hash
+            batch.render(one, [&](const ViewResult& result) { hash = image_hash(*result.framebuffer); });
+
+            start = bench_clock::now();
+            for (int frame = 0; frame < frames; frame++) batch.render(one, ViewCallback());
+            double elapsed = seconds_since(start);
+
+            std::string key = std::string(scene.name) + " " + view_names[view];
+            const char* verdict;
+            if (update_golden) {
+                verdict = golden[key] == hash ? "ok" : "updated";
+                golden[key] = hash;
+            }
+            else if (!golden.count(key)) {
+                verdict = "MISSING";
+                mismatches++;
+            }
+            else if (golden[key] != hash) {
+                verdict = "MISMATCH";
+                mismatches++;
+            }
+            else {
+                verdict = "ok";
+            }
+            std::cout << "renderer/" << scene.name << "/" << view_names[view] << std::fixed << std::setprecision(3)
+                << "  frames=" << frames
+                << "  frames/s=" << frames / elapsed
+                << "  triangles/s=" << std::setprecision(0) << (double)triangles * frames / elapsed
+                << std::defaultfloat
+                << "  hash=" << hash << " " << verdict << std::endl;
+        }
+    }
+
+    if (update_golden && !write_golden(golden_path, golden)) failed++;
+    if (mismatches) {
+        std::cout << mismatches << " views differ from " << golden_path << std::endl;
+    }
+    return failed || mismatches ? 1 : 0;
+}
@@ -0,0 +1,141 @@
+#include <algorithm>
+#include <cmath>
+#include "shading.h"
+#include "rasterizer.h"
+#include "shading_simd.h"
+
+MapShader::MapShader(Vec3f light_dir, float material_specular, float shininess, ShadingMode mode, float ambient)
+    : light_dir_(light_dir), ambient_(ambient), specular_(material_specular), shininess_(shininess),
+    blinn_(mode == SHADE_BLINN) {
+    light_dir_.normalize();
+}
+
+void MapShader::shade(const RasterTriangle& tri, const FragmentBatch& batch, unsigned int* out) const {
+    const Texture& surface = tri.model->surface_texture();
+    int n = batch.n;
+
+    unsigned int texel[fragment_batch_size];
+    if (surface.nlevels() == 0) {
+        tri.model->diffuse_texture().sample(batch.u, batch.v, batch.lod, n, batch.filter, texel);
+        for (int i = 0; i < n; i++) {
+            TGAColor color((int)texel[i], 4);
+            color.r = (unsigned char)(color.r * tri.intensity);
+            color.g = (unsigned char)(color.g * tri.intensity);
+            color.b = (unsigned char)(color.b * tri.intensity);
+            out[i] = color.val;
+        }
+        return;
+    }
+
+    // color, then normal and highlight exponent from the same cache lines
+    unsigned int normal[fragment_batch_size];
+    unsigned int* layers[2] = { texel, normal };
+    surface.sample_layers(batch.u, batch.v, batch.lod, n, batch.filter, layers);
+    bool mapped_exponent = tri.model->has_specular_map();
+    // Blinn-Phong needs about four times the exponent for the same highlight
+    float boost = blinn_ ? 4.0f : 1.0f;
+
+    const Vec3f& l = light_dir_;
+    Vec3f view = tri.view_dir;
+    // Phong: r * v with r = 2 (n * l) n - l, the reflection render_model uses
+    float lv = l * view;
+    // Blinn-Phong: n * h with the half vector between light and eye
+    Vec3f h = l + view;
+    if (h.norm() > 0.0f) h.normalize();
+
+#ifdef SHADING_SSE2
+    for (int i = n; i < (n + 3) / 4 * 4; i++) {
+        texel[i] = 0;
+        normal[i] = 0;
+    }
+    // The model normalized the map's texels when it loaded them; only
+    // filtered normals, averaged over several texels, need it again.
+    bool renormalize = batch.filter != TEXTURE_NEAREST;
+    // normals are read as texel - 127.5 and the 2 / 255 that takes them to
+    // [-1, 1] is folded into the vectors they are dotted with
+    const float unit = 2.0f / 255.0f;
+    const __m128 half = _mm_set1_ps(127.5f);
+    const __m128 one = _mm_set1_ps(1.0f);
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 sign = _mm_set1_ps(-0.0f);
+    const __m128 lx = _mm_set1_ps(l.x * unit), ly = _mm_set1_ps(l.y * unit), lz = _mm_set1_ps(l.z * unit);
+    const Vec3f& d = blinn_ ? h : view;
+    const __m128 dx = _mm_set1_ps(d.x * unit), dy = _mm_set1_ps(d.y * unit), dz = _mm_set1_ps(d.z * unit);
+    const __m128 lv4 = _mm_set1_ps(lv);
+    const __m128 ambient = _mm_set1_ps(ambient_);
+    // log2 of the dimmest highlight worth a pow: one adding under 1/512 to
+    // the intensity is below half a level of any channel
+    const __m128 faint = _mm_set1_ps(std::log2(1.0f / 512.0f / std::max(specular_, 1e-6f)));
+    const __m128 shininess = _mm_set1_ps(boost * shininess_);
+    const __m128i alpha = _mm_set_epi16(256, 0, 0, 0, 256, 0, 0, 0);
+    const __m128i rgb = _mm_set_epi16(0, -1, -1, -1, 0, -1, -1, -1);
+    for (int i = 0; i < n; i += 4) {
+        __m128i c = _mm_loadu_si128((const __m128i*)(texel + i));
+        __m128i nm = _mm_loadu_si128((const __m128i*)(normal + i));
+
+        // texels hold b, g, r from the low byte up; the normal is (r, g, b)
+        __m128 x = _mm_sub_ps(channel(nm, 16), half);
+        __m128 y = _mm_sub_ps(channel(nm, 8), half);
+        __m128 z = _mm_sub_ps(channel(nm, 0), half);
+        if (renormalize) {
+            __m128 len2 = _mm_max_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(x, x), _mm_mul_ps(y, y)), _mm_mul_ps(z, z)), _mm_set1_ps(1e-6f));
+            __m128 r = _mm_mul_ps(rsqrt_ps(len2), _mm_set1_ps(127.5f));
+            x = _mm_mul_ps(x, r);
+            y = _mm_mul_ps(y, r);
+            z = _mm_mul_ps(z, r);
+        }
+
+        __m128 nl = _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, lx), _mm_mul_ps(y, ly)), _mm_mul_ps(z, lz));
+        __m128 nd = _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, dx), _mm_mul_ps(y, dy)), _mm_mul_ps(z, dz));
+        // Blinn-Phong: n * h; Phong: r * v = 2 (n * l) (n * v) - l * v
+        __m128 highlight = blinn_ ? nd : _mm_sub_ps(_mm_mul_ps(_mm_add_ps(nl, nl), nd), lv4);
+        __m128 intensity = _mm_add_ps(ambient, _mm_andnot_ps(sign, nl));
+        // pow only runs for quads with a pixel it can change: not lit to
+        // full already, and with a highlight bright enough to show, judged
+        // by a bound on log2 that costs a few instructions
+        __m128 exponent = mapped_exponent ? _mm_mul_ps(channel(nm, 24), _mm_set1_ps(boost)) : shininess;
+        __m128 visible = _mm_cmpge_ps(_mm_mul_ps(exponent, log2_upper_ps(highlight)), faint);
+        if (_mm_movemask_ps(_mm_and_ps(visible, _mm_cmplt_ps(intensity, one)))) {
+            __m128 spec = pow_ps(_mm_max_ps(highlight, zero), exponent);
+            intensity = _mm_add_ps(intensity, _mm_mul_ps(_mm_set1_ps(specular_), spec));
+        }
+        intensity = _mm_min_ps(one, _mm_max_ps(zero, intensity));
+
+        // color * intensity in 16-bit lanes as (color * weight) >> 8, with
+        // weight = intensity * 256 over each pixel's b, g, r and 256 over its alpha
+        __m128i weight = _mm_cvttps_epi32(_mm_mul_ps(intensity, _mm_set1_ps(256.0f)));
+        weight = _mm_packs_epi32(weight, weight);
+        weight = _mm_unpacklo_epi16(weight, weight);
+        __m128i w01 = _mm_or_si128(_mm_and_si128(_mm_unpacklo_epi32(weight, weight), rgb), alpha);
+        __m128i w23 = _mm_or_si128(_mm_and_si128(_mm_unpackhi_epi32(weight, weight), rgb), alpha);
+        __m128i c01 = _mm_srli_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(c, _mm_setzero_si128()), w01), 8);
+        __m128i c23 = _mm_srli_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(c, _mm_setzero_si128()), w23), 8);
+        __m128i packed = _mm_packus_epi16(c01, c23);
+        if (i + 4 <= n) {
+            _mm_storeu_si128((__m128i*)(out + i), packed);
+        }
+        else {
+            unsigned int rest[4];
+            _mm_storeu_si128((__m128i*)rest, packed);
+            for (int k = i; k < n; k++) out[k] = rest[k - i];
+        }
+    }
+#else
+    for (int i = 0; i < n; i++) {
+        Vec3f nrm((float)((normal[i] >> 16) & 0xff), (float)((normal[i] >> 8) & 0xff), (float)(normal[i] & 0xff));
+        nrm = nrm * (2.0f / 255.0f) - Vec3f(1.0f, 1.0f, 1.0f);
+        if (nrm.norm() > 0.0f) nrm.normalize();
+        float nl = nrm * l;
+        float highlight = blinn_ ? nrm * h : 2.0f * nl * (nrm * view) - lv;
+        float exponent = boost * (mapped_exponent ? (float)(normal[i] >> 24) : shininess_);
+        float spec = highlight > 0.0f ? std::pow(highlight, exponent) : 0.0f;
+        float intensity = std::min(1.0f, std::max(0.0f, ambient_ + std::abs(nl) + specular_ * spec));
+
+        TGAColor color((int)texel[i], 4);
+        color.r = (unsigned char)(color.r * intensity);
+        color.g = (unsigned char)(color.g * intensity);
+        color.b = (unsigned char)(color.b * intensity);
+        out[i] = color.val;
+    }
+#endif
+}
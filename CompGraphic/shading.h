@@ -0,0 +1,63 @@
+#ifndef SHADING_H
+#define SHADING_H
+
+#include "geometry.h"
+#include "texture.h"
+
+struct RasterTriangle;
+
+enum ShadingMode {
+    SHADE_FLAT,   // one intensity per face, set up in render_model
+    SHADE_PHONG,  // per pixel from the normal and specular maps, Phong highlight
+    SHADE_BLINN,  // the same with a Blinn-Phong half-vector highlight
+    SHADE_DEFERRED // G-buffer first, then every light per pixel in a pass of its own
+};
+
+const int fragment_batch_size = 64;
+
+// Covered pixels of one triangle waiting to be shaded, as arrays so a shader
+// can work through them four at a time. u and v are texel coordinates of the
+// diffuse map the way Texture::sample takes them, lod as texture_lod() gives it.
+struct FragmentBatch {
+    int n;
+    TextureFilter filter;
+    int x[fragment_batch_size];
+    int y[fragment_batch_size];
+    float u[fragment_batch_size];
+    float v[fragment_batch_size];
+    float lod[fragment_batch_size];
+
+    FragmentBatch() : n(0), filter(TEXTURE_NEAREST) {}
+};
+
+// Programmable stage for the textured, opaque triangles of a model. The
+// rasterizer hands over a batch at a time, so the cost of the call is spread
+// over up to fragment_batch_size pixels. shade() is called from several tiles
+// at once and must not change the shader.
+class FragmentShader {
+public:
+    virtual ~FragmentShader() {}
+    // Colors of the batch's fragments in order, packed like TGAColor::val.
+    virtual void shade(const RasterTriangle& tri, const FragmentBatch& batch, unsigned int* out) const = 0;
+};
+
+// The lighting of render_model evaluated per pixel: ambient plus two-sided
+// diffuse plus a highlight, with the normal read from the model's normal map
+// (object space) and the highlight exponent from its specular map. The view
+// direction is the one render_model computed for the triangle. Models without
+// a normal map keep the triangle's flat intensity; without a specular map
+// every texel uses shininess.
+class MapShader : public FragmentShader {
+private:
+    Vec3f light_dir_;
+    float ambient_;
+    float specular_;
+    float shininess_;
+    bool blinn_;
+public:
+    MapShader(Vec3f light_dir, float material_specular, float shininess, ShadingMode mode, float ambient = 0.25f);
+
+    void shade(const RasterTriangle& tri, const FragmentBatch& batch, unsigned int* out) const override;
+};
+
+#endif // SHADING_H
@@ -0,0 +1,73 @@
+#ifndef SHADING_SIMD_H
+#define SHADING_SIMD_H
+
+// SSE2 pieces shared by the per-pixel lighting code.
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define SHADING_SSE2 1
+#include <emmintrin.h>
+#endif
+
+#ifdef SHADING_SSE2
+// log2 of x > 0: the exponent bits plus a degree 5 fit of log2 on the
+// mantissa in [1, 2), within 3.2e-5.
+static inline __m128 log2_ps(__m128 x) {
+    __m128i bits = _mm_castps_si128(x);
+    __m128 e = _mm_cvtepi32_ps(_mm_sub_epi32(_mm_srli_epi32(bits, 23), _mm_set1_epi32(127)));
+    __m128 m = _mm_or_ps(_mm_castsi128_ps(_mm_and_si128(bits, _mm_set1_epi32(0x007fffff))), _mm_set1_ps(1.0f));
+    __m128 p = _mm_set1_ps(0.0434294804f);
+    p = _mm_add_ps(_mm_mul_ps(p, m), _mm_set1_ps(-0.404874905f));
+    p = _mm_add_ps(_mm_mul_ps(p, m), _mm_set1_ps(1.59393483f));
+    p = _mm_add_ps(_mm_mul_ps(p, m), _mm_set1_ps(-3.49255926f));
+    p = _mm_add_ps(_mm_mul_ps(p, m), _mm_set1_ps(5.04693496f));
+    p = _mm_add_ps(_mm_mul_ps(p, m), _mm_set1_ps(-2.78683329f));
+    return _mm_add_ps(e, p);
+}
+
+// 2^y for y in [-126, 127]: the integer part goes into the exponent bits, the
+// fraction through a degree 4 fit, relative error 5.3e-6.
+static inline __m128 exp2_ps(__m128 y) {
+    y = _mm_max_ps(_mm_min_ps(y, _mm_set1_ps(127.0f)), _mm_set1_ps(-126.0f));
+    __m128i i = _mm_cvttps_epi32(y);
+    // truncation rounds negative values up; step back to the floor
+    __m128 fi = _mm_cvtepi32_ps(i);
+    __m128 up = _mm_cmpgt_ps(fi, y);
+    i = _mm_add_epi32(i, _mm_castps_si128(up));
+    fi = _mm_sub_ps(fi, _mm_and_ps(up, _mm_set1_ps(1.0f)));
+    __m128 f = _mm_sub_ps(y, fi);
+    __m128 p = _mm_set1_ps(0.0135115091f);
+    p = _mm_add_ps(_mm_mul_ps(p, f), _mm_set1_ps(0.0519898759f));
+    p = _mm_add_ps(_mm_mul_ps(p, f), _mm_set1_ps(0.241508463f));
+    p = _mm_add_ps(_mm_mul_ps(p, f), _mm_set1_ps(0.692974412f));
+    p = _mm_add_ps(_mm_mul_ps(p, f), _mm_set1_ps(1.00000524f));
+    __m128 scale = _mm_castsi128_ps(_mm_slli_epi32(_mm_add_epi32(i, _mm_set1_epi32(127)), 23));
+    return _mm_mul_ps(p, scale);
+}
+
+// At least log2 of x and at most 0.087 above it, from the bits alone: the
+// exponent plus the mantissa taken as linear, raised by the largest amount
+// log2 rises above that line on [1, 2). Anything <= 0 comes out below -126.
+static inline __m128 log2_upper_ps(__m128 x) {
+    __m128 bits = _mm_cvtepi32_ps(_mm_castps_si128(x));
+    return _mm_add_ps(_mm_mul_ps(bits, _mm_set1_ps(1.0f / 8388608.0f)), _mm_set1_ps(-127.0f + 0.0861f));
+}
+
+// x^e for x >= 0, 0 where x is 0.
+static inline __m128 pow_ps(__m128 x, __m128 e) {
+    __m128 positive = _mm_cmpgt_ps(x, _mm_setzero_ps());
+    return _mm_and_ps(positive, exp2_ps(_mm_mul_ps(e, log2_ps(x))));
+}
+
+// The byte at bit shift of each packed texel, as a float.
+static inline __m128 channel(__m128i c, int shift) {
+    return _mm_cvtepi32_ps(_mm_and_si128(_mm_srli_epi32(c, shift), _mm_set1_epi32(0xff)));
+}
+
+// 1 / sqrt(x): the rsqrt estimate and one Newton step.
+static inline __m128 rsqrt_ps(__m128 x) {
+    __m128 r = _mm_rsqrt_ps(x);
+    return _mm_mul_ps(r, _mm_sub_ps(_mm_set1_ps(1.5f), _mm_mul_ps(_mm_mul_ps(_mm_set1_ps(0.5f), x), _mm_mul_ps(r, r))));
+}
+#endif
+
+#endif // SHADING_SIMD_H
@@ -0,0 +1,238 @@
+#include <algorithm>
+#include <cstring>
+#include "texture.h"
+#include "shading_simd.h"
+
+// bits of a 0..7 coordinate spread to the even bit positions
+static const unsigned char spread3[8] = { 0, 1, 4, 5, 16, 17, 20, 21 };
+
+static inline int texel_index(int tiles_x, int x, int y) {
+    return (((y >> 3) * tiles_x + (x >> 3)) << 6) | spread3[x & 7] | (spread3[y & 7] << 1);
+}
+
+// floor without a libm call, which is what floor() compiles to below SSE4.1
+static inline int floor_int(float f) {
+    int i = (int)f;
+    return i - (f < (float)i);
+}
+
+// Per-byte a + (b - a) * w / 256, two bytes per 16-bit half at a time.
+static inline unsigned int lerp_texel(unsigned int a, unsigned int b, unsigned int w) {
+    unsigned int rb = ((a & 0x00ff00ffu) * (256 - w) + (b & 0x00ff00ffu) * w) >> 8;
+    unsigned int ga = (((a >> 8) & 0x00ff00ffu) * (256 - w) + ((b >> 8) & 0x00ff00ffu) * w) >> 8;
+    return (rb & 0x00ff00ffu) | ((ga & 0x00ff00ffu) << 8);
+}
+
+inline unsigned int Texture::fetch(const Level& level, int x, int y, int layer) const {
+    x = std::max(0, std::min(level.width - 1, x));
+    y = std::max(0, std::min(level.height - 1, y));
+    return level.texels[texel_index(level.tiles_x, x, y) * layers_ + layer];
+}
+
+void Texture::build(TGAImage& image, int layers) {
+    TGAImage* images[1] = { &image };
+    build(images, 1, layers);
+}
+
+void Texture::build(TGAImage* const* images, int count, int layers) {
+    levels_.clear();
+    layers_ = std::max(1, std::max(count, layers));
+    bytespp_ = count > 0 ? images[0]->get_bytespp() : 0;
+    if (count <= 0) return;
+    int w = images[0]->get_width();
+    int h = images[0]->get_height();
+    for (int k = 0; k < count; k++) {
+        if (!images[k]->buffer() || images[k]->get_width() != w || images[k]->get_height() != h) return;
+    }
+    if (w <= 0 || h <= 0) return;
+
+    levels_.reserve(32);
+    for (;;) {
+        levels_.push_back(Level());
+        Level& level = levels_.back();
+        level.width = w;
+        level.height = h;
+        level.tiles_x = (w + 7) / 8;
+        level.texels.resize(level.tiles_x * ((h + 7) / 8) * 64 * layers_);
+        if (w == 1 && h == 1) break;
+        w = std::max(1, w / 2);
+        h = std::max(1, h / 2);
+    }
+    for (int k = 0; k < count; k++) store_layer(k, *images[k]);
+}
+
+bool Texture::fill_layer(int layer, TGAImage& image) {
+    if (levels_.empty() || layer < 0 || layer >= layers_ || !image.buffer() ||
+        image.get_width() != levels_[0].width || image.get_height() != levels_[0].height) return false;
+    store_layer(layer, image);
+    return true;
+}
+
+// Copies the image into level 0 of the layer and box filters it down the
+// mip chain, touching no other layer's texels.
+void Texture::store_layer(int layer, TGAImage& image) {
+    Level& base = levels_[0];
+    const unsigned char* data = image.buffer();
+    int bytespp = image.get_bytespp();
+    for (int y = 0; y < base.height; y++) {
+        for (int x = 0; x < base.width; x++) {
+            base.texels[texel_index(base.tiles_x, x, y) * layers_ + layer] = TGAColor(data + (x + y * base.width) * bytespp, bytespp).val;
+        }
+    }
+
+    for (size_t i = 1; i < levels_.size(); i++) {
+        const Level& src = levels_[i - 1];
+        Level& next = levels_[i];
+        for (int y = 0; y < next.height; y++) {
+            for (int x = 0; x < next.width; x++) {
+                int x0 = 2 * x, x1 = std::min(2 * x + 1, src.width - 1);
+                int y0 = 2 * y, y1 = std::min(2 * y + 1, src.height - 1);
+                unsigned int c[4] = {
+                    fetch(src, x0, y0, layer), fetch(src, x1, y0, layer),
+                    fetch(src, x0, y1, layer), fetch(src, x1, y1, layer)
+                };
+                unsigned int out = 0;
+                for (int k = 0; k < 32; k += 8) {
+                    unsigned int sum = 2;
+                    for (int j = 0; j < 4; j++) sum += (c[j] >> k) & 0xff;
+                    out |= (sum >> 2) << k;
+                }
+                next.texels[texel_index(next.tiles_x, x, y) * layers_ + layer] = out;
+            }
+        }
+    }
+}
+
+TGAColor Texture::get(int x, int y) const {
+    if (levels_.empty()) return TGAColor();
+    return TGAColor((int)fetch(levels_[0], x, y, 0), bytespp_);
+}
+
+unsigned int Texture::bilinear(int level, float u, float v, int layer) const {
+    const Level& l = levels_[level];
+    float scale = 1.0f / (float)(1 << level);
+    // texel centers sit at half-integer coordinates
+    float s = u * scale - 0.5f;
+    float t = v * scale - 0.5f;
+    int x = floor_int(s);
+    int y = floor_int(t);
+    unsigned int wx = (unsigned int)((s - (float)x) * 256.0f);
+    unsigned int wy = (unsigned int)((t - (float)y) * 256.0f);
+
+    unsigned int top = lerp_texel(fetch(l, x, y, layer), fetch(l, x + 1, y, layer), wx);
+    unsigned int bottom = lerp_texel(fetch(l, x, y + 1, layer), fetch(l, x + 1, y + 1, layer), wx);
+    return lerp_texel(top, bottom, wy);
+}
+
+TGAColor Texture::sample(float u, float v, float lod, TextureFilter filter, int layer) const {
+    if (levels_.empty()) return TGAColor();
+    int last = (int)levels_.size() - 1;
+
+    if (filter == TEXTURE_NEAREST) {
+        return TGAColor((int)fetch(levels_[0], floor_int(u), floor_int(v), layer), bytespp_);
+    }
+    if (filter == TEXTURE_TRILINEAR) {
+        float l = std::max(0.0f, std::min((float)last, lod));
+        int l0 = (int)l;
+        unsigned int w = (unsigned int)((l - l0) * 256.0f);
+        unsigned int c = bilinear(l0, u, v, layer);
+        if (w > 0 && l0 < last) c = lerp_texel(c, bilinear(l0 + 1, u, v, layer), w);
+        return TGAColor((int)c, bytespp_);
+    }
+
+    int level = std::max(0, std::min(last, floor_int(lod + 0.5f)));
+    if (filter == TEXTURE_BILINEAR) {
+        return TGAColor((int)bilinear(level, u, v, layer), bytespp_);
+    }
+    float scale = 1.0f / (float)(1 << level);
+    return TGAColor((int)fetch(levels_[level], floor_int(u * scale), floor_int(v * scale), layer), bytespp_);
+}
+
+void Texture::sample(const float* u, const float* v, const float* lod, int n, TextureFilter filter,
+    unsigned int* out, int layer) const {
+    if (levels_.empty()) {
+        for (int i = 0; i < n; i++) out[i] = 0;
+        return;
+    }
+    if (filter == TEXTURE_NEAREST) {
+        const Level& l = levels_[0];
+        for (int i = 0; i < n; i++) out[i] = fetch(l, floor_int(u[i]), floor_int(v[i]), layer);
+        return;
+    }
+    for (int i = 0; i < n; i++) out[i] = sample(u[i], v[i], lod[i], filter, layer).val;
+}
+
+void Texture::sample_layers(const float* u, const float* v, const float* lod, int n, TextureFilter filter,
+    unsigned int* const* out) const {
+    if (levels_.empty() || filter != TEXTURE_NEAREST) {
+        for (int layer = 0; layer < layers_; layer++) sample(u, v, lod, n, filter, out[layer], layer);
+        return;
+    }
+    const Level& l = levels_[0];
+    if (layers_ == 2) {
+        // the common color + normal pair: one 8-byte load per point
+        const unsigned long long* pairs = (const unsigned long long*)l.texels.data();
+        unsigned int* out0 = out[0];
+        unsigned int* out1 = out[1];
+        int width = l.width;
+        int height = l.height;
+        int tiles_x = l.tiles_x;
+        int i = 0;
+#ifdef SHADING_SSE2
+        // texel_index four points at a time. Clamping before truncation makes
+        // truncation agree with floor_int, and tile rows times tiles_x fit
+        // the 16-bit multiply of madd.
+        const __m128 max_u = _mm_set1_ps((float)(width - 1));
+        const __m128 max_v = _mm_set1_ps((float)(height - 1));
+        const __m128i row_tiles = _mm_set1_epi32(tiles_x);
+        const __m128i seven = _mm_set1_epi32(7);
+        unsigned int index[4];
+        for (; i + 4 <= n; i += 4) {
+            // the operand order sends NaN to 0
+            __m128i x = _mm_cvttps_epi32(_mm_min_ps(_mm_max_ps(_mm_loadu_ps(u + i), _mm_setzero_ps()), max_u));
+            __m128i y = _mm_cvttps_epi32(_mm_min_ps(_mm_max_ps(_mm_loadu_ps(v + i), _mm_setzero_ps()), max_v));
+            __m128i tile = _mm_add_epi32(_mm_madd_epi16(_mm_srli_epi32(y, 3), row_tiles), _mm_srli_epi32(x, 3));
+            __m128i sx = _mm_and_si128(x, seven);
+            __m128i sy = _mm_and_si128(y, seven);
+            // spread3: bits 0, 1, 2 to bits 0, 2, 4
+            sx = _mm_and_si128(_mm_or_si128(sx, _mm_slli_epi32(sx, 2)), _mm_set1_epi32(0x13));
+            sx = _mm_and_si128(_mm_or_si128(sx, _mm_slli_epi32(sx, 1)), _mm_set1_epi32(0x15));
+            sy = _mm_and_si128(_mm_or_si128(sy, _mm_slli_epi32(sy, 2)), _mm_set1_epi32(0x13));
+            sy = _mm_and_si128(_mm_or_si128(sy, _mm_slli_epi32(sy, 1)), _mm_set1_epi32(0x15));
+            __m128i idx = _mm_or_si128(_mm_slli_epi32(tile, 6), _mm_or_si128(sx, _mm_slli_epi32(sy, 1)));
+            _mm_storeu_si128((__m128i*)index, idx);
+            for (int k = 0; k < 4; k++) {
+                unsigned long long pair;
+                memcpy(&pair, pairs + index[k], sizeof(pair));
+                out0[i + k] = (unsigned int)pair;
+                out1[i + k] = (unsigned int)(pair >> 32);
+            }
+        }
+#endif
+        for (; i < n; i++) {
+            int x = std::max(0, std::min(width - 1, floor_int(u[i])));
+            int y = std::max(0, std::min(height - 1, floor_int(v[i])));
+            unsigned long long pair;
+            memcpy(&pair, pairs + texel_index(tiles_x, x, y), sizeof(pair));
+            out0[i] = (unsigned int)pair;
+            out1[i] = (unsigned int)(pair >> 32);
+        }
+        return;
+    }
+    for (int i = 0; i < n; i++) {
+        int x = std::max(0, std::min(l.width - 1, floor_int(u[i])));
+        int y = std::max(0, std::min(l.height - 1, floor_int(v[i])));
+        const unsigned int* texel = &l.texels[texel_index(l.tiles_x, x, y) * layers_];
+        for (int layer = 0; layer < layers_; layer++) out[layer][i] = texel[layer];
+    }
+}
+
+float texture_lod(float dudx, float dvdx, float dudy, float dvdy) {
+    float rho2 = std::max(dudx * dudx + dvdx * dvdx, dudy * dudy + dvdy * dvdy);
+    if (!(rho2 > 0.0f)) return 0.0f;
+    // log2 read off the float's exponent and mantissa bits: within 0.09 of
+    // the exact value, plenty for picking and blending mip levels
+    unsigned int bits;
+    memcpy(&bits, &rho2, sizeof(bits));
+    return 0.5f * ((float)bits * (1.0f / 8388608.0f) - 127.0f);
+}
@@ -0,0 +1,78 @@
+#ifndef TEXTURE_H
+#define TEXTURE_H
+
+#include <vector>
+#include "tgaimage.h"
+
+enum TextureFilter {
+    TEXTURE_NEAREST,   // nearest texel of the full-size image, no mip levels
+    TEXTURE_POINT,     // nearest texel of the nearest mip level
+    TEXTURE_BILINEAR,  // four texels of the nearest mip level
+    TEXTURE_TRILINEAR  // bilinear in the two closest mip levels, blended
+};
+
+// Read-only texture with a full mip chain. Texels are kept as packed
+// TGAColor values in 8x8 tiles, Morton order inside a tile and tiles row by
+// row, so the four texels of a bilinear footprint share a cache line or two
+// and a minified level is small enough to stay cached.
+//
+// Coordinates are in texels of level 0, the way Model::uv() hands them out;
+// lookups clamp to the edge. lod is log2 of the texels covered per pixel.
+//
+// A texture can hold several images of one size as layers, stored texel by
+// texel side by side, so reading all of them at one point costs one cache
+// miss instead of one per image.
+class Texture {
+private:
+    struct Level {
+        int width;
+        int height;
+        int tiles_x;
+        std::vector<unsigned int> texels;
+    };
+
+    std::vector<Level> levels_;
+    int layers_;
+    int bytespp_;   // of the first layer, for the TGAColor results
+
+    unsigned int fetch(const Level& level, int x, int y, int layer) const;
+    unsigned int bilinear(int level, float u, float v, int layer) const;
+    void store_layer(int layer, TGAImage& image);
+public:
+    Texture() : layers_(1), bytespp_(0) {}
+
+    // Copies the image into tiled storage and builds the mip levels by 2x2
+    // box filtering. Layers past the first are left zero for fill_layer.
+    void build(TGAImage& image, int layers = 1);
+    // The same with count images as layers; they must all have the size of
+    // the first one, otherwise the texture is left empty.
+    void build(TGAImage* const* images, int count, int layers = 0);
+    // Stores an image of the texture's size in one layer, mip levels and
+    // all. Only that layer's texels are written, so other threads may go on
+    // reading the rest meanwhile. False if the sizes differ.
+    bool fill_layer(int layer, TGAImage& image);
+
+    int width() const { return levels_.empty() ? 0 : levels_[0].width; }
+    int height() const { return levels_.empty() ? 0 : levels_[0].height; }
+    int nlevels() const { return (int)levels_.size(); }
+    int nlayers() const { return layers_; }
+
+    // Texel (x, y) of level 0, the same color TGAImage::get returns for it.
+    TGAColor get(int x, int y) const;
+
+    TGAColor sample(float u, float v, float lod, TextureFilter filter, int layer = 0) const;
+    // sample() of n points at once into packed texels, the filter picked
+    // once for all of them.
+    void sample(const float* u, const float* v, const float* lod, int n, TextureFilter filter,
+        unsigned int* out, int layer = 0) const;
+    // The same for every layer at once, layer k into out[k]; the nearest
+    // filter finds each texel once for all of them.
+    void sample_layers(const float* u, const float* v, const float* lod, int n, TextureFilter filter,
+        unsigned int* const* out) const;
+};
+
+// log2 of the larger screen-space footprint axis, from the uv derivatives in
+// texels per pixel.
+float texture_lod(float dudx, float dvdx, float dudy, float dvdy);
+
+#endif // TEXTURE_H
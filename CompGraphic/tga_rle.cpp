@@ -0,0 +1,242 @@
+#include <cstring>
+#include <algorithm>
+#include "tga_rle.h"
+
+#if defined(__AVX2__)
+#define RLE_AVX2 1
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define RLE_SSE2 1
+#include <emmintrin.h>
+#endif
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+namespace {
+
+const size_t max_chunk_length = 128;
+
+inline int lowest_bit(unsigned long long v) {
+#if defined(_MSC_VER) && defined(_M_X64)
+    unsigned long i;
+    _BitScanForward64(&i, v);
+    return (int)i;
+#elif defined(__GNUC__)
+    return __builtin_ctzll(v);
+#else
+    int i = 0;
+    while (!(v & 1)) {
+        v >>= 1;
+        i++;
+    }
+    return i;
+#endif
+}
+
+// Compares pixel a with the one after it.
+inline bool pixels_equal(const unsigned char* a, int bytespp) {
+    switch (bytespp) {
+    case 1:
+        return a[0] == a[1];
+    case 3:
+        return a[0] == a[3] && a[1] == a[4] && a[2] == a[5];
+    case 4: {
+        unsigned x, y;
+        memcpy(&x, a, 4);
+        memcpy(&y, a + 4, 4);
+        return x == y;
+    }
+    }
+    for (int t = 0; t < bytespp; t++) {
+        if (a[t] != a[t + bytespp]) return false;
+    }
+    return true;
+}
+
+// Bit i is set when p[i] == p[i + shift], for i in [0, 64). Reads 64 + shift bytes.
+inline unsigned long long byte_equal_mask64(const unsigned char* p, int shift) {
+#if defined(RLE_AVX2)
+    unsigned long long m = 0;
+    for (int i = 0; i < 2; i++) {
+        __m256i a = _mm256_loadu_si256((const __m256i*)(p + 32 * i));
+        __m256i b = _mm256_loadu_si256((const __m256i*)(p + 32 * i + shift));
+        m |= (unsigned long long)(unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(a, b)) << (32 * i);
+    }
+    return m;
+#elif defined(RLE_SSE2)
+    unsigned long long m = 0;
+    for (int i = 0; i < 4; i++) {
+        __m128i a = _mm_loadu_si128((const __m128i*)(p + 16 * i));
+        __m128i b = _mm_loadu_si128((const __m128i*)(p + 16 * i + shift));
+        m |= (unsigned long long)(unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(a, b)) << (16 * i);
+    }
+    return m;
+#else
+    unsigned long long m = 0;
+    for (int i = 0; i < 64; i++) {
+        if (p[i] == p[i + shift]) m |= 1ULL << i;
+    }
+    return m;
+#endif
+}
+
+// Bits at the first byte of each whole pixel inside a 64-byte block.
+inline unsigned long long pixel_start_bits(int bytespp) {
+    switch (bytespp) {
+    case 1: return ~0ULL;
+    case 3: return 0x1249249249249249ULL; // bits 0, 3, ... 60
+    case 4: return 0x1111111111111111ULL;
+    default: {
+        unsigned long long r = 0;
+        for (int i = 0; i + bytespp <= 64; i += bytespp) r |= 1ULL << i;
+        return r;
+    }
+    }
+}
+
+// First k in [0, count) for which (pixel start+k == pixel start+k+1) == want_equal,
+// or count if there is none. Pixel start + count must exist.
+size_t scan_pairs(const unsigned char* data, int bytespp, size_t start, size_t count, bool want_equal) {
+    const size_t block = 64 / bytespp;
+    const unsigned long long starts = pixel_start_bits(bytespp);
+    size_t k = 0;
+    // short packets are common; settle them without loading a whole block
+    for (size_t probe = std::min(count, (size_t)4); k < probe; k++) {
+        if (pixels_equal(data + (start + k) * bytespp, bytespp) == want_equal) return k;
+    }
+    // a block reads 64 + bytespp bytes, i.e. at most block + 2 pixels from start + k
+    while (k + block < count) {
+        unsigned long long m = byte_equal_mask64(data + (start + k) * bytespp, bytespp);
+        // keep a pixel's first bit only if all of its bytes matched
+        unsigned long long eq = m;
+        for (int t = 1; t < bytespp; t++) eq &= m >> t;
+        unsigned long long hits = (want_equal ? eq : ~eq) & starts;
+        if (hits) return k + lowest_bit(hits) / bytespp;
+        k += block;
+    }
+    for (; k < count; k++) {
+        if (pixels_equal(data + (start + k) * bytespp, bytespp) == want_equal) return k;
+    }
+    return count;
+}
+
+void fill_run(unsigned char* dst, const unsigned char* pixel, int bytespp, size_t count) {
+    if (bytespp == 1) {
+        memset(dst, pixel[0], count);
+        return;
+    }
+    if (count <= 8) {
+        for (size_t i = 0; i < count; i++) memcpy(dst + i * bytespp, pixel, bytespp);
+        return;
+    }
+    // repeat the pixel into a 48-byte pattern (a whole number of 3- and 4-byte
+    // pixels) and copy that in one go per 48 bytes
+    unsigned char pattern[48];
+    for (int i = 0; i < 48; i += bytespp) memcpy(pattern + i, pixel, bytespp);
+    size_t per_pattern = 48 / bytespp;
+    while (count >= per_pattern) {
+        memcpy(dst, pattern, 48);
+        dst += 48;
+        count -= per_pattern;
+    }
+    memcpy(dst, pattern, count * bytespp);
+}
+
+} // namespace
+
+size_t rle_encode(const unsigned char* data, size_t npixels, int bytespp, unsigned char* out) {
+    unsigned char* p = out;
+    size_t curpix = 0;
+    while (curpix < npixels) {
+        size_t limit = std::min(max_chunk_length, npixels - curpix);
+        size_t run_length;
+        bool raw;
+        if (limit == 1) {
+            run_length = 1;
+            raw = true;
+        }
+        else if (pixels_equal(data + curpix * bytespp, bytespp)) {
+            // run: this pixel and every following one while neighbours stay equal
+            run_length = 2 + scan_pairs(data, bytespp, curpix + 1, limit - 2, false);
+            raw = false;
+        }
+        else {
+            // raw: stops before the first pixel that starts a run
+            size_t count = limit - 2;
+            size_t k = scan_pairs(data, bytespp, curpix + 1, count, true);
+            run_length = k < count ? k + 1 : limit;
+            raw = true;
+        }
+
+        *p++ = (unsigned char)(raw ? run_length - 1 : run_length + 127);
+        size_t nbytes = raw ? run_length * bytespp : bytespp;
+        memcpy(p, data + curpix * bytespp, nbytes);
+        p += nbytes;
+        curpix += run_length;
+    }
+    return p - out;
+}
+
+size_t rle_encode_scalar(const unsigned char* data, size_t npixels, int bytespp, unsigned char* out) {
+    const unsigned char max_chunk = 128;
+    size_t curpix = 0;
+    unsigned char* p = out;
+    while (curpix < npixels) {
+        size_t chunkstart = curpix * bytespp;
+        size_t curbyte = curpix * bytespp;
+        unsigned char run_length = 1;
+        bool raw = true;
+        while (curpix + run_length < npixels && run_length < max_chunk) {
+            bool succ_eq = true;
+            for (int t = 0; succ_eq && t < bytespp; t++) {
+                succ_eq = (data[curbyte + t] == data[curbyte + t + bytespp]);
+            }
+            curbyte += bytespp;
+            if (1 == run_length) {
+                raw = !succ_eq;
+            }
+            if (raw && succ_eq) {
+                run_length--;
+                break;
+            }
+            if (!raw && !succ_eq) {
+                break;
+            }
+            run_length++;
+        }
+        curpix += run_length;
+        *p++ = raw ? run_length - 1 : run_length + 127;
+        size_t nbytes = raw ? run_length * bytespp : bytespp;
+        memcpy(p, data + chunkstart, nbytes);
+        p += nbytes;
+    }
+    return p - out;
+}
+
+bool rle_decode(const unsigned char* src, size_t size, size_t npixels, int bytespp, unsigned char* dst) {
+    const unsigned char* end = src + size;
+    size_t currentpixel = 0;
+    while (currentpixel < npixels) {
+        if (src >= end) return false;
+        size_t chunkheader = *src++;
+        if (chunkheader < 128) {
+            chunkheader++;
+            size_t nbytes = chunkheader * bytespp;
+            if (currentpixel + chunkheader > npixels || (size_t)(end - src) < nbytes) return false;
+            memcpy(dst, src, nbytes);
+            src += nbytes;
+            dst += nbytes;
+        }
+        else {
+            chunkheader -= 127;
+            if (currentpixel + chunkheader > npixels || (size_t)(end - src) < (size_t)bytespp) return false;
+            fill_run(dst, src, bytespp, chunkheader);
+            src += bytespp;
+            dst += chunkheader * bytespp;
+        }
+        currentpixel += chunkheader;
+    }
+    return true;
+}
@@ -0,0 +1,21 @@
+#ifndef TGA_RLE_H
+#define TGA_RLE_H
+
+#include <cstddef>
+
+// TGA run-length packet coding for 1, 3 and 4 bytes per pixel.
+
+// Encodes npixels pixels into out, which must hold npixels * (bytespp + 1)
+// bytes, and returns the number of bytes written. Pixel comparisons run on
+// wide vectors (AVX2 or SSE2 when available); the packets are exactly those of
+// rle_encode_scalar.
+size_t rle_encode(const unsigned char* data, size_t npixels, int bytespp, unsigned char* out);
+
+// The original byte-by-byte encoder, kept as the reference.
+size_t rle_encode_scalar(const unsigned char* data, size_t npixels, int bytespp, unsigned char* out);
+
+// Decodes packets from src into npixels pixels at dst. Returns false on
+// truncated input or if the packets describe more than npixels pixels.
+bool rle_decode(const unsigned char* src, size_t size, size_t npixels, int bytespp, unsigned char* dst);
+
+#endif // TGA_RLE_H
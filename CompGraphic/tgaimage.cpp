@@ -1,9 +1,13 @@
 #include <iostream>
 #include <fstream>
+#include <memory>
 #include <string.h>
 #include <time.h>
 #include <math.h>
 #include "tgaimage.h"
+#include "mapped_file.h"
+#include "tga_rle.h"
+#include "profiler.h"
 
 TGAImage::TGAImage() : data(NULL), width(0), height(0), bytespp(0) {
 }
@@ -43,47 +47,44 @@ TGAImage& TGAImage::operator =(const TGAImage& img) {
 bool TGAImage::read_tga_file(const char* filename) {
 	if (data) delete[] data;
 	data = NULL;
-	std::ifstream in;
-	in.open(filename, std::ios::binary);
-	if (!in.is_open()) {
+	MappedFile in;
+	if (!in.open(filename)) {
 		std::cerr << "can't open file " << filename << "\n";
-		in.close();
 		return false;
 	}
+	const unsigned char* src = (const unsigned char*)in.data();
+	size_t size = in.size();
 	TGA_Header header;
-	in.read((char*)&header, sizeof(header));
-	if (!in.good()) {
-		in.close();
+	if (size < sizeof(header)) {
 		std::cerr << "an error occured while reading the header\n";
 		return false;
 	}
+	memcpy((void*)&header, src, sizeof(header));
 	width = header.width;
 	height = header.height;
 	bytespp = header.bitsperpixel >> 3; // from bit to byte
 	if (width <= 0 || height <= 0 || (bytespp != GRAYSCALE && bytespp != RGB && bytespp != RGBA)) {
-		in.close();
 		std::cerr << "bad bpp (or width/height) value\n";
 		return false;
 	}
+	size_t pos = sizeof(header) + (unsigned char)header.idlength;
+	if (pos > size) pos = size;
 	unsigned long nbytes = bytespp * width * height;
 	data = new unsigned char[nbytes];
 	if (3 == header.datatypecode || 2 == header.datatypecode) {
-		in.read((char*)data, nbytes);
-		if (!in.good()) {
-			in.close();
+		if (size - pos < nbytes) {
 			std::cerr << "an error occured while reading the data\n";
 			return false;
 		}
+		memcpy(data, src + pos, nbytes);
 	}
 	else if (10 == header.datatypecode || 11 == header.datatypecode) {
-		if (!load_rle_data(in)) {
-			in.close();
+		if (!load_rle_data(src + pos, size - pos)) {
 			std::cerr << "an error occured while reading the data\n";
 			return false;
 		}
 	}
 	else {
-		in.close();
 		std::cerr << "unknown file format " << (int)header.datatypecode << "\n";
 		return false;
 	}
@@ -94,64 +95,31 @@ bool TGAImage::read_tga_file(const char* filename) {
 		flip_horizontally();
 	}
 	std::cerr << width << "x" << height << "/" << bytespp * 8 << "\n";
-	in.close();
 	return true;
 }
 
-bool TGAImage::load_rle_data(std::ifstream& in) {
-	unsigned long pixelcount = width * height;
-	unsigned long currentpixel = 0;
-	unsigned long currentbyte = 0;
-	TGAColor colorbuffer;
-	do {
-		unsigned char chunkheader = 0;
-		chunkheader = in.get();
-		if (!in.good()) {
-			std::cerr << "an error occured while reading the data\n";
-			return false;
-		}
-		if (chunkheader < 128) {
-			chunkheader++;
-			for (int i = 0; i < chunkheader; i++) {
-				in.read((char*)colorbuffer.raw, bytespp);
-				if (!in.good()) {
-					std::cerr << "an error occured while reading the header\n";
-					return false;
-				}
-				for (int t = 0; t < bytespp; t++)
-					data[currentbyte++] = colorbuffer.raw[t];
-				currentpixel++;
-				if (currentpixel > pixelcount) {
-					std::cerr << "Too many pixels read\n";
-					return false;
-				}
-			}
-		}
-		else {
-			chunkheader -= 127;
-			in.read((char*)colorbuffer.raw, bytespp);
-			if (!in.good()) {
-				std::cerr << "an error occured while reading the header\n";
-				return false;
-			}
-			for (int i = 0; i < chunkheader; i++) {
-				for (int t = 0; t < bytespp; t++)
-					data[currentbyte++] = colorbuffer.raw[t];
-				currentpixel++;
-				if (currentpixel > pixelcount) {
-					std::cerr << "Too many pixels read\n";
-					return false;
-				}
-			}
-		}
-	} while (currentpixel < pixelcount);
+// Decodes RLE packets straight from the mapped file into data.
+bool TGAImage::load_rle_data(const unsigned char* src, size_t size) {
+	if (!rle_decode(src, size, (size_t)width * height, bytespp, data)) {
+		std::cerr << "an error occured while reading the data\n";
+		return false;
+	}
 	return true;
 }
 
 bool TGAImage::write_tga_file(const char* filename, bool rle) {
-	unsigned char developer_area_ref[4] = { 0, 0, 0, 0 };
-	unsigned char extension_area_ref[4] = { 0, 0, 0, 0 };
-	unsigned char footer[18] = { 'T','R','U','E','V','I','S','I','O','N','-','X','F','I','L','E','.','\0' };
+	// left uninitialized: only the pages the encoder writes get touched
+	std::unique_ptr<unsigned char[]> buf(new unsigned char[max_tga_size(rle)]);
+	size_t size;
+	{
+		PROFILE_SCOPE(STAGE_ENCODE, "encode tga");
+		size = encode_tga(buf.get(), rle);
+		if (!size) {
+			std::cerr << "can't dump the tga file\n";
+			return false;
+		}
+	}
+	PROFILE_SCOPE(STAGE_WRITE, "write tga");
 	std::ofstream out;
 	out.open(filename, std::ios::binary);
 	if (!out.is_open()) {
@@ -159,6 +127,34 @@ bool TGAImage::write_tga_file(const char* filename, bool rle) {
 		out.close();
 		return false;
 	}
+	out.write((const char*)buf.get(), size);
+	if (!out.good()) {
+		std::cerr << "can't dump the tga file\n";
+		out.close();
+		return false;
+	}
+	out.close();
+	return true;
+}
+
+namespace {
+
+const unsigned char developer_area_ref[4] = { 0, 0, 0, 0 };
+const unsigned char extension_area_ref[4] = { 0, 0, 0, 0 };
+const unsigned char footer[18] = { 'T','R','U','E','V','I','S','I','O','N','-','X','F','I','L','E','.','\0' };
+
+} // namespace
+
+size_t TGAImage::max_tga_size(bool rle) {
+	size_t npixels = (size_t)width * height;
+	size_t max_body = rle ? npixels * (bytespp + 1) : npixels * bytespp;
+	return sizeof(TGA_Header) + max_body + sizeof(developer_area_ref) + sizeof(extension_area_ref) + sizeof(footer);
+}
+
+// The whole file is built in memory so the caller can write it with a single
+// call.
+size_t TGAImage::encode_tga(unsigned char* out, bool rle) {
+	if (!data) return 0;
 	TGA_Header header;
 	memset((void*)&header, 0, sizeof(header));
 	header.bitsperpixel = bytespp << 3;
@@ -166,89 +162,31 @@ bool TGAImage::write_tga_file(const char* filename, bool rle) {
 	header.height = height;
 	header.datatypecode = (bytespp == GRAYSCALE ? (rle ? 11 : 3) : (rle ? 10 : 2));
 	header.imagedescriptor = 0x20; 
-	out.write((char*)&header, sizeof(header));
-	if (!out.good()) {
-		out.close();
-		std::cerr << "can't dump the tga file\n";
-		return false;
-	}
+
+	size_t npixels = (size_t)width * height;
+	unsigned char* p = out;
+	memcpy(p, &header, sizeof(header));
+	p += sizeof(header);
 	if (!rle) {
-		out.write((char*)data, width * height * bytespp);
-		if (!out.good()) {
-			std::cerr << "can't unload raw data\n";
-			out.close();
-			return false;
-		}
+		memcpy(p, data, npixels * bytespp);
+		p += npixels * bytespp;
 	}
 	else {
-		if (!unload_rle_data(out)) {
-			out.close();
-			std::cerr << "can't unload rle data\n";
-			return false;
-		}
-	}
-	out.write((char*)developer_area_ref, sizeof(developer_area_ref));
-	if (!out.good()) {
-		std::cerr << "can't dump the tga file\n";
-		out.close();
-		return false;
-	}
-	out.write((char*)extension_area_ref, sizeof(extension_area_ref));
-	if (!out.good()) {
-		std::cerr << "can't dump the tga file\n";
-		out.close();
-		return false;
-	}
-	out.write((char*)footer, sizeof(footer));
-	if (!out.good()) {
-		std::cerr << "can't dump the tga file\n";
-		out.close();
-		return false;
+		p += unload_rle_data(p);
 	}
-	out.close();
-	return true;
+	memcpy(p, developer_area_ref, sizeof(developer_area_ref));
+	p += sizeof(developer_area_ref);
+	memcpy(p, extension_area_ref, sizeof(extension_area_ref));
+	p += sizeof(extension_area_ref);
+	memcpy(p, footer, sizeof(footer));
+	p += sizeof(footer);
+	return p - out;
 }
 
-bool TGAImage::unload_rle_data(std::ofstream& out) {
-	const unsigned char max_chunk_length = 128;
-	unsigned long npixels = width * height;
-	unsigned long curpix = 0;
-	while (curpix < npixels) {
-		unsigned long chunkstart = curpix * bytespp;
-		unsigned long curbyte = curpix * bytespp;
-		unsigned char run_length = 1;
-		bool raw = true;
-		while (curpix + run_length < npixels && run_length < max_chunk_length) {
-			bool succ_eq = true;
-			for (int t = 0; succ_eq && t < bytespp; t++) {
-				succ_eq = (data[curbyte + t] == data[curbyte + t + bytespp]);
-			}
-			curbyte += bytespp;
-			if (1 == run_length) {
-				raw = !succ_eq;
-			}
-			if (raw && succ_eq) {
-				run_length--;
-				break;
-			}
-			if (!raw && !succ_eq) {
-				break;
-			}
-			run_length++;
-		}
-		curpix += run_length;
-		out.put(raw ? run_length - 1 : run_length + 127);
-		if (!out.good()) {
-			std::cerr << "can't dump the tga file\n";
-			return false;
-		}
-		out.write((char*)(data + chunkstart), (raw ? run_length * bytespp : bytespp));
-		if (!out.good()) {
-			std::cerr << "can't dump the tga file\n";
-			return false;
-		}
-	}
-	return true;
+// Writes the RLE packets to out and returns the number of bytes used, at most
+// width * height * (bytespp + 1).
+size_t TGAImage::unload_rle_data(unsigned char* out) {
+	return rle_encode(data, (size_t)width * height, bytespp, out);
 }
 
 TGAColor TGAImage::get(int x, int y) {
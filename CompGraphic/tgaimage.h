@@ -1,7 +1,7 @@
 #ifndef __IMAGE_H__
 #define __IMAGE_H__
 
-#include <fstream>
+#include <cstddef>
 
 #pragma pack(push,1)
 struct TGA_Header {
@@ -72,8 +72,8 @@ protected:
 	int height;
 	int bytespp;
 
-	bool   load_rle_data(std::ifstream& in);
-	bool unload_rle_data(std::ofstream& out);
+	bool   load_rle_data(const unsigned char* src, size_t size);
+	size_t unload_rle_data(unsigned char* out);
 public:
 	enum Format {
 		GRAYSCALE = 1, RGB = 3, RGBA = 4
@@ -84,6 +84,11 @@ public:
 	TGAImage(const TGAImage& img);
 	bool read_tga_file(const char* filename);
 	bool write_tga_file(const char* filename, bool rle = true);
+	// Largest file encode_tga can produce for this image.
+	size_t max_tga_size(bool rle = true);
+	// Complete TGA file (header, pixels, footer) into out, which must hold
+	// max_tga_size(rle) bytes. Returns the bytes used, 0 without an image.
+	size_t encode_tga(unsigned char* out, bool rle = true);
 	bool flip_horizontally();
 	bool flip_vertically();
 	bool scale(int w, int h);
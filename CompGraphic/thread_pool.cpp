@@ -0,0 +1,92 @@
+#include "thread_pool.h"
+
+static thread_local bool in_pool_worker = false;
+
+ThreadPool::ThreadPool(int nthreads) : job_(nullptr), count_(0), cursor_(0), active_(0), generation_(0), stop_(false) {
+    if (nthreads <= 0) nthreads = default_threads();
+    for (int i = 1; i < nthreads; i++) {
+        workers_.emplace_back(&ThreadPool::worker_loop, this);
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_ = true;
+    }
+    wake_.notify_all();
+    for (size_t i = 0; i < workers_.size(); i++) workers_[i].join();
+}
+
+int ThreadPool::default_threads() {
+    unsigned n = std::thread::hardware_concurrency();
+    return n == 0 ? 1 : (int)n;
+}
+
+ThreadPool& ThreadPool::shared() {
+    static ThreadPool pool;
+    return pool;
+}
+
+void ThreadPool::run_job(const std::function<void(int)>& fn, int count, unsigned generation) {
+    unsigned long long cursor = cursor_.load();
+    for (;;) {
+        if ((unsigned)(cursor >> 32) != generation || (int)(unsigned)cursor >= count) return;
+        if (cursor_.compare_exchange_weak(cursor, cursor + 1)) fn((int)(unsigned)cursor);
+    }
+}
+
+void ThreadPool::worker_loop() {
+    in_pool_worker = true;
+    unsigned seen = 0;
+    for (;;) {
+        const std::function<void(int)>* job;
+        int count;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            wake_.wait(lock, [&] { return stop_ || generation_ != seen; });
+            if (stop_) return;
+            seen = generation_;
+            job = job_;
+            count = count_;
+            active_++;
+        }
+        // job_ is cleared once a job is over; a worker that woke too late
+        // for it finds nothing to do
+        if (job) run_job(*job, count, seen);
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            active_--;
+        }
+        done_.notify_all();
+    }
+}
+
+void ThreadPool::parallel_for(int count, const std::function<void(int)>& fn) {
+    if (count <= 0) return;
+    if (workers_.empty() || count == 1 || in_pool_worker) {
+        for (int i = 0; i < count; i++) fn(i);
+        return;
+    }
+
+    std::lock_guard<std::mutex> submit(submit_mutex_);
+
+    unsigned generation;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        job_ = &fn;
+        count_ = count;
+        generation = ++generation_;
+        cursor_ = (unsigned long long)generation << 32;
+    }
+    wake_.notify_all();
+
+    bool was_worker = in_pool_worker;
+    in_pool_worker = true;
+    run_job(fn, count, generation);
+    in_pool_worker = was_worker;
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    done_.wait(lock, [&] { return active_ == 0; });
+    job_ = nullptr;
+}
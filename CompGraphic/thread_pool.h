@@ -0,0 +1,45 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Persistent pool of worker threads. parallel_for hands out indices
+// [0, count) through an atomic cursor; the calling thread takes part too.
+class ThreadPool {
+private:
+    std::vector<std::thread> workers_;
+    std::mutex submit_mutex_;  // held by parallel_for: one job on the pool at a time
+    std::mutex mutex_;
+    std::condition_variable wake_;
+    std::condition_variable done_;
+    const std::function<void(int)>* job_;
+    int count_;
+    // generation in the high half, next index in the low half, so a worker
+    // still finishing an older job can never take an index of the current one
+    std::atomic<unsigned long long> cursor_;
+    int active_;
+    unsigned generation_;
+    bool stop_;
+
+    void worker_loop();
+    void run_job(const std::function<void(int)>& fn, int count, unsigned generation);
+public:
+    explicit ThreadPool(int nthreads = 0);
+    ~ThreadPool();
+
+    int size() const { return (int)workers_.size() + 1; }
+
+    // Runs fn(i) for every i in [0, count). Calls made from inside a pool
+    // worker run inline, so nested use cannot deadlock.
+    void parallel_for(int count, const std::function<void(int)>& fn);
+
+    static ThreadPool& shared();
+    static int default_threads();
+};
+
+#endif // THREAD_POOL_H
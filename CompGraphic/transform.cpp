@@ -0,0 +1,180 @@
+#include "transform.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define TRANSFORM_SSE2 1
+#include <emmintrin.h>
+#endif
+
+static inline Vec4f project(const float m[16], const Vec3f& v) {
+    return Vec4f(
+        m[0] * v.x + m[1] * v.y + m[2] * v.z + m[3],
+        m[4] * v.x + m[5] * v.y + m[6] * v.z + m[7],
+        m[8] * v.x + m[9] * v.y + m[10] * v.z + m[11],
+        m[12] * v.x + m[13] * v.y + m[14] * v.z + m[15]);
+}
+
+Vec3i clip_to_screen(const Vec4f& v, float fw, float fh) {
+    float x = v.x;
+    float y = v.y;
+    float z = v.z;
+
+    if (v.w != 0.0f) {
+        x /= v.w;
+        y /= v.w;
+        z /= v.w;
+    }
+
+    return Vec3i(
+        (int)((x + 1.0f) * fw / 2.0f + 0.5f),
+        (int)((y + 1.0f) * fh / 2.0f + 0.5f),
+        (int)(z * 1000.0f)
+    );
+}
+
+static inline Vec3i to_screen(const float m[16], const Vec3f& v, float fw, float fh) {
+    return clip_to_screen(project(m, v), fw, fh);
+}
+
+#ifdef TRANSFORM_SSE2
+// dot of one matrix row with four vertices held as x, y, z lanes;
+// summed left to right like the scalar path so results are identical
+static inline __m128 row_dot(const float* r, __m128 x, __m128 y, __m128 z) {
+    __m128 s = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(r[0]), x), _mm_mul_ps(_mm_set1_ps(r[1]), y));
+    s = _mm_add_ps(s, _mm_mul_ps(_mm_set1_ps(r[2]), z));
+    return _mm_add_ps(s, _mm_set1_ps(r[3]));
+}
+#endif
+
+#ifdef TRANSFORM_SSE2
+// Four vertices into clip space, one lane each.
+static inline void project4(const float* m, const Vec3f& v0, const Vec3f& v1, const Vec3f& v2, const Vec3f& v3,
+    __m128& tx, __m128& ty, __m128& tz, __m128& tw) {
+    __m128 x = _mm_setr_ps(v0.x, v1.x, v2.x, v3.x);
+    __m128 y = _mm_setr_ps(v0.y, v1.y, v2.y, v3.y);
+    __m128 z = _mm_setr_ps(v0.z, v1.z, v2.z, v3.z);
+
+    tx = row_dot(m, x, y, z);
+    ty = row_dot(m + 4, x, y, z);
+    tz = row_dot(m + 8, x, y, z);
+    tw = row_dot(m + 12, x, y, z);
+}
+
+// The divide and viewport mapping of clip_to_screen for four lanes.
+static inline void screen4(__m128 tx, __m128 ty, __m128 tz, __m128 tw, __m128 vw, __m128 vh, Vec3i* out[4]) {
+    const __m128 one = _mm_set1_ps(1.0f);
+    const __m128 half = _mm_set1_ps(0.5f);
+    const __m128 two = _mm_set1_ps(2.0f);
+    const __m128 zscale = _mm_set1_ps(1000.0f);
+
+    // w == 0 leaves the lane undivided
+    __m128 zero_w = _mm_cmpeq_ps(tw, _mm_setzero_ps());
+    tw = _mm_or_ps(_mm_and_ps(zero_w, one), _mm_andnot_ps(zero_w, tw));
+    tx = _mm_div_ps(tx, tw);
+    ty = _mm_div_ps(ty, tw);
+    tz = _mm_div_ps(tz, tw);
+
+    __m128i sx = _mm_cvttps_epi32(_mm_add_ps(_mm_div_ps(_mm_mul_ps(_mm_add_ps(tx, one), vw), two), half));
+    __m128i sy = _mm_cvttps_epi32(_mm_add_ps(_mm_div_ps(_mm_mul_ps(_mm_add_ps(ty, one), vh), two), half));
+    __m128i sz = _mm_cvttps_epi32(_mm_mul_ps(tz, zscale));
+
+    int px[4], py[4], pz[4];
+    _mm_storeu_si128((__m128i*)px, sx);
+    _mm_storeu_si128((__m128i*)py, sy);
+    _mm_storeu_si128((__m128i*)pz, sz);
+    for (int k = 0; k < 4; k++) *out[k] = Vec3i(px[k], py[k], pz[k]);
+}
+
+static inline void to_screen4(const float* m, const Vec3f& v0, const Vec3f& v1, const Vec3f& v2, const Vec3f& v3,
+    __m128 vw, __m128 vh, Vec3i* out[4]) {
+    __m128 tx, ty, tz, tw;
+    project4(m, v0, v1, v2, v3, tx, ty, tz, tw);
+    screen4(tx, ty, tz, tw, vw, vh, out);
+}
+#endif
+
+void transform_vertices(const Mat4f& viewProj, const Vec3f* verts, int n,
+    int width, int height, Vec3i* out) {
+    const float* m = &viewProj.m[0][0];
+    float fw = (float)width;
+    float fh = (float)height;
+
+    int i = 0;
+#ifdef TRANSFORM_SSE2
+    const __m128 vw = _mm_set1_ps(fw);
+    const __m128 vh = _mm_set1_ps(fh);
+    for (; i + 4 <= n; i += 4) {
+        const Vec3f* v = verts + i;
+        Vec3i* o[4] = { out + i, out + i + 1, out + i + 2, out + i + 3 };
+        to_screen4(m, v[0], v[1], v[2], v[3], vw, vh, o);
+    }
+#endif
+    for (; i < n; i++) {
+        out[i] = to_screen(m, verts[i], fw, fh);
+    }
+}
+
+void transform_vertices(const Mat4f& viewProj, const Vec3f* verts, const int* indices, int n,
+    int width, int height, Vec3i* out) {
+    const float* m = &viewProj.m[0][0];
+    float fw = (float)width;
+    float fh = (float)height;
+
+    int i = 0;
+#ifdef TRANSFORM_SSE2
+    const __m128 vw = _mm_set1_ps(fw);
+    const __m128 vh = _mm_set1_ps(fh);
+    for (; i + 4 <= n; i += 4) {
+        const int* k = indices + i;
+        Vec3i* o[4] = { out + k[0], out + k[1], out + k[2], out + k[3] };
+        to_screen4(m, verts[k[0]], verts[k[1]], verts[k[2]], verts[k[3]], vw, vh, o);
+    }
+#endif
+    for (; i < n; i++) {
+        out[indices[i]] = to_screen(m, verts[indices[i]], fw, fh);
+    }
+}
+
+void transform_vertices(const Mat4f& viewProj, const std::vector<Vec3f>& verts,
+    int width, int height, std::vector<Vec3i>& out) {
+    out.resize(verts.size());
+    if (verts.empty()) return;
+    transform_vertices(viewProj, verts.data(), (int)verts.size(), width, height, out.data());
+}
+
+void transform_vertices(const Mat4f& viewProj, const ClipVolume& volume, const Vec3f* verts, const int* indices, int n,
+    int width, int height, Vec3i* out, Vec4f* clip, unsigned char* codes) {
+    const float* m = &viewProj.m[0][0];
+    float fw = (float)width;
+    float fh = (float)height;
+
+    int i = 0;
+#ifdef TRANSFORM_SSE2
+    const __m128 vw = _mm_set1_ps(fw);
+    const __m128 vh = _mm_set1_ps(fh);
+    for (; i + 4 <= n; i += 4) {
+        int k[4];
+        for (int j = 0; j < 4; j++) k[j] = indices ? indices[i + j] : i + j;
+        __m128 tx, ty, tz, tw;
+        project4(m, verts[k[0]], verts[k[1]], verts[k[2]], verts[k[3]], tx, ty, tz, tw);
+
+        float px[4], py[4], pz[4], pw[4];
+        _mm_storeu_ps(px, tx);
+        _mm_storeu_ps(py, ty);
+        _mm_storeu_ps(pz, tz);
+        _mm_storeu_ps(pw, tw);
+        for (int j = 0; j < 4; j++) {
+            clip[k[j]] = Vec4f(px[j], py[j], pz[j], pw[j]);
+            codes[k[j]] = (unsigned char)clip_code(clip[k[j]], volume);
+        }
+
+        Vec3i* o[4] = { out + k[0], out + k[1], out + k[2], out + k[3] };
+        screen4(tx, ty, tz, tw, vw, vh, o);
+    }
+#endif
+    for (; i < n; i++) {
+        int k = indices ? indices[i] : i;
+        clip[k] = project(m, verts[k]);
+        codes[k] = (unsigned char)clip_code(clip[k], volume);
+        out[k] = clip_to_screen(clip[k], fw, fh);
+    }
+}
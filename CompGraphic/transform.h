@@ -0,0 +1,32 @@
+#ifndef TRANSFORM_H
+#define TRANSFORM_H
+
+#include <vector>
+#include "geometry.h"
+#include "clip.h"
+
+// Vertex stage: projects every vertex through the view-projection matrix once
+// and maps it to screen space, so faces only look their corners up by index.
+// Output matches operator*(Mat4f, Vec3f) followed by the viewport mapping
+// (x, y rounded to pixels, z scaled by 1000) bit for bit.
+void transform_vertices(const Mat4f& viewProj, const Vec3f* verts, int n,
+    int width, int height, Vec3i* out);
+
+// Only the listed vertices: out[indices[i]] = projection of verts[indices[i]].
+void transform_vertices(const Mat4f& viewProj, const Vec3f* verts, const int* indices, int n,
+    int width, int height, Vec3i* out);
+
+void transform_vertices(const Mat4f& viewProj, const std::vector<Vec3f>& verts,
+    int width, int height, std::vector<Vec3i>& out);
+
+// Clip-space variant for geometry that may cross the near plane or leave the
+// guard band: also keeps every vertex before the divide and its clip_code,
+// so faces with a clip_needed bit can be clipped first. The screen position
+// of such a vertex is meaningless. indices == nullptr means the first n.
+void transform_vertices(const Mat4f& viewProj, const ClipVolume& volume, const Vec3f* verts, const int* indices, int n,
+    int width, int height, Vec3i* out, Vec4f* clip, unsigned char* codes);
+
+// The divide and viewport mapping of transform_vertices for one clip-space point.
+Vec3i clip_to_screen(const Vec4f& v, float width, float height);
+
+#endif // TRANSFORM_H